@@ -0,0 +1,122 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import glob
+import os
+import random
+import shutil
+import tempfile
+import time
+
+import supersqlite.third_party.sqlite3
+from supersqlite import SuperSQLite, apsw
+
+_CONFIGS = [
+    ("plain", None),
+    ("none", "codec=none"),
+    ("zlib-1", "codec=zlib&level=1"),
+    ("zlib-6", "codec=zlib&level=6"),
+    ("deflate-9", "codec=deflate&level=9"),
+]
+
+
+def _load_vfs():
+    # Registering the VFS is permanent, so any connection will do.
+    path = glob.glob(os.path.join(
+        os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+        'compressvfs*'))[0]
+    db = SuperSQLite.connect(':memory:')
+    db.enableloadextension(True)
+    db.loadextension(path, 'sqlite3_compressvfs_init')
+    db.close()
+
+
+def _connect(path, params, lru):
+    if params is None:
+        return SuperSQLite.connect(path)
+    return SuperSQLite.connect(
+        'file:%s?vfs=compressvfs&%s&lru=%d' % (path, params, lru),
+        flags=(apsw.SQLITE_OPEN_READWRITE | apsw.SQLITE_OPEN_CREATE |
+               apsw.SQLITE_OPEN_URI))
+
+
+def _populate(db, rows):
+    # Text with a realistic amount of redundancy: words from a small
+    # vocabulary, numbers and a few repeated categories.
+    rand = random.Random(42)
+    words = ['w%d' % (i,) for i in range(2000)]
+    cursor = db.cursor()
+    cursor.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, category, "
+                   "price REAL, description)")
+    cursor.execute("BEGIN")
+    cursor.executemany(
+        "INSERT INTO t(category, price, description) VALUES(?, ?, ?)",
+        (('category %d' % (rand.randint(0, 20),),
+          round(rand.uniform(0, 1000), 2),
+          ' '.join(rand.choice(words) for j in range(20)))
+         for i in range(rows)))
+    cursor.execute("CREATE INDEX t_category ON t(category, price)")
+    cursor.execute("COMMIT")
+
+
+def _reads(db, rows, lookups):
+    # A full scan followed by random point lookups.  SQLite's own page
+    # cache is kept small so that most reads reach the VFS.
+    rand = random.Random(7)
+    cursor = db.cursor()
+    cursor.execute("PRAGMA cache_size=16")
+    start = time.time()
+    cursor.execute("SELECT sum(length(description)) FROM t").fetchone()
+    for i in range(lookups):
+        cursor.execute("SELECT description FROM t WHERE id=?",
+                       (rand.randint(1, rows),)).fetchone()
+    return time.time() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare the on-disk size and read speed of a database "
+                    "stored through the compressvfs VFS with the default "
+                    "VFS.  Cold reads use a new connection, warm reads "
+                    "repeat them on the same connection.  The operating "
+                    "system's cache is not dropped between runs.")
+    parser.add_argument('--rows', type=int, default=500000)
+    parser.add_argument('--lookups', type=int, default=100000)
+    parser.add_argument('--lru', type=int, default=1024,
+                        help="pages kept decompressed by compressvfs")
+    args = parser.parse_args()
+
+    _load_vfs()
+    tmpdir = tempfile.mkdtemp()
+    try:
+        print("rows: %d, lookups: %d, lru: %d" %
+              (args.rows, args.lookups, args.lru))
+        print("%-10s %10s %8s %10s %10s %10s" %
+              ("codec", "size (MB)", "ratio", "build (s)", "cold (s)",
+               "warm (s)"))
+        plain_size = None
+        for name, params in _CONFIGS:
+            path = os.path.join(tmpdir, name + '.db')
+            db = _connect(path, params, args.lru)
+            start = time.time()
+            _populate(db, args.rows)
+            build = time.time() - start
+            db.close()
+            size = os.path.getsize(path)
+            if plain_size is None:
+                plain_size = size
+
+            db = _connect(path, params, args.lru)
+            cold = _reads(db, args.rows, args.lookups)
+            warm = _reads(db, args.rows, args.lookups)
+            db.close()
+            print("%-10s %10.1f %8.2f %10.3f %10.3f %10.3f" %
+                  (name, size / 1e6, plain_size / size, build, cold, warm))
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
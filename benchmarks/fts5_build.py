@@ -0,0 +1,87 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import multiprocessing
+import os
+import random
+import shutil
+import tempfile
+import time
+
+from supersqlite import SuperSQLite
+
+
+def _thread_counts():
+    counts = [1]
+    n = 2
+    while n < multiprocessing.cpu_count():
+        counts.append(n)
+        n *= 2
+    counts.append(multiprocessing.cpu_count())
+    return sorted(set(counts))
+
+
+def _populate(db, docs, words, vocabulary):
+    # Word ranks are log-uniform, a rough Zipf distribution as in real text.
+    rand = random.Random(42)
+
+    def text(n):
+        return ' '.join('w%x' % (int(vocabulary ** rand.random()),)
+                        for i in range(n))
+    cursor = db.cursor()
+    cursor.execute("CREATE TABLE docs(id INTEGER PRIMARY KEY, title, body)")
+    cursor.execute("BEGIN")
+    cursor.executemany(
+        "INSERT INTO docs(title, body) VALUES(?, ?)",
+        ((text(8), text(words)) for i in range(docs)))
+    cursor.execute("COMMIT")
+
+
+def _build(db, threads):
+    cursor = db.cursor()
+    cursor.execute("DROP TABLE IF EXISTS ft")
+    cursor.execute("CREATE VIRTUAL TABLE ft USING fts5(title, body, "
+                   "content=docs, content_rowid=id)")
+    start = time.time()
+    cursor.execute("INSERT INTO ft(ft, rank) VALUES('rebuild', ?)",
+                   (threads,))
+    elapsed = time.time() - start
+    segments = cursor.execute(
+        "SELECT count(DISTINCT segid) FROM ft_idx").fetchone()[0]
+    return elapsed, segments
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time building an FTS5 index over a synthetic corpus "
+                    "with the 'rebuild' command against the number of "
+                    "tokenizer threads.")
+    parser.add_argument('--docs', type=int, default=200000)
+    parser.add_argument('--words', type=int, default=100,
+                        help="words in the body of each document")
+    parser.add_argument('--vocabulary', type=int, default=50000)
+    parser.add_argument('--threads', type=int, nargs='*',
+                        default=_thread_counts())
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        db = SuperSQLite.connect(os.path.join(tmpdir, 'fts5_build.db'))
+        _populate(db, args.docs, args.words, args.vocabulary)
+
+        print("docs: %d, cores: %d" % (args.docs, multiprocessing.cpu_count()))
+        print("%8s %10s %10s %9s" %
+              ("threads", "seconds", "docs/sec", "segments"))
+        for threads in args.threads:
+            elapsed, segments = _build(db, threads)
+            print("%8d %10.3f %10.0f %9d" %
+                  (threads, elapsed, args.docs / elapsed, segments))
+        db.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,83 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import multiprocessing
+import os
+import random
+import shutil
+import tempfile
+import time
+
+from supersqlite import apsw, SuperSQLite
+
+
+def _thread_counts():
+    counts = [0]
+    n = 1
+    while n < multiprocessing.cpu_count():
+        counts.append(n)
+        n *= 2
+    counts.append(multiprocessing.cpu_count() - 1)
+    return sorted(set(c for c in counts if c >= 0))
+
+
+def _populate(db, rows):
+    rand = random.Random(42)
+    cursor = db.cursor()
+    cursor.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, k TEXT, v REAL)")
+    cursor.execute("BEGIN")
+    cursor.executemany(
+        "INSERT INTO t(k, v) VALUES(?, ?)",
+        (('%016x' % rand.getrandbits(64), rand.random())
+         for i in range(rows)))
+    cursor.execute("COMMIT")
+
+
+def _time_index_build(db, threads, repeat):
+    cursor = db.cursor()
+    best = None
+    for i in range(repeat):
+        cursor.execute("DROP INDEX IF EXISTS t_k")
+        db.limit(apsw.SQLITE_LIMIT_WORKER_THREADS, threads)
+        start = time.time()
+        cursor.execute("CREATE INDEX t_k ON t(k, v)")
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time CREATE INDEX against the number of sorter "
+                    "worker threads.")
+    parser.add_argument('--rows', type=int, default=2000000)
+    parser.add_argument('--cache-size', type=int, default=-16384,
+                        help="PRAGMA cache_size, which also sets the "
+                             "sorter's in-memory PMA size")
+    parser.add_argument('--threads', type=int, nargs='*',
+                        default=_thread_counts())
+    parser.add_argument('--repeat', type=int, default=3)
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        db = SuperSQLite.connect(os.path.join(tmpdir, 'index_build.db'))
+        db.cursor().execute("PRAGMA cache_size=%d" % (args.cache_size,))
+        _populate(db, args.rows)
+
+        print("rows: %d, cores: %d" % (args.rows, multiprocessing.cpu_count()))
+        print("%8s %10s %8s" % ("threads", "seconds", "speedup"))
+        base = None
+        for threads in args.threads:
+            elapsed = _time_index_build(db, threads, args.repeat)
+            base = elapsed if base is None else base
+            print("%8d %10.3f %7.2fx" % (threads, elapsed, base / elapsed))
+        db.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,262 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import csv
+import glob
+import json
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+import supersqlite.third_party.sqlite3
+from supersqlite import SuperSQLite
+
+# Statements run by other statements, such as those FTS5 and the R*Tree
+# module use to read and write their shadow tables, are included in the time,
+# cache and sorter figures of the statement that ran them, so only top-level
+# statements are summed.  VM steps are not inclusive and are summed over all
+# statements.
+_INCLUSIVE = ['runs', 'rows', 'elapsed_ns', 'cache_hits', 'cache_misses',
+              'sorter_spill_bytes']
+
+# Metrics compared by --compare.  VM steps and cache hits do not depend on
+# the machine or its load, so any change in them is a real change in the
+# work done.
+_COMPARED = ['elapsed_ns', 'vm_steps', 'cache_hits', 'cache_misses',
+             'sorter_spill_bytes']
+
+
+def _load_extension(db, name):
+    path = glob.glob(os.path.join(
+        os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+        name + '*'))[0]
+    db.enableloadextension(True)
+    db.loadextension(path, 'sqlite3_%s_init' % (name,))
+
+
+def _text(rand, n):
+    # Word ranks are log-uniform, a rough Zipf distribution as in real text.
+    return ' '.join('w%x' % (int(5000 ** rand.random()),) for i in range(n))
+
+
+def bulk_insert(db, args, tmpdir):
+    rand = random.Random(42)
+    cursor = db.cursor()
+    cursor.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, category, "
+                   "value REAL, note)")
+    cursor.execute("BEGIN")
+    cursor.executemany(
+        "INSERT INTO t VALUES(?, ?, ?, ?)",
+        ((i, rand.randint(0, 99), rand.uniform(0, 1000), _text(rand, 8))
+         for i in range(1, args.rows + 1)))
+    cursor.execute("CREATE INDEX t_category ON t(category, value)")
+    cursor.execute("COMMIT")
+
+
+def point_lookup(db, args, tmpdir):
+    rand = random.Random(7)
+    cursor = db.cursor()
+    for i in range(args.lookups):
+        cursor.execute("SELECT note FROM t WHERE id=?",
+                       (rand.randint(1, args.rows),)).fetchone()
+
+
+def range_scan(db, args, tmpdir):
+    rand = random.Random(11)
+    cursor = db.cursor()
+    for i in range(args.scans):
+        lo = rand.randint(0, 90)
+        cursor.execute("SELECT count(*), sum(value) FROM t "
+                       "WHERE category BETWEEN ? AND ?", (lo, lo + 9)).fetchone()
+    # A sort over the whole table, large enough to spill to temp files.
+    cursor.execute("SELECT count(*) FROM (SELECT note FROM t ORDER BY note)"
+                   ).fetchone()
+
+
+def fts5_query(db, args, tmpdir):
+    rand = random.Random(13)
+    cursor = db.cursor()
+    cursor.execute("CREATE VIRTUAL TABLE IF NOT EXISTS ft USING fts5(note, "
+                   "content=t, content_rowid=id)")
+    cursor.execute("INSERT INTO ft(ft) VALUES('rebuild')")
+    for i in range(args.scans):
+        word = 'w%x' % (int(5000 ** rand.random()),)
+        cursor.execute("SELECT count(*) FROM ft WHERE ft MATCH ?",
+                       (word,)).fetchone()
+        cursor.execute("SELECT rowid FROM ft WHERE ft MATCH ? "
+                       "ORDER BY rank LIMIT 10", (word,)).fetchall()
+
+
+def rtree_query(db, args, tmpdir):
+    rand = random.Random(17)
+    cursor = db.cursor()
+    cursor.execute("CREATE VIRTUAL TABLE IF NOT EXISTS boxes USING "
+                   "rtree(id, minx, maxx, miny, maxy)")
+    cursor.execute("BEGIN")
+    boxes = []
+    for i in range(1, args.rows + 1):
+        x, y = rand.uniform(0, 1000), rand.uniform(0, 1000)
+        boxes.append((i, x, x + rand.uniform(0, 2), y, y + rand.uniform(0, 2)))
+    cursor.executemany("INSERT INTO boxes VALUES(?, ?, ?, ?, ?)", boxes)
+    cursor.execute("COMMIT")
+    for i in range(args.lookups):
+        x, y = rand.uniform(0, 990), rand.uniform(0, 990)
+        cursor.execute("SELECT count(*) FROM boxes WHERE minx<=? AND maxx>=? "
+                       "AND miny<=? AND maxy>=?",
+                       (x + 10, x, y + 10, y)).fetchone()
+
+
+def csv_import(db, args, tmpdir):
+    rand = random.Random(19)
+    path = os.path.join(tmpdir, 'import.csv')
+    with open(path, 'w') as f:
+        writer = csv.writer(f)
+        writer.writerow(['id', 'name', 'amount', 'comment'])
+        for i in range(args.rows):
+            writer.writerow([i, 'name %d' % (rand.randint(0, 999),),
+                             round(rand.uniform(0, 100), 2),
+                             _text(rand, 6)])
+    _load_extension(db, 'csv')
+    cursor = db.cursor()
+    cursor.execute("CREATE VIRTUAL TABLE temp.c USING csv(filename='%s', "
+                   "header=1)" % (path.replace("'", "''"),))
+    cursor.execute("CREATE TABLE imported(id INTEGER PRIMARY KEY, name, "
+                   "amount REAL, comment)")
+    cursor.execute("INSERT INTO imported SELECT * FROM temp.c")
+    cursor.execute("DROP TABLE temp.c")
+
+
+_WORKLOADS = [
+    ("bulk insert", bulk_insert),
+    ("point lookup", point_lookup),
+    ("range scan", range_scan),
+    ("fts5 query", fts5_query),
+    ("rtree query", rtree_query),
+    ("csv import", csv_import),
+]
+
+
+def _profile(db):
+    # Statements that read or control the profile are not part of the
+    # workload.
+    return [p for p in db.statementprofile(enable=False, reset=True)
+            if p['sql'] is None or 'sqlite_profile' not in p['sql']]
+
+
+def _run(db, func, args, tmpdir):
+    # A run is recorded when its statement is reset, which happens when the
+    # workload's cursors are released on return.
+    db.statementprofile(enable=True, reset=True)
+    start = time.time()
+    func(db, args, tmpdir)
+    wall = time.time() - start
+    statements = _profile(db)
+    toplevel = [p for p in statements if p['nested_runs'] < p['runs']]
+    totals = dict((k, sum(p[k] for p in toplevel)) for k in _INCLUSIVE)
+    totals['vm_steps'] = sum(p['vm_steps'] for p in statements)
+    totals['wall_s'] = wall
+    return totals, statements
+
+
+def _print_row(name, totals):
+    print("%-14s %8.3f %9d %10d %10.1f %12d %11d %9d %11.1f" %
+          (name, totals['wall_s'], totals['runs'], totals['rows'],
+           totals['elapsed_ns'] / 1e6, totals['vm_steps'],
+           totals['cache_hits'], totals['cache_misses'],
+           totals['sorter_spill_bytes'] / 1e6))
+
+
+def _compare(results, baseline, threshold):
+    regressions = []
+    print()
+    print("compared with the baseline (new / old):")
+    print("%-14s %s" % ("workload", ' '.join('%12s' % (k,) for k in _COMPARED)))
+    for name, _ in _WORKLOADS:
+        if name not in baseline or name not in results:
+            continue
+        ratios = []
+        for k in _COMPARED:
+            old, new = baseline[name][k], results[name][k]
+            ratio = new / old if old else (1.0 if not new else float('inf'))
+            ratios.append(ratio)
+            if ratio > threshold:
+                regressions.append((name, k, ratio))
+        print("%-14s %s" % (name, ' '.join('%12.3f' % (r,) for r in ratios)))
+    for name, k, ratio in regressions:
+        print("REGRESSION: %s %s is %.2fx the baseline" % (name, k, ratio))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run a fixed set of workloads (bulk insert, point "
+                    "lookup, range scan, FTS5 query, R*Tree query and CSV "
+                    "import) and print the figures collected for them by "
+                    "the sqlite_profile virtual table.  Save the results of "
+                    "one release with --save and check another against "
+                    "them with --compare.")
+    parser.add_argument('--rows', type=int, default=200000)
+    parser.add_argument('--lookups', type=int, default=50000)
+    parser.add_argument('--scans', type=int, default=200)
+    parser.add_argument('--cache-size', type=int, default=-8000,
+                        help="PRAGMA cache_size for the connection")
+    parser.add_argument('--statements', action='store_true',
+                        help="also print the figures for each statement, "
+                             "marking nested statements with '*'")
+    parser.add_argument('--save', metavar='FILE',
+                        help="write the results to FILE as JSON")
+    parser.add_argument('--compare', metavar='FILE',
+                        help="compare the results with those saved in FILE")
+    parser.add_argument('--threshold', type=float, default=1.10,
+                        help="ratio above which --compare reports a "
+                             "regression")
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    results = {}
+    try:
+        db = SuperSQLite.connect(os.path.join(tmpdir, 'suite.db'))
+        db.cursor().execute("PRAGMA cache_size=%d" % (args.cache_size,))
+        print("rows: %d, lookups: %d, scans: %d" %
+              (args.rows, args.lookups, args.scans))
+        print("%-14s %8s %9s %10s %10s %12s %11s %9s %11s" %
+              ("workload", "wall (s)", "runs", "rows", "exec (ms)",
+               "vm steps", "cache hits", "misses", "spill (MB)"))
+        all_statements = []
+        for name, func in _WORKLOADS:
+            totals, statements = _run(db, func, args, tmpdir)
+            results[name] = totals
+            all_statements.append((name, statements))
+            _print_row(name, totals)
+        db.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+    if args.statements:
+        for name, statements in all_statements:
+            print()
+            print("%s:" % (name,))
+            for p in sorted(statements, key=lambda p: -p['elapsed_ns']):
+                print("  %10.1f ms %8d runs %10d steps %s %s" %
+                      (p['elapsed_ns'] / 1e6, p['runs'], p['vm_steps'],
+                       '*' if p['nested_runs'] else ' ',
+                       ' '.join((p['sql'] or '(other)').split())[:60]))
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump({'args': vars(args), 'results': results}, f,
+                      indent=2, sort_keys=True)
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)['results']
+        if _compare(results, baseline, args.threshold):
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
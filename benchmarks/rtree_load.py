@@ -0,0 +1,98 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import tempfile
+import time
+
+from supersqlite import SuperSQLite
+
+
+def _populate(db, rows, size):
+    rand = random.Random(42)
+    cursor = db.cursor()
+    cursor.execute(
+        "CREATE TABLE src(id INTEGER PRIMARY KEY, x0, x1, y0, y1)")
+    cursor.execute("BEGIN")
+
+    def boxes():
+        for i in range(rows):
+            x = rand.uniform(0, size)
+            y = rand.uniform(0, size)
+            yield (x, x + rand.uniform(0, 1), y, y + rand.uniform(0, 1))
+    cursor.executemany("INSERT INTO src(x0, x1, y0, y1) VALUES(?, ?, ?, ?)",
+                       boxes())
+    cursor.execute("COMMIT")
+
+
+def _load(db, table, bulk):
+    cursor = db.cursor()
+    cursor.execute("CREATE VIRTUAL TABLE %s USING rtree(id, x0, x1, y0, y1)"
+                   % (table,))
+    start = time.time()
+    if bulk:
+        cursor.execute("SELECT rtreebulkload(?, 'SELECT * FROM src')",
+                       (table,))
+    else:
+        cursor.execute("BEGIN")
+        cursor.execute("INSERT INTO %s SELECT * FROM src" % (table,))
+        cursor.execute("COMMIT")
+    elapsed = time.time() - start
+    nodes = cursor.execute(
+        "SELECT count(*) FROM %s_node" % (table,)).fetchone()[0]
+    return elapsed, nodes
+
+
+def _query(db, table, queries, size, window):
+    rand = random.Random(7)
+    cursor = db.cursor()
+    sql = ("SELECT count(*) FROM %s WHERE x0<=? AND x1>=? AND y0<=? AND y1>=?"
+           % (table,))
+    found = 0
+    start = time.time()
+    for i in range(queries):
+        x = rand.uniform(0, size)
+        y = rand.uniform(0, size)
+        found += cursor.execute(sql, (x + window, x, y + window, y)
+                                ).fetchone()[0]
+    return time.time() - start, found
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare loading an R*Tree with INSERT against "
+                    "rtreebulkload(), and the query speed of the results.")
+    parser.add_argument('--rows', type=int, default=1000000)
+    parser.add_argument('--size', type=float, default=1000.0,
+                        help="width of the square the boxes are placed in")
+    parser.add_argument('--queries', type=int, default=10000)
+    parser.add_argument('--window', type=float, default=5.0,
+                        help="width of each query window")
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        db = SuperSQLite.connect(os.path.join(tmpdir, 'rtree_load.db'))
+        _populate(db, args.rows, args.size)
+
+        print("rows: %d, queries: %d" % (args.rows, args.queries))
+        print("%-8s %10s %8s %12s %10s" %
+              ("method", "load (s)", "nodes", "queries (s)", "found"))
+        for table, bulk in (("rt_insert", False), ("rt_bulk", True)):
+            elapsed, nodes = _load(db, table, bulk)
+            qelapsed, found = _query(db, table, args.queries, args.size,
+                                     args.window)
+            print("%-8s %10.3f %8d %12.3f %10d" %
+                  ("bulk" if bulk else "insert", elapsed, nodes, qelapsed,
+                   found))
+        db.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
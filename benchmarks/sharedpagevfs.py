@@ -0,0 +1,192 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import random
+import resource
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import supersqlite.third_party.sqlite3
+from supersqlite import SuperSQLite, apsw
+
+_clock = getattr(time, 'perf_counter', time.time)
+
+
+def _load_vfs():
+    # Registering the VFS is permanent, so any connection will do.
+    path = glob.glob(os.path.join(
+        os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+        'sharedpagevfs*'))[0]
+    db = SuperSQLite.connect(':memory:')
+    db.enableloadextension(True)
+    db.loadextension(path, 'sqlite3_sharedpagevfs_init')
+    return db
+
+
+def _rss_kb():
+    try:
+        with open('/proc/self/status') as f:
+            for line in f:
+                if line.startswith('VmRSS:'):
+                    return int(line.split()[1])
+    except IOError:
+        pass
+    # Peak rather than current RSS; kB on Linux, bytes on macOS.
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return rss // 1024 if sys.platform == 'darwin' else rss
+
+
+def _populate(path, rows):
+    rand = random.Random(42)
+    db = SuperSQLite.connect(path)
+    cursor = db.cursor()
+    cursor.execute("PRAGMA journal_mode=WAL")
+    cursor.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, category, "
+                   "description)")
+    cursor.execute("BEGIN")
+    cursor.executemany(
+        "INSERT INTO t VALUES(?, ?, ?)",
+        ((i, rand.randint(0, 99),
+          ' '.join('w%d' % (rand.randint(0, 5000),) for j in range(30)))
+         for i in range(1, rows + 1)))
+    cursor.execute("COMMIT")
+    db.close()
+
+
+def _lookups(db, seed, rows, lookups, latencies):
+    # Keys are log-uniform, so that a few pages are hot and most are cold,
+    # as with the requests a web worker sees.
+    rand = random.Random(seed)
+    cursor = db.cursor()
+    for i in range(lookups):
+        key = int(rows ** rand.random())
+        start = _clock()
+        cursor.execute("SELECT description FROM t WHERE id=?",
+                       (key,)).fetchone()
+        latencies.append(_clock() - start)
+
+
+def _percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def _child(args):
+    # Runs one configuration in a process of its own, so that its RSS is
+    # not affected by the other.
+    stats_db = _load_vfs() if args.child == 'shared' else None
+    flags = apsw.SQLITE_OPEN_READONLY | apsw.SQLITE_OPEN_URI
+    if args.child == 'shared':
+        uri = 'file:%s?vfs=sharedpagevfs&sharedcache=%d&stripes=%d' % (
+            args.db, args.shared_cache, args.stripes)
+        cache_size = args.connection_cache
+    else:
+        uri = 'file:%s' % (args.db,)
+        cache_size = args.cache_size
+    rss_before = _rss_kb()
+    dbs = []
+    for i in range(args.connections):
+        db = SuperSQLite.connect(uri, flags=flags)
+        db.cursor().execute("PRAGMA cache_size=-%d" % (cache_size,))
+        dbs.append(db)
+
+    result = {}
+    for phase in ('cold', 'warm'):
+        latencies = [[] for db in dbs]
+        threads = [threading.Thread(target=_lookups,
+                                    args=(db, i, args.rows, args.lookups,
+                                          latencies[i]))
+                   for i, db in enumerate(dbs)]
+        start = time.time()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        wall = time.time() - start
+        flat = [x for l in latencies for x in l]
+        result[phase] = {
+            'p50_us': _percentile(flat, 0.50) * 1e6,
+            'p99_us': _percentile(flat, 0.99) * 1e6,
+            'lookups_per_s': len(flat) / wall,
+        }
+    result['rss_mb'] = (_rss_kb() - rss_before) / 1024.0
+    if stats_db is not None:
+        row = stats_db.cursor().execute(
+            "SELECT hits, misses FROM sharedpagevfs_stats WHERE file LIKE ?",
+            ('%' + os.path.basename(args.db),)).fetchone()
+        result['hit_ratio'] = row[0] / float(row[0] + row[1] or 1)
+    for db in dbs:
+        db.close()
+    print(json.dumps(result))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare the memory used by many read-only connections "
+                    "to one database, and the latency of point lookups "
+                    "made through them from as many threads, with "
+                    "per-connection page caches and with the cache shared "
+                    "by the sharedpagevfs VFS.  Each configuration runs in "
+                    "a new process; RSS is the growth in the process's "
+                    "resident set from before the connections are opened "
+                    "to after the lookups.  'cold' is the first round of "
+                    "lookups on new connections, 'warm' the second.")
+    parser.add_argument('--rows', type=int, default=500000)
+    parser.add_argument('--connections', type=int, default=32)
+    parser.add_argument('--lookups', type=int, default=20000,
+                        help="lookups per connection in each round")
+    parser.add_argument('--cache-size', type=int, default=8192,
+                        help="page cache of each connection in KiB, "
+                             "without the shared cache")
+    parser.add_argument('--connection-cache', type=int, default=256,
+                        help="page cache of each connection in KiB, "
+                             "with the shared cache")
+    parser.add_argument('--shared-cache', type=int, default=65536,
+                        help="size of the shared cache in KiB")
+    parser.add_argument('--stripes', type=int, default=16)
+    parser.add_argument('--child', help=argparse.SUPPRESS)
+    parser.add_argument('--db', help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.child:
+        _child(args)
+        return
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        path = os.path.join(tmpdir, 'lookup.db')
+        _populate(path, args.rows)
+        print("rows: %d, size: %.1f MB, connections: %d, lookups: %d" %
+              (args.rows, os.path.getsize(path) / 1e6, args.connections,
+               args.lookups))
+        print("%-8s %9s %10s %10s %10s %10s %10s %9s" %
+              ("cache", "RSS (MB)", "cold p50", "cold p99", "warm p50",
+               "warm p99", "lookups/s", "hit ratio"))
+        for name in ('private', 'shared'):
+            out = subprocess.check_output(
+                [sys.executable, os.path.abspath(__file__),
+                 '--child', name, '--db', path] +
+                ['--%s=%s' % (k.replace('_', '-'), v)
+                 for k, v in sorted(vars(args).items())
+                 if k not in ('child', 'db')])
+            r = json.loads(out.decode('utf-8').strip().splitlines()[-1])
+            print("%-8s %9.1f %9.0fus %9.0fus %9.0fus %9.0fus %10.0f %9s" %
+                  (name, r['rss_mb'], r['cold']['p50_us'],
+                   r['cold']['p99_us'], r['warm']['p50_us'],
+                   r['warm']['p99_us'], r['warm']['lookups_per_s'],
+                   '%.3f' % (r['hit_ratio'],) if 'hit_ratio' in r else '-'))
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
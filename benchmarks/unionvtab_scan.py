@@ -0,0 +1,107 @@
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import argparse
+import glob
+import multiprocessing
+import os
+import random
+import shutil
+import tempfile
+import time
+
+import supersqlite.third_party.sqlite3
+from supersqlite import SuperSQLite
+
+
+def _thread_counts():
+    counts = [1]
+    n = 2
+    while n < multiprocessing.cpu_count():
+        counts.append(n)
+        n *= 2
+    counts.append(multiprocessing.cpu_count())
+    return sorted(set(counts))
+
+
+def _load_unionvtab(db):
+    path = glob.glob(os.path.join(
+        os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+        'unionvtab*'))[0]
+    db.enableloadextension(True)
+    db.loadextension(path, 'sqlite3_unionvtab_init')
+
+
+def _make_shards(tmpdir, shards, rows):
+    rand = random.Random(42)
+    directory = []
+    for i in range(shards):
+        path = os.path.join(tmpdir, 'shard%d.db' % (i,))
+        first = i * rows + 1
+        db = SuperSQLite.connect(path)
+        cursor = db.cursor()
+        cursor.execute("CREATE TABLE t(id INTEGER PRIMARY KEY, value, note)")
+        cursor.execute("BEGIN")
+        cursor.executemany(
+            "INSERT INTO t VALUES(?, ?, ?)",
+            ((first + j, rand.randint(0, 1000000), 'note %d' % (j % 97,))
+             for j in range(rows)))
+        cursor.execute("COMMIT")
+        db.close()
+        directory.append((path, first, first + rows - 1))
+    return directory
+
+
+def _time(cursor, sql):
+    start = time.time()
+    result = cursor.execute(sql).fetchone()
+    return time.time() - start, result
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time full scans and unionvtab_aggregate() over a "
+                    "swarmvtab table spread across several database files "
+                    "against the value of its 'parallel' option.")
+    parser.add_argument('--shards', type=int, default=16)
+    parser.add_argument('--rows', type=int, default=200000,
+                        help="rows in each shard")
+    parser.add_argument('--threads', type=int, nargs='*',
+                        default=_thread_counts())
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        directory = _make_shards(tmpdir, args.shards, args.rows)
+        db = SuperSQLite.connect(':memory:')
+        _load_unionvtab(db)
+        cursor = db.cursor()
+        cursor.execute("CREATE TEMP TABLE shards(path, tbl, lo, hi)")
+        cursor.executemany("INSERT INTO shards VALUES(?, 't', ?, ?)",
+                           directory)
+
+        print("shards: %d, rows: %d, cores: %d" %
+              (args.shards, args.shards * args.rows,
+               multiprocessing.cpu_count()))
+        print("%8s %10s %10s %10s" %
+              ("threads", "scan (s)", "rows/sec", "agg (s)"))
+        for threads in args.threads:
+            cursor.execute(
+                "CREATE VIRTUAL TABLE temp.swarm USING swarmvtab("
+                "'SELECT * FROM shards', maxopen=%d, parallel=%d)" %
+                (args.shards, threads))
+            scan, _ = _time(
+                cursor, "SELECT count(*), sum(value), max(note) FROM swarm")
+            agg, _ = _time(
+                cursor, "SELECT unionvtab_aggregate('swarm', 'sum', 'value')")
+            cursor.execute("DROP TABLE temp.swarm")
+            print("%8d %10.3f %10.0f %10.3f" %
+                  (threads, scan, args.shards * args.rows / scan, agg))
+        db.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -142,6 +142,7 @@ def get_modules(THIRD_PARTY, INTERNAL, PROJ_PATH,
 
     def sqlite_config(outfile):
         outfile.write('#define U_DISABLE_RENAMING 1' + '\n')
+        outfile.write('#define SQLITE_ENABLE_ASYNCIO 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_DBPAGE_VTAB 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_DBSTAT_VTAB 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_FTS3 1' + '\n')
@@ -152,6 +153,7 @@ def get_modules(THIRD_PARTY, INTERNAL, PROJ_PATH,
         outfile.write('#define SQLITE_ENABLE_ICU 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_IOTRACE 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_JSON1 1' + '\n')
+        outfile.write('#define SQLITE_ENABLE_PROFILE_VTAB 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_RBU 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_RTREE 1' + '\n')
         outfile.write('#define SQLITE_ENABLE_SESSION 1' + '\n')
@@ -191,6 +193,8 @@ def get_modules(THIRD_PARTY, INTERNAL, PROJ_PATH,
         outfile.write('#define SQLITE_MAX_TRIGGER_DEPTH 2147483647' + '\n')
         outfile.write('#define SQLITE_MAX_ATTACHED 125' + '\n')
         outfile.write('#define SQLITE_MAX_PAGE_COUNT 2147483646' + '\n')
+        outfile.write('#define SQLITE_MAX_WORKER_THREADS 16' + '\n')
+        outfile.write('#define SQLITE_DEFAULT_WORKER_THREADS 2' + '\n')
         outfile.write('\n\n\n')
 
     with open(ICU_POST, 'w+') as outfile:
@@ -358,7 +362,7 @@ def get_modules(THIRD_PARTY, INTERNAL, PROJ_PATH,
     return ([sqlite3, lsm1] +
             sqlite_misc_extensions(
                 skip=['dbdump.c', 'mmapwarm.c', 'normalize.c', 'scrub.c', 'vfslog.c'],
-                zlib=['compress.c', 'sqlar.c', 'zipfile.c'],
+                zlib=['compress.c', 'compressvfs.c', 'sqlar.c', 'zipfile.c'],
                 windirent=['fileio.c']))
 
 
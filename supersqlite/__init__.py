@@ -7,6 +7,7 @@ import bisect
 import hashlib
 import heapq
 import mmap
+import multiprocessing
 import os
 import sys
 import tempfile
@@ -70,6 +71,15 @@ def _pset(self, value):
     _error("You cannot set this property with SuperSQLite.")
 
 
+def _default_worker_threads():
+    # Leave one core for the thread running the statement itself, the
+    # sorter uses it to merge the first key range.
+    try:
+        return max(multiprocessing.cpu_count() - 1, 0)
+    except NotImplementedError:
+        return 0
+
+
 class SuperSQLite():
     pass
 
@@ -80,6 +90,10 @@ class SuperSQLiteConnection(apsw.Connection):
         if 'timeout' in kwargs:
             timeout = kwargs['timeout']
             del kwargs['timeout']
+        threads = None
+        if 'threads' in kwargs:
+            threads = kwargs['threads']
+            del kwargs['threads']
         cached_statements = None
         if 'cached_statements' in kwargs:
             kwargs['statementcachesize'] = kwargs['cached_statements']
@@ -106,6 +120,9 @@ class SuperSQLiteConnection(apsw.Connection):
         self.timeout = timeout
         if self.timeout:
             self.setbusytimeout(timeout * 1000)
+        if threads is None:
+            threads = _default_worker_threads()
+        self.limit(apsw.SQLITE_LIMIT_WORKER_THREADS, threads)
         self.cached_statements = cached_statements
 
         self.isolation_level = property(_pget, _pset)
@@ -1275,6 +1275,9 @@ PyInit_apsw(void)
         || PyType_Ready(&APSWStatementType) <0
         || PyType_Ready(&APSWBufferType) <0
         || PyType_Ready(&FunctionCBInfoType) <0
+#if PY_MAJOR_VERSION >= 3
+        || PyType_Ready(&FetchColumnsBufferType) <0
+#endif
 #ifdef EXPERIMENTAL
         || PyType_Ready(&APSWBackupType) <0
 #endif
@@ -3259,6 +3259,116 @@ Connection_status(Connection *self, PyObject *args)
   return Py_BuildValue("(ii)", current, highwater);
 }
 
+/* A helper function.  Runs a sqlite_profile command.  Returns 1 on success */
+static int
+connection_profile_command(Connection *self, const char *sql)
+{
+  int res;
+  PYSQLITE_CON_CALL(res=sqlite3_exec(self->db, sql, 0, 0, 0));
+  SET_EXC(res, self->db);
+  return res==SQLITE_OK;
+}
+
+/** .. method:: statementprofile(enable=None, reset=False) -> list
+
+  Returns the per-statement profile collected by the ``sqlite_profile``
+  virtual table.  Each item of the list is a dict with the keys *sql*,
+  *runs*, *nested_runs*, *rows*, *elapsed_ns*, *max_elapsed_ns*,
+  *vm_steps*, *cache_hits*, *cache_misses* and *sorter_spill_bytes*.
+  Runs are recorded when a statement is reset, so a cursor that is
+  still returning rows is not included yet.
+
+  :param enable: If *True* start collecting the profile, if *False* stop
+     collecting it.  This is done before the profile is read.
+  :param reset: If *True* discard the profile after reading it.
+
+  SQLite must have been compiled with ``SQLITE_ENABLE_PROFILE_VTAB``,
+  otherwise :exc:`SQLError` is raised.
+*/
+static PyObject *
+Connection_statementprofile(Connection *self, PyObject *args, PyObject *kwargs)
+{
+  static char *kwlist[]={"enable", "reset", NULL};
+  PyObject *enable=Py_None, *reset=Py_False;
+  PyObject *result=NULL, *row=NULL, *item=NULL;
+  sqlite3_stmt *stmt=NULL;
+  int res, i, ncols, doreset;
+
+  CHECK_USE(NULL);
+  CHECK_CLOSED(self, NULL);
+
+  if(!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:statementprofile(enable=None, reset=False)",
+                                  kwlist, &enable, &reset))
+    return NULL;
+
+  doreset=PyObject_IsTrue(reset);
+  if(doreset==-1)
+    return NULL;
+
+  if(enable!=Py_None)
+    {
+      int doenable=PyObject_IsTrue(enable);
+      if(doenable==-1)
+        return NULL;
+      if(!connection_profile_command(self, doenable?
+                                     "INSERT INTO sqlite_profile(sqlite_profile) VALUES('enable')":
+                                     "INSERT INTO sqlite_profile(sqlite_profile) VALUES('disable')"))
+        return NULL;
+    }
+
+  PYSQLITE_CON_CALL(res=sqlite3_prepare_v2(self->db, "SELECT * FROM sqlite_profile", -1, &stmt, NULL));
+  SET_EXC(res, self->db);
+  if(res!=SQLITE_OK)
+    goto error;
+
+  result=PyList_New(0);
+  if(!result)
+    goto error;
+
+  ncols=sqlite3_column_count(stmt);
+  for(;;)
+    {
+      PYSQLITE_CON_CALL(res=sqlite3_step(stmt));
+      if(res!=SQLITE_ROW)
+        break;
+      row=PyDict_New();
+      if(!row)
+        goto error;
+      for(i=0; i<ncols; i++)
+        {
+          INUSE_CALL(item=convert_column_to_pyobject(stmt, i));
+          if(!item || PyDict_SetItemString(row, sqlite3_column_name(stmt, i), item))
+            goto error;
+          Py_CLEAR(item);
+        }
+      if(PyList_Append(result, row))
+        goto error;
+      Py_CLEAR(row);
+    }
+  if(res!=SQLITE_DONE)
+    {
+      SET_EXC(res, self->db);
+      goto error;
+    }
+
+  PYSQLITE_VOID_CALL(sqlite3_finalize(stmt));
+  stmt=NULL;
+
+  if(doreset && !connection_profile_command(self, "INSERT INTO sqlite_profile(sqlite_profile) VALUES('reset')"))
+    goto error;
+
+  return result;
+
+ error:
+  assert(PyErr_Occurred());
+  if(stmt)
+    PYSQLITE_VOID_CALL(sqlite3_finalize(stmt));
+  Py_XDECREF(item);
+  Py_XDECREF(row);
+  Py_XDECREF(result);
+  return NULL;
+}
+
 
 /** .. method:: readonly(name) -> bool
 
@@ -3442,6 +3552,8 @@ static PyMethodDef Connection_methods[] = {
    "Configure this connection"},
   {"status", (PyCFunction)Connection_status, METH_VARARGS,
    "Information about this connection"},
+  {"statementprofile", (PyCFunction)Connection_statementprofile, METH_VARARGS|METH_KEYWORDS,
+   "Per-statement profile from the sqlite_profile table"},
   {"readonly", (PyCFunction)Connection_readonly, METH_O,
    "Check if database is readonly"},
   {"db_filename", (PyCFunction)Connection_db_filename, METH_O,
@@ -735,6 +735,90 @@ class APSW(unittest.TestCase):
         self.assertEqual(c.fetchall(), [])
         self.assertEqual(c.execute("select 3; select 4").fetchall(), [(3,), (4,)] )
 
+    def testCursorFetchColumns(self):
+        "Check columnar fetching"
+        c=self.db.cursor()
+        c.execute("create table foo(i,r,t,bl,n)")
+        c.executemany("insert into foo values(?,?,?,?,?)",
+                      [(1, 1.5, u("one"), b("\x01"), None),
+                       (None, 2, u("two"), b(""), None),
+                       (3, 3.5, None, b("\x03\x03"), None)])
+        self.assertRaises(TypeError, c.fetchcolumns)
+        self.assertRaises(ValueError, c.execute("select 1").fetchcolumns, 0)
+        c.execute("select * from foo")
+        cols=c.fetchcolumns(10)
+        self.assertEqual([col[0] for col in cols], ["integer", "real", "text", "blob", "null"])
+        if py3:
+            self.assertEqual(cols[0][1].tolist(), [1, 0, 3])
+            self.assertEqual(cols[0][3].tolist(), [False, True, False])
+            self.assertEqual(cols[1][1].tolist(), [1.5, 2.0, 3.5])
+            self.assertEqual(cols[1][3], None)
+            self.assertEqual(bytes(cols[2][1]), b("onetwo"))
+            self.assertEqual(cols[2][2].tolist(), [0, 3, 6, 6])
+            self.assertEqual(cols[3][2].tolist(), [0, 1, 1, 3])
+            self.assertEqual(cols[4][1:], (None, None, cols[4][3]))
+            self.assertEqual(cols[4][3].tolist(), [True, True, True])
+            # the views are read only
+            self.assertEqual(cols[0][1].readonly, True)
+            self.assertRaises(TypeError, cols[0][1].__setitem__, 0, 7)
+        self.assertEqual(c.fetchcolumns(10), None)
+        # batches do not span statements and can be mixed with next
+        c.execute("select r from foo; select 'x'")
+        self.assertEqual(next(c), (1.5,))
+        self.assertEqual(len(c.fetchcolumns(1)[0][1]), 1)
+        self.assertEqual(len(c.fetchcolumns(5)[0][1]), 1)
+        self.assertEqual(c.fetchcolumns(5)[0][0], "text")
+        self.assertEqual(c.fetchcolumns(5), None)
+        # errors while stepping
+        self.assertRaises(apsw.SQLError, c.execute("select abs(x) from (select 1 as x union all select -9223372036854775807-1)").fetchcolumns, 10)
+        # and the buffers outlive the cursor
+        c.close()
+        if py3:
+            self.assertEqual(cols[0][1].tolist(), [1, 0, 3])
+            self.assertEqual(bytes(cols[2][1]), b("onetwo"))
+
+    def testCursorFetchColumnsMixed(self):
+        "Check columnar fetching of columns with mixed types"
+        c=self.db.cursor()
+        c.execute("create table foo(x)")
+        def fetch(values):
+            c.execute("delete from foo")
+            c.executemany("insert into foo values(?)", [(v,) for v in values])
+            col=c.execute("select x from foo order by rowid").fetchcolumns(100)[0]
+            self.assertEqual(c.fetchcolumns(100), None)
+            if not py3:
+                return col[0], None
+            if col[0] in ("text", "blob"):
+                data=bytes(col[1])
+                offsets=col[2].tolist()
+                return col[0], [data[offsets[i]:offsets[i+1]] for i in range(len(values))]
+            if col[0]=="object":
+                return col[0], col[1]
+            return col[0], col[1].tolist()
+        big=2**53+1
+        # integers and reals
+        self.assertEqual(fetch([1, None, 2.5]), ("real", [1.0, 0.0, 2.5]))
+        self.assertEqual(fetch([2.5, 1]), ("real", [2.5, 1.0]))
+        self.assertEqual(fetch([big, 2]), ("integer", [big, 2]))
+        self.assertEqual(fetch([big, 2.5]), ("object", [big, 2.5]))
+        self.assertEqual(fetch([0.5, None, big]), ("object", [0.5, None, big]))
+        self.assertEqual(fetch([2**63-1, 1.5, -2**63]), ("object", [2**63-1, 1.5, -2**63]))
+        # numbers become text from their original values
+        self.assertEqual(fetch([1, None, 2.5, u("z"), 3]),
+                         ("text", [b("1"), b(""), b("2.5"), b("z"), b("3")]))
+        self.assertEqual(fetch([big, 0.5, u("z")]),
+                         ("text", [b(str(big)), b("0.5"), b("z")]))
+        self.assertEqual(fetch([2.5, 7, b("\x01"), 8]),
+                         ("blob", [b("2.5"), b("7"), b("\x01"), b("8")]))
+        # null rows are marked whatever the promotion
+        c.execute("delete from foo")
+        c.executemany("insert into foo values(?)", [(1,), (None,), (1.5,), (None,), (u("a"),)])
+        col=c.execute("select x from foo order by rowid").fetchcolumns(10)[0]
+        self.assertEqual(col[0], "text")
+        if py3:
+            self.assertEqual(col[3].tolist(), [False, True, False, True, False])
+            self.assertEqual(bytes(col[1]), b("11.5a"))
+
     def testTypes(self):
         "Check type information is maintained"
         c=self.db.cursor()
@@ -3889,6 +3973,40 @@ class APSW(unittest.TestCase):
             self.assertEqual(type(res), tuple)
             self.assertTrue(res[1]==0 or res[0]<=res[1])
 
+    def testStatementProfile(self):
+        "Verify per-statement profile"
+        if "ENABLE_PROFILE_VTAB" not in apsw.compile_options:
+            self.assertRaises(apsw.SQLError, self.db.statementprofile)
+            return
+        class foo:
+            def __bool__(self): 1/0
+            __nonzero__=__bool__
+        self.assertRaises(ZeroDivisionError, self.db.statementprofile, foo())
+        self.assertRaises(ZeroDivisionError, self.db.statementprofile, None, foo())
+        self.assertEqual(self.db.statementprofile(), [])
+        self.db.statementprofile(enable=True)
+        cur=self.db.cursor()
+        cur.execute("create table foo(x)")
+        for i in range(10):
+            cur.execute("insert into foo values(?)", (i,))
+        self.assertEqual(len(cur.execute("select x from foo order by x").fetchall()), 10)
+        cur.execute("select 1")
+        profile=dict((p["sql"], p) for p in self.db.statementprofile(enable=False, reset=True))
+        self.assertEqual(profile["insert into foo values(?)"]["runs"], 10)
+        select=profile["select x from foo order by x"]
+        self.assertEqual(select["runs"], 1)
+        self.assertEqual(select["rows"], 10)
+        self.assertTrue(select["vm_steps"]>0)
+        self.assertTrue(select["elapsed_ns"]>=select["max_elapsed_ns"]>0)
+        for k in ("cache_hits", "cache_misses", "sorter_spill_bytes"):
+            self.assertTrue(select[k]>=0)
+        # nothing is recorded while disabled
+        cur.execute("select 2")
+        cur.execute("select 3")
+        sqls=[p["sql"] for p in self.db.statementprofile()]
+        self.assertTrue("select 2" not in sqls)
+        self.assertTrue("select x from foo order by x" not in sqls)
+
     def testZeroBlob(self):
         "Verify handling of zero blobs"
         self.assertRaises(TypeError, apsw.zeroblob)
@@ -39,6 +39,8 @@ typedef struct AsyncFile AsyncFile;
 typedef struct AsyncFileData AsyncFileData;
 typedef struct AsyncFileLock AsyncFileLock;
 typedef struct AsyncLock AsyncLock;
+typedef struct AsyncBatch AsyncBatch;
+typedef struct AsyncStats AsyncStats;
 
 /* Enable for debugging */
 #ifndef NDEBUG
@@ -176,7 +178,7 @@ static void asyncTrace(const char *zFormat, ...){
 ** compatible systems and one for Win32. These functions isolate the OS
 ** specific code required by each platform.
 **
-** The system uses three mutexes and a single condition variable. To
+** The system uses three mutexes and two condition variables. To
 ** block on a mutex, async_mutex_enter() is called. The parameter passed
 ** to async_mutex_enter(), which must be one of ASYNC_MUTEX_LOCK,
 ** ASYNC_MUTEX_QUEUE or ASYNC_MUTEX_WRITER, identifies which of the three
@@ -202,6 +204,20 @@ static void asyncTrace(const char *zFormat, ...){
 ** It is guaranteed that no other thread will call async_cond_wait() when
 ** there is already a thread waiting on the condition variable.
 **
+** The async_cond_timedwait() function is the same as async_cond_wait(),
+** except that it returns after at most nUs microseconds even if the
+** condition variable is not signalled. It may be used with either
+** ASYNC_COND_QUEUE or ASYNC_COND_DONE. Any number of threads may wait on
+** ASYNC_COND_DONE, which is used to wake up threads blocked in
+** xFileControl() or xWrite() when the writer thread has made progress. It is signalled
+** using async_cond_broadcast(), which wakes all waiting threads. Callers
+** must always re-check the condition they are waiting for after either
+** wait function returns.
+**
+** The async_time_us() function returns the value of a monotonic clock, 
+** in microseconds. It is used to implement the batch window and to 
+** measure sync latency.
+**
 ** The async_sched_yield() function is called to suggest to the operating
 ** system that it would be a good time to shift the current thread off the
 ** CPU. The system will still work if this function is not implemented
@@ -212,7 +228,10 @@ static void async_mutex_enter(int eMutex);
 static void async_mutex_leave(int eMutex);
 static void async_cond_wait(int eCond, int eMutex);
 static void async_cond_signal(int eCond);
+static void async_cond_timedwait(int eCond, int eMutex, sqlite3_int64 nUs);
+static void async_cond_broadcast(int eCond);
 static void async_sched_yield(void);
+static sqlite3_int64 async_time_us(void);
 
 /*
 ** There are also two definitions of the following. async_os_initialize()
@@ -241,6 +260,7 @@ static void async_os_shutdown(void);
 
 /* Values for use as the 'eCond' argument of the above functions. */
 #define ASYNC_COND_QUEUE    0
+#define ASYNC_COND_DONE     1
 
 /*************************************************************************
 ** Start of OS specific code.
@@ -253,19 +273,22 @@ static void async_os_shutdown(void);
 
 #define mutex_held(X) (GetCurrentThreadId()==primitives.aHolder[X])
 
+/* Condition variables are used rather than events, as several threads
+** may wait on ASYNC_COND_DONE at once, and a manual-reset event reset by
+** one waiter can lose the wakeup meant for another. */
 static struct AsyncPrimitives {
   int isInit;
   DWORD aHolder[3];
   CRITICAL_SECTION aMutex[3];
-  HANDLE aCond[1];
+  CONDITION_VARIABLE aCond[2];
+  LARGE_INTEGER freq;
 } primitives = { 0 };
 
 static int async_os_initialize(void){
   if( !primitives.isInit ){
-    primitives.aCond[0] = CreateEvent(NULL, TRUE, FALSE, 0);
-    if( primitives.aCond[0]==NULL ){
-      return 1;
-    }
+    InitializeConditionVariable(&primitives.aCond[0]);
+    InitializeConditionVariable(&primitives.aCond[1]);
+    QueryPerformanceFrequency(&primitives.freq);
     InitializeCriticalSection(&primitives.aMutex[0]);
     InitializeCriticalSection(&primitives.aMutex[1]);
     InitializeCriticalSection(&primitives.aMutex[2]);
@@ -278,7 +301,6 @@ static void async_os_shutdown(void){
     DeleteCriticalSection(&primitives.aMutex[0]);
     DeleteCriticalSection(&primitives.aMutex[1]);
     DeleteCriticalSection(&primitives.aMutex[2]);
-    CloseHandle(primitives.aCond[0]);
     primitives.isInit = 0;
   }
 }
@@ -299,23 +321,44 @@ static void async_mutex_leave(int eMutex){
   LeaveCriticalSection(&primitives.aMutex[eMutex]);
 }
 static void async_cond_wait(int eCond, int eMutex){
-  ResetEvent(primitives.aCond[eCond]);
-  async_mutex_leave(eMutex);
-  WaitForSingleObject(primitives.aCond[eCond], INFINITE);
-  async_mutex_enter(eMutex);
+  assert( mutex_held(eMutex) );
+  TESTONLY( primitives.aHolder[eMutex] = 0; )
+  SleepConditionVariableCS(
+      &primitives.aCond[eCond], &primitives.aMutex[eMutex], INFINITE
+  );
+  TESTONLY( primitives.aHolder[eMutex] = GetCurrentThreadId(); )
 }
 static void async_cond_signal(int eCond){
   assert( mutex_held(ASYNC_MUTEX_QUEUE) );
-  SetEvent(primitives.aCond[eCond]);
+  WakeConditionVariable(&primitives.aCond[eCond]);
+}
+static void async_cond_timedwait(int eCond, int eMutex, sqlite3_int64 nUs){
+  assert( mutex_held(eMutex) );
+  TESTONLY( primitives.aHolder[eMutex] = 0; )
+  SleepConditionVariableCS(
+      &primitives.aCond[eCond], &primitives.aMutex[eMutex],
+      (DWORD)((nUs+999)/1000)
+  );
+  TESTONLY( primitives.aHolder[eMutex] = GetCurrentThreadId(); )
+}
+static void async_cond_broadcast(int eCond){
+  assert( mutex_held(ASYNC_MUTEX_QUEUE) );
+  WakeAllConditionVariable(&primitives.aCond[eCond]);
 }
 static void async_sched_yield(void){
   Sleep(0);
 }
+static sqlite3_int64 async_time_us(void){
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return (sqlite3_int64)((double)t.QuadPart*1000000.0 / primitives.freq.QuadPart);
+}
 #else
 
 /* The following block contains the pthreads specific code. */
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
 #define mutex_held(X) pthread_equal(primitives.aHolder[X], pthread_self())
 
@@ -324,13 +367,14 @@ static void async_os_shutdown(void) {}
 
 static struct AsyncPrimitives {
   pthread_mutex_t aMutex[3];
-  pthread_cond_t aCond[1];
+  pthread_cond_t aCond[2];
   pthread_t aHolder[3];
 } primitives = {
   { PTHREAD_MUTEX_INITIALIZER, 
     PTHREAD_MUTEX_INITIALIZER, 
     PTHREAD_MUTEX_INITIALIZER
   } , {
+    PTHREAD_COND_INITIALIZER,
     PTHREAD_COND_INITIALIZER
   } , { 0, 0, 0 }
 };
@@ -360,9 +404,33 @@ static void async_cond_signal(int eCond){
   assert( mutex_held(ASYNC_MUTEX_QUEUE) );
   pthread_cond_signal(&primitives.aCond[eCond]);
 }
+static void async_cond_timedwait(int eCond, int eMutex, sqlite3_int64 nUs){
+  struct timespec t;
+  assert( eMutex==0 || eMutex==1 || eMutex==2 );
+  assert( mutex_held(eMutex) );
+  clock_gettime(CLOCK_REALTIME, &t);
+  t.tv_sec += (time_t)(nUs / 1000000);
+  t.tv_nsec += (long)(nUs % 1000000) * 1000;
+  if( t.tv_nsec>=1000000000 ){
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000;
+  }
+  TESTONLY( primitives.aHolder[eMutex] = 0; )
+  pthread_cond_timedwait(&primitives.aCond[eCond], &primitives.aMutex[eMutex], &t);
+  TESTONLY( primitives.aHolder[eMutex] = pthread_self(); )
+}
+static void async_cond_broadcast(int eCond){
+  assert( mutex_held(ASYNC_MUTEX_QUEUE) );
+  pthread_cond_broadcast(&primitives.aCond[eCond]);
+}
 static void async_sched_yield(void){
   sched_yield();
 }
+static sqlite3_int64 async_time_us(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (sqlite3_int64)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
 #endif
 /*
 ** End of OS specific code.
@@ -376,11 +444,47 @@ static void async_sched_yield(void){
 #define SQLITE_ASYNC_TWO_FILEHANDLES 1
 #endif
 
+/*
+** Number of buckets in the histograms of batch sizes and sync latencies
+** reported by the sqlite3async_stats virtual table. Bucket i of the batch
+** size histogram counts batches of up to (1<<i) sync requests. Bucket i 
+** of the latency histogram counts syncs that took up to 100*(10^i) 
+** microseconds. In both cases the last bucket counts everything larger.
+*/
+#define ASYNC_NBATCHHIST 8
+#define ASYNC_NSYNCHIST  5
+
+/*
+** Counters reported by the sqlite3async_stats virtual table.
+**
+** All fields of async.stats are protected by the queue mutex. The writer
+** thread performs IO without holding that mutex, so it counts the writes
+** and syncs it makes in a private AsyncStats structure and adds them to
+** async.stats using asyncStatsPublish() once it holds the mutex again.
+*/
+struct AsyncStats {
+  sqlite3_int64 nQueue;        /* Operations currently in the write-op queue */
+  sqlite3_int64 nQueueByte;    /* Bytes of ASYNC_WRITE data in the queue */
+  sqlite3_int64 mxQueue;       /* Largest value nQueue has had */
+  sqlite3_int64 nWrite;        /* ASYNC_WRITE operations processed */
+  sqlite3_int64 nWriteByte;    /* Bytes written by those operations */
+  sqlite3_int64 nWriteCall;    /* Calls made to write to the parent VFS */
+  sqlite3_int64 nSync;         /* Calls made to xSync() of the parent VFS */
+  sqlite3_int64 nSyncUs;       /* Total time spent in xSync() */
+  sqlite3_int64 mxSyncUs;      /* Longest time spent in a single xSync() */
+  sqlite3_int64 nBatch;        /* Batches processed in group-commit mode */
+  sqlite3_int64 nCommit;       /* ASYNC_SYNC operations in those batches */
+  sqlite3_int64 aBatchHist[ASYNC_NBATCHHIST];
+  sqlite3_int64 aSyncHist[ASYNC_NSYNCHIST];
+};
+
 /*
 ** State information is held in the static variable "async" defined
 ** as the following structure.
 **
 ** Both async.ioError and async.nFile are protected by async.queueMutex.
+** As are async.iSeq, async.iSeqDone, async.iSeqError, async.bWriterActive
+** and async.nWaiter.
 */
 static struct TestAsyncStaticData {
   AsyncWrite *pQueueFirst;     /* Next write operation to be processed */
@@ -391,7 +495,24 @@ static struct TestAsyncStaticData {
   volatile int bLockFiles;     /* Current value of "lockfiles" parameter */
   int ioError;                 /* True if an IO error has occurred */
   int nFile;                   /* Number of open files (from sqlite pov) */
-} async = { 0,0,0,0,0,1,0,0 };
+  volatile int bGroupCommit;   /* Current value of "groupcommit" parameter */
+  volatile int nBatchWindow;   /* Current value of "batchwindow" parameter */
+  volatile int nBatchSize;     /* Current value of "batchsize" parameter */
+  volatile int nBatchByte;     /* Current value of "batchbytes" parameter */
+  volatile int nQueueLimit;    /* Current value of "queuebytes" parameter */
+  int bWriterActive;           /* True while sqlite3async_run() is running */
+  int nWaiter;                 /* Threads blocked on ASYNC_COND_DONE */
+  sqlite3_int64 iSeq;          /* AsyncWrite.iSeq of last queued operation */
+  sqlite3_int64 iSeqDone;      /* AsyncWrite.iSeq of last completed op */
+  sqlite3_int64 iSeqError;     /* First AsyncWrite.iSeq failed by ioError */
+  AsyncStats stats;            /* Counters for sqlite3async_stats */
+} async = { 0,0,0,0,0,1,0,0, 0,0,64,16*1024*1024,0, 0,0,0,0,0 };
+
+/*
+** When a thread blocks on ASYNC_COND_DONE it wakes up at least this often
+** to check that a writer thread is still running.
+*/
+#define ASYNC_DONE_TIMEOUT 100000
 
 /* Possible values of AsyncWrite.op */
 #define ASYNC_NOOP          0
@@ -425,6 +546,8 @@ static const char *azOpcodeName[] = {
 **     nByte   -> Number of bytes of data to write (pointed to by zBuf).
 **
 ** ASYNC_SYNC:
+**     iOffset -> Unused, except in group-commit mode, where the writer 
+**                thread stores the result of the sync here.
 **     nByte   -> flags to pass to sqlite3OsSync().
 **
 ** ASYNC_TRUNCATE:
@@ -451,6 +574,10 @@ static const char *azOpcodeName[] = {
 ** This space is sqlite3_malloc()d along with the AsyncWrite structure in a
 ** single blob, so is deleted when sqlite3_free() is called on the parent 
 ** structure.
+**
+** Each operation is assigned a sequence number (iSeq) when it is added to
+** the queue. Since operations are completed in the order in which they 
+** were queued, operation X has been completed if async.iSeqDone>=X.iSeq.
 */
 struct AsyncWrite {
   AsyncFileData *pFileData;    /* File to write data to or sync */
@@ -458,6 +585,7 @@ struct AsyncWrite {
   sqlite_int64 iOffset;        /* See above */
   int nByte;          /* See above */
   char *zBuf;         /* Data to write to file (or NULL if op!=ASYNC_WRITE) */
+  sqlite3_int64 iSeq; /* Sequence number (see above) */
   AsyncWrite *pNext;  /* Next write operation (to any file) */
 };
 
@@ -479,6 +607,10 @@ struct AsyncWrite {
 **
 ** See comments above the asyncLock() function for more details on 
 ** the implementation of database locking used by this backend.
+**
+** Unlike the other fields, AsyncLock.iLastSeq is protected by the queue
+** mutex. It is used in group-commit mode to find the operation that a 
+** commit to a WAL mode database must wait for (see asyncCommitWait()).
 */
 struct AsyncLock {
   char *zFile;
@@ -487,6 +619,7 @@ struct AsyncLock {
   int eLock;
   AsyncFileLock *pList;
   AsyncLock *pNext;           /* Next in linked list headed by async.pLock */
+  sqlite3_int64 iLastSeq;     /* iSeq of last operation queued on file */
 };
 
 /*
@@ -523,6 +656,7 @@ struct AsyncFileData {
   AsyncFileLock lock;        /* Lock state for this handle */
   AsyncLock *pLock;          /* AsyncLock object for this file system entry */
   AsyncWrite closeOp;        /* Preallocated close operation */
+  int bWal;                  /* True if opened with SQLITE_OPEN_WAL */
 };
 
 /*
@@ -534,6 +668,7 @@ struct AsyncFileData {
 ** Once an AsyncWrite structure has been added to the list, it becomes the
 ** property of the writer thread and must not be read or modified by the
 ** caller.  
+**
 */
 static void addAsyncWrite(AsyncWrite *pWrite){
   /* We must hold the queue mutex in order to modify the queue pointers */
@@ -541,6 +676,20 @@ static void addAsyncWrite(AsyncWrite *pWrite){
     async_mutex_enter(ASYNC_MUTEX_QUEUE);
   }
 
+  /* If the "queuebytes" limit has been reached, wait for the writer 
+  ** thread to catch up before queueing any more data. There is no point
+  ** in waiting if there is no writer thread.  */
+  if( pWrite->op==ASYNC_WRITE ){
+    while( async.nQueueLimit>0 
+        && async.stats.nQueueByte>=async.nQueueLimit 
+        && async.bWriterActive
+    ){
+      async.nWaiter++;
+      async_cond_timedwait(ASYNC_COND_DONE, ASYNC_MUTEX_QUEUE, ASYNC_DONE_TIMEOUT);
+      async.nWaiter--;
+    }
+  }
+
   /* Add the record to the end of the write-op queue */
   assert( !pWrite->pNext );
   if( async.pQueueLast ){
@@ -550,12 +699,21 @@ static void addAsyncWrite(AsyncWrite *pWrite){
     async.pQueueFirst = pWrite;
   }
   async.pQueueLast = pWrite;
+  pWrite->iSeq = ++async.iSeq;
+  if( pWrite->pFileData && pWrite->pFileData->pLock ){
+    pWrite->pFileData->pLock->iLastSeq = pWrite->iSeq;
+  }
   ASYNC_TRACE(("PUSH %p (%s %s %d)\n", pWrite, azOpcodeName[pWrite->op],
          pWrite->pFileData ? pWrite->pFileData->zName : "-", pWrite->iOffset));
 
   if( pWrite->op==ASYNC_CLOSE ){
     async.nFile--;
   }
+  async.stats.nQueue++;
+  async.stats.mxQueue = MAX(async.stats.mxQueue, async.stats.nQueue);
+  if( pWrite->op==ASYNC_WRITE ){
+    async.stats.nQueueByte += pWrite->nByte;
+  }
 
   /* The writer thread might have been idle because there was nothing
   ** on the write-op queue for it to do.  So wake it up. */
@@ -567,6 +725,20 @@ static void addAsyncWrite(AsyncWrite *pWrite){
   }
 }
 
+/*
+** Record that operation p, which has just been removed from the head of
+** the write-op queue, is complete. The queue mutex must be held.
+*/
+static void asyncQueueRemoved(AsyncWrite *p){
+  assert_mutex_is_held(ASYNC_MUTEX_QUEUE);
+  assert( p->iSeq>async.iSeqDone );
+  async.iSeqDone = p->iSeq;
+  async.stats.nQueue--;
+  if( p->op==ASYNC_WRITE ){
+    async.stats.nQueueByte -= p->nByte;
+  }
+}
+
 /*
 ** Increment async.nFile in a thread-safe manner.
 */
@@ -932,6 +1104,59 @@ static int asyncCheckReservedLock(sqlite3_file *pFile, int *pResOut){
   return SQLITE_OK;
 }
 
+/*
+** This function is called in group-commit mode when a transaction on the
+** database file p has been committed and the locks that prevent other
+** connections from writing to the database have been released. It blocks
+** until the transaction is on disk and returns the result.
+**
+** If the database is in WAL mode, the transaction is on disk once the
+** last operation queued on the WAL file has been performed. This is the
+** sync of the WAL file that ended the transaction if it synced at all
+** (synchronous=FULL), or the write of its last frame if not (NORMAL).
+** Otherwise, it is on disk once all operations queued so far (including 
+** the deletion or truncation of the rollback journal) have been 
+** performed. If no thread is running sqlite3async_run(), SQLITE_OK is
+** returned without waiting.
+**
+** The error returned is that of the batch or operation that failed, if
+** it was one of those waited for or one queued before them. Errors in
+** later operations, which belong to other transactions, are ignored.
+**
+** Because the write lock has been released, other connections may queue
+** and commit their transactions while this thread waits. This is what 
+** allows the writer thread to sync several transactions at once.
+*/
+static int asyncCommitWait(AsyncFileData *p){
+  sqlite3_int64 iTarget;
+  AsyncLock *pWal;
+  int rc = SQLITE_OK;
+
+  async_mutex_enter(ASYNC_MUTEX_QUEUE);
+  async_mutex_enter(ASYNC_MUTEX_LOCK);
+  for(pWal=async.pLock; pWal; pWal=pWal->pNext){
+    if( pWal->nFile==p->nName+4 
+     && memcmp(pWal->zFile, p->zName, p->nName)==0 
+     && memcmp(&pWal->zFile[p->nName], "-wal", 4)==0
+    ){
+      break;
+    }
+  }
+  iTarget = pWal ? pWal->iLastSeq : async.iSeq;
+  async_mutex_leave(ASYNC_MUTEX_LOCK);
+
+  while( iTarget>async.iSeqDone && async.bWriterActive ){
+    async.nWaiter++;
+    async_cond_timedwait(ASYNC_COND_DONE, ASYNC_MUTEX_QUEUE, ASYNC_DONE_TIMEOUT);
+    async.nWaiter--;
+  }
+  if( iTarget<=async.iSeqDone && async.iSeqError<=iTarget ){
+    rc = async.ioError;
+  }
+  async_mutex_leave(ASYNC_MUTEX_QUEUE);
+  return rc;
+}
+
 /* 
 ** sqlite3_file_control() implementation.
 */
@@ -943,6 +1168,13 @@ static int asyncFileControl(sqlite3_file *id, int op, void *pArg){
       async_mutex_leave(ASYNC_MUTEX_LOCK);
       return SQLITE_OK;
     }
+    case SQLITE_FCNTL_COMMIT_PHASETWO: {
+      AsyncFileData *p = ((AsyncFile*)id)->pData;
+      if( async.bGroupCommit && p->zName ){
+        return asyncCommitWait(p);
+      }
+      break;
+    }
   }
   return SQLITE_NOTFOUND;
 }
@@ -961,6 +1193,49 @@ static int asyncDeviceCharacteristics(sqlite3_file *pFile){
   return 0;
 }
 
+/*
+** Shared-memory methods. These are passed straight through to the read
+** handle of the database file, which is always opened synchronously. This
+** allows more than one connection in the process to use a database in WAL
+** mode. Changes made to the wal-index are visible to other connections 
+** immediately, but the WAL frames they refer to are read through 
+** asyncRead(), which sees the contents of the write-op queue, so this is
+** safe within a single process.
+*/
+static int asyncShmMap(
+  sqlite3_file *pFile, 
+  int iPg, 
+  int pgsz, 
+  int bExtend, 
+  void volatile **pp
+){
+  sqlite3_file *pBase = ((AsyncFile *)pFile)->pData->pBaseRead;
+  if( !pBase->pMethods || pBase->pMethods->iVersion<2 ){
+    return SQLITE_IOERR_SHMMAP;
+  }
+  return pBase->pMethods->xShmMap(pBase, iPg, pgsz, bExtend, pp);
+}
+static int asyncShmLock(sqlite3_file *pFile, int ofst, int n, int flags){
+  sqlite3_file *pBase = ((AsyncFile *)pFile)->pData->pBaseRead;
+  if( !pBase->pMethods || pBase->pMethods->iVersion<2 ){
+    return SQLITE_IOERR_SHMLOCK;
+  }
+  return pBase->pMethods->xShmLock(pBase, ofst, n, flags);
+}
+static void asyncShmBarrier(sqlite3_file *pFile){
+  sqlite3_file *pBase = ((AsyncFile *)pFile)->pData->pBaseRead;
+  if( pBase->pMethods && pBase->pMethods->iVersion>=2 ){
+    pBase->pMethods->xShmBarrier(pBase);
+  }
+}
+static int asyncShmUnmap(sqlite3_file *pFile, int deleteFlag){
+  sqlite3_file *pBase = ((AsyncFile *)pFile)->pData->pBaseRead;
+  if( !pBase->pMethods || pBase->pMethods->iVersion<2 ){
+    return SQLITE_OK;
+  }
+  return pBase->pMethods->xShmUnmap(pBase, deleteFlag);
+}
+
 static int unlinkAsyncFile(AsyncFileData *pData){
   AsyncFileLock **ppIter;
   int rc = SQLITE_OK;
@@ -1019,7 +1294,7 @@ static int asyncOpen(
   int *pOutFlags
 ){
   static sqlite3_io_methods async_methods = {
-    1,                               /* iVersion */
+    2,                               /* iVersion */
     asyncClose,                      /* xClose */
     asyncRead,                       /* xRead */
     asyncWrite,                      /* xWrite */
@@ -1031,7 +1306,11 @@ static int asyncOpen(
     asyncCheckReservedLock,          /* xCheckReservedLock */
     asyncFileControl,                /* xFileControl */
     asyncSectorSize,                 /* xSectorSize */
-    asyncDeviceCharacteristics       /* xDeviceCharacteristics */
+    asyncDeviceCharacteristics,      /* xDeviceCharacteristics */
+    asyncShmMap,                     /* xShmMap */
+    asyncShmLock,                    /* xShmLock */
+    asyncShmBarrier,                 /* xShmBarrier */
+    asyncShmUnmap                    /* xShmUnmap */
   };
 
   sqlite3_vfs *pVfs = (sqlite3_vfs *)pAsyncVfs->pAppData;
@@ -1069,6 +1348,7 @@ static int asyncOpen(
   pData->pBaseWrite = (sqlite3_file*)z;
   pData->closeOp.pFileData = pData;
   pData->closeOp.op = ASYNC_CLOSE;
+  pData->bWal = (flags & SQLITE_OPEN_WAL)!=0;
 
   if( zName ){
     z += pVfs->szOsFile;
@@ -1318,6 +1598,434 @@ static sqlite3_vfs async_vfs = {
   asyncCurrentTime      /* xDlClose */
 };
 
+/*
+** GROUP COMMIT
+**
+** In group-commit mode the writer thread does not process ASYNC_WRITE 
+** and ASYNC_SYNC operations one at a time. Instead, it removes a batch 
+** of them from the head of the queue and processes the batch as follows:
+**
+**     1. All ASYNC_WRITE operations are performed, in queue order. Runs 
+**        of operations that write to adjacent regions of the same file 
+**        are merged into a single write (a single pwritev() where 
+**        available).
+**
+**     2. Each file with one or more ASYNC_SYNC operations in the batch is
+**        synced once.
+**
+**     3. The operations are removed from the queue and threads waiting 
+**        in asyncCommitWait() for them to be performed are woken up.
+**
+** Performing the writes before the syncs is only safe if no write in
+** the batch must reach the disk after a sync that precedes it in the 
+** queue. The writes to a WAL file that follow a sync of a WAL file never 
+** depend on it, so a batch may contain any number of WAL file syncs. But a
+** write to any other file may depend on a preceding sync (for example,
+** the database file may only be written once the WAL or rollback journal
+** is synced), so a batch ends at the first such write after a sync. And 
+** a sync of a database or rollback journal file always ends the batch.
+*/
+
+/*
+** A batch of operations taken from the head of the write-op queue. The
+** aOp[] array is allocated with space for 2*nAlloc entries. The second
+** half is used as scratch space by asyncBatchRun().
+*/
+struct AsyncBatch {
+  AsyncWrite **aOp;            /* Operations in queue order */
+  int nOp;                     /* Number of entries in aOp[] */
+  int nAlloc;                  /* Allocated size of aOp[] (see above) */
+  int nSync;                   /* Number of ASYNC_SYNC operations in aOp[] */
+  sqlite3_int64 nByte;         /* Bytes of ASYNC_WRITE data in aOp[] */
+  int isFull;                  /* True if the batch may not be extended */
+};
+
+/*
+** In an amalgamation build on a system that has pwritev(), a run of writes
+** to a file opened by the built-in unix VFS is issued as a single 
+** pwritev() on the file descriptor instead of being copied into a single
+** buffer first. This relies on the unixFile structure and unixOpen() 
+** being visible in the same translation unit.
+*/
+#if defined(SQLITE_AMALGAMATION) && SQLITE_OS_UNIX \
+ && !defined(SQLITE_MMAP_READWRITE) \
+ && (defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__))
+# include <sys/uio.h>
+# include <errno.h>
+# define ASYNC_HAVE_PWRITEV 1
+# define ASYNC_IOV_MAX 64            /* Max iovec entries per pwritev() */
+#else
+# define ASYNC_HAVE_PWRITEV 0
+#endif
+
+/*
+** Return the handle the writer thread should use to write to file p.
+*/
+static sqlite3_file *asyncBaseFile(AsyncFileData *p){
+  return p->pBaseWrite->pMethods ? p->pBaseWrite : p->pBaseRead;
+}
+
+/*
+** Return a value that identifies the file-system entry opened by file p.
+** Two handles open on the same file return the same value.
+*/
+static void *asyncFileKey(AsyncFileData *p){
+  return p->zName ? (void *)p->zName : (void *)p;
+}
+
+/*
+** Add the counters accumulated by the writer thread in *pStats to
+** async.stats, then zero *pStats. The caller must hold the queue mutex.
+*/
+static void asyncStatsPublish(AsyncStats *pStats){
+  int i;
+  assert_mutex_is_held(ASYNC_MUTEX_QUEUE);
+  async.stats.nWrite += pStats->nWrite;
+  async.stats.nWriteByte += pStats->nWriteByte;
+  async.stats.nWriteCall += pStats->nWriteCall;
+  async.stats.nSync += pStats->nSync;
+  async.stats.nSyncUs += pStats->nSyncUs;
+  async.stats.mxSyncUs = MAX(async.stats.mxSyncUs, pStats->mxSyncUs);
+  for(i=0; i<ASYNC_NSYNCHIST; i++){
+    async.stats.aSyncHist[i] += pStats->aSyncHist[i];
+  }
+  memset(pStats, 0, sizeof(AsyncStats));
+}
+
+/*
+** Call the xSync() method of file handle pBase and record the time taken
+** in *pStats. Only the writer thread may call this function.
+*/
+static int asyncSyncBase(sqlite3_file *pBase, int flags, AsyncStats *pStats){
+  sqlite3_int64 iStart = async_time_us();
+  sqlite3_int64 nUs;
+  sqlite3_int64 iLimit = 100;
+  int rc;
+  int i;
+
+  rc = pBase->pMethods->xSync(pBase, flags);
+  nUs = async_time_us() - iStart;
+  pStats->nSync++;
+  pStats->nSyncUs += nUs;
+  pStats->mxSyncUs = MAX(pStats->mxSyncUs, nUs);
+  for(i=0; i<ASYNC_NSYNCHIST-1 && nUs>iLimit; i++){
+    iLimit = iLimit*10;
+  }
+  pStats->aSyncHist[i]++;
+  return rc;
+}
+
+#if ASYNC_HAVE_PWRITEV
+/*
+** Write the nWrite ASYNC_WRITE operations in aWrite[], which are for 
+** adjacent regions of the file, to the unix file descriptor fd.
+*/
+static int asyncPwritev(
+  int fd,
+  AsyncWrite **aWrite,
+  int nWrite,
+  AsyncStats *pStats
+){
+  struct iovec aIov[ASYNC_IOV_MAX];
+  sqlite3_int64 iOff = aWrite[0]->iOffset;
+  int iSkip = 0;                  /* Bytes of aWrite[i] already written */
+  int i = 0;
+
+  while( i<nWrite ){
+    int nIov;
+    ssize_t n;
+    for(nIov=0; nIov<ASYNC_IOV_MAX && i+nIov<nWrite; nIov++){
+      AsyncWrite *p = aWrite[i+nIov];
+      int iStart = (nIov==0 ? iSkip : 0);
+      aIov[nIov].iov_base = (void *)&p->zBuf[iStart];
+      aIov[nIov].iov_len = p->nByte - iStart;
+    }
+    do{
+      n = pwritev(fd, aIov, nIov, (off_t)iOff);
+    }while( n<0 && errno==EINTR );
+    pStats->nWriteCall++;
+    if( n<0 && errno!=ENOSPC ) return SQLITE_IOERR_WRITE;
+    if( n<=0 ) return SQLITE_FULL;
+    iOff += n;
+    while( i<nWrite && n>=aWrite[i]->nByte-iSkip ){
+      n -= aWrite[i]->nByte-iSkip;
+      iSkip = 0;
+      i++;
+    }
+    iSkip += (int)n;
+  }
+  return SQLITE_OK;
+}
+#endif
+
+/*
+** Largest buffer passed to the xWrite() method of the parent VFS when
+** merging writes. VFS implementations are not required to support writes
+** larger than the largest page size (the unix VFS does not).
+*/
+#define ASYNC_MAX_WRITE 65536
+
+/*
+** Write the nWrite ASYNC_WRITE operations in aWrite[] to the file. The
+** operations all write to the same file, and each begins where the 
+** previous one ends, so they are written using as few calls as possible.
+** The writes are counted in *pStats.
+*/
+static int asyncWriteRun(AsyncWrite **aWrite, int nWrite, AsyncStats *pStats){
+  sqlite3_file *pBase = asyncBaseFile(aWrite[0]->pFileData);
+  sqlite3_int64 iOffset = aWrite[0]->iOffset;
+  sqlite3_int64 nByte = 0;
+  char *aBuf;
+  int rc = SQLITE_OK;
+  int i, j;
+
+  for(i=0; i<nWrite; i++){
+    nByte += aWrite[i]->nByte;
+  }
+  pStats->nWrite += nWrite;
+  pStats->nWriteByte += nByte;
+  ASYNC_TRACE(("WRITE %s %d bytes at %lld (%d ops)\n",
+          aWrite[0]->pFileData->zName, (int)nByte, iOffset, nWrite));
+
+  if( nWrite==1 ){
+    pStats->nWriteCall++;
+    return pBase->pMethods->xWrite(pBase, aWrite[0]->zBuf, (int)nByte, iOffset);
+  }
+
+#if ASYNC_HAVE_PWRITEV
+  if( ((sqlite3_vfs *)async_vfs.pAppData)->xOpen==unixOpen ){
+    return asyncPwritev(((unixFile *)pBase)->h, aWrite, nWrite, pStats);
+  }
+#endif
+
+  /* Copy the data into buffers of up to ASYNC_MAX_WRITE bytes and write 
+  ** those. A single operation larger than that is written directly. If 
+  ** the buffer cannot be allocated, write each region separately.  */
+  aBuf = (char *)sqlite3_malloc(ASYNC_MAX_WRITE);
+  for(i=0; rc==SQLITE_OK && i<nWrite; i=j){
+    AsyncWrite *p = aWrite[i];
+    int n = p->nByte;
+    for(j=i+1; aBuf && j<nWrite && n+aWrite[j]->nByte<=ASYNC_MAX_WRITE; j++){
+      n += aWrite[j]->nByte;
+    }
+    pStats->nWriteCall++;
+    if( j==i+1 ){
+      rc = pBase->pMethods->xWrite(pBase, p->zBuf, p->nByte, p->iOffset);
+    }else{
+      char *z = aBuf;
+      int k;
+      for(k=i; k<j; k++){
+        memcpy(z, aWrite[k]->zBuf, aWrite[k]->nByte);
+        z += aWrite[k]->nByte;
+      }
+      rc = pBase->pMethods->xWrite(pBase, aBuf, n, p->iOffset);
+    }
+  }
+  sqlite3_free(aBuf);
+  return rc;
+}
+
+/*
+** Return the flags to pass to xSync() to satisfy two sync requests, one
+** with flags f1 and the other with flags f2.
+*/
+static int asyncSyncFlags(int f1, int f2){
+  int f = MAX(f1&0x0F, f2&0x0F);
+  if( f1 & f2 & SQLITE_SYNC_DATAONLY ){
+    f |= SQLITE_SYNC_DATAONLY;
+  }
+  return f;
+}
+
+/*
+** Populate the batch object with as many operations from the head of the
+** write-op queue as the rules described under "GROUP COMMIT" above, and
+** the "batchsize" and "batchbytes" parameters, allow. The caller must 
+** hold the queue mutex, and the first operation on the queue must be an
+** ASYNC_WRITE or ASYNC_SYNC.
+**
+** SQLITE_NOMEM is returned if the batch cannot contain even one operation
+** due to a malloc failure. Otherwise SQLITE_OK.
+*/
+static int asyncBatchFill(AsyncBatch *pBatch){
+  AsyncWrite *p;
+  int hasSync = 0;
+
+  assert_mutex_is_held(ASYNC_MUTEX_QUEUE);
+  pBatch->nOp = 0;
+  pBatch->nSync = 0;
+  pBatch->nByte = 0;
+  pBatch->isFull = 0;
+  for(p=async.pQueueFirst; p; p=p->pNext){
+    if( (p->op!=ASYNC_WRITE && p->op!=ASYNC_SYNC)
+     || (hasSync && !p->pFileData->bWal)
+     || (p->op==ASYNC_SYNC && pBatch->nSync>=async.nBatchSize)
+     || (p->op==ASYNC_WRITE && pBatch->nOp>0 
+                            && pBatch->nByte+p->nByte>async.nBatchByte)
+    ){
+      pBatch->isFull = 1;
+      break;
+    }
+    if( pBatch->nOp==pBatch->nAlloc ){
+      int nNew = pBatch->nAlloc ? pBatch->nAlloc*2 : 64;
+      AsyncWrite **aNew;
+      aNew = sqlite3_realloc64(pBatch->aOp, 2*nNew*sizeof(AsyncWrite *));
+      if( !aNew ){
+        if( pBatch->nOp==0 ) return SQLITE_NOMEM;
+        pBatch->isFull = 1;
+        break;
+      }
+      pBatch->aOp = aNew;
+      pBatch->nAlloc = nNew;
+    }
+    pBatch->aOp[pBatch->nOp++] = p;
+    if( p->op==ASYNC_WRITE ){
+      pBatch->nByte += p->nByte;
+    }else{
+      pBatch->nSync++;
+      hasSync = 1;
+      if( !p->pFileData->bWal ){
+        pBatch->isFull = 1;
+        break;
+      }
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Populate the batch object, as asyncBatchFill() does. If the batch
+** contains a sync request and has room for more, wait for up to 
+** "batchwindow" microseconds for other threads to add to it first.
+*/
+static int asyncBatchCollect(AsyncBatch *pBatch){
+  sqlite3_int64 iEnd = 0;
+  int rc;
+  while( (rc = asyncBatchFill(pBatch))==SQLITE_OK ){
+    sqlite3_int64 iNow;
+    if( pBatch->isFull 
+     || pBatch->nSync==0 
+     || async.nBatchWindow<=0
+     || async.eHalt!=SQLITEASYNC_HALT_NEVER
+    ){
+      break;
+    }
+    iNow = async_time_us();
+    if( iEnd==0 ) iEnd = iNow + async.nBatchWindow;
+    if( iNow>=iEnd ) break;
+    async_cond_timedwait(ASYNC_COND_QUEUE, ASYNC_MUTEX_QUEUE, iEnd-iNow);
+  }
+  return rc;
+}
+
+/*
+** Process the batch of operations collected by asyncBatchCollect(), then
+** remove them from the write-op queue, wake up any threads waiting for
+** them and free them. The queue mutex is held when this function is 
+** called and when it returns, but is released while IO is performed if
+** every file in the batch has its own write handle. The IO performed is
+** counted in *pStats. SQLITE_OK is returned if successful, or the first
+** error encountered otherwise.
+*/
+static int asyncBatchRun(AsyncBatch *pBatch, AsyncStats *pStats){
+  sqlite3_vfs *pVfs = (sqlite3_vfs *)(async_vfs.pAppData);
+  AsyncWrite **aOp = pBatch->aOp;
+  AsyncWrite **aWrite = &pBatch->aOp[pBatch->nAlloc];
+  AsyncWrite *pLast = aOp[pBatch->nOp-1];
+  int nOp = pBatch->nOp;
+  int nWrite = 0;
+  int holdingMutex = 0;
+  int rc = SQLITE_OK;
+  int i, j;
+
+  assert( nOp>0 && async.pQueueFirst==aOp[0] );
+  for(i=0; i<nOp; i++){
+    if( aOp[i]->pFileData->pBaseWrite->pMethods==0 ) holdingMutex = 1;
+    if( aOp[i]->op==ASYNC_WRITE ) aWrite[nWrite++] = aOp[i];
+  }
+  if( !holdingMutex ){
+    async_mutex_leave(ASYNC_MUTEX_QUEUE);
+  }
+
+  /* Perform the writes. */
+  for(i=0; rc==SQLITE_OK && i<nWrite; i=j){
+    void *pKey = asyncFileKey(aWrite[i]->pFileData);
+    sqlite3_int64 iEnd = aWrite[i]->iOffset + aWrite[i]->nByte;
+    for(j=i+1; j<nWrite; j++){
+      if( asyncFileKey(aWrite[j]->pFileData)!=pKey 
+       || aWrite[j]->iOffset!=iEnd 
+      ){
+        break;
+      }
+      iEnd += aWrite[j]->nByte;
+    }
+    if( async.ioDelay>0 ){
+      pVfs->xSleep(pVfs, async.ioDelay*1000);
+    }
+    rc = asyncWriteRun(&aWrite[i], j-i, pStats);
+  }
+
+  /* Sync each file once. The result is stored in AsyncWrite.iOffset of each
+  ** sync request. If a write failed, the syncs are not attempted and each
+  ** request is given the error code from the write.  */
+  for(i=0; i<nOp; i++){
+    AsyncWrite *p = aOp[i];
+    void *pKey;
+    int flags;
+    if( p->op!=ASYNC_SYNC ) continue;
+    pKey = asyncFileKey(p->pFileData);
+    for(j=0; j<i; j++){
+      if( aOp[j]->op==ASYNC_SYNC && asyncFileKey(aOp[j]->pFileData)==pKey ){
+        break;
+      }
+    }
+    if( j<i ){
+      p->iOffset = aOp[j]->iOffset;
+      continue;
+    }
+    flags = p->nByte;
+    for(j=i+1; j<nOp; j++){
+      if( aOp[j]->op==ASYNC_SYNC && asyncFileKey(aOp[j]->pFileData)==pKey ){
+        flags = asyncSyncFlags(flags, aOp[j]->nByte);
+      }
+    }
+    if( rc==SQLITE_OK ){
+      ASYNC_TRACE(("SYNC %s\n", p->pFileData->zName));
+      if( async.ioDelay>0 ){
+        pVfs->xSleep(pVfs, async.ioDelay*1000);
+      }
+      p->iOffset = asyncSyncBase(asyncBaseFile(p->pFileData), flags, pStats);
+    }else{
+      p->iOffset = rc;
+    }
+  }
+
+  if( !holdingMutex ){
+    async_mutex_enter(ASYNC_MUTEX_QUEUE);
+  }
+  assert( async.pQueueFirst==aOp[0] );
+  async.pQueueFirst = pLast->pNext;
+  if( pLast==async.pQueueLast ){
+    async.pQueueLast = 0;
+  }
+  for(i=0; i<nOp; i++){
+    AsyncWrite *p = aOp[i];
+    asyncQueueRemoved(p);
+    if( p->op==ASYNC_SYNC && rc==SQLITE_OK ){
+      rc = (int)p->iOffset;
+    }
+    sqlite3_free(p);
+  }
+
+  if( pBatch->nSync>0 ){
+    for(i=0; i<ASYNC_NBATCHHIST-1 && pBatch->nSync>(1<<i); i++);
+    async.stats.aBatchHist[i]++;
+    async.stats.nBatch++;
+    async.stats.nCommit += pBatch->nSync;
+  }
+  return rc;
+}
+
 /* 
 ** This procedure runs in a separate thread, reading messages off of the
 ** write queue and processing them one by one.  
@@ -1334,6 +2042,11 @@ static sqlite3_vfs async_vfs = {
 **
 ** An artifical delay of async.ioDelay milliseconds is inserted before
 ** each write operation in order to simulate the effect of a slow disk.
+** In group-commit mode it is inserted before each write and sync call 
+** made to the parent VFS by asyncBatchRun() instead.
+**
+** If async.bGroupCommit is true, then write and sync operations are 
+** processed in batches as described under "GROUP COMMIT" above.
 **
 ** Only one instance of this procedure may be running at a time.
 */
@@ -1342,11 +2055,20 @@ static void asyncWriterThread(void){
   AsyncWrite *p = 0;
   int rc = SQLITE_OK;
   int holdingMutex = 0;
+  AsyncBatch batch;
+  AsyncStats stats;            /* IO not yet added to async.stats */
 
+  memset(&batch, 0, sizeof(batch));
+  memset(&stats, 0, sizeof(stats));
   async_mutex_enter(ASYNC_MUTEX_WRITER);
+  async_mutex_enter(ASYNC_MUTEX_QUEUE);
+  async.bWriterActive = 1;
+  async_mutex_leave(ASYNC_MUTEX_QUEUE);
 
   while( async.eHalt!=SQLITEASYNC_HALT_NOW ){
     int doNotFree = 0;
+    int bRanBatch = 0;
+    sqlite3_int64 iSeqOp;
     sqlite3_file *pBase = 0;
 
     if( !holdingMutex ){
@@ -1355,6 +2077,7 @@ static void asyncWriterThread(void){
     while( (p = async.pQueueFirst)==0 ){
       if( async.eHalt!=SQLITEASYNC_HALT_NEVER ){
         async_mutex_leave(ASYNC_MUTEX_QUEUE);
+        holdingMutex = 0;
         break;
       }else{
         ASYNC_TRACE(("IDLE\n"));
@@ -1364,6 +2087,18 @@ static void asyncWriterThread(void){
     }
     if( p==0 ) break;
     holdingMutex = 1;
+    iSeqOp = p->iSeq;
+
+    if( async.bGroupCommit 
+     && async.ioError==SQLITE_OK
+     && (p->op==ASYNC_WRITE || p->op==ASYNC_SYNC)
+     && asyncBatchCollect(&batch)==SQLITE_OK
+    ){
+      assert( batch.aOp[0]==p );
+      rc = asyncBatchRun(&batch, &stats);
+      bRanBatch = 1;
+      goto writer_op_done;
+    }
 
     /* Right now this thread is holding the mutex on the write-op queue.
     ** Variable 'p' points to the first entry in the write-op queue. In
@@ -1385,6 +2120,7 @@ static void asyncWriterThread(void){
     **       file-handles are open for the particular file being "synced".
     */
     if( async.ioError!=SQLITE_OK && p->op!=ASYNC_CLOSE ){
+      if( p->op==ASYNC_WRITE ) async.stats.nQueueByte -= p->nByte;
       p->op = ASYNC_NOOP;
     }
     if( p->pFileData ){
@@ -1411,12 +2147,15 @@ static void asyncWriterThread(void){
         ASYNC_TRACE(("WRITE %s %d bytes at %d\n",
                 p->pFileData->zName, p->nByte, p->iOffset));
         rc = pBase->pMethods->xWrite(pBase, (void *)(p->zBuf), p->nByte, p->iOffset);
+        stats.nWrite++;
+        stats.nWriteByte += p->nByte;
+        stats.nWriteCall++;
         break;
 
       case ASYNC_SYNC:
         assert( pBase );
         ASYNC_TRACE(("SYNC %s\n", p->pFileData->zName));
-        rc = pBase->pMethods->xSync(pBase, p->nByte);
+        rc = asyncSyncBase(pBase, p->nByte, &stats);
         break;
 
       case ASYNC_TRUNCATE:
@@ -1449,6 +2188,7 @@ static void asyncWriterThread(void){
           holdingMutex = 1;
         }
         assert_mutex_is_held(ASYNC_MUTEX_QUEUE);
+        asyncQueueRemoved(p);
         async.pQueueFirst = p->pNext;
         sqlite3_free(pData);
         doNotFree = 1;
@@ -1542,10 +2282,14 @@ static void asyncWriterThread(void){
     }
     if( !doNotFree ){
       assert_mutex_is_held(ASYNC_MUTEX_QUEUE);
+      asyncQueueRemoved(p);
       async.pQueueFirst = p->pNext;
       sqlite3_free(p);
     }
+
+writer_op_done:
     assert( holdingMutex );
+    asyncStatsPublish(&stats);
 
     /* An IO error has occurred. We cannot report the error back to the
     ** connection that requested the I/O since the error happened 
@@ -1564,8 +2308,15 @@ static void asyncWriterThread(void){
     ** multi-file transaction that included the database associated with 
     ** the IO error (i.e. a database ATTACHed to the same handle at some 
     ** point in time).
+    **
+    ** If the error occurred in a batch, every operation in the batch is
+    ** considered to have failed, as is every operation after it that is
+    ** discarded because of the error. async.iSeqError records where that
+    ** begins, so that asyncCommitWait() only reports the error to the
+    ** transactions it affected.
     */
     if( rc!=SQLITE_OK ){
+      if( async.ioError==SQLITE_OK ) async.iSeqError = iSeqOp;
       async.ioError = rc;
     }
 
@@ -1577,19 +2328,35 @@ static void asyncWriterThread(void){
       async_mutex_leave(ASYNC_MUTEX_LOCK);
     }
 
+    /* Wake up any threads waiting for a sync to complete or for space
+    ** on the queue.  */
+    if( async.nWaiter>0 ){
+      async_cond_broadcast(ASYNC_COND_DONE);
+    }
+
     /* Drop the queue mutex before continuing to the next write operation
     ** in order to give other threads a chance to work with the write queue.
     */
     if( !async.pQueueFirst || !async.ioError ){
       async_mutex_leave(ASYNC_MUTEX_QUEUE);
       holdingMutex = 0;
-      if( async.ioDelay>0 ){
+      if( async.ioDelay>0 && !bRanBatch ){
         pVfs->xSleep(pVfs, async.ioDelay*1000);
       }else{
         async_sched_yield();
       }
     }
   }
+
+  /* Threads blocked in asyncCommitWait() or asyncWrite() stop waiting once
+  ** they see that there is no writer thread.  */
+  if( !holdingMutex ){
+    async_mutex_enter(ASYNC_MUTEX_QUEUE);
+  }
+  async.bWriterActive = 0;
+  async_cond_broadcast(ASYNC_COND_DONE);
+  async_mutex_leave(ASYNC_MUTEX_QUEUE);
+  sqlite3_free(batch.aOp);
   
   async_mutex_leave(ASYNC_MUTEX_WRITER);
   return;
@@ -1678,6 +2445,59 @@ int sqlite3async_control(int op, ...){
       async_mutex_leave(ASYNC_MUTEX_QUEUE);
       break;
     }
+
+    case SQLITEASYNC_GROUPCOMMIT: {
+      int bGroup = va_arg(ap, int);
+      if( bGroup!=0 && bGroup!=1 ){
+        rc = SQLITE_MISUSE;
+        break;
+      }
+      async.bGroupCommit = bGroup;
+      break;
+    }
+
+    case SQLITEASYNC_BATCHWINDOW: {
+      int nUs = va_arg(ap, int);
+      if( nUs<0 ){
+        rc = SQLITE_MISUSE;
+        break;
+      }
+      async.nBatchWindow = nUs;
+      break;
+    }
+
+    case SQLITEASYNC_BATCHSIZE: {
+      int nSync = va_arg(ap, int);
+      if( nSync<1 ){
+        rc = SQLITE_MISUSE;
+        break;
+      }
+      async.nBatchSize = nSync;
+      break;
+    }
+
+    case SQLITEASYNC_BATCHBYTES: {
+      int nByte = va_arg(ap, int);
+      if( nByte<1 ){
+        rc = SQLITE_MISUSE;
+        break;
+      }
+      async.nBatchByte = nByte;
+      break;
+    }
+
+    case SQLITEASYNC_QUEUEBYTES: {
+      int nByte = va_arg(ap, int);
+      if( nByte<0 ){
+        rc = SQLITE_MISUSE;
+        break;
+      }
+      async_mutex_enter(ASYNC_MUTEX_QUEUE);
+      async.nQueueLimit = nByte;
+      async_cond_broadcast(ASYNC_COND_DONE);
+      async_mutex_leave(ASYNC_MUTEX_QUEUE);
+      break;
+    }
       
     case SQLITEASYNC_GET_HALT: {
       int *peWhen = va_arg(ap, int *);
@@ -1694,6 +2514,31 @@ int sqlite3async_control(int op, ...){
       *piDelay = async.bLockFiles;
       break;
     }
+    case SQLITEASYNC_GET_GROUPCOMMIT: {
+      int *pbGroup = va_arg(ap, int *);
+      *pbGroup = async.bGroupCommit;
+      break;
+    }
+    case SQLITEASYNC_GET_BATCHWINDOW: {
+      int *pnUs = va_arg(ap, int *);
+      *pnUs = async.nBatchWindow;
+      break;
+    }
+    case SQLITEASYNC_GET_BATCHSIZE: {
+      int *pnSync = va_arg(ap, int *);
+      *pnSync = async.nBatchSize;
+      break;
+    }
+    case SQLITEASYNC_GET_BATCHBYTES: {
+      int *pnByte = va_arg(ap, int *);
+      *pnByte = async.nBatchByte;
+      break;
+    }
+    case SQLITEASYNC_GET_QUEUEBYTES: {
+      int *pnByte = va_arg(ap, int *);
+      *pnByte = async.nQueueLimit;
+      break;
+    }
 
     default:
       rc = SQLITE_ERROR;
@@ -1703,5 +2548,192 @@ int sqlite3async_control(int op, ...){
   return rc;
 }
 
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+/*
+** The sqlite3async_stats eponymous virtual table. Each row is a (name, 
+** value) pair. The names, in order, are listed in azAsyncStat[]. The
+** values are copied out of async.stats by asyncStatsFilter().
+*/
+static const char *azAsyncStat[] = {
+  "queue_depth",
+  "queue_bytes",
+  "queue_depth_max",
+  "writes",
+  "bytes_written",
+  "write_calls",
+  "fsyncs",
+  "fsync_us_total",
+  "fsync_us_max",
+  "fsync_us<=100",
+  "fsync_us<=1000",
+  "fsync_us<=10000",
+  "fsync_us<=100000",
+  "fsync_us>100000",
+  "batches",
+  "commits",
+  "batch_size<=1",
+  "batch_size<=2",
+  "batch_size<=4",
+  "batch_size<=8",
+  "batch_size<=16",
+  "batch_size<=32",
+  "batch_size<=64",
+  "batch_size>64",
+};
+#define ASYNC_NSTAT (int)(sizeof(azAsyncStat)/sizeof(azAsyncStat[0]))
+
+typedef struct AsyncStatsCursor AsyncStatsCursor;
+struct AsyncStatsCursor {
+  sqlite3_vtab_cursor base;    /* Base class.  Must be first */
+  int iRow;                    /* Current row, an index into azAsyncStat[] */
+  sqlite3_int64 aValue[ASYNC_NSTAT];   /* Values, taken by xFilter */
+};
+
+static int asyncStatsConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  sqlite3_vtab *pNew;
+  int rc;
+  UNUSED_PARAMETER(pAux);
+  UNUSED_PARAMETER(argc);
+  UNUSED_PARAMETER(argv);
+  UNUSED_PARAMETER(pzErr);
+
+  rc = sqlite3_declare_vtab(db, "CREATE TABLE x(name TEXT, value INTEGER)");
+  if( rc==SQLITE_OK ){
+    pNew = *ppVtab = sqlite3_malloc(sizeof(*pNew));
+    if( pNew==0 ) return SQLITE_NOMEM;
+    memset(pNew, 0, sizeof(*pNew));
+  }
+  return rc;
+}
+static int asyncStatsDisconnect(sqlite3_vtab *pVtab){
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+static int asyncStatsOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
+  AsyncStatsCursor *pCur;
+  UNUSED_PARAMETER(p);
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if( pCur==0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+static int asyncStatsClose(sqlite3_vtab_cursor *cur){
+  sqlite3_free(cur);
+  return SQLITE_OK;
+}
+static int asyncStatsNext(sqlite3_vtab_cursor *cur){
+  ((AsyncStatsCursor *)cur)->iRow++;
+  return SQLITE_OK;
+}
+static int asyncStatsEof(sqlite3_vtab_cursor *cur){
+  return ((AsyncStatsCursor *)cur)->iRow>=ASYNC_NSTAT;
+}
+static int asyncStatsColumn(
+  sqlite3_vtab_cursor *cur,
+  sqlite3_context *ctx,
+  int i
+){
+  AsyncStatsCursor *pCur = (AsyncStatsCursor *)cur;
+  if( i==0 ){
+    sqlite3_result_text(ctx, azAsyncStat[pCur->iRow], -1, SQLITE_STATIC);
+  }else{
+    sqlite3_result_int64(ctx, pCur->aValue[pCur->iRow]);
+  }
+  return SQLITE_OK;
+}
+static int asyncStatsRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid){
+  *pRowid = ((AsyncStatsCursor *)cur)->iRow;
+  return SQLITE_OK;
+}
+
+/*
+** Take a snapshot of the statistics. The queue mutex is not used if the
+** VFS has not been initialized, as it may not exist yet (on win32).
+*/
+static int asyncStatsFilter(
+  sqlite3_vtab_cursor *cur, 
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  AsyncStatsCursor *pCur = (AsyncStatsCursor *)cur;
+  sqlite3_int64 *a = pCur->aValue;
+  int isInit = async_vfs.pAppData!=0;
+  int i;
+  UNUSED_PARAMETER(idxNum);
+  UNUSED_PARAMETER(idxStr);
+  UNUSED_PARAMETER(argc);
+  UNUSED_PARAMETER(argv);
+
+  if( isInit ) async_mutex_enter(ASYNC_MUTEX_QUEUE);
+  *a++ = async.stats.nQueue;
+  *a++ = async.stats.nQueueByte;
+  *a++ = async.stats.mxQueue;
+  *a++ = async.stats.nWrite;
+  *a++ = async.stats.nWriteByte;
+  *a++ = async.stats.nWriteCall;
+  *a++ = async.stats.nSync;
+  *a++ = async.stats.nSyncUs;
+  *a++ = async.stats.mxSyncUs;
+  for(i=0; i<ASYNC_NSYNCHIST; i++) *a++ = async.stats.aSyncHist[i];
+  *a++ = async.stats.nBatch;
+  *a++ = async.stats.nCommit;
+  for(i=0; i<ASYNC_NBATCHHIST; i++) *a++ = async.stats.aBatchHist[i];
+  if( isInit ) async_mutex_leave(ASYNC_MUTEX_QUEUE);
+  assert( a==&pCur->aValue[ASYNC_NSTAT] );
+
+  pCur->iRow = 0;
+  return SQLITE_OK;
+}
+static int asyncStatsBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdx){
+  UNUSED_PARAMETER(tab);
+  pIdx->estimatedCost = (double)ASYNC_NSTAT;
+  return SQLITE_OK;
+}
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+
+/*
+** Register the sqlite3async_stats virtual table with database handle db.
+*/
+int sqlite3async_stats_register(sqlite3 *db){
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+  static sqlite3_module async_stats_module = {
+    0,                         /* iVersion */
+    0,                         /* xCreate */
+    asyncStatsConnect,         /* xConnect */
+    asyncStatsBestIndex,       /* xBestIndex */
+    asyncStatsDisconnect,      /* xDisconnect */
+    0,                         /* xDestroy */
+    asyncStatsOpen,            /* xOpen */
+    asyncStatsClose,           /* xClose */
+    asyncStatsFilter,          /* xFilter */
+    asyncStatsNext,            /* xNext */
+    asyncStatsEof,             /* xEof */
+    asyncStatsColumn,          /* xColumn */
+    asyncStatsRowid,           /* xRowid */
+    0,                         /* xUpdate */
+    0,                         /* xBegin */
+    0,                         /* xSync */
+    0,                         /* xCommit */
+    0,                         /* xRollback */
+    0,                         /* xFindMethod */
+    0,                         /* xRename */
+    0,                         /* xSavepoint */
+    0,                         /* xRelease */
+    0,                         /* xRollbackTo */
+  };
+  return sqlite3_create_module(db, "sqlite3async_stats", &async_stats_module, 0);
+#else
+  UNUSED_PARAMETER(db);
+  return SQLITE_OK;
+#endif
+}
+
 #endif /* !defined(SQLITE_CORE) || defined(SQLITE_ENABLE_ASYNCIO) */
 
@@ -2,6 +2,8 @@
 #ifndef __SQLITEASYNC_H_
 #define __SQLITEASYNC_H_ 1
 
+#include "sqlite3.h"
+
 /*
 ** Make sure we can call this stuff from C++.
 */
@@ -100,7 +102,7 @@ void sqlite3async_run(void);
 ** This function may only be called when the asynchronous IO VFS is 
 ** installed (after a call to sqlite3async_initialize()). It is used 
 ** to query or configure various parameters that affect the operation 
-** of the asynchronous IO VFS. At present there are three parameters 
+** of the asynchronous IO VFS. At present there are eight parameters 
 ** supported:
 **
 **   * The "halt" parameter, which configures the circumstances under
@@ -115,13 +117,27 @@ void sqlite3async_run(void);
 **     not the asynchronous IO VFS locks the database files it operates
 **     on. Disabling file locking can improve throughput.
 **
+**   * The "groupcommit" parameter, which enables group-commit mode. In
+**     this mode queued writes are processed in batches and COMMIT 
+**     blocks until the transaction is on disk.
+**
+**   * The "batchwindow", "batchsize" and "batchbytes" parameters, which
+**     limit how long the writer waits to grow a batch and how large a
+**     batch may become in group-commit mode.
+**
+**   * The "queuebytes" parameter, which limits the amount of write data
+**     that may be queued before writers block.
+**
 ** This function is always passed two arguments. When setting the value
 ** of a parameter, the first argument must be one of SQLITEASYNC_HALT,
-** SQLITEASYNC_DELAY or SQLITEASYNC_LOCKFILES. The second argument must
-** be passed the new value for the parameter as type "int".
+** SQLITEASYNC_DELAY, SQLITEASYNC_LOCKFILES, SQLITEASYNC_GROUPCOMMIT,
+** SQLITEASYNC_BATCHWINDOW, SQLITEASYNC_BATCHSIZE, SQLITEASYNC_BATCHBYTES
+** or SQLITEASYNC_QUEUEBYTES. The second argument must be passed the new 
+** value for the parameter as type "int".
 **
 ** When querying the current value of a paramter, the first argument must
-** be one of SQLITEASYNC_GET_HALT, GET_DELAY or GET_LOCKFILES. The second 
+** be the corresponding SQLITEASYNC_GET_XXX symbol (e.g. GET_HALT, GET_DELAY
+** or GET_LOCKFILES). The second 
 ** argument to this function must be of type (int *). The current value
 ** of the queried parameter is copied to the memory pointed to by the
 ** second argument. For example:
@@ -195,6 +211,71 @@ void sqlite3async_run(void);
 **   Alternatively, if this parameter is set to 1, then it is safe to access
 **   the database from multiple connections within multiple processes using
 **   either the asynchronous IO VFS or the parent VFS directly.
+**
+** SQLITEASYNC_GROUPCOMMIT:
+**
+**   This is used to set the value of the "groupcommit" parameter, which
+**   must be either 0 (the default) or 1. 
+**
+**   When it is set to 1, the thread running sqlite3async_run() removes 
+**   write and sync requests from the queue in batches. All writes in a 
+**   batch are issued first, with writes to adjacent regions of the same
+**   file merged into a single vectored write, then each file with a sync
+**   request in the batch is synced exactly once.
+**
+**   Also, a COMMIT does not return until the transaction has been written
+**   and synced by the writer thread, and returns an error if that fails.
+**   The wait happens after the transaction has released its write lock 
+**   on the database, so other connections in the same process may commit
+**   their own transactions meanwhile. In WAL mode, this means that 
+**   transactions committed concurrently by connections in several threads
+**   share a single fsync(), and that a commit is durable once 
+**   sqlite3_step() returns. With PRAGMA synchronous=NORMAL, WAL commits
+**   are not synced, so COMMIT only waits until the transaction has been
+**   written to the WAL file. As without this VFS, it then survives the
+**   application crashing, but not the loss of power.
+**
+**   Sync requests on a WAL file may be merged with sync requests on the
+**   same file and with writes queued after them. A sync request on any 
+**   other kind of file (a database or rollback journal) always ends the 
+**   batch, so the ordering that rollback-journal commits depend on is 
+**   preserved.
+**
+**   If no thread is running sqlite3async_run() when a transaction is
+**   committed, COMMIT returns immediately as it does when group-commit
+**   mode is off.
+**
+**   The "delay" parameter applies to each write and sync call the writer
+**   thread makes to the parent VFS, after writes have been merged.
+**
+** SQLITEASYNC_BATCHWINDOW:
+**
+**   The number of microseconds the writer thread may wait, once a batch
+**   contains a sync request, for more transactions to join the batch
+**   before processing it. The default value is 0, which means the batch 
+**   consists of whatever was queued while the previous batch was being
+**   written. Setting this parameter to a negative value causes 
+**   sqlite3async_control() to return SQLITE_MISUSE.
+**
+** SQLITEASYNC_BATCHSIZE:
+**
+**   The maximum number of sync requests (transactions) in a single batch.
+**   The default value is 64. It must be at least 1.
+**
+** SQLITEASYNC_BATCHBYTES:
+**
+**   The maximum number of bytes of write data in a single batch. A batch
+**   always contains at least one request, so a single write larger than
+**   this is not split. The default value is 16MiB. It must be at least 1.
+**
+** SQLITEASYNC_QUEUEBYTES:
+**
+**   If set to a value greater than zero, xWrite() blocks while the write
+**   requests in the queue hold this many bytes of data or more, until the
+**   writer thread has caught up. Calls do not block if no thread is 
+**   running sqlite3async_run(). The default value is 0 (no limit).
+**   Setting this parameter to a negative value causes 
+**   sqlite3async_control() to return SQLITE_MISUSE.
 */
 int sqlite3async_control(int op, ...);
 
@@ -207,6 +288,16 @@ int sqlite3async_control(int op, ...);
 #define SQLITEASYNC_GET_DELAY     4
 #define SQLITEASYNC_LOCKFILES     5
 #define SQLITEASYNC_GET_LOCKFILES 6
+#define SQLITEASYNC_GROUPCOMMIT       7
+#define SQLITEASYNC_GET_GROUPCOMMIT   8
+#define SQLITEASYNC_BATCHWINDOW       9
+#define SQLITEASYNC_GET_BATCHWINDOW  10
+#define SQLITEASYNC_BATCHSIZE        11
+#define SQLITEASYNC_GET_BATCHSIZE    12
+#define SQLITEASYNC_BATCHBYTES       13
+#define SQLITEASYNC_GET_BATCHBYTES   14
+#define SQLITEASYNC_QUEUEBYTES       15
+#define SQLITEASYNC_GET_QUEUEBYTES   16
 
 /*
 ** If the first argument to sqlite3async_control() is SQLITEASYNC_HALT,
@@ -216,6 +307,33 @@ int sqlite3async_control(int op, ...);
 #define SQLITEASYNC_HALT_NOW   1       /* Halt as soon as possible */
 #define SQLITEASYNC_HALT_IDLE  2       /* Halt when write-queue is empty */
 
+/*
+** Register the eponymous virtual table "sqlite3async_stats" with database
+** handle db. The table reports the activity of the asynchronous IO VFS
+** since it was initialized as (name, value) rows:
+**
+**   queue_depth, queue_bytes   Requests and bytes of write data queued now.
+**   queue_depth_max            Largest value queue_depth has had.
+**   writes, bytes_written      Write requests processed, and their size.
+**   write_calls                Calls made to write to the parent VFS, after
+**                              adjacent writes have been merged.
+**   fsyncs                     Calls made to xSync() of the parent VFS.
+**   fsync_us_total/max         Total and longest time spent in xSync().
+**   fsync_us<=N, fsync_us>N    Histogram of xSync() latency.
+**   batches, commits           Batches containing sync requests processed
+**                              in group-commit mode, and the number of 
+**                              sync requests they contained.
+**   batch_size<=N, batch_size>N   Histogram of sync requests per batch.
+**
+** For example:
+**
+**   SELECT value FROM sqlite3async_stats WHERE name='fsyncs';
+**
+** SQLITE_OK is returned if successful, or an SQLite error code otherwise.
+** This function may be called before sqlite3async_initialize().
+*/
+int sqlite3async_stats_register(sqlite3 *db);
+
 #ifdef __cplusplus
 }  /* End of the 'extern "C"' block */
 #endif
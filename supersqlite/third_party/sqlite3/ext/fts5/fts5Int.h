@@ -21,6 +21,17 @@ SQLITE_EXTENSION_INIT1
 #include <string.h>
 #include <assert.h>
 
+/*
+** The multi-threaded 'rebuild' command requires a threadsafe build. If
+** SQLITE_THREADSAFE is not defined, assume the library default (threadsafe)
+** and rely on the sqlite3_threadsafe() check at runtime.
+*/
+#if !defined(SQLITE_THREADSAFE) || SQLITE_THREADSAFE>0
+# define FTS5_BULK_THREADS 1
+#else
+# define FTS5_BULK_THREADS 0
+#endif
+
 #ifndef SQLITE_AMALGAMATION
 
 typedef unsigned char  u8;
@@ -148,6 +159,11 @@ typedef struct Fts5Config Fts5Config;
 ** bColumnsize:
 **   True if the %_docsize table is created.
 **
+** azTokArg/nTokArg:
+**   The arguments passed to the tokenizer by the tokenize= option, with
+**   the tokenizer name in azTokArg[0]. Or NULL and 0 if the default 
+**   tokenizer is used. These are used by sqlite3Fts5ConfigNewTokenizer().
+**
 ** bPrefixIndex:
 **   This is only used for debugging. If set to false, any prefix indexes
 **   are ignored. This value is configured using:
@@ -157,6 +173,7 @@ typedef struct Fts5Config Fts5Config;
 */
 struct Fts5Config {
   sqlite3 *db;                    /* Database handle */
+  Fts5Global *pGlobal;            /* Global context (one per db handle) */
   char *zDb;                      /* Database holding FTS index (e.g. "main") */
   char *zName;                    /* Name of FTS index */
   int nCol;                       /* Number of columns */
@@ -172,6 +189,8 @@ struct Fts5Config {
   char *zContentExprlist;
   Fts5Tokenizer *pTok;
   fts5_tokenizer *pTokApi;
+  char **azTokArg;                /* tokenize= arguments (or NULL) */
+  int nTokArg;                    /* Number of entries in azTokArg[] */
 
   /* Values loaded from the %_config table */
   int iCookie;                    /* Incremented when %_config is modified */
@@ -219,6 +238,12 @@ int sqlite3Fts5Tokenize(
   int (*xToken)(void*, int, const char*, int, int, int)    /* Callback */
 );
 
+#if FTS5_BULK_THREADS
+int sqlite3Fts5ConfigNewTokenizer(
+  Fts5Config*, Fts5Tokenizer**, fts5_tokenizer**
+);
+#endif
+
 void sqlite3Fts5Dequote(char *z);
 
 /* Load the contents of the %_config table */
@@ -490,6 +515,32 @@ int sqlite3Fts5IndexReset(Fts5Index *p);
 
 int sqlite3Fts5IndexLoadConfig(Fts5Index *p);
 
+/*
+** Interface used to build level-0 segments on worker threads. 
+**
+** sqlite3Fts5IndexBulkOpen() allocates a "bulk" index object that is not
+** attached to the database. Documents are added to it using the usual
+** sqlite3Fts5IndexBeginWrite() and sqlite3Fts5IndexWrite() calls, but 
+** each time its in-memory hash table is flushed the segment is assembled 
+** in memory instead of being written to the %_data table. A bulk index
+** object may be used by any single thread, as it never uses the database 
+** handle.
+**
+** sqlite3Fts5IndexBulkFlush() assembles a segment from any data still in
+** the hash table. sqlite3Fts5IndexBulkTake() appends the segments 
+** assembled so far to buffer pBuf and removes them from the bulk index
+** object. And sqlite3Fts5IndexBulkWrite(), which must be called by the
+** thread that owns the database handle, writes segments collected by 
+** sqlite3Fts5IndexBulkTake() to the database as new level-0 segments of
+** index p.
+*/
+#if FTS5_BULK_THREADS
+int sqlite3Fts5IndexBulkOpen(Fts5Config*, Fts5Index**);
+int sqlite3Fts5IndexBulkFlush(Fts5Index *pBulk);
+int sqlite3Fts5IndexBulkTake(Fts5Index *pBulk, Fts5Buffer *pBuf);
+int sqlite3Fts5IndexBulkWrite(Fts5Index *p, const u8 *aSeg, int nSeg);
+#endif
+
 /*
 ** End of interface to code in fts5_index.c.
 **************************************************************************/
@@ -532,6 +583,10 @@ int sqlite3Fts5GetTokenizer(
   char **pzErr
 );
 
+#if FTS5_BULK_THREADS
+int sqlite3Fts5TokenizerIsBuiltin(Fts5Global*, const char **azArg, int nArg);
+#endif
+
 Fts5Index *sqlite3Fts5IndexFromCsrid(Fts5Global*, i64, Fts5Config **);
 
 /*
@@ -626,7 +681,7 @@ int sqlite3Fts5StorageConfigValue(
 );
 
 int sqlite3Fts5StorageDeleteAll(Fts5Storage *p);
-int sqlite3Fts5StorageRebuild(Fts5Storage *p);
+int sqlite3Fts5StorageRebuild(Fts5Storage *p, int nThread);
 int sqlite3Fts5StorageOptimize(Fts5Storage *p);
 int sqlite3Fts5StorageMerge(Fts5Storage *p, int nMerge);
 int sqlite3Fts5StorageReset(Fts5Storage *p);
@@ -296,11 +296,10 @@ static int fts5ConfigParseSpecial(
   if( sqlite3_strnicmp("tokenize", zCmd, nCmd)==0 ){
     const char *p = (const char*)zArg;
     int nArg = (int)strlen(zArg) + 1;
-    char **azArg = sqlite3Fts5MallocZero(&rc, sizeof(char*) * nArg);
-    char *pDel = sqlite3Fts5MallocZero(&rc, nArg * 2);
-    char *pSpace = pDel;
+    char **azArg = sqlite3Fts5MallocZero(&rc, (sizeof(char*) + 2) * nArg);
 
-    if( azArg && pSpace ){
+    if( azArg ){
+      char *pSpace = (char*)&azArg[nArg];
       if( pConfig->pTok ){
         *pzErr = sqlite3_mprintf("multiple tokenize=... directives");
         rc = SQLITE_ERROR;
@@ -328,12 +327,18 @@ static int fts5ConfigParseSpecial(
               (const char**)azArg, nArg, &pConfig->pTok, &pConfig->pTokApi,
               pzErr
           );
+          if( rc==SQLITE_OK ){
+            /* Keep the arguments so that sqlite3Fts5ConfigNewTokenizer()
+            ** can create more instances of the same tokenizer later on. */
+            pConfig->azTokArg = azArg;
+            pConfig->nTokArg = nArg;
+            azArg = 0;
+          }
         }
       }
     }
 
     sqlite3_free(azArg);
-    sqlite3_free(pDel);
     return rc;
   }
 
@@ -535,6 +540,7 @@ int sqlite3Fts5ConfigParse(
   if( pRet==0 ) return SQLITE_NOMEM;
   memset(pRet, 0, sizeof(Fts5Config));
   pRet->db = db;
+  pRet->pGlobal = pGlobal;
   pRet->iCookie = -1;
 
   nByte = nArg * (sizeof(char*) + sizeof(u8));
@@ -643,6 +649,7 @@ void sqlite3Fts5ConfigFree(Fts5Config *pConfig){
     if( pConfig->pTok ){
       pConfig->pTokApi->xDelete(pConfig->pTok);
     }
+    sqlite3_free(pConfig->azTokArg);
     sqlite3_free(pConfig->zDb);
     sqlite3_free(pConfig->zName);
     for(i=0; i<pConfig->nCol; i++){
@@ -723,6 +730,30 @@ int sqlite3Fts5Tokenize(
   );
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Allocate a new instance of the tokenizer used by the table, created with
+** the same arguments as Fts5Config.pTok. A tokenizer instance may only be
+** used by one thread at a time, so each thread that tokenizes documents
+** for a multi-threaded 'rebuild' uses its own. This is only done for the
+** built-in tokenizers (see sqlite3Fts5TokenizerIsBuiltin()).
+**
+** If successful, SQLITE_OK is returned and the new tokenizer and its 
+** methods are written to *ppTok and *ppTokApi. The caller must eventually
+** free the tokenizer using (*ppTokApi)->xDelete(). Otherwise, an SQLite
+** error code is returned and both output variables are set to NULL.
+*/
+int sqlite3Fts5ConfigNewTokenizer(
+  Fts5Config *pConfig,
+  Fts5Tokenizer **ppTok,
+  fts5_tokenizer **ppTokApi
+){
+  return sqlite3Fts5GetTokenizer(pConfig->pGlobal, 
+      (const char**)pConfig->azTokArg, pConfig->nTokArg, ppTok, ppTokApi, 0
+  );
+}
+#endif /* FTS5_BULK_THREADS */
+
 /*
 ** Argument pIn points to the first character in what is expected to be
 ** a comma-separated list of SQL literals followed by a ')' character.
@@ -308,6 +308,10 @@ struct Fts5Index {
   sqlite3_stmt *pDataVersion;
   i64 iStructVersion;             /* data_version when pStruct read */
   Fts5Structure *pStruct;         /* Current db structure (or NULL) */
+
+  /* Used by bulk index objects only. See sqlite3Fts5IndexBulkOpen(). */
+  int bBulk;                      /* True for a bulk index object */
+  Fts5Buffer bulk;                /* Segments assembled in memory */
 };
 
 struct Fts5DoclistIter {
@@ -738,13 +742,78 @@ static int fts5IndexPrepareStmt(
   return p->rc;
 }
 
+/*
+** Prepare the "INSERT INTO %_idx" statement used by segment writers.
+*/
+static void fts5IndexPrepareIdxWriter(Fts5Index *p){
+  Fts5Config *pConfig = p->pConfig;
+  fts5IndexPrepareStmt(p, &p->pIdxWriter, sqlite3_mprintf(
+        "INSERT INTO '%q'.'%q_idx'(segid,term,pgno) VALUES(?,?,?)", 
+        pConfig->zDb, pConfig->zName
+  ));
+}
+
+/*
+** A bulk index object (see sqlite3Fts5IndexBulkOpen()) assembles segments
+** in buffer Fts5Index.bulk instead of writing them to the database. Each
+** segment is stored as a series of records, each of which begins with one
+** of the following type bytes:
+**
+**   FTS5_BULK_DATA:
+**     A %_data record. Followed by the rowid the record would have if the
+**     segment id were 0, the size of the record in bytes and the record
+**     itself.
+**
+**   FTS5_BULK_IDX:
+**     A %_idx record. Followed by the value of the pgno column, the size 
+**     of the term in bytes and the term itself.
+**
+**   FTS5_BULK_END:
+**     The end of the segment. Followed by the number of leaf pages in the
+**     segment.
+**
+** All integers are stored as varints.
+*/
+#define FTS5_BULK_DATA 1
+#define FTS5_BULK_IDX  2
+#define FTS5_BULK_END  3
 
 /*
-** INSERT OR REPLACE a record into the %_data table.
+** Append a record of type eType to the Fts5Index.bulk buffer. The blob
+** argument is ignored for FTS5_BULK_END records.
+*/
+static void fts5BulkAppend(
+  Fts5Index *p, 
+  int eType,                      /* FTS5_BULK_XXX constant */
+  i64 iVal,                       /* Rowid, pgno value or leaf page count */
+  const u8 *a, int n              /* Record data or term */
+){
+  assert( p->bBulk );
+  if( fts5BufferGrow(&p->rc, &p->bulk, 1 + 9 + 9 + n)==0 ){
+    p->bulk.p[p->bulk.n++] = (u8)eType;
+    p->bulk.n += sqlite3Fts5PutVarint(&p->bulk.p[p->bulk.n], (u64)iVal);
+    if( eType!=FTS5_BULK_END ){
+      p->bulk.n += sqlite3Fts5PutVarint(&p->bulk.p[p->bulk.n], (u64)n);
+      if( n>0 ){
+        memcpy(&p->bulk.p[p->bulk.n], a, n);
+        p->bulk.n += n;
+      }
+    }
+  }
+}
+
+/*
+** INSERT OR REPLACE a record into the %_data table. Or, for a bulk index
+** object, append it to the segment being assembled in memory.
 */
 static void fts5DataWrite(Fts5Index *p, i64 iRowid, const u8 *pData, int nData){
   if( p->rc!=SQLITE_OK ) return;
 
+  if( p->bBulk ){
+    fts5BulkAppend(p, FTS5_BULK_DATA, iRowid, pData, nData);
+    return;
+  }
+
   if( p->pWriter==0 ){
     Fts5Config *pConfig = p->pConfig;
     fts5IndexPrepareStmt(p, &p->pWriter, sqlite3_mprintf(
@@ -3719,7 +3788,11 @@ static void fts5WriteFlushBtree(Fts5Index *p, Fts5SegWriter *pWriter){
   if( pWriter->iBtPage==0 ) return;
   bFlag = fts5WriteFlushDlidx(p, pWriter);
 
-  if( p->rc==SQLITE_OK ){
+  if( p->rc==SQLITE_OK && p->bBulk ){
+    fts5BulkAppend(p, FTS5_BULK_IDX, bFlag + ((i64)pWriter->iBtPage<<1), 
+        pWriter->btterm.p, pWriter->btterm.n
+    );
+  }else if( p->rc==SQLITE_OK ){
     const char *z = (pWriter->btterm.n>0?(const char*)pWriter->btterm.p:"");
     /* The following was already done in fts5WriteInit(): */
     /* sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid); */
@@ -4086,12 +4159,8 @@ static void fts5WriteInit(
   sqlite3Fts5BufferSize(&p->rc, &pWriter->writer.pgidx, nBuffer);
   sqlite3Fts5BufferSize(&p->rc, &pWriter->writer.buf, nBuffer);
 
-  if( p->pIdxWriter==0 ){
-    Fts5Config *pConfig = p->pConfig;
-    fts5IndexPrepareStmt(p, &p->pIdxWriter, sqlite3_mprintf(
-          "INSERT INTO '%q'.'%q_idx'(segid,term,pgno) VALUES(?,?,?)", 
-          pConfig->zDb, pConfig->zName
-    ));
+  if( p->pIdxWriter==0 && p->bBulk==0 ){
+    fts5IndexPrepareIdxWriter(p);
   }
 
   if( p->rc==SQLITE_OK ){
@@ -4102,7 +4171,9 @@ static void fts5WriteInit(
     /* Bind the current output segment id to the index-writer. This is an
     ** optimization over binding the same value over and over as rows are
     ** inserted into %_idx by the current writer.  */
-    sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid);
+    if( p->bBulk==0 ){
+      sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid);
+    }
   }
 }
 
@@ -4459,28 +4530,22 @@ static int fts5PoslistPrefix(const u8 *aBuf, int nMax){
 }
 
 /*
-** Flush the contents of in-memory hash table iHash to a new level-0 
-** segment on disk. Also update the corresponding structure record.
+** Write the contents of in-memory hash table pHash to segment iSegid and
+** clear the hash table. Set *ppgnoLast to the last leaf page number in the
+** new segment.
 **
 ** If an error occurs, set the Fts5Index.rc error code. If an error has 
 ** already occurred, this function is a no-op.
 */
-static void fts5FlushOneHash(Fts5Index *p){
-  Fts5Hash *pHash = p->pHash;
-  Fts5Structure *pStruct;
-  int iSegid;
-  int pgnoLast = 0;                 /* Last leaf page number in segment */
-
-  /* Obtain a reference to the index structure and allocate a new segment-id
-  ** for the new level-0 segment.  */
-  pStruct = fts5StructureRead(p);
-  iSegid = fts5AllocateSegid(p, pStruct);
-  fts5StructureInvalidate(p);
-
-  if( iSegid ){
+static void fts5WriteHash(
+  Fts5Index *p,                   /* FTS5 backend object */
+  Fts5Hash *pHash,                /* Hash table to write */
+  int iSegid,                     /* Segment id to write to */
+  int *ppgnoLast                  /* OUT: Last leaf page number */
+){
+  if( p->rc==SQLITE_OK ){
     const int pgsz = p->pConfig->pgsz;
     int eDetail = p->pConfig->eDetail;
-    Fts5StructureSegment *pSeg;   /* New segment within pStruct */
     Fts5Buffer *pBuf;             /* Buffer in which to assemble leaf page */
     Fts5Buffer *pPgidx;           /* Buffer in which to assemble pgidx */
 
@@ -4590,7 +4655,27 @@ static void fts5FlushOneHash(Fts5Index *p){
       sqlite3Fts5HashScanNext(pHash);
     }
     sqlite3Fts5HashClear(pHash);
-    fts5WriteFinish(p, &writer, &pgnoLast);
+    fts5WriteFinish(p, &writer, ppgnoLast);
+  }
+}
+
+/*
+** Level-0 segment iSegid, which has pgnoLast leaf pages, has just been 
+** written to the database. Add it to structure pStruct, perform any 
+** automerge or crisis-merge work required, then write the structure back
+** to the database and release the reference to it.
+**
+** If iSegid is 0, no segment is added, but the structure is still written
+** back and released.
+*/
+static void fts5IndexAppendSegment(
+  Fts5Index *p,                   /* FTS5 backend object */
+  Fts5Structure *pStruct,         /* Structure of index */
+  int iSegid,                     /* New level-0 segment (or 0) */
+  int pgnoLast                    /* Last leaf page number in segment */
+){
+  if( iSegid ){
+    Fts5StructureSegment *pSeg;   /* New segment within pStruct */
 
     /* Update the Fts5Structure. It is written back to the database by the
     ** fts5StructureRelease() call below.  */
@@ -4614,6 +4699,41 @@ static void fts5FlushOneHash(Fts5Index *p){
   fts5StructureRelease(pStruct);
 }
 
+/*
+** Flush the contents of in-memory hash table iHash to a new level-0 
+** segment on disk. Also update the corresponding structure record.
+**
+** If an error occurs, set the Fts5Index.rc error code. If an error has 
+** already occurred, this function is a no-op.
+*/
+static void fts5FlushOneHash(Fts5Index *p){
+  Fts5Structure *pStruct;
+  int iSegid;
+  int pgnoLast = 0;                 /* Last leaf page number in segment */
+
+  /* Obtain a reference to the index structure and allocate a new segment-id
+  ** for the new level-0 segment.  */
+  pStruct = fts5StructureRead(p);
+  iSegid = fts5AllocateSegid(p, pStruct);
+  fts5StructureInvalidate(p);
+
+  if( iSegid ){
+    fts5WriteHash(p, p->pHash, iSegid, &pgnoLast);
+  }
+  fts5IndexAppendSegment(p, pStruct, iSegid, pgnoLast);
+}
+
+/*
+** Flush the contents of the in-memory hash table of bulk index object p
+** to a new segment assembled in the Fts5Index.bulk buffer.
+*/
+static void fts5BulkFlushHash(Fts5Index *p){
+  int pgnoLast = 0;
+  assert( p->bBulk );
+  fts5WriteHash(p, p->pHash, 0, &pgnoLast);
+  fts5BulkAppend(p, FTS5_BULK_END, pgnoLast, 0, 0);
+}
+
 /*
 ** Flush any data stored in the in-memory hash tables to the database.
 */
@@ -4622,7 +4742,11 @@ static void fts5IndexFlush(Fts5Index *p){
   if( p->nPendingData ){
     assert( p->pHash );
     p->nPendingData = 0;
-    fts5FlushOneHash(p);
+    if( p->bBulk ){
+      fts5BulkFlushHash(p);
+    }else{
+      fts5FlushOneHash(p);
+    }
   }
 }
 
@@ -5240,12 +5364,118 @@ int sqlite3Fts5IndexClose(Fts5Index *p){
     sqlite3_finalize(p->pIdxSelect);
     sqlite3_finalize(p->pDataVersion);
     sqlite3Fts5HashFree(p->pHash);
+    sqlite3Fts5BufferFree(&p->bulk);
     sqlite3_free(p->zDataTbl);
     sqlite3_free(p);
   }
   return rc;
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Open a new bulk index object. It is closed using sqlite3Fts5IndexClose().
+**
+** If successful, set *pp to point to the new object and return SQLITE_OK.
+** Otherwise, set *pp to NULL and return an SQLite error code.
+*/
+int sqlite3Fts5IndexBulkOpen(Fts5Config *pConfig, Fts5Index **pp){
+  int rc = SQLITE_OK;
+  Fts5Index *p;
+
+  *pp = p = (Fts5Index*)sqlite3Fts5MallocZero(&rc, sizeof(Fts5Index));
+  if( rc==SQLITE_OK ){
+    p->pConfig = pConfig;
+    p->nWorkUnit = FTS5_WORK_UNIT;
+    p->bBulk = 1;
+  }
+  return rc;
+}
+
+/*
+** Assemble a segment from any data in the hash table of bulk index p.
+*/
+int sqlite3Fts5IndexBulkFlush(Fts5Index *p){
+  assert( p->bBulk );
+  fts5IndexFlush(p);
+  return fts5IndexReturn(p);
+}
+
+/*
+** Append the segments assembled by bulk index p to buffer pBuf, and remove
+** them from p.
+*/
+int sqlite3Fts5IndexBulkTake(Fts5Index *p, Fts5Buffer *pBuf){
+  int rc = SQLITE_OK;
+  assert( p->bBulk );
+  if( pBuf->n==0 ){
+    Fts5Buffer tmp = *pBuf;
+    *pBuf = p->bulk;
+    p->bulk = tmp;
+  }else{
+    sqlite3Fts5BufferAppendBlob(&rc, pBuf, p->bulk.n, p->bulk.p);
+    p->bulk.n = 0;
+  }
+  return rc;
+}
+
+/*
+** Buffer aSeg[], which is nSeg bytes in size, contains one or more 
+** segments assembled by bulk index objects. Write them to the database as
+** new level-0 segments of index p, performing any automerge or crisis-merge
+** work the new segments require as they are added.
+*/
+int sqlite3Fts5IndexBulkWrite(Fts5Index *p, const u8 *aSeg, int nSeg){
+  Fts5Structure *pStruct = 0;     /* Structure, while writing a segment */
+  int iSegid = 0;                 /* Id of segment being written */
+  i64 iBase = 0;                  /* Rowid of page 0 of segment iSegid */
+  int i = 0;                      /* Offset of next record in aSeg[] */
+
+  assert( p->bBulk==0 && p->rc==SQLITE_OK );
+  while( p->rc==SQLITE_OK && i<nSeg ){
+    int eType = aSeg[i++];
+    u64 iVal;
+
+    i += fts5GetVarint(&aSeg[i], &iVal);
+    if( pStruct==0 ){
+      /* This is the first record of a segment. Allocate a segment id. */
+      pStruct = fts5StructureRead(p);
+      iSegid = fts5AllocateSegid(p, pStruct);
+      fts5StructureInvalidate(p);
+      iBase = FTS5_SEGMENT_ROWID(iSegid, 0);
+    }
+
+    if( eType==FTS5_BULK_END ){
+      fts5IndexAppendSegment(p, pStruct, iSegid, (int)iVal);
+      pStruct = 0;
+    }else{
+      int n;
+      i += fts5GetVarint32(&aSeg[i], n);
+      if( eType==FTS5_BULK_DATA ){
+        fts5DataWrite(p, iBase + (i64)iVal, &aSeg[i], n);
+      }else{
+        assert( eType==FTS5_BULK_IDX );
+        if( p->pIdxWriter==0 ){
+          fts5IndexPrepareIdxWriter(p);
+        }
+        if( p->rc==SQLITE_OK ){
+          const char *z = (n>0 ? (const char*)&aSeg[i] : "");
+          sqlite3_bind_int(p->pIdxWriter, 1, iSegid);
+          sqlite3_bind_blob(p->pIdxWriter, 2, z, n, SQLITE_STATIC);
+          sqlite3_bind_int64(p->pIdxWriter, 3, (i64)iVal);
+          sqlite3_step(p->pIdxWriter);
+          p->rc = sqlite3_reset(p->pIdxWriter);
+          sqlite3_bind_null(p->pIdxWriter, 2);
+        }
+      }
+      i += n;
+    }
+  }
+
+  fts5StructureRelease(pStruct);
+  return fts5IndexReturn(p);
+}
+#endif /* FTS5_BULK_THREADS */
+
 /*
 ** Argument p points to a buffer containing utf-8 text that is n bytes in 
 ** size. Return the number of bytes in the nChar character prefix of the
@@ -108,6 +108,7 @@ struct Fts5TokenizerModule {
   fts5_tokenizer x;               /* Tokenizer functions */
   void (*xDestroy)(void*);        /* Destructor function */
   Fts5TokenizerModule *pNext;     /* Next registered tokenizer module */
+  int bBuiltin;                   /* True for the built-in tokenizers */
 };
 
 /*
@@ -1409,7 +1410,7 @@ static int fts5SpecialInsert(
       );
       rc = SQLITE_ERROR;
     }else{
-      rc = sqlite3Fts5StorageRebuild(pTab->pStorage);
+      rc = sqlite3Fts5StorageRebuild(pTab->pStorage, sqlite3_value_int(pVal));
     }
   }else if( 0==sqlite3_stricmp("optimize", zCmd) ){
     rc = sqlite3Fts5StorageOptimize(pTab->pStorage);
@@ -2599,6 +2600,34 @@ int sqlite3Fts5GetTokenizer(
   return rc;
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Return true if the tokenizer specified by azArg[] and nArg, as for
+** sqlite3Fts5GetTokenizer(), is a built-in tokenizer, and so is any 
+** tokenizer it wraps. Separate instances of these may be used by separate
+** threads at once. Nothing is known about application tokenizers, so a
+** multi-threaded 'rebuild' only uses them from the calling thread.
+*/
+int sqlite3Fts5TokenizerIsBuiltin(
+  Fts5Global *pGlobal, 
+  const char **azArg, 
+  int nArg
+){
+  const char *zName = (nArg>0 ? azArg[0] : 0);
+  while( 1 ){
+    Fts5TokenizerModule *pMod = fts5LocateTokenizer(pGlobal, zName);
+    if( pMod==0 || pMod->bBuiltin==0 ) return 0;
+    if( zName==0 || sqlite3_stricmp(zName, "porter") ) return 1;
+
+    /* The porter tokenizer wraps the tokenizer named by its first 
+    ** argument, or "unicode61" if there is none. */
+    azArg++;
+    nArg--;
+    zName = (nArg>0 ? azArg[0] : "unicode61");
+  }
+}
+#endif
+
 static void fts5ModuleDestroy(void *pCtx){
   Fts5TokenizerModule *pTok, *pNextTok;
   Fts5Auxiliary *pAux, *pNextAux;
@@ -2690,7 +2719,11 @@ static int fts5Init(sqlite3 *db){
     if( rc==SQLITE_OK ) rc = sqlite3Fts5IndexInit(db);
     if( rc==SQLITE_OK ) rc = sqlite3Fts5ExprInit(pGlobal, db);
     if( rc==SQLITE_OK ) rc = sqlite3Fts5AuxInit(&pGlobal->api);
-    if( rc==SQLITE_OK ) rc = sqlite3Fts5TokenizerInit(&pGlobal->api);
+    if( rc==SQLITE_OK ){
+      Fts5TokenizerModule *pMod;
+      rc = sqlite3Fts5TokenizerInit(&pGlobal->api);
+      for(pMod=pGlobal->pTok; pMod; pMod=pMod->pNext) pMod->bBuiltin = 1;
+    }
     if( rc==SQLITE_OK ) rc = sqlite3Fts5VocabInit(pGlobal, db);
     if( rc==SQLITE_OK ){
       rc = sqlite3_create_function(
@@ -16,6 +16,14 @@
 
 #include "fts5Int.h"
 
+#if FTS5_BULK_THREADS
+# if defined(_WIN32)
+#  include <windows.h>
+# else
+#  include <pthread.h>
+# endif
+#endif
+
 struct Fts5Storage {
   Fts5Config *pConfig;
   Fts5Index *pIndex;
@@ -355,7 +363,7 @@ int sqlite3Fts5StorageClose(Fts5Storage *p){
 
 typedef struct Fts5InsertCtx Fts5InsertCtx;
 struct Fts5InsertCtx {
-  Fts5Storage *pStorage;
+  Fts5Index *pIdx;                /* Index to write tokens to */
   int iCol;
   int szCol;                      /* Size of column value in tokens */
 };
@@ -372,7 +380,7 @@ static int fts5StorageInsertCallback(
   int iUnused2                    /* End offset of token */
 ){
   Fts5InsertCtx *pCtx = (Fts5InsertCtx*)pContext;
-  Fts5Index *pIdx = pCtx->pStorage->pIndex;
+  Fts5Index *pIdx = pCtx->pIdx;
   UNUSED_PARAM2(iUnused1, iUnused2);
   if( nToken>FTS5_MAX_TOKEN_SIZE ) nToken = FTS5_MAX_TOKEN_SIZE;
   if( (tflags & FTS5_TOKEN_COLOCATED)==0 || pCtx->szCol==0 ){
@@ -407,7 +415,7 @@ static int fts5StorageDeleteFromIndex(
     }
   }
 
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   ctx.iCol = -1;
   rc = sqlite3Fts5IndexBeginWrite(p->pIndex, 1, iDel);
   for(iCol=1; rc==SQLITE_OK && iCol<=pConfig->nCol; iCol++){
@@ -582,7 +590,417 @@ int sqlite3Fts5StorageDeleteAll(Fts5Storage *p){
   return rc;
 }
 
-int sqlite3Fts5StorageRebuild(Fts5Storage *p){
+#if FTS5_BULK_THREADS
+
+/* Maximum number of worker threads used by a multi-threaded rebuild */
+#define FTS5_BULK_MAX_THREAD 64
+
+/* Bytes of document text handed to each worker per round */
+#define FTS5_BULK_BATCH (1024*1024)
+
+/*
+** One worker of a multi-threaded rebuild. Each worker owns a tokenizer
+** instance and a bulk Fts5Index object (see sqlite3Fts5IndexBulkOpen()), so
+** that workers share nothing but the (read-only) Fts5Config object and the
+** Fts5BulkPool used to hand them work.
+**
+** Documents are processed in rounds. Both aDoc[] and aSize[] are double
+** buffered: while a worker tokenizes aDoc[iBuf] and writes the corresponding
+** %_docsize records to aSize[iBuf], the connection thread writes out the
+** aSize[!iBuf] records from the previous round and reads the next round of
+** documents into aDoc[!iBuf].
+**
+** Each entry in aDoc[] is a varint rowid followed by, for each indexed
+** column, a varint byte count and the column text. Each entry in aSize[]
+** is a varint rowid, a varint byte count and a %_docsize blob.
+*/
+typedef struct Fts5BulkPool Fts5BulkPool;
+typedef struct Fts5BulkWorker Fts5BulkWorker;
+struct Fts5BulkWorker {
+  Fts5Config *pConfig;
+  Fts5BulkPool *pPool;            /* Pool this worker's thread belongs to */
+  Fts5Index *pIdx;                /* Bulk index object */
+  Fts5Tokenizer *pTok;            /* Private tokenizer instance */
+  fts5_tokenizer *pTokApi;
+  Fts5Buffer aDoc[2];             /* Documents to tokenize */
+  Fts5Buffer aSize[2];            /* %_docsize records to write */
+  Fts5Buffer sz;                  /* Used to build up a %_docsize blob */
+  int iBuf;                       /* Index of aDoc[] and aSize[] to use */
+  int bFlush;                     /* Flush pending data after this round */
+  int rc;                         /* Error code from this round */
+  i64 nRow;                       /* Rows processed so far */
+  i64 *aTotalSize;                /* Total tokens in each column so far */
+};
+
+/*
+** Tokenize the documents in pW->aDoc[pW->iBuf] into the worker's index. If
+** pW->bFlush is set, write all pending data to the bulk buffer afterwards.
+*/
+static void fts5BulkWorkerRun(Fts5BulkWorker *pW){
+  Fts5Config *pConfig = pW->pConfig;
+  Fts5Buffer *pDoc = &pW->aDoc[pW->iBuf];
+  Fts5Buffer *pSize = &pW->aSize[pW->iBuf];
+  Fts5InsertCtx ctx;
+  int i = 0;
+  int rc = SQLITE_OK;
+
+  ctx.pIdx = pW->pIdx;
+  pSize->n = 0;
+  while( rc==SQLITE_OK && i<pDoc->n ){
+    i64 iRowid;
+    i += fts5GetVarint(&pDoc->p[i], (u64*)&iRowid);
+    rc = sqlite3Fts5IndexBeginWrite(pW->pIdx, 0, iRowid);
+    pW->sz.n = 0;
+    for(ctx.iCol=0; rc==SQLITE_OK && ctx.iCol<pConfig->nCol; ctx.iCol++){
+      ctx.szCol = 0;
+      if( pConfig->abUnindexed[ctx.iCol]==0 ){
+        int nText;
+        i += fts5GetVarint32(&pDoc->p[i], nText);
+        rc = pW->pTokApi->xTokenize(pW->pTok, (void*)&ctx, 
+            FTS5_TOKENIZE_DOCUMENT, (const char*)&pDoc->p[i], nText,
+            fts5StorageInsertCallback
+        );
+        i += nText;
+      }
+      sqlite3Fts5BufferAppendVarint(&rc, &pW->sz, ctx.szCol);
+      pW->aTotalSize[ctx.iCol] += (i64)ctx.szCol;
+    }
+    pW->nRow++;
+    sqlite3Fts5BufferAppendVarint(&rc, pSize, iRowid);
+    sqlite3Fts5BufferAppendVarint(&rc, pSize, pW->sz.n);
+    sqlite3Fts5BufferAppendBlob(&rc, pSize, pW->sz.n, pW->sz.p);
+  }
+
+  if( rc==SQLITE_OK && pW->bFlush ){
+    rc = sqlite3Fts5IndexBulkFlush(pW->pIdx);
+  }
+  pW->rc = rc;
+}
+
+#if defined(_WIN32)
+typedef HANDLE Fts5Thread;
+typedef CRITICAL_SECTION Fts5Mutex;
+typedef CONDITION_VARIABLE Fts5Cond;
+# define fts5MutexInit(p)      InitializeCriticalSection(p)
+# define fts5MutexFree(p)      DeleteCriticalSection(p)
+# define fts5MutexEnter(p)     EnterCriticalSection(p)
+# define fts5MutexLeave(p)     LeaveCriticalSection(p)
+# define fts5CondInit(p)       InitializeConditionVariable(p)
+# define fts5CondFree(p)
+# define fts5CondWait(p, pMut) SleepConditionVariableCS(p, pMut, INFINITE)
+# define fts5CondBroadcast(p)  WakeAllConditionVariable(p)
+#else
+typedef pthread_t Fts5Thread;
+typedef pthread_mutex_t Fts5Mutex;
+typedef pthread_cond_t Fts5Cond;
+# define fts5MutexInit(p)      pthread_mutex_init(p, 0)
+# define fts5MutexFree(p)      pthread_mutex_destroy(p)
+# define fts5MutexEnter(p)     pthread_mutex_lock(p)
+# define fts5MutexLeave(p)     pthread_mutex_unlock(p)
+# define fts5CondInit(p)       pthread_cond_init(p, 0)
+# define fts5CondFree(p)       pthread_cond_destroy(p)
+# define fts5CondWait(p, pMut) pthread_cond_wait(p, pMut)
+# define fts5CondBroadcast(p)  pthread_cond_broadcast(p)
+#endif
+
+/*
+** The worker threads of a multi-threaded rebuild are started once and
+** then wait on condWork for each round. The connection thread increments
+** iRound to start a round, and waits on condDone until nBusy, the number
+** of threads still working on the round, drops to zero. Setting bExit
+** tells the threads to exit once there are no more rounds.
+*/
+struct Fts5BulkPool {
+  Fts5Mutex mutex;
+  Fts5Cond condWork;
+  Fts5Cond condDone;
+  int iRound;                     /* Number of rounds started */
+  int nBusy;                      /* Threads that have not finished iRound */
+  int bExit;                      /* True once all rounds have been run */
+};
+
+/*
+** The body of a worker thread. Run fts5BulkWorkerRun() once for each round
+** started by fts5BulkPoolRound() until the pool is shut down.
+*/
+static void fts5BulkWorkerLoop(Fts5BulkWorker *pW){
+  Fts5BulkPool *pPool = pW->pPool;
+  int iRound = 0;
+
+  fts5MutexEnter(&pPool->mutex);
+  while( 1 ){
+    while( pPool->iRound==iRound && pPool->bExit==0 ){
+      fts5CondWait(&pPool->condWork, &pPool->mutex);
+    }
+    if( pPool->iRound==iRound ) break;
+    iRound = pPool->iRound;
+    fts5MutexLeave(&pPool->mutex);
+    fts5BulkWorkerRun(pW);
+    fts5MutexEnter(&pPool->mutex);
+    pPool->nBusy--;
+    if( pPool->nBusy==0 ) fts5CondBroadcast(&pPool->condDone);
+  }
+  fts5MutexLeave(&pPool->mutex);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI fts5BulkWorkerMain(LPVOID pArg){
+  fts5BulkWorkerLoop((Fts5BulkWorker*)pArg);
+  return 0;
+}
+static int fts5ThreadStart(Fts5Thread *pThread, Fts5BulkWorker *pW){
+  *pThread = CreateThread(0, 0, fts5BulkWorkerMain, (LPVOID)pW, 0, 0);
+  return *pThread==0;
+}
+static void fts5ThreadJoin(Fts5Thread thread){
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+#else
+static void *fts5BulkWorkerMain(void *pArg){
+  fts5BulkWorkerLoop((Fts5BulkWorker*)pArg);
+  return 0;
+}
+static int fts5ThreadStart(Fts5Thread *pThread, Fts5BulkWorker *pW){
+  return pthread_create(pThread, 0, fts5BulkWorkerMain, (void*)pW);
+}
+static void fts5ThreadJoin(Fts5Thread thread){
+  pthread_join(thread, 0);
+}
+#endif
+
+/*
+** Start a round on the nThread worker threads of pPool.
+*/
+static void fts5BulkPoolRound(Fts5BulkPool *pPool, int nThread){
+  fts5MutexEnter(&pPool->mutex);
+  pPool->iRound++;
+  pPool->nBusy = nThread;
+  fts5CondBroadcast(&pPool->condWork);
+  fts5MutexLeave(&pPool->mutex);
+}
+
+/*
+** Wait until the worker threads of pPool have finished the current round.
+*/
+static void fts5BulkPoolWait(Fts5BulkPool *pPool){
+  fts5MutexEnter(&pPool->mutex);
+  while( pPool->nBusy>0 ){
+    fts5CondWait(&pPool->condDone, &pPool->mutex);
+  }
+  fts5MutexLeave(&pPool->mutex);
+}
+
+/*
+** Read the next round of documents from pScan into the aDoc[iBuf] buffers
+** of the nWorker workers in aWorker[]. Set *pbEof if the scan is finished.
+*/
+static int fts5BulkRead(
+  Fts5Config *pConfig,
+  sqlite3_stmt *pScan,
+  Fts5BulkWorker *aWorker,
+  int nWorker,
+  int iBuf,
+  int *pbEof
+){
+  int rc = SQLITE_OK;
+  int i;
+
+  for(i=0; i<nWorker; i++) aWorker[i].aDoc[iBuf].n = 0;
+  for(i=0; rc==SQLITE_OK && i<nWorker; i++){
+    Fts5Buffer *pDoc = &aWorker[i].aDoc[iBuf];
+    while( rc==SQLITE_OK && pDoc->n<FTS5_BULK_BATCH ){
+      int iCol;
+      int rcStep = sqlite3_step(pScan);
+      if( rcStep!=SQLITE_ROW ){
+        *pbEof = 1;
+        if( rcStep!=SQLITE_DONE ) rc = sqlite3_reset(pScan);
+        return rc;
+      }
+      sqlite3Fts5BufferAppendVarint(&rc, pDoc, sqlite3_column_int64(pScan,0));
+      for(iCol=0; iCol<pConfig->nCol; iCol++){
+        if( pConfig->abUnindexed[iCol]==0 ){
+          const u8 *pText = sqlite3_column_text(pScan, iCol+1);
+          int nText = sqlite3_column_bytes(pScan, iCol+1);
+          sqlite3Fts5BufferAppendVarint(&rc, pDoc, nText);
+          if( nText>0 ) sqlite3Fts5BufferAppendBlob(&rc, pDoc, nText, pText);
+        }
+      }
+    }
+  }
+  return rc;
+}
+
+/*
+** Write the %_docsize records in the aSize[iBuf] buffers of the workers in
+** aWorker[] and the segments in buffer pSeg to the database.
+*/
+static int fts5BulkWrite(
+  Fts5Storage *p,
+  Fts5BulkWorker *aWorker,
+  int nWorker,
+  int iBuf,
+  Fts5Buffer *pSeg
+){
+  int rc = SQLITE_OK;
+  int i;
+
+  for(i=0; rc==SQLITE_OK && i<nWorker; i++){
+    Fts5Buffer *pSize = &aWorker[i].aSize[iBuf];
+    int iOff = 0;
+    while( rc==SQLITE_OK && iOff<pSize->n ){
+      Fts5Buffer blob;
+      i64 iRowid;
+      iOff += fts5GetVarint(&pSize->p[iOff], (u64*)&iRowid);
+      iOff += fts5GetVarint32(&pSize->p[iOff], blob.n);
+      blob.p = &pSize->p[iOff];
+      blob.nSpace = blob.n;
+      rc = fts5StorageInsertDocsize(p, iRowid, &blob);
+      iOff += blob.n;
+    }
+    pSize->n = 0;
+  }
+
+  if( rc==SQLITE_OK && pSeg->n>0 ){
+    rc = sqlite3Fts5IndexBulkWrite(p->pIndex, pSeg->p, pSeg->n);
+  }
+  pSeg->n = 0;
+  return rc;
+}
+
+/*
+** Implementation of the 'rebuild' command with nThread worker threads.
+** The %_data and %_docsize tables have already been cleared and pScan is
+** the FTS5_STMT_SCAN statement.
+**
+** The worker threads are started once and are handed each round of
+** documents through an Fts5BulkPool. Workers tokenize into private
+** in-memory segments. After each round the segments are collected and,
+** while the workers tokenize the next round, written to the database by
+** this thread. Writing a segment may run the
+** usual automerge and crisismerge work, so that merging overlaps with
+** tokenization instead of following it.
+*/
+static int fts5StorageRebuildThreads(
+  Fts5Storage *p,
+  sqlite3_stmt *pScan,
+  int nThread
+){
+  Fts5Config *pConfig = p->pConfig;
+  Fts5BulkWorker *aWorker;
+  Fts5BulkPool pool;
+  Fts5Thread aThread[FTS5_BULK_MAX_THREAD];
+  int aStarted[FTS5_BULK_MAX_THREAD];
+  int nStarted = 0;               /* Number of threads running */
+  Fts5Buffer seg = {0,0,0};       /* Segments collected from the workers */
+  int iBuf = 0;                   /* aDoc[] buffers to tokenize this round */
+  int bEof = 0;                   /* True once pScan is finished */
+  int rc = SQLITE_OK;
+  int i;
+
+  assert( nThread>1 && nThread<=FTS5_BULK_MAX_THREAD );
+  aWorker = (Fts5BulkWorker*)sqlite3Fts5MallocZero(&rc,
+      (sizeof(Fts5BulkWorker) + sizeof(i64)*pConfig->nCol) * nThread
+  );
+  memset(&pool, 0, sizeof(pool));
+  fts5MutexInit(&pool.mutex);
+  fts5CondInit(&pool.condWork);
+  fts5CondInit(&pool.condDone);
+  for(i=0; rc==SQLITE_OK && i<nThread; i++){
+    Fts5BulkWorker *pW = &aWorker[i];
+    pW->pConfig = pConfig;
+    pW->pPool = &pool;
+    pW->aTotalSize = &((i64*)&aWorker[nThread])[i*pConfig->nCol];
+    rc = sqlite3Fts5IndexBulkOpen(pConfig, &pW->pIdx);
+    if( rc==SQLITE_OK ){
+      rc = sqlite3Fts5ConfigNewTokenizer(pConfig, &pW->pTok, &pW->pTokApi);
+    }
+  }
+
+  /* Start the worker threads. A worker whose thread cannot be started is
+  ** run inline by this thread in each round.  */
+  for(i=0; i<nThread; i++){
+    aStarted[i] = rc==SQLITE_OK 
+               && fts5ThreadStart(&aThread[i], &aWorker[i])==0;
+    nStarted += aStarted[i];
+  }
+
+  if( rc==SQLITE_OK ){
+    rc = fts5BulkRead(pConfig, pScan, aWorker, nThread, iBuf, &bEof);
+  }
+  while( rc==SQLITE_OK ){
+    int bLast = bEof;             /* True if this is the final round */
+
+    /* Start the workers on the documents read by the previous iteration. */
+    for(i=0; i<nThread; i++){
+      aWorker[i].iBuf = iBuf;
+      aWorker[i].bFlush = bLast;
+    }
+    fts5BulkPoolRound(&pool, nStarted);
+
+    /* While they run, write out the results of the previous round and read
+    ** the documents for the next.  */
+    rc = fts5BulkWrite(p, aWorker, nThread, !iBuf, &seg);
+    if( rc==SQLITE_OK && bLast==0 ){
+      rc = fts5BulkRead(pConfig, pScan, aWorker, nThread, !iBuf, &bEof);
+    }
+
+    for(i=0; i<nThread; i++){
+      if( aStarted[i]==0 ) fts5BulkWorkerRun(&aWorker[i]);
+    }
+    fts5BulkPoolWait(&pool);
+    for(i=0; i<nThread; i++){
+      Fts5BulkWorker *pW = &aWorker[i];
+      if( rc==SQLITE_OK ) rc = pW->rc;
+      if( rc==SQLITE_OK ) rc = sqlite3Fts5IndexBulkTake(pW->pIdx, &seg);
+    }
+    iBuf = !iBuf;
+    if( bLast ) break;
+  }
+  if( rc==SQLITE_OK ){
+    rc = fts5BulkWrite(p, aWorker, nThread, !iBuf, &seg);
+  }
+
+  /* Shut down the worker threads. */
+  fts5MutexEnter(&pool.mutex);
+  pool.bExit = 1;
+  fts5CondBroadcast(&pool.condWork);
+  fts5MutexLeave(&pool.mutex);
+  for(i=0; i<nThread; i++){
+    if( aStarted[i] ) fts5ThreadJoin(aThread[i]);
+  }
+  fts5CondFree(&pool.condDone);
+  fts5CondFree(&pool.condWork);
+  fts5MutexFree(&pool.mutex);
+
+  for(i=0; aWorker && i<nThread; i++){
+    Fts5BulkWorker *pW = &aWorker[i];
+    int iCol;
+    for(iCol=0; iCol<pConfig->nCol; iCol++){
+      p->aTotalSize[iCol] += pW->aTotalSize[iCol];
+    }
+    p->nTotalRow += pW->nRow;
+    if( pW->pTok ) pW->pTokApi->xDelete(pW->pTok);
+    sqlite3Fts5IndexClose(pW->pIdx);
+    sqlite3Fts5BufferFree(&pW->aDoc[0]);
+    sqlite3Fts5BufferFree(&pW->aDoc[1]);
+    sqlite3Fts5BufferFree(&pW->aSize[0]);
+    sqlite3Fts5BufferFree(&pW->aSize[1]);
+    sqlite3Fts5BufferFree(&pW->sz);
+  }
+  sqlite3Fts5BufferFree(&seg);
+  sqlite3_free(aWorker);
+  return rc;
+}
+#endif /* FTS5_BULK_THREADS */
+
+/*
+** Implementation of the 'rebuild' command. If nThread is greater than one,
+** the library is threadsafe and the table uses a built-in tokenizer, the
+** index is built using up to nThread worker threads. Otherwise it is built
+** by the calling thread.
+*/
+int sqlite3Fts5StorageRebuild(Fts5Storage *p, int nThread){
   Fts5Buffer buf = {0,0,0};
   Fts5Config *pConfig = p->pConfig;
   sqlite3_stmt *pScan = 0;
@@ -590,7 +1008,7 @@ int sqlite3Fts5StorageRebuild(Fts5Storage *p){
   int rc;
 
   memset(&ctx, 0, sizeof(Fts5InsertCtx));
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   rc = sqlite3Fts5StorageDeleteAll(p);
   if( rc==SQLITE_OK ){
     rc = fts5StorageLoadTotals(p, 1);
@@ -600,6 +1018,17 @@ int sqlite3Fts5StorageRebuild(Fts5Storage *p){
     rc = fts5StorageGetStmt(p, FTS5_STMT_SCAN, &pScan, 0);
   }
 
+#if FTS5_BULK_THREADS
+  if( nThread>FTS5_BULK_MAX_THREAD ) nThread = FTS5_BULK_MAX_THREAD;
+  if( rc==SQLITE_OK && nThread>1 && sqlite3_threadsafe() 
+   && sqlite3Fts5TokenizerIsBuiltin(pConfig->pGlobal, 
+          (const char**)pConfig->azTokArg, pConfig->nTokArg)
+  ){
+    rc = fts5StorageRebuildThreads(p, pScan, nThread);
+  }else
+#else
+  UNUSED_PARAM(nThread);
+#endif
   while( rc==SQLITE_OK && SQLITE_ROW==sqlite3_step(pScan) ){
     i64 iRowid = sqlite3_column_int64(pScan, 0);
 
@@ -722,7 +1151,7 @@ int sqlite3Fts5StorageIndexInsert(
   Fts5Buffer buf;                 /* Buffer used to build up %_docsize blob */
 
   memset(&buf, 0, sizeof(Fts5Buffer));
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   rc = fts5StorageLoadTotals(p, 1);
 
   if( rc==SQLITE_OK ){
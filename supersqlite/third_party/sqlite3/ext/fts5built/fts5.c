@@ -614,6 +614,17 @@ SQLITE_EXTENSION_INIT1
 #include <string.h>
 #include <assert.h>
 
+/*
+** The multi-threaded 'rebuild' command requires a threadsafe build. If
+** SQLITE_THREADSAFE is not defined, assume the library default (threadsafe)
+** and rely on the sqlite3_threadsafe() check at runtime.
+*/
+#if !defined(SQLITE_THREADSAFE) || SQLITE_THREADSAFE>0
+# define FTS5_BULK_THREADS 1
+#else
+# define FTS5_BULK_THREADS 0
+#endif
+
 #ifndef SQLITE_AMALGAMATION
 
 typedef unsigned char  u8;
@@ -741,6 +752,11 @@ typedef struct Fts5Config Fts5Config;
 ** bColumnsize:
 **   True if the %_docsize table is created.
 **
+** azTokArg/nTokArg:
+**   The arguments passed to the tokenizer by the tokenize= option, with
+**   the tokenizer name in azTokArg[0]. Or NULL and 0 if the default 
+**   tokenizer is used. These are used by sqlite3Fts5ConfigNewTokenizer().
+**
 ** bPrefixIndex:
 **   This is only used for debugging. If set to false, any prefix indexes
 **   are ignored. This value is configured using:
@@ -750,6 +766,7 @@ typedef struct Fts5Config Fts5Config;
 */
 struct Fts5Config {
   sqlite3 *db;                    /* Database handle */
+  Fts5Global *pGlobal;            /* Global context (one per db handle) */
   char *zDb;                      /* Database holding FTS index (e.g. "main") */
   char *zName;                    /* Name of FTS index */
   int nCol;                       /* Number of columns */
@@ -765,6 +782,8 @@ struct Fts5Config {
   char *zContentExprlist;
   Fts5Tokenizer *pTok;
   fts5_tokenizer *pTokApi;
+  char **azTokArg;                /* tokenize= arguments (or NULL) */
+  int nTokArg;                    /* Number of entries in azTokArg[] */
 
   /* Values loaded from the %_config table */
   int iCookie;                    /* Incremented when %_config is modified */
@@ -812,6 +831,12 @@ static int sqlite3Fts5Tokenize(
   int (*xToken)(void*, int, const char*, int, int, int)    /* Callback */
 );
 
+#if FTS5_BULK_THREADS
+static int sqlite3Fts5ConfigNewTokenizer(
+  Fts5Config*, Fts5Tokenizer**, fts5_tokenizer**
+);
+#endif
+
 static void sqlite3Fts5Dequote(char *z);
 
 /* Load the contents of the %_config table */
@@ -1083,6 +1108,32 @@ static int sqlite3Fts5IndexReset(Fts5Index *p);
 
 static int sqlite3Fts5IndexLoadConfig(Fts5Index *p);
 
+/*
+** Interface used to build level-0 segments on worker threads. 
+**
+** sqlite3Fts5IndexBulkOpen() allocates a "bulk" index object that is not
+** attached to the database. Documents are added to it using the usual
+** sqlite3Fts5IndexBeginWrite() and sqlite3Fts5IndexWrite() calls, but 
+** each time its in-memory hash table is flushed the segment is assembled 
+** in memory instead of being written to the %_data table. A bulk index
+** object may be used by any single thread, as it never uses the database 
+** handle.
+**
+** sqlite3Fts5IndexBulkFlush() assembles a segment from any data still in
+** the hash table. sqlite3Fts5IndexBulkTake() appends the segments 
+** assembled so far to buffer pBuf and removes them from the bulk index
+** object. And sqlite3Fts5IndexBulkWrite(), which must be called by the
+** thread that owns the database handle, writes segments collected by 
+** sqlite3Fts5IndexBulkTake() to the database as new level-0 segments of
+** index p.
+*/
+#if FTS5_BULK_THREADS
+static int sqlite3Fts5IndexBulkOpen(Fts5Config*, Fts5Index**);
+static int sqlite3Fts5IndexBulkFlush(Fts5Index *pBulk);
+static int sqlite3Fts5IndexBulkTake(Fts5Index *pBulk, Fts5Buffer *pBuf);
+static int sqlite3Fts5IndexBulkWrite(Fts5Index *p, const u8 *aSeg, int nSeg);
+#endif
+
 /*
 ** End of interface to code in fts5_index.c.
 **************************************************************************/
@@ -1125,6 +1176,10 @@ static int sqlite3Fts5GetTokenizer(
   char **pzErr
 );
 
+#if FTS5_BULK_THREADS
+static int sqlite3Fts5TokenizerIsBuiltin(Fts5Global*, const char **azArg, int nArg);
+#endif
+
 static Fts5Index *sqlite3Fts5IndexFromCsrid(Fts5Global*, i64, Fts5Config **);
 
 /*
@@ -1219,7 +1274,7 @@ static int sqlite3Fts5StorageConfigValue(
 );
 
 static int sqlite3Fts5StorageDeleteAll(Fts5Storage *p);
-static int sqlite3Fts5StorageRebuild(Fts5Storage *p);
+static int sqlite3Fts5StorageRebuild(Fts5Storage *p, int nThread);
 static int sqlite3Fts5StorageOptimize(Fts5Storage *p);
 static int sqlite3Fts5StorageMerge(Fts5Storage *p, int nMerge);
 static int sqlite3Fts5StorageReset(Fts5Storage *p);
@@ -4328,11 +4383,10 @@ static int fts5ConfigParseSpecial(
   if( sqlite3_strnicmp("tokenize", zCmd, nCmd)==0 ){
     const char *p = (const char*)zArg;
     int nArg = (int)strlen(zArg) + 1;
-    char **azArg = sqlite3Fts5MallocZero(&rc, sizeof(char*) * nArg);
-    char *pDel = sqlite3Fts5MallocZero(&rc, nArg * 2);
-    char *pSpace = pDel;
+    char **azArg = sqlite3Fts5MallocZero(&rc, (sizeof(char*) + 2) * nArg);
 
-    if( azArg && pSpace ){
+    if( azArg ){
+      char *pSpace = (char*)&azArg[nArg];
       if( pConfig->pTok ){
         *pzErr = sqlite3_mprintf("multiple tokenize=... directives");
         rc = SQLITE_ERROR;
@@ -4360,12 +4414,18 @@ static int fts5ConfigParseSpecial(
               (const char**)azArg, nArg, &pConfig->pTok, &pConfig->pTokApi,
               pzErr
           );
+          if( rc==SQLITE_OK ){
+            /* Keep the arguments so that sqlite3Fts5ConfigNewTokenizer()
+            ** can create more instances of the same tokenizer later on. */
+            pConfig->azTokArg = azArg;
+            pConfig->nTokArg = nArg;
+            azArg = 0;
+          }
         }
       }
     }
 
     sqlite3_free(azArg);
-    sqlite3_free(pDel);
     return rc;
   }
 
@@ -4567,6 +4627,7 @@ static int sqlite3Fts5ConfigParse(
   if( pRet==0 ) return SQLITE_NOMEM;
   memset(pRet, 0, sizeof(Fts5Config));
   pRet->db = db;
+  pRet->pGlobal = pGlobal;
   pRet->iCookie = -1;
 
   nByte = nArg * (sizeof(char*) + sizeof(u8));
@@ -4675,6 +4736,7 @@ static void sqlite3Fts5ConfigFree(Fts5Config *pConfig){
     if( pConfig->pTok ){
       pConfig->pTokApi->xDelete(pConfig->pTok);
     }
+    sqlite3_free(pConfig->azTokArg);
     sqlite3_free(pConfig->zDb);
     sqlite3_free(pConfig->zName);
     for(i=0; i<pConfig->nCol; i++){
@@ -4755,6 +4817,30 @@ static int sqlite3Fts5Tokenize(
   );
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Allocate a new instance of the tokenizer used by the table, created with
+** the same arguments as Fts5Config.pTok. A tokenizer instance may only be
+** used by one thread at a time, so each thread that tokenizes documents
+** for a multi-threaded 'rebuild' uses its own. This is only done for the
+** built-in tokenizers (see sqlite3Fts5TokenizerIsBuiltin()).
+**
+** If successful, SQLITE_OK is returned and the new tokenizer and its 
+** methods are written to *ppTok and *ppTokApi. The caller must eventually
+** free the tokenizer using (*ppTokApi)->xDelete(). Otherwise, an SQLite
+** error code is returned and both output variables are set to NULL.
+*/
+static int sqlite3Fts5ConfigNewTokenizer(
+  Fts5Config *pConfig,
+  Fts5Tokenizer **ppTok,
+  fts5_tokenizer **ppTokApi
+){
+  return sqlite3Fts5GetTokenizer(pConfig->pGlobal, 
+      (const char**)pConfig->azTokArg, pConfig->nTokArg, ppTok, ppTokApi, 0
+  );
+}
+#endif /* FTS5_BULK_THREADS */
+
 /*
 ** Argument pIn points to the first character in what is expected to be
 ** a comma-separated list of SQL literals followed by a ')' character.
@@ -8694,6 +8780,10 @@ struct Fts5Index {
   sqlite3_stmt *pDataVersion;
   i64 iStructVersion;             /* data_version when pStruct read */
   Fts5Structure *pStruct;         /* Current db structure (or NULL) */
+
+  /* Used by bulk index objects only. See sqlite3Fts5IndexBulkOpen(). */
+  int bBulk;                      /* True for a bulk index object */
+  Fts5Buffer bulk;                /* Segments assembled in memory */
 };
 
 struct Fts5DoclistIter {
@@ -9124,13 +9214,78 @@ static int fts5IndexPrepareStmt(
   return p->rc;
 }
 
+/*
+** Prepare the "INSERT INTO %_idx" statement used by segment writers.
+*/
+static void fts5IndexPrepareIdxWriter(Fts5Index *p){
+  Fts5Config *pConfig = p->pConfig;
+  fts5IndexPrepareStmt(p, &p->pIdxWriter, sqlite3_mprintf(
+        "INSERT INTO '%q'.'%q_idx'(segid,term,pgno) VALUES(?,?,?)", 
+        pConfig->zDb, pConfig->zName
+  ));
+}
+
+/*
+** A bulk index object (see sqlite3Fts5IndexBulkOpen()) assembles segments
+** in buffer Fts5Index.bulk instead of writing them to the database. Each
+** segment is stored as a series of records, each of which begins with one
+** of the following type bytes:
+**
+**   FTS5_BULK_DATA:
+**     A %_data record. Followed by the rowid the record would have if the
+**     segment id were 0, the size of the record in bytes and the record
+**     itself.
+**
+**   FTS5_BULK_IDX:
+**     A %_idx record. Followed by the value of the pgno column, the size 
+**     of the term in bytes and the term itself.
+**
+**   FTS5_BULK_END:
+**     The end of the segment. Followed by the number of leaf pages in the
+**     segment.
+**
+** All integers are stored as varints.
+*/
+#define FTS5_BULK_DATA 1
+#define FTS5_BULK_IDX  2
+#define FTS5_BULK_END  3
 
 /*
-** INSERT OR REPLACE a record into the %_data table.
+** Append a record of type eType to the Fts5Index.bulk buffer. The blob
+** argument is ignored for FTS5_BULK_END records.
+*/
+static void fts5BulkAppend(
+  Fts5Index *p, 
+  int eType,                      /* FTS5_BULK_XXX constant */
+  i64 iVal,                       /* Rowid, pgno value or leaf page count */
+  const u8 *a, int n              /* Record data or term */
+){
+  assert( p->bBulk );
+  if( fts5BufferGrow(&p->rc, &p->bulk, 1 + 9 + 9 + n)==0 ){
+    p->bulk.p[p->bulk.n++] = (u8)eType;
+    p->bulk.n += sqlite3Fts5PutVarint(&p->bulk.p[p->bulk.n], (u64)iVal);
+    if( eType!=FTS5_BULK_END ){
+      p->bulk.n += sqlite3Fts5PutVarint(&p->bulk.p[p->bulk.n], (u64)n);
+      if( n>0 ){
+        memcpy(&p->bulk.p[p->bulk.n], a, n);
+        p->bulk.n += n;
+      }
+    }
+  }
+}
+
+/*
+** INSERT OR REPLACE a record into the %_data table. Or, for a bulk index
+** object, append it to the segment being assembled in memory.
 */
 static void fts5DataWrite(Fts5Index *p, i64 iRowid, const u8 *pData, int nData){
   if( p->rc!=SQLITE_OK ) return;
 
+  if( p->bBulk ){
+    fts5BulkAppend(p, FTS5_BULK_DATA, iRowid, pData, nData);
+    return;
+  }
+
   if( p->pWriter==0 ){
     Fts5Config *pConfig = p->pConfig;
     fts5IndexPrepareStmt(p, &p->pWriter, sqlite3_mprintf(
@@ -12105,7 +12260,11 @@ static void fts5WriteFlushBtree(Fts5Index *p, Fts5SegWriter *pWriter){
   if( pWriter->iBtPage==0 ) return;
   bFlag = fts5WriteFlushDlidx(p, pWriter);
 
-  if( p->rc==SQLITE_OK ){
+  if( p->rc==SQLITE_OK && p->bBulk ){
+    fts5BulkAppend(p, FTS5_BULK_IDX, bFlag + ((i64)pWriter->iBtPage<<1), 
+        pWriter->btterm.p, pWriter->btterm.n
+    );
+  }else if( p->rc==SQLITE_OK ){
     const char *z = (pWriter->btterm.n>0?(const char*)pWriter->btterm.p:"");
     /* The following was already done in fts5WriteInit(): */
     /* sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid); */
@@ -12472,12 +12631,8 @@ static void fts5WriteInit(
   sqlite3Fts5BufferSize(&p->rc, &pWriter->writer.pgidx, nBuffer);
   sqlite3Fts5BufferSize(&p->rc, &pWriter->writer.buf, nBuffer);
 
-  if( p->pIdxWriter==0 ){
-    Fts5Config *pConfig = p->pConfig;
-    fts5IndexPrepareStmt(p, &p->pIdxWriter, sqlite3_mprintf(
-          "INSERT INTO '%q'.'%q_idx'(segid,term,pgno) VALUES(?,?,?)", 
-          pConfig->zDb, pConfig->zName
-    ));
+  if( p->pIdxWriter==0 && p->bBulk==0 ){
+    fts5IndexPrepareIdxWriter(p);
   }
 
   if( p->rc==SQLITE_OK ){
@@ -12488,7 +12643,9 @@ static void fts5WriteInit(
     /* Bind the current output segment id to the index-writer. This is an
     ** optimization over binding the same value over and over as rows are
     ** inserted into %_idx by the current writer.  */
-    sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid);
+    if( p->bBulk==0 ){
+      sqlite3_bind_int(p->pIdxWriter, 1, pWriter->iSegid);
+    }
   }
 }
 
@@ -12845,28 +13002,22 @@ static int fts5PoslistPrefix(const u8 *aBuf, int nMax){
 }
 
 /*
-** Flush the contents of in-memory hash table iHash to a new level-0 
-** segment on disk. Also update the corresponding structure record.
+** Write the contents of in-memory hash table pHash to segment iSegid and
+** clear the hash table. Set *ppgnoLast to the last leaf page number in the
+** new segment.
 **
 ** If an error occurs, set the Fts5Index.rc error code. If an error has 
 ** already occurred, this function is a no-op.
 */
-static void fts5FlushOneHash(Fts5Index *p){
-  Fts5Hash *pHash = p->pHash;
-  Fts5Structure *pStruct;
-  int iSegid;
-  int pgnoLast = 0;                 /* Last leaf page number in segment */
-
-  /* Obtain a reference to the index structure and allocate a new segment-id
-  ** for the new level-0 segment.  */
-  pStruct = fts5StructureRead(p);
-  iSegid = fts5AllocateSegid(p, pStruct);
-  fts5StructureInvalidate(p);
-
-  if( iSegid ){
+static void fts5WriteHash(
+  Fts5Index *p,                   /* FTS5 backend object */
+  Fts5Hash *pHash,                /* Hash table to write */
+  int iSegid,                     /* Segment id to write to */
+  int *ppgnoLast                  /* OUT: Last leaf page number */
+){
+  if( p->rc==SQLITE_OK ){
     const int pgsz = p->pConfig->pgsz;
     int eDetail = p->pConfig->eDetail;
-    Fts5StructureSegment *pSeg;   /* New segment within pStruct */
     Fts5Buffer *pBuf;             /* Buffer in which to assemble leaf page */
     Fts5Buffer *pPgidx;           /* Buffer in which to assemble pgidx */
 
@@ -12976,7 +13127,27 @@ static void fts5FlushOneHash(Fts5Index *p){
       sqlite3Fts5HashScanNext(pHash);
     }
     sqlite3Fts5HashClear(pHash);
-    fts5WriteFinish(p, &writer, &pgnoLast);
+    fts5WriteFinish(p, &writer, ppgnoLast);
+  }
+}
+
+/*
+** Level-0 segment iSegid, which has pgnoLast leaf pages, has just been 
+** written to the database. Add it to structure pStruct, perform any 
+** automerge or crisis-merge work required, then write the structure back
+** to the database and release the reference to it.
+**
+** If iSegid is 0, no segment is added, but the structure is still written
+** back and released.
+*/
+static void fts5IndexAppendSegment(
+  Fts5Index *p,                   /* FTS5 backend object */
+  Fts5Structure *pStruct,         /* Structure of index */
+  int iSegid,                     /* New level-0 segment (or 0) */
+  int pgnoLast                    /* Last leaf page number in segment */
+){
+  if( iSegid ){
+    Fts5StructureSegment *pSeg;   /* New segment within pStruct */
 
     /* Update the Fts5Structure. It is written back to the database by the
     ** fts5StructureRelease() call below.  */
@@ -13000,6 +13171,41 @@ static void fts5FlushOneHash(Fts5Index *p){
   fts5StructureRelease(pStruct);
 }
 
+/*
+** Flush the contents of in-memory hash table iHash to a new level-0 
+** segment on disk. Also update the corresponding structure record.
+**
+** If an error occurs, set the Fts5Index.rc error code. If an error has 
+** already occurred, this function is a no-op.
+*/
+static void fts5FlushOneHash(Fts5Index *p){
+  Fts5Structure *pStruct;
+  int iSegid;
+  int pgnoLast = 0;                 /* Last leaf page number in segment */
+
+  /* Obtain a reference to the index structure and allocate a new segment-id
+  ** for the new level-0 segment.  */
+  pStruct = fts5StructureRead(p);
+  iSegid = fts5AllocateSegid(p, pStruct);
+  fts5StructureInvalidate(p);
+
+  if( iSegid ){
+    fts5WriteHash(p, p->pHash, iSegid, &pgnoLast);
+  }
+  fts5IndexAppendSegment(p, pStruct, iSegid, pgnoLast);
+}
+
+/*
+** Flush the contents of the in-memory hash table of bulk index object p
+** to a new segment assembled in the Fts5Index.bulk buffer.
+*/
+static void fts5BulkFlushHash(Fts5Index *p){
+  int pgnoLast = 0;
+  assert( p->bBulk );
+  fts5WriteHash(p, p->pHash, 0, &pgnoLast);
+  fts5BulkAppend(p, FTS5_BULK_END, pgnoLast, 0, 0);
+}
+
 /*
 ** Flush any data stored in the in-memory hash tables to the database.
 */
@@ -13008,7 +13214,11 @@ static void fts5IndexFlush(Fts5Index *p){
   if( p->nPendingData ){
     assert( p->pHash );
     p->nPendingData = 0;
-    fts5FlushOneHash(p);
+    if( p->bBulk ){
+      fts5BulkFlushHash(p);
+    }else{
+      fts5FlushOneHash(p);
+    }
   }
 }
 
@@ -13626,12 +13836,118 @@ static int sqlite3Fts5IndexClose(Fts5Index *p){
     sqlite3_finalize(p->pIdxSelect);
     sqlite3_finalize(p->pDataVersion);
     sqlite3Fts5HashFree(p->pHash);
+    sqlite3Fts5BufferFree(&p->bulk);
     sqlite3_free(p->zDataTbl);
     sqlite3_free(p);
   }
   return rc;
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Open a new bulk index object. It is closed using sqlite3Fts5IndexClose().
+**
+** If successful, set *pp to point to the new object and return SQLITE_OK.
+** Otherwise, set *pp to NULL and return an SQLite error code.
+*/
+static int sqlite3Fts5IndexBulkOpen(Fts5Config *pConfig, Fts5Index **pp){
+  int rc = SQLITE_OK;
+  Fts5Index *p;
+
+  *pp = p = (Fts5Index*)sqlite3Fts5MallocZero(&rc, sizeof(Fts5Index));
+  if( rc==SQLITE_OK ){
+    p->pConfig = pConfig;
+    p->nWorkUnit = FTS5_WORK_UNIT;
+    p->bBulk = 1;
+  }
+  return rc;
+}
+
+/*
+** Assemble a segment from any data in the hash table of bulk index p.
+*/
+static int sqlite3Fts5IndexBulkFlush(Fts5Index *p){
+  assert( p->bBulk );
+  fts5IndexFlush(p);
+  return fts5IndexReturn(p);
+}
+
+/*
+** Append the segments assembled by bulk index p to buffer pBuf, and remove
+** them from p.
+*/
+static int sqlite3Fts5IndexBulkTake(Fts5Index *p, Fts5Buffer *pBuf){
+  int rc = SQLITE_OK;
+  assert( p->bBulk );
+  if( pBuf->n==0 ){
+    Fts5Buffer tmp = *pBuf;
+    *pBuf = p->bulk;
+    p->bulk = tmp;
+  }else{
+    sqlite3Fts5BufferAppendBlob(&rc, pBuf, p->bulk.n, p->bulk.p);
+    p->bulk.n = 0;
+  }
+  return rc;
+}
+
+/*
+** Buffer aSeg[], which is nSeg bytes in size, contains one or more 
+** segments assembled by bulk index objects. Write them to the database as
+** new level-0 segments of index p, performing any automerge or crisis-merge
+** work the new segments require as they are added.
+*/
+static int sqlite3Fts5IndexBulkWrite(Fts5Index *p, const u8 *aSeg, int nSeg){
+  Fts5Structure *pStruct = 0;     /* Structure, while writing a segment */
+  int iSegid = 0;                 /* Id of segment being written */
+  i64 iBase = 0;                  /* Rowid of page 0 of segment iSegid */
+  int i = 0;                      /* Offset of next record in aSeg[] */
+
+  assert( p->bBulk==0 && p->rc==SQLITE_OK );
+  while( p->rc==SQLITE_OK && i<nSeg ){
+    int eType = aSeg[i++];
+    u64 iVal;
+
+    i += fts5GetVarint(&aSeg[i], &iVal);
+    if( pStruct==0 ){
+      /* This is the first record of a segment. Allocate a segment id. */
+      pStruct = fts5StructureRead(p);
+      iSegid = fts5AllocateSegid(p, pStruct);
+      fts5StructureInvalidate(p);
+      iBase = FTS5_SEGMENT_ROWID(iSegid, 0);
+    }
+
+    if( eType==FTS5_BULK_END ){
+      fts5IndexAppendSegment(p, pStruct, iSegid, (int)iVal);
+      pStruct = 0;
+    }else{
+      int n;
+      i += fts5GetVarint32(&aSeg[i], n);
+      if( eType==FTS5_BULK_DATA ){
+        fts5DataWrite(p, iBase + (i64)iVal, &aSeg[i], n);
+      }else{
+        assert( eType==FTS5_BULK_IDX );
+        if( p->pIdxWriter==0 ){
+          fts5IndexPrepareIdxWriter(p);
+        }
+        if( p->rc==SQLITE_OK ){
+          const char *z = (n>0 ? (const char*)&aSeg[i] : "");
+          sqlite3_bind_int(p->pIdxWriter, 1, iSegid);
+          sqlite3_bind_blob(p->pIdxWriter, 2, z, n, SQLITE_STATIC);
+          sqlite3_bind_int64(p->pIdxWriter, 3, (i64)iVal);
+          sqlite3_step(p->pIdxWriter);
+          p->rc = sqlite3_reset(p->pIdxWriter);
+          sqlite3_bind_null(p->pIdxWriter, 2);
+        }
+      }
+      i += n;
+    }
+  }
+
+  fts5StructureRelease(pStruct);
+  return fts5IndexReturn(p);
+}
+#endif /* FTS5_BULK_THREADS */
+
 /*
 ** Argument p points to a buffer containing utf-8 text that is n bytes in 
 ** size. Return the number of bytes in the nChar character prefix of the
@@ -15004,6 +15320,7 @@ struct Fts5TokenizerModule {
   fts5_tokenizer x;               /* Tokenizer functions */
   void (*xDestroy)(void*);        /* Destructor function */
   Fts5TokenizerModule *pNext;     /* Next registered tokenizer module */
+  int bBuiltin;                   /* True for the built-in tokenizers */
 };
 
 /*
@@ -16305,7 +16622,7 @@ static int fts5SpecialInsert(
       );
       rc = SQLITE_ERROR;
     }else{
-      rc = sqlite3Fts5StorageRebuild(pTab->pStorage);
+      rc = sqlite3Fts5StorageRebuild(pTab->pStorage, sqlite3_value_int(pVal));
     }
   }else if( 0==sqlite3_stricmp("optimize", zCmd) ){
     rc = sqlite3Fts5StorageOptimize(pTab->pStorage);
@@ -17495,6 +17812,34 @@ static int sqlite3Fts5GetTokenizer(
   return rc;
 }
 
+#if FTS5_BULK_THREADS
+/*
+** Return true if the tokenizer specified by azArg[] and nArg, as for
+** sqlite3Fts5GetTokenizer(), is a built-in tokenizer, and so is any 
+** tokenizer it wraps. Separate instances of these may be used by separate
+** threads at once. Nothing is known about application tokenizers, so a
+** multi-threaded 'rebuild' only uses them from the calling thread.
+*/
+static int sqlite3Fts5TokenizerIsBuiltin(
+  Fts5Global *pGlobal, 
+  const char **azArg, 
+  int nArg
+){
+  const char *zName = (nArg>0 ? azArg[0] : 0);
+  while( 1 ){
+    Fts5TokenizerModule *pMod = fts5LocateTokenizer(pGlobal, zName);
+    if( pMod==0 || pMod->bBuiltin==0 ) return 0;
+    if( zName==0 || sqlite3_stricmp(zName, "porter") ) return 1;
+
+    /* The porter tokenizer wraps the tokenizer named by its first 
+    ** argument, or "unicode61" if there is none. */
+    azArg++;
+    nArg--;
+    zName = (nArg>0 ? azArg[0] : "unicode61");
+  }
+}
+#endif
+
 static void fts5ModuleDestroy(void *pCtx){
   Fts5TokenizerModule *pTok, *pNextTok;
   Fts5Auxiliary *pAux, *pNextAux;
@@ -17586,7 +17931,11 @@ static int fts5Init(sqlite3 *db){
     if( rc==SQLITE_OK ) rc = sqlite3Fts5IndexInit(db);
     if( rc==SQLITE_OK ) rc = sqlite3Fts5ExprInit(pGlobal, db);
     if( rc==SQLITE_OK ) rc = sqlite3Fts5AuxInit(&pGlobal->api);
-    if( rc==SQLITE_OK ) rc = sqlite3Fts5TokenizerInit(&pGlobal->api);
+    if( rc==SQLITE_OK ){
+      Fts5TokenizerModule *pMod;
+      rc = sqlite3Fts5TokenizerInit(&pGlobal->api);
+      for(pMod=pGlobal->pTok; pMod; pMod=pMod->pNext) pMod->bBuiltin = 1;
+    }
     if( rc==SQLITE_OK ) rc = sqlite3Fts5VocabInit(pGlobal, db);
     if( rc==SQLITE_OK ){
       rc = sqlite3_create_function(
@@ -17673,6 +18022,14 @@ int sqlite3Fts5Init(sqlite3 *db){
 
 /* #include "fts5Int.h" */
 
+#if FTS5_BULK_THREADS
+# if defined(_WIN32)
+#  include <windows.h>
+# else
+#  include <pthread.h>
+# endif
+#endif
+
 struct Fts5Storage {
   Fts5Config *pConfig;
   Fts5Index *pIndex;
@@ -18012,7 +18369,7 @@ static int sqlite3Fts5StorageClose(Fts5Storage *p){
 
 typedef struct Fts5InsertCtx Fts5InsertCtx;
 struct Fts5InsertCtx {
-  Fts5Storage *pStorage;
+  Fts5Index *pIdx;                /* Index to write tokens to */
   int iCol;
   int szCol;                      /* Size of column value in tokens */
 };
@@ -18029,7 +18386,7 @@ static int fts5StorageInsertCallback(
   int iUnused2                    /* End offset of token */
 ){
   Fts5InsertCtx *pCtx = (Fts5InsertCtx*)pContext;
-  Fts5Index *pIdx = pCtx->pStorage->pIndex;
+  Fts5Index *pIdx = pCtx->pIdx;
   UNUSED_PARAM2(iUnused1, iUnused2);
   if( nToken>FTS5_MAX_TOKEN_SIZE ) nToken = FTS5_MAX_TOKEN_SIZE;
   if( (tflags & FTS5_TOKEN_COLOCATED)==0 || pCtx->szCol==0 ){
@@ -18064,7 +18421,7 @@ static int fts5StorageDeleteFromIndex(
     }
   }
 
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   ctx.iCol = -1;
   rc = sqlite3Fts5IndexBeginWrite(p->pIndex, 1, iDel);
   for(iCol=1; rc==SQLITE_OK && iCol<=pConfig->nCol; iCol++){
@@ -18239,7 +18596,417 @@ static int sqlite3Fts5StorageDeleteAll(Fts5Storage *p){
   return rc;
 }
 
-static int sqlite3Fts5StorageRebuild(Fts5Storage *p){
+#if FTS5_BULK_THREADS
+
+/* Maximum number of worker threads used by a multi-threaded rebuild */
+#define FTS5_BULK_MAX_THREAD 64
+
+/* Bytes of document text handed to each worker per round */
+#define FTS5_BULK_BATCH (1024*1024)
+
+/*
+** One worker of a multi-threaded rebuild. Each worker owns a tokenizer
+** instance and a bulk Fts5Index object (see sqlite3Fts5IndexBulkOpen()), so
+** that workers share nothing but the (read-only) Fts5Config object and the
+** Fts5BulkPool used to hand them work.
+**
+** Documents are processed in rounds. Both aDoc[] and aSize[] are double
+** buffered: while a worker tokenizes aDoc[iBuf] and writes the corresponding
+** %_docsize records to aSize[iBuf], the connection thread writes out the
+** aSize[!iBuf] records from the previous round and reads the next round of
+** documents into aDoc[!iBuf].
+**
+** Each entry in aDoc[] is a varint rowid followed by, for each indexed
+** column, a varint byte count and the column text. Each entry in aSize[]
+** is a varint rowid, a varint byte count and a %_docsize blob.
+*/
+typedef struct Fts5BulkPool Fts5BulkPool;
+typedef struct Fts5BulkWorker Fts5BulkWorker;
+struct Fts5BulkWorker {
+  Fts5Config *pConfig;
+  Fts5BulkPool *pPool;            /* Pool this worker's thread belongs to */
+  Fts5Index *pIdx;                /* Bulk index object */
+  Fts5Tokenizer *pTok;            /* Private tokenizer instance */
+  fts5_tokenizer *pTokApi;
+  Fts5Buffer aDoc[2];             /* Documents to tokenize */
+  Fts5Buffer aSize[2];            /* %_docsize records to write */
+  Fts5Buffer sz;                  /* Used to build up a %_docsize blob */
+  int iBuf;                       /* Index of aDoc[] and aSize[] to use */
+  int bFlush;                     /* Flush pending data after this round */
+  int rc;                         /* Error code from this round */
+  i64 nRow;                       /* Rows processed so far */
+  i64 *aTotalSize;                /* Total tokens in each column so far */
+};
+
+/*
+** Tokenize the documents in pW->aDoc[pW->iBuf] into the worker's index. If
+** pW->bFlush is set, write all pending data to the bulk buffer afterwards.
+*/
+static void fts5BulkWorkerRun(Fts5BulkWorker *pW){
+  Fts5Config *pConfig = pW->pConfig;
+  Fts5Buffer *pDoc = &pW->aDoc[pW->iBuf];
+  Fts5Buffer *pSize = &pW->aSize[pW->iBuf];
+  Fts5InsertCtx ctx;
+  int i = 0;
+  int rc = SQLITE_OK;
+
+  ctx.pIdx = pW->pIdx;
+  pSize->n = 0;
+  while( rc==SQLITE_OK && i<pDoc->n ){
+    i64 iRowid;
+    i += fts5GetVarint(&pDoc->p[i], (u64*)&iRowid);
+    rc = sqlite3Fts5IndexBeginWrite(pW->pIdx, 0, iRowid);
+    pW->sz.n = 0;
+    for(ctx.iCol=0; rc==SQLITE_OK && ctx.iCol<pConfig->nCol; ctx.iCol++){
+      ctx.szCol = 0;
+      if( pConfig->abUnindexed[ctx.iCol]==0 ){
+        int nText;
+        i += fts5GetVarint32(&pDoc->p[i], nText);
+        rc = pW->pTokApi->xTokenize(pW->pTok, (void*)&ctx, 
+            FTS5_TOKENIZE_DOCUMENT, (const char*)&pDoc->p[i], nText,
+            fts5StorageInsertCallback
+        );
+        i += nText;
+      }
+      sqlite3Fts5BufferAppendVarint(&rc, &pW->sz, ctx.szCol);
+      pW->aTotalSize[ctx.iCol] += (i64)ctx.szCol;
+    }
+    pW->nRow++;
+    sqlite3Fts5BufferAppendVarint(&rc, pSize, iRowid);
+    sqlite3Fts5BufferAppendVarint(&rc, pSize, pW->sz.n);
+    sqlite3Fts5BufferAppendBlob(&rc, pSize, pW->sz.n, pW->sz.p);
+  }
+
+  if( rc==SQLITE_OK && pW->bFlush ){
+    rc = sqlite3Fts5IndexBulkFlush(pW->pIdx);
+  }
+  pW->rc = rc;
+}
+
+#if defined(_WIN32)
+typedef HANDLE Fts5Thread;
+typedef CRITICAL_SECTION Fts5Mutex;
+typedef CONDITION_VARIABLE Fts5Cond;
+# define fts5MutexInit(p)      InitializeCriticalSection(p)
+# define fts5MutexFree(p)      DeleteCriticalSection(p)
+# define fts5MutexEnter(p)     EnterCriticalSection(p)
+# define fts5MutexLeave(p)     LeaveCriticalSection(p)
+# define fts5CondInit(p)       InitializeConditionVariable(p)
+# define fts5CondFree(p)
+# define fts5CondWait(p, pMut) SleepConditionVariableCS(p, pMut, INFINITE)
+# define fts5CondBroadcast(p)  WakeAllConditionVariable(p)
+#else
+typedef pthread_t Fts5Thread;
+typedef pthread_mutex_t Fts5Mutex;
+typedef pthread_cond_t Fts5Cond;
+# define fts5MutexInit(p)      pthread_mutex_init(p, 0)
+# define fts5MutexFree(p)      pthread_mutex_destroy(p)
+# define fts5MutexEnter(p)     pthread_mutex_lock(p)
+# define fts5MutexLeave(p)     pthread_mutex_unlock(p)
+# define fts5CondInit(p)       pthread_cond_init(p, 0)
+# define fts5CondFree(p)       pthread_cond_destroy(p)
+# define fts5CondWait(p, pMut) pthread_cond_wait(p, pMut)
+# define fts5CondBroadcast(p)  pthread_cond_broadcast(p)
+#endif
+
+/*
+** The worker threads of a multi-threaded rebuild are started once and
+** then wait on condWork for each round. The connection thread increments
+** iRound to start a round, and waits on condDone until nBusy, the number
+** of threads still working on the round, drops to zero. Setting bExit
+** tells the threads to exit once there are no more rounds.
+*/
+struct Fts5BulkPool {
+  Fts5Mutex mutex;
+  Fts5Cond condWork;
+  Fts5Cond condDone;
+  int iRound;                     /* Number of rounds started */
+  int nBusy;                      /* Threads that have not finished iRound */
+  int bExit;                      /* True once all rounds have been run */
+};
+
+/*
+** The body of a worker thread. Run fts5BulkWorkerRun() once for each round
+** started by fts5BulkPoolRound() until the pool is shut down.
+*/
+static void fts5BulkWorkerLoop(Fts5BulkWorker *pW){
+  Fts5BulkPool *pPool = pW->pPool;
+  int iRound = 0;
+
+  fts5MutexEnter(&pPool->mutex);
+  while( 1 ){
+    while( pPool->iRound==iRound && pPool->bExit==0 ){
+      fts5CondWait(&pPool->condWork, &pPool->mutex);
+    }
+    if( pPool->iRound==iRound ) break;
+    iRound = pPool->iRound;
+    fts5MutexLeave(&pPool->mutex);
+    fts5BulkWorkerRun(pW);
+    fts5MutexEnter(&pPool->mutex);
+    pPool->nBusy--;
+    if( pPool->nBusy==0 ) fts5CondBroadcast(&pPool->condDone);
+  }
+  fts5MutexLeave(&pPool->mutex);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI fts5BulkWorkerMain(LPVOID pArg){
+  fts5BulkWorkerLoop((Fts5BulkWorker*)pArg);
+  return 0;
+}
+static int fts5ThreadStart(Fts5Thread *pThread, Fts5BulkWorker *pW){
+  *pThread = CreateThread(0, 0, fts5BulkWorkerMain, (LPVOID)pW, 0, 0);
+  return *pThread==0;
+}
+static void fts5ThreadJoin(Fts5Thread thread){
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+#else
+static void *fts5BulkWorkerMain(void *pArg){
+  fts5BulkWorkerLoop((Fts5BulkWorker*)pArg);
+  return 0;
+}
+static int fts5ThreadStart(Fts5Thread *pThread, Fts5BulkWorker *pW){
+  return pthread_create(pThread, 0, fts5BulkWorkerMain, (void*)pW);
+}
+static void fts5ThreadJoin(Fts5Thread thread){
+  pthread_join(thread, 0);
+}
+#endif
+
+/*
+** Start a round on the nThread worker threads of pPool.
+*/
+static void fts5BulkPoolRound(Fts5BulkPool *pPool, int nThread){
+  fts5MutexEnter(&pPool->mutex);
+  pPool->iRound++;
+  pPool->nBusy = nThread;
+  fts5CondBroadcast(&pPool->condWork);
+  fts5MutexLeave(&pPool->mutex);
+}
+
+/*
+** Wait until the worker threads of pPool have finished the current round.
+*/
+static void fts5BulkPoolWait(Fts5BulkPool *pPool){
+  fts5MutexEnter(&pPool->mutex);
+  while( pPool->nBusy>0 ){
+    fts5CondWait(&pPool->condDone, &pPool->mutex);
+  }
+  fts5MutexLeave(&pPool->mutex);
+}
+
+/*
+** Read the next round of documents from pScan into the aDoc[iBuf] buffers
+** of the nWorker workers in aWorker[]. Set *pbEof if the scan is finished.
+*/
+static int fts5BulkRead(
+  Fts5Config *pConfig,
+  sqlite3_stmt *pScan,
+  Fts5BulkWorker *aWorker,
+  int nWorker,
+  int iBuf,
+  int *pbEof
+){
+  int rc = SQLITE_OK;
+  int i;
+
+  for(i=0; i<nWorker; i++) aWorker[i].aDoc[iBuf].n = 0;
+  for(i=0; rc==SQLITE_OK && i<nWorker; i++){
+    Fts5Buffer *pDoc = &aWorker[i].aDoc[iBuf];
+    while( rc==SQLITE_OK && pDoc->n<FTS5_BULK_BATCH ){
+      int iCol;
+      int rcStep = sqlite3_step(pScan);
+      if( rcStep!=SQLITE_ROW ){
+        *pbEof = 1;
+        if( rcStep!=SQLITE_DONE ) rc = sqlite3_reset(pScan);
+        return rc;
+      }
+      sqlite3Fts5BufferAppendVarint(&rc, pDoc, sqlite3_column_int64(pScan,0));
+      for(iCol=0; iCol<pConfig->nCol; iCol++){
+        if( pConfig->abUnindexed[iCol]==0 ){
+          const u8 *pText = sqlite3_column_text(pScan, iCol+1);
+          int nText = sqlite3_column_bytes(pScan, iCol+1);
+          sqlite3Fts5BufferAppendVarint(&rc, pDoc, nText);
+          if( nText>0 ) sqlite3Fts5BufferAppendBlob(&rc, pDoc, nText, pText);
+        }
+      }
+    }
+  }
+  return rc;
+}
+
+/*
+** Write the %_docsize records in the aSize[iBuf] buffers of the workers in
+** aWorker[] and the segments in buffer pSeg to the database.
+*/
+static int fts5BulkWrite(
+  Fts5Storage *p,
+  Fts5BulkWorker *aWorker,
+  int nWorker,
+  int iBuf,
+  Fts5Buffer *pSeg
+){
+  int rc = SQLITE_OK;
+  int i;
+
+  for(i=0; rc==SQLITE_OK && i<nWorker; i++){
+    Fts5Buffer *pSize = &aWorker[i].aSize[iBuf];
+    int iOff = 0;
+    while( rc==SQLITE_OK && iOff<pSize->n ){
+      Fts5Buffer blob;
+      i64 iRowid;
+      iOff += fts5GetVarint(&pSize->p[iOff], (u64*)&iRowid);
+      iOff += fts5GetVarint32(&pSize->p[iOff], blob.n);
+      blob.p = &pSize->p[iOff];
+      blob.nSpace = blob.n;
+      rc = fts5StorageInsertDocsize(p, iRowid, &blob);
+      iOff += blob.n;
+    }
+    pSize->n = 0;
+  }
+
+  if( rc==SQLITE_OK && pSeg->n>0 ){
+    rc = sqlite3Fts5IndexBulkWrite(p->pIndex, pSeg->p, pSeg->n);
+  }
+  pSeg->n = 0;
+  return rc;
+}
+
+/*
+** Implementation of the 'rebuild' command with nThread worker threads.
+** The %_data and %_docsize tables have already been cleared and pScan is
+** the FTS5_STMT_SCAN statement.
+**
+** The worker threads are started once and are handed each round of
+** documents through an Fts5BulkPool. Workers tokenize into private
+** in-memory segments. After each round the segments are collected and,
+** while the workers tokenize the next round, written to the database by
+** this thread. Writing a segment may run the
+** usual automerge and crisismerge work, so that merging overlaps with
+** tokenization instead of following it.
+*/
+static int fts5StorageRebuildThreads(
+  Fts5Storage *p,
+  sqlite3_stmt *pScan,
+  int nThread
+){
+  Fts5Config *pConfig = p->pConfig;
+  Fts5BulkWorker *aWorker;
+  Fts5BulkPool pool;
+  Fts5Thread aThread[FTS5_BULK_MAX_THREAD];
+  int aStarted[FTS5_BULK_MAX_THREAD];
+  int nStarted = 0;               /* Number of threads running */
+  Fts5Buffer seg = {0,0,0};       /* Segments collected from the workers */
+  int iBuf = 0;                   /* aDoc[] buffers to tokenize this round */
+  int bEof = 0;                   /* True once pScan is finished */
+  int rc = SQLITE_OK;
+  int i;
+
+  assert( nThread>1 && nThread<=FTS5_BULK_MAX_THREAD );
+  aWorker = (Fts5BulkWorker*)sqlite3Fts5MallocZero(&rc,
+      (sizeof(Fts5BulkWorker) + sizeof(i64)*pConfig->nCol) * nThread
+  );
+  memset(&pool, 0, sizeof(pool));
+  fts5MutexInit(&pool.mutex);
+  fts5CondInit(&pool.condWork);
+  fts5CondInit(&pool.condDone);
+  for(i=0; rc==SQLITE_OK && i<nThread; i++){
+    Fts5BulkWorker *pW = &aWorker[i];
+    pW->pConfig = pConfig;
+    pW->pPool = &pool;
+    pW->aTotalSize = &((i64*)&aWorker[nThread])[i*pConfig->nCol];
+    rc = sqlite3Fts5IndexBulkOpen(pConfig, &pW->pIdx);
+    if( rc==SQLITE_OK ){
+      rc = sqlite3Fts5ConfigNewTokenizer(pConfig, &pW->pTok, &pW->pTokApi);
+    }
+  }
+
+  /* Start the worker threads. A worker whose thread cannot be started is
+  ** run inline by this thread in each round.  */
+  for(i=0; i<nThread; i++){
+    aStarted[i] = rc==SQLITE_OK 
+               && fts5ThreadStart(&aThread[i], &aWorker[i])==0;
+    nStarted += aStarted[i];
+  }
+
+  if( rc==SQLITE_OK ){
+    rc = fts5BulkRead(pConfig, pScan, aWorker, nThread, iBuf, &bEof);
+  }
+  while( rc==SQLITE_OK ){
+    int bLast = bEof;             /* True if this is the final round */
+
+    /* Start the workers on the documents read by the previous iteration. */
+    for(i=0; i<nThread; i++){
+      aWorker[i].iBuf = iBuf;
+      aWorker[i].bFlush = bLast;
+    }
+    fts5BulkPoolRound(&pool, nStarted);
+
+    /* While they run, write out the results of the previous round and read
+    ** the documents for the next.  */
+    rc = fts5BulkWrite(p, aWorker, nThread, !iBuf, &seg);
+    if( rc==SQLITE_OK && bLast==0 ){
+      rc = fts5BulkRead(pConfig, pScan, aWorker, nThread, !iBuf, &bEof);
+    }
+
+    for(i=0; i<nThread; i++){
+      if( aStarted[i]==0 ) fts5BulkWorkerRun(&aWorker[i]);
+    }
+    fts5BulkPoolWait(&pool);
+    for(i=0; i<nThread; i++){
+      Fts5BulkWorker *pW = &aWorker[i];
+      if( rc==SQLITE_OK ) rc = pW->rc;
+      if( rc==SQLITE_OK ) rc = sqlite3Fts5IndexBulkTake(pW->pIdx, &seg);
+    }
+    iBuf = !iBuf;
+    if( bLast ) break;
+  }
+  if( rc==SQLITE_OK ){
+    rc = fts5BulkWrite(p, aWorker, nThread, !iBuf, &seg);
+  }
+
+  /* Shut down the worker threads. */
+  fts5MutexEnter(&pool.mutex);
+  pool.bExit = 1;
+  fts5CondBroadcast(&pool.condWork);
+  fts5MutexLeave(&pool.mutex);
+  for(i=0; i<nThread; i++){
+    if( aStarted[i] ) fts5ThreadJoin(aThread[i]);
+  }
+  fts5CondFree(&pool.condDone);
+  fts5CondFree(&pool.condWork);
+  fts5MutexFree(&pool.mutex);
+
+  for(i=0; aWorker && i<nThread; i++){
+    Fts5BulkWorker *pW = &aWorker[i];
+    int iCol;
+    for(iCol=0; iCol<pConfig->nCol; iCol++){
+      p->aTotalSize[iCol] += pW->aTotalSize[iCol];
+    }
+    p->nTotalRow += pW->nRow;
+    if( pW->pTok ) pW->pTokApi->xDelete(pW->pTok);
+    sqlite3Fts5IndexClose(pW->pIdx);
+    sqlite3Fts5BufferFree(&pW->aDoc[0]);
+    sqlite3Fts5BufferFree(&pW->aDoc[1]);
+    sqlite3Fts5BufferFree(&pW->aSize[0]);
+    sqlite3Fts5BufferFree(&pW->aSize[1]);
+    sqlite3Fts5BufferFree(&pW->sz);
+  }
+  sqlite3Fts5BufferFree(&seg);
+  sqlite3_free(aWorker);
+  return rc;
+}
+#endif /* FTS5_BULK_THREADS */
+
+/*
+** Implementation of the 'rebuild' command. If nThread is greater than one,
+** the library is threadsafe and the table uses a built-in tokenizer, the
+** index is built using up to nThread worker threads. Otherwise it is built
+** by the calling thread.
+*/
+static int sqlite3Fts5StorageRebuild(Fts5Storage *p, int nThread){
   Fts5Buffer buf = {0,0,0};
   Fts5Config *pConfig = p->pConfig;
   sqlite3_stmt *pScan = 0;
@@ -18247,7 +19014,7 @@ static int sqlite3Fts5StorageRebuild(Fts5Storage *p){
   int rc;
 
   memset(&ctx, 0, sizeof(Fts5InsertCtx));
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   rc = sqlite3Fts5StorageDeleteAll(p);
   if( rc==SQLITE_OK ){
     rc = fts5StorageLoadTotals(p, 1);
@@ -18257,6 +19024,17 @@ static int sqlite3Fts5StorageRebuild(Fts5Storage *p){
     rc = fts5StorageGetStmt(p, FTS5_STMT_SCAN, &pScan, 0);
   }
 
+#if FTS5_BULK_THREADS
+  if( nThread>FTS5_BULK_MAX_THREAD ) nThread = FTS5_BULK_MAX_THREAD;
+  if( rc==SQLITE_OK && nThread>1 && sqlite3_threadsafe() 
+   && sqlite3Fts5TokenizerIsBuiltin(pConfig->pGlobal, 
+          (const char**)pConfig->azTokArg, pConfig->nTokArg)
+  ){
+    rc = fts5StorageRebuildThreads(p, pScan, nThread);
+  }else
+#else
+  UNUSED_PARAM(nThread);
+#endif
   while( rc==SQLITE_OK && SQLITE_ROW==sqlite3_step(pScan) ){
     i64 iRowid = sqlite3_column_int64(pScan, 0);
 
@@ -18379,7 +19157,7 @@ static int sqlite3Fts5StorageIndexInsert(
   Fts5Buffer buf;                 /* Buffer used to build up %_docsize blob */
 
   memset(&buf, 0, sizeof(Fts5Buffer));
-  ctx.pStorage = p;
+  ctx.pIdx = p->pIndex;
   rc = fts5StorageLoadTotals(p, 1);
 
   if( rc==SQLITE_OK ){
@@ -0,0 +1,1585 @@
+/*
+** 2018-11-26
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This file implements a VFS shim that stores each block of a database
+** file compressed.  It is intended for large, read-mostly databases that
+** are limited by I/O rather than by CPU.
+**
+** USAGE:
+**
+**    .load ./compressvfs
+**    .open 'file:big.db?vfs=compressvfs&codec=zlib&level=6&lru=512'
+**
+** The following URI parameters are recognized:
+**
+**    codec=zlib|deflate|none    Codec used to compress the blocks of a new
+**                               database.  "zlib" is deflate with a header
+**                               and checksum, "deflate" is raw deflate.
+**                               The codec of an existing database is read
+**                               from its header, so this is ignored for
+**                               existing files.  Default "zlib".
+**
+**    level=N                    Compression level (0..9) used for blocks
+**                               written by this connection.  Default 6.
+**
+**    lru=N                      Number of decompressed blocks this
+**                               connection keeps in an LRU cache.
+**                               Default 256.
+**
+** The block size is set when a new database is first written: it is the
+** size of the first write if that is a page of a valid SQLite page size,
+** or 4096 otherwise.  Set the page size before creating the first table
+** to choose it.  Writes that do not line up with blocks are handled by
+** read-modify-write, so a database remains usable if its page size is
+** later changed, though compression works best when the two are equal.
+**
+** Only the main database file is compressed.  Journals, WAL files and
+** temporary files are passed through to the underlying VFS unchanged, as
+** are existing ordinary (uncompressed) databases.
+**
+** FILE FORMAT:
+**
+** The file begins with two 512-byte header slots.  Each holds a magic
+** string, the block size and codec, a sequence number, the logical size of
+** the database, the location of the page map directory and free-list, and a
+** checksum.  The valid slot with the larger sequence number is current.
+**
+** The page map records, for each block, a 64-bit entry holding the offset
+** of its compressed image (in 64-byte granules) and its size in bytes.  An
+** entry of 0 is a block that has never been written and reads as zeros.  A
+** size equal to the block size is a block stored uncompressed.  The map is
+** stored in 4096-byte map blocks of 512 entries each.  The directory is an
+** array with the offset of each map block, and the free-list an array of
+** (offset, size) pairs describing unused space.
+**
+** Blocks, map blocks, the directory and the free-list are never written in
+** place.  New versions are written to free space and the space used by the
+** old versions is only reused after the next header has been synced, so
+** that a crash leaves the database as of the last successful xSync.  That
+** is the state the rollback journal expects to find.
+**
+** LIMITATIONS:
+**
+** Memory-mapped I/O is not available.  Because the file does not support
+** shared-memory, WAL mode may only be used with locking_mode=EXCLUSIVE.
+** The file does not shrink when the database does (use the backup API to
+** write a compacted copy), but free space is reused.
+*/
+#include "sqlite3ext.h"
+SQLITE_EXTENSION_INIT1
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <zlib.h>
+
+/* Magic string at the start of each header slot */
+#define CZ_MAGIC        "SQLite-compress1"
+#define CZ_MAGIC_SZ     16
+
+/* Size of each header slot, and of bytes written to each */
+#define CZ_SLOT_SIZE    512
+#define CZ_HDR_SIZE     76
+
+/* Offset of the first byte after the header slots */
+#define CZ_DATA_START   (2*CZ_SLOT_SIZE)
+
+/* Unit of allocation within the file */
+#define CZ_GRANULE_SHIFT 6
+#define CZ_GRANULE       (1<<CZ_GRANULE_SHIFT)
+#define CZ_ROUNDUP(n)    (((n)+CZ_GRANULE-1) & ~(sqlite3_int64)(CZ_GRANULE-1))
+
+/* Entries in each block of the page map */
+#define CZ_MAP_ENTRY    512
+#define CZ_MAP_SIZE     (CZ_MAP_ENTRY*8)
+
+/* Codecs.  These values are stored in the header. */
+#define CZ_CODEC_NONE    0
+#define CZ_CODEC_ZLIB    1
+#define CZ_CODEC_DEFLATE 2
+
+/* Defaults for the level= and lru= URI parameters */
+#define CZ_DEFAULT_LEVEL 6
+#define CZ_DEFAULT_CACHE 256
+
+/* Block size used if the first write is not a database page */
+#define CZ_DEFAULT_BLOCK 4096
+
+/* Largest block size.  Block sizes are stored in 20 bits of map entries. */
+#define CZ_MAX_BLOCK    65536
+
+/*
+** Forward declaration of objects used by this utility
+*/
+typedef struct CzFile CzFile;
+typedef struct CzHeader CzHeader;
+typedef struct CzExtent CzExtent;
+typedef struct CzPage CzPage;
+typedef unsigned char u8;
+typedef sqlite3_uint64 u64;
+
+/* Access to a lower-level VFS that (might) implement dynamic loading,
+** access to randomness, etc.
+*/
+#define ORIGVFS(p)  ((sqlite3_vfs*)((p)->pAppData))
+#define ORIGFILE(p) ((sqlite3_file*)(((CzFile*)(p))+1))
+
+/* The contents of a header slot */
+struct CzHeader {
+  int szBlock;                    /* Block size in bytes */
+  int eCodec;                     /* CZ_CODEC_* value */
+  u64 iSeq;                       /* Sequence number, 0 for a new file */
+  sqlite3_int64 iSize;            /* Logical size of the database */
+  sqlite3_int64 iEnd;             /* End of allocated storage */
+  sqlite3_int64 iDir;             /* Offset of the map directory */
+  int nDir;                       /* Number of map blocks */
+  sqlite3_int64 iFree;            /* Offset of the free-list */
+  int nFree;                      /* Number of free-list entries */
+};
+
+/* A range of bytes within the file */
+struct CzExtent {
+  sqlite3_int64 iOff;
+  sqlite3_int64 nByte;
+};
+
+/* A decompressed block in the LRU cache.  The block data follows. */
+struct CzPage {
+  sqlite3_int64 iBlk;             /* Block number */
+  CzPage *pHashNext;              /* Next entry with the same hash */
+  CzPage *pLruPrev;               /* Next more recently used entry */
+  CzPage *pLruNext;               /* Next less recently used entry */
+};
+
+/* An open file */
+struct CzFile {
+  sqlite3_file base;              /* IO methods */
+  CzHeader hdr;                   /* Header as of the last commit or load */
+  int szBlock;                    /* Block size, or 0 if not yet known */
+  int eCodec;                     /* CZ_CODEC_* value */
+  int iLevel;                     /* Compression level for writes */
+  int eLock;                      /* Current lock held on the file */
+  int bDirty;                     /* True if there are uncommitted changes */
+  sqlite3_int64 iSize;            /* Logical size of the database */
+  sqlite3_int64 iEnd;             /* End of allocated storage */
+
+  /* Page map.  apMap[i] is map block i, or NULL if it is not loaded. */
+  int nDir;                       /* Number of map blocks */
+  int nDirAlloc;                  /* Allocated size of the arrays below */
+  sqlite3_int64 *aDir;            /* File offset of each map block, or 0 */
+  u64 **apMap;                    /* Loaded map blocks */
+  u8 *aMapDirty;                  /* True for each modified map block */
+
+  /* Free space.  aFree[] is sorted by offset.  aPending[] is space that
+  ** was in use as of the last commit, and so may not be reused until the
+  ** next.  */
+  int nFree, nFreeAlloc;
+  CzExtent *aFree;
+  int nPending, nPendingAlloc;
+  CzExtent *aPending;
+
+  /* LRU cache of decompressed blocks */
+  int nCacheMax;                  /* Maximum number of entries */
+  int nCache;                     /* Current number of entries */
+  int nHash;                      /* Size of apHash[] */
+  CzPage **apHash;                /* Hash table on block number */
+  CzPage *pLruFirst;              /* Most recently used entry */
+  CzPage *pLruLast;               /* Least recently used entry */
+
+  /* Compression */
+  int bDeflate;                   /* True once zDeflate is initialized */
+  z_stream zDeflate;              /* Stream reused for each block written */
+  u8 *aCmp;                       /* Buffer for compressed block images */
+  u8 *aTmp;                       /* Buffer for read-modify-write */
+};
+
+/*
+** Methods for CzFile
+*/
+static int czClose(sqlite3_file*);
+static int czRead(sqlite3_file*, void*, int iAmt, sqlite3_int64 iOfst);
+static int czWrite(sqlite3_file*,const void*,int iAmt, sqlite3_int64 iOfst);
+static int czTruncate(sqlite3_file*, sqlite3_int64 size);
+static int czSync(sqlite3_file*, int flags);
+static int czFileSize(sqlite3_file*, sqlite3_int64 *pSize);
+static int czLock(sqlite3_file*, int);
+static int czUnlock(sqlite3_file*, int);
+static int czCheckReservedLock(sqlite3_file*, int *pResOut);
+static int czFileControl(sqlite3_file*, int op, void *pArg);
+static int czSectorSize(sqlite3_file*);
+static int czDeviceCharacteristics(sqlite3_file*);
+
+/*
+** Methods for CzVfs
+*/
+static int czOpen(sqlite3_vfs*, const char *, sqlite3_file*, int , int *);
+static int czDelete(sqlite3_vfs*, const char *zName, int syncDir);
+static int czAccess(sqlite3_vfs*, const char *zName, int flags, int *);
+static int czFullPathname(sqlite3_vfs*, const char *zName, int, char *zOut);
+static void *czDlOpen(sqlite3_vfs*, const char *zFilename);
+static void czDlError(sqlite3_vfs*, int nByte, char *zErrMsg);
+static void (*czDlSym(sqlite3_vfs *pVfs, void *p, const char*zSym))(void);
+static void czDlClose(sqlite3_vfs*, void*);
+static int czRandomness(sqlite3_vfs*, int nByte, char *zOut);
+static int czSleep(sqlite3_vfs*, int microseconds);
+static int czCurrentTime(sqlite3_vfs*, double*);
+static int czGetLastError(sqlite3_vfs*, int, char *);
+static int czCurrentTimeInt64(sqlite3_vfs*, sqlite3_int64*);
+static int czSetSystemCall(sqlite3_vfs*, const char*,sqlite3_syscall_ptr);
+static sqlite3_syscall_ptr czGetSystemCall(sqlite3_vfs*, const char *z);
+static const char *czNextSystemCall(sqlite3_vfs*, const char *zName);
+
+static sqlite3_vfs cz_vfs = {
+  3,                            /* iVersion (set when registered) */
+  0,                            /* szOsFile (set when registered) */
+  1024,                         /* mxPathname */
+  0,                            /* pNext */
+  "compressvfs",                /* zName */
+  0,                            /* pAppData (set when registered) */
+  czOpen,                       /* xOpen */
+  czDelete,                     /* xDelete */
+  czAccess,                     /* xAccess */
+  czFullPathname,               /* xFullPathname */
+  czDlOpen,                     /* xDlOpen */
+  czDlError,                    /* xDlError */
+  czDlSym,                      /* xDlSym */
+  czDlClose,                    /* xDlClose */
+  czRandomness,                 /* xRandomness */
+  czSleep,                      /* xSleep */
+  czCurrentTime,                /* xCurrentTime */
+  czGetLastError,               /* xGetLastError */
+  czCurrentTimeInt64,           /* xCurrentTimeInt64 */
+  czSetSystemCall,              /* xSetSystemCall */
+  czGetSystemCall,              /* xGetSystemCall */
+  czNextSystemCall              /* xNextSystemCall */
+};
+
+/* Version 1 methods: no shared-memory, and so no WAL except in exclusive
+** locking mode, and no memory-mapped I/O.  */
+static const sqlite3_io_methods cz_io_methods = {
+  1,                              /* iVersion */
+  czClose,                        /* xClose */
+  czRead,                         /* xRead */
+  czWrite,                        /* xWrite */
+  czTruncate,                     /* xTruncate */
+  czSync,                         /* xSync */
+  czFileSize,                     /* xFileSize */
+  czLock,                         /* xLock */
+  czUnlock,                       /* xUnlock */
+  czCheckReservedLock,            /* xCheckReservedLock */
+  czFileControl,                  /* xFileControl */
+  czSectorSize,                   /* xSectorSize */
+  czDeviceCharacteristics,        /* xDeviceCharacteristics */
+  0,                              /* xShmMap */
+  0,                              /* xShmLock */
+  0,                              /* xShmBarrier */
+  0,                              /* xShmUnmap */
+  0,                              /* xFetch */
+  0                               /* xUnfetch */
+};
+
+/*
+** Big-endian integer encoding.
+*/
+static void czPut32(u8 *a, unsigned int v){
+  a[0] = (u8)(v>>24);
+  a[1] = (u8)(v>>16);
+  a[2] = (u8)(v>>8);
+  a[3] = (u8)v;
+}
+static unsigned int czGet32(const u8 *a){
+  return ((unsigned int)a[0]<<24) + ((unsigned int)a[1]<<16)
+       + ((unsigned int)a[2]<<8) + (unsigned int)a[3];
+}
+static void czPut64(u8 *a, u64 v){
+  czPut32(a, (unsigned int)(v>>32));
+  czPut32(&a[4], (unsigned int)v);
+}
+static u64 czGet64(const u8 *a){
+  return ((u64)czGet32(a)<<32) + czGet32(&a[4]);
+}
+
+/*
+** Page map entries.  In memory, entries for blocks written since the last
+** commit also have the CZ_ENTRY_NEW bit set.  The space they use is not
+** part of the committed file, so may be reused as soon as the block is
+** written again.
+*/
+#define CZ_ENTRY(iOff, nByte) \
+    ((((u64)(iOff))>>CZ_GRANULE_SHIFT)<<20 | (u64)(nByte))
+#define CZ_ENTRY_OFFSET(e) ((sqlite3_int64)((e)>>20)<<CZ_GRANULE_SHIFT)
+#define CZ_ENTRY_SIZE(e)   ((int)((e) & 0x1FFFF))
+#define CZ_ENTRY_NEW       ((u64)1<<19)
+
+/*
+** Checksum of the first n bytes of header slot a[].
+*/
+static unsigned int czChecksum(const u8 *a, int n){
+  unsigned int s1 = 1, s2 = 0;
+  int i;
+  for(i=0; i<n; i++){
+    s1 += a[i];
+    s2 += s1;
+  }
+  return (s2<<16) ^ s1;
+}
+
+/*
+** Read the current header of file pSub into *pHdr.  If the file has no
+** valid header, set *pHdr to all zeroes (a new file) if it is no larger
+** than the header slots, or return SQLITE_CORRUPT otherwise.
+*/
+static int czReadHeader(sqlite3_file *pSub, CzHeader *pHdr){
+  u8 a[CZ_SLOT_SIZE*2];
+  sqlite3_int64 sz;
+  int bFound = 0;
+  int i;
+  int rc;
+
+  memset(pHdr, 0, sizeof(CzHeader));
+  rc = pSub->pMethods->xFileSize(pSub, &sz);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sz==0 ) return SQLITE_OK;
+  rc = pSub->pMethods->xRead(pSub, a, sizeof(a), 0);
+  if( rc==SQLITE_IOERR_SHORT_READ ){
+    rc = SQLITE_OK;
+  }else if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  for(i=0; i<2; i++){
+    const u8 *s = &a[i*CZ_SLOT_SIZE];
+    u64 iSeq;
+    if( memcmp(s, CZ_MAGIC, CZ_MAGIC_SZ) ) continue;
+    if( czGet32(&s[72])!=czChecksum(s, 72) ) continue;
+    iSeq = czGet64(&s[24]);
+    if( bFound && iSeq<=pHdr->iSeq ) continue;
+    bFound = 1;
+    pHdr->szBlock = (int)czGet32(&s[16]);
+    pHdr->eCodec = s[20];
+    pHdr->iSeq = iSeq;
+    pHdr->iSize = (sqlite3_int64)czGet64(&s[32]);
+    pHdr->iEnd = (sqlite3_int64)czGet64(&s[40]);
+    pHdr->iDir = (sqlite3_int64)czGet64(&s[48]);
+    pHdr->nDir = (int)czGet32(&s[56]);
+    pHdr->iFree = (sqlite3_int64)czGet64(&s[60]);
+    pHdr->nFree = (int)czGet32(&s[68]);
+  }
+  if( bFound==0 ){
+    return sz<=CZ_DATA_START ? SQLITE_OK : SQLITE_CORRUPT;
+  }
+  if( pHdr->szBlock<512 || pHdr->szBlock>CZ_MAX_BLOCK
+   || (pHdr->szBlock & (pHdr->szBlock-1))!=0
+   || pHdr->eCodec>CZ_CODEC_DEFLATE
+  ){
+    return SQLITE_CORRUPT;
+  }
+
+  /* The directory and free-list must lie within the file, and each be
+  ** small enough to read with a single call.  As the checksum only guards
+  ** against torn writes, this is what bounds the buffers that czLoad()
+  ** allocates for them. */
+  if( pHdr->nDir<0 || pHdr->nDir>0x0FFFFFFF
+   || pHdr->nFree<0 || pHdr->nFree>0x07FFFFFF
+   || (pHdr->nDir>0 && (pHdr->iDir<CZ_DATA_START
+                     || pHdr->iDir>sz-(sqlite3_int64)pHdr->nDir*8))
+   || (pHdr->nFree>0 && (pHdr->iFree<CZ_DATA_START
+                      || pHdr->iFree>sz-(sqlite3_int64)pHdr->nFree*16))
+  ){
+    return SQLITE_CORRUPT;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Write *pHdr to the header slot for its sequence number.
+*/
+static int czWriteHeader(sqlite3_file *pSub, const CzHeader *pHdr){
+  u8 a[CZ_HDR_SIZE];
+  memcpy(a, CZ_MAGIC, CZ_MAGIC_SZ);
+  czPut32(&a[16], (unsigned int)pHdr->szBlock);
+  a[20] = (u8)pHdr->eCodec;
+  a[21] = a[22] = a[23] = 0;
+  czPut64(&a[24], pHdr->iSeq);
+  czPut64(&a[32], (u64)pHdr->iSize);
+  czPut64(&a[40], (u64)pHdr->iEnd);
+  czPut64(&a[48], (u64)pHdr->iDir);
+  czPut32(&a[56], (unsigned int)pHdr->nDir);
+  czPut64(&a[60], (u64)pHdr->iFree);
+  czPut32(&a[68], (unsigned int)pHdr->nFree);
+  czPut32(&a[72], czChecksum(a, 72));
+  return pSub->pMethods->xWrite(
+      pSub, a, CZ_HDR_SIZE, (pHdr->iSeq & 1) * CZ_SLOT_SIZE
+  );
+}
+
+/*
+** Return true if file pSub begins with a compressvfs header.
+*/
+static int czIsCompressedFile(sqlite3_file *pSub){
+  u8 a[CZ_SLOT_SIZE + CZ_MAGIC_SZ];
+  int rc = pSub->pMethods->xRead(pSub, a, sizeof(a), 0);
+  if( rc!=SQLITE_OK && rc!=SQLITE_IOERR_SHORT_READ ) return 0;
+  return memcmp(a, CZ_MAGIC, CZ_MAGIC_SZ)==0
+      || memcmp(&a[CZ_SLOT_SIZE], CZ_MAGIC, CZ_MAGIC_SZ)==0;
+}
+
+/*
+** Read or write nByte bytes at offset iOff of file pSub.  Blobs of
+** metadata may be larger than the largest single read or write the
+** underlying VFS supports, so they are split into pieces.
+*/
+#define CZ_MAX_IO 65536
+static int czBlobRead(sqlite3_file *pSub, u8 *a, int nByte, sqlite3_int64 iOff){
+  int rc = SQLITE_OK;
+  while( rc==SQLITE_OK && nByte>0 ){
+    int n = nByte<CZ_MAX_IO ? nByte : CZ_MAX_IO;
+    rc = pSub->pMethods->xRead(pSub, a, n, iOff);
+    a += n;
+    iOff += n;
+    nByte -= n;
+  }
+  return rc;
+}
+static int czBlobWrite(
+  sqlite3_file *pSub,
+  const u8 *a,
+  int nByte,
+  sqlite3_int64 iOff
+){
+  int rc = SQLITE_OK;
+  while( rc==SQLITE_OK && nByte>0 ){
+    int n = nByte<CZ_MAX_IO ? nByte : CZ_MAX_IO;
+    rc = pSub->pMethods->xWrite(pSub, a, n, iOff);
+    a += n;
+    iOff += n;
+    nByte -= n;
+  }
+  return rc;
+}
+
+/*
+** LRU cache of decompressed blocks.
+*/
+#define CZ_PAGE_DATA(pPg) ((u8*)&(pPg)[1])
+
+static int czCacheHash(CzFile *p, sqlite3_int64 iBlk){
+  return (int)((u64)iBlk % (u64)p->nHash);
+}
+
+static void czCacheUnlinkLru(CzFile *p, CzPage *pPg){
+  if( pPg->pLruPrev ){
+    pPg->pLruPrev->pLruNext = pPg->pLruNext;
+  }else{
+    p->pLruFirst = pPg->pLruNext;
+  }
+  if( pPg->pLruNext ){
+    pPg->pLruNext->pLruPrev = pPg->pLruPrev;
+  }else{
+    p->pLruLast = pPg->pLruPrev;
+  }
+}
+
+static void czCacheLinkFirst(CzFile *p, CzPage *pPg){
+  pPg->pLruPrev = 0;
+  pPg->pLruNext = p->pLruFirst;
+  if( p->pLruFirst ) p->pLruFirst->pLruPrev = pPg;
+  p->pLruFirst = pPg;
+  if( p->pLruLast==0 ) p->pLruLast = pPg;
+}
+
+static void czCacheUnlinkHash(CzFile *p, CzPage *pPg){
+  CzPage **pp = &p->apHash[czCacheHash(p, pPg->iBlk)];
+  while( *pp!=pPg ) pp = &(*pp)->pHashNext;
+  *pp = pPg->pHashNext;
+}
+
+/*
+** Return the cache entry for block iBlk, or NULL if there is none.  An
+** entry that is found becomes the most recently used.
+*/
+static CzPage *czCacheFind(CzFile *p, sqlite3_int64 iBlk){
+  CzPage *pPg;
+  if( p->apHash==0 ) return 0;
+  for(pPg=p->apHash[czCacheHash(p, iBlk)]; pPg; pPg=pPg->pHashNext){
+    if( pPg->iBlk==iBlk ){
+      if( pPg!=p->pLruFirst ){
+        czCacheUnlinkLru(p, pPg);
+        czCacheLinkFirst(p, pPg);
+      }
+      return pPg;
+    }
+  }
+  return 0;
+}
+
+/*
+** Return a cache entry for block iBlk, which must not already be cached.
+** The least recently used entry is recycled if the cache is full.  The
+** contents of the returned entry are undefined.
+*/
+static CzPage *czCacheAdd(CzFile *p, sqlite3_int64 iBlk){
+  CzPage *pPg;
+  if( p->nCache>=p->nCacheMax ){
+    pPg = p->pLruLast;
+    czCacheUnlinkLru(p, pPg);
+    czCacheUnlinkHash(p, pPg);
+  }else{
+    pPg = (CzPage*)sqlite3_malloc64(sizeof(CzPage) + p->szBlock);
+    if( pPg==0 ) return 0;
+    p->nCache++;
+  }
+  pPg->iBlk = iBlk;
+  pPg->pHashNext = p->apHash[czCacheHash(p, iBlk)];
+  p->apHash[czCacheHash(p, iBlk)] = pPg;
+  czCacheLinkFirst(p, pPg);
+  return pPg;
+}
+
+/*
+** Remove entry pPg from the cache and free it.
+*/
+static void czCacheRemove(CzFile *p, CzPage *pPg){
+  czCacheUnlinkLru(p, pPg);
+  czCacheUnlinkHash(p, pPg);
+  sqlite3_free(pPg);
+  p->nCache--;
+}
+
+/*
+** Remove all cache entries for blocks iFirst and greater.
+*/
+static void czCacheDrop(CzFile *p, sqlite3_int64 iFirst){
+  CzPage *pPg = p->pLruFirst;
+  while( pPg ){
+    CzPage *pNext = pPg->pLruNext;
+    if( pPg->iBlk>=iFirst ) czCacheRemove(p, pPg);
+    pPg = pNext;
+  }
+}
+
+/*
+** Set the block size of the file and allocate the buffers that depend
+** on it.
+*/
+static int czSetBlockSize(CzFile *p, int szBlock){
+  assert( p->szBlock==0 && p->apHash==0 );
+  p->aCmp = (u8*)sqlite3_malloc64(szBlock);
+  p->aTmp = (u8*)sqlite3_malloc64(szBlock);
+  p->nHash = p->nCacheMax*2 + 1;
+  p->apHash = (CzPage**)sqlite3_malloc64(sizeof(CzPage*)*p->nHash);
+  if( p->aCmp==0 || p->aTmp==0 || p->apHash==0 ) return SQLITE_NOMEM;
+  memset(p->apHash, 0, sizeof(CzPage*)*p->nHash);
+  p->szBlock = szBlock;
+  return SQLITE_OK;
+}
+
+/*
+** Discard the in-memory page map, free-list and cache.
+*/
+static void czReset(CzFile *p){
+  int i;
+  czCacheDrop(p, 0);
+  for(i=0; i<p->nDir; i++) sqlite3_free(p->apMap[i]);
+  p->nDir = 0;
+  p->nFree = 0;
+  p->nPending = 0;
+  p->bDirty = 0;
+}
+
+/*
+** Grow the page map directory to hold at least nDir map blocks.
+*/
+static int czGrowDir(CzFile *p, int nDir){
+  if( nDir>p->nDirAlloc ){
+    int nNew = p->nDirAlloc ? p->nDirAlloc*2 : 16;
+    sqlite3_int64 *aDir;
+    u64 **apMap;
+    u8 *aDirty;
+    while( nNew<nDir ) nNew *= 2;
+    aDir = sqlite3_realloc64(p->aDir, sizeof(sqlite3_int64)*nNew);
+    if( aDir ) p->aDir = aDir;
+    apMap = sqlite3_realloc64(p->apMap, sizeof(u64*)*nNew);
+    if( apMap ) p->apMap = apMap;
+    aDirty = sqlite3_realloc64(p->aMapDirty, nNew);
+    if( aDirty ) p->aMapDirty = aDirty;
+    if( aDir==0 || apMap==0 || aDirty==0 ) return SQLITE_NOMEM;
+    p->nDirAlloc = nNew;
+  }
+  while( p->nDir<nDir ){
+    p->aDir[p->nDir] = 0;
+    p->apMap[p->nDir] = 0;
+    p->aMapDirty[p->nDir] = 0;
+    p->nDir++;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Load the current header, page map directory and free-list from the
+** file, discarding any in-memory state.  Map blocks are loaded as they
+** are needed.
+*/
+static int czLoad(CzFile *p){
+  sqlite3_file *pSub = ORIGFILE(p);
+  CzHeader hdr;
+  u8 *a = 0;
+  int rc;
+  int i;
+
+  czReset(p);
+  rc = czReadHeader(pSub, &hdr);
+  if( rc!=SQLITE_OK ) return rc;
+  if( hdr.iSeq==0 ){
+    /* A new file.  Keep the codec from the URI parameters. */
+    hdr.eCodec = p->eCodec;
+    hdr.iEnd = CZ_DATA_START;
+  }else if( p->szBlock!=0 && p->szBlock!=hdr.szBlock ){
+    return SQLITE_CORRUPT;
+  }
+  if( hdr.iSeq && p->szBlock==0 ){
+    rc = czSetBlockSize(p, hdr.szBlock);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  p->hdr = hdr;
+  p->eCodec = hdr.eCodec;
+  p->iSize = hdr.iSize;
+  p->iEnd = hdr.iEnd;
+
+  if( hdr.nDir>0 || hdr.nFree>0 ){
+    sqlite3_int64 nDirByte = (sqlite3_int64)hdr.nDir*8;
+    sqlite3_int64 nFreeByte = (sqlite3_int64)hdr.nFree*16;
+    a = (u8*)sqlite3_malloc64(nDirByte>nFreeByte ? nDirByte : nFreeByte);
+    if( a==0 ) return SQLITE_NOMEM;
+    rc = czGrowDir(p, hdr.nDir);
+    if( rc==SQLITE_OK && hdr.nDir>0 ){
+      rc = czBlobRead(pSub, a, (int)nDirByte, hdr.iDir);
+      for(i=0; rc==SQLITE_OK && i<hdr.nDir; i++){
+        p->aDir[i] = (sqlite3_int64)czGet64(&a[i*8]);
+      }
+    }
+    if( rc==SQLITE_OK && hdr.nFree>p->nFreeAlloc ){
+      CzExtent *aNew = sqlite3_realloc64(p->aFree, sizeof(CzExtent)*hdr.nFree);
+      if( aNew==0 ){
+        rc = SQLITE_NOMEM;
+      }else{
+        p->aFree = aNew;
+        p->nFreeAlloc = hdr.nFree;
+      }
+    }
+    if( rc==SQLITE_OK && hdr.nFree>0 ){
+      rc = czBlobRead(pSub, a, (int)nFreeByte, hdr.iFree);
+      for(i=0; rc==SQLITE_OK && i<hdr.nFree; i++){
+        CzExtent *pExt = &p->aFree[p->nFree];
+        pExt->iOff = (sqlite3_int64)czGet64(&a[i*16]);
+        pExt->nByte = (sqlite3_int64)czGet64(&a[i*16+8]);
+        if( pExt->nByte ) p->nFree++;
+      }
+    }
+    sqlite3_free(a);
+    if( rc==SQLITE_IOERR_SHORT_READ ) rc = SQLITE_CORRUPT;
+  }
+  return rc;
+}
+
+/*
+** Set *ppEntry to point to the page map entry for block iBlk.  If the
+** block is beyond the end of the map, set *ppEntry to NULL, unless bCreate
+** is true, in which case the map is extended.
+*/
+static int czMapEntry(
+  CzFile *p,
+  sqlite3_int64 iBlk,
+  int bCreate,
+  u64 **ppEntry
+){
+  sqlite3_int64 iMap = iBlk / CZ_MAP_ENTRY;
+  int rc = SQLITE_OK;
+
+  *ppEntry = 0;
+  if( iMap>=p->nDir ){
+    if( bCreate==0 ) return SQLITE_OK;
+    if( iMap>=0x7fffffff ) return SQLITE_FULL;
+    rc = czGrowDir(p, (int)iMap+1);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( p->apMap[iMap]==0 ){
+    u64 *aMap = (u64*)sqlite3_malloc64(CZ_MAP_SIZE);
+    if( aMap==0 ) return SQLITE_NOMEM;
+    if( p->aDir[iMap] ){
+      sqlite3_file *pSub = ORIGFILE(p);
+      u8 *a = (u8*)aMap;
+      int i;
+      rc = pSub->pMethods->xRead(pSub, a, CZ_MAP_SIZE, p->aDir[iMap]);
+      if( rc!=SQLITE_OK ){
+        sqlite3_free(aMap);
+        return rc==SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+      }
+      for(i=0; i<CZ_MAP_ENTRY; i++) aMap[i] = czGet64(&a[i*8]);
+    }else{
+      memset(aMap, 0, CZ_MAP_SIZE);
+    }
+    p->apMap[iMap] = aMap;
+  }
+  *ppEntry = &p->apMap[iMap][iBlk % CZ_MAP_ENTRY];
+  return rc;
+}
+
+/*
+** Allocate nByte bytes (a multiple of the granule size) of file space.
+** Space is taken from the first free extent large enough, or from the
+** end of the file.
+*/
+static int czAlloc(CzFile *p, sqlite3_int64 nByte, sqlite3_int64 *piOff){
+  int i;
+  assert( nByte==CZ_ROUNDUP(nByte) );
+  for(i=0; i<p->nFree; i++){
+    CzExtent *pExt = &p->aFree[i];
+    if( pExt->nByte>=nByte ){
+      *piOff = pExt->iOff;
+      pExt->iOff += nByte;
+      pExt->nByte -= nByte;
+      if( pExt->nByte==0 ){
+        p->nFree--;
+        memmove(pExt, &pExt[1], (p->nFree-i)*sizeof(CzExtent));
+      }
+      return SQLITE_OK;
+    }
+  }
+  *piOff = p->iEnd;
+  p->iEnd += nByte;
+  return SQLITE_OK;
+}
+
+/*
+** Release nByte bytes of file space at iOff.  The space may be reused
+** once the next commit is complete.
+*/
+static int czFree(CzFile *p, sqlite3_int64 iOff, sqlite3_int64 nByte){
+  if( p->nPending>=p->nPendingAlloc ){
+    int nNew = p->nPendingAlloc ? p->nPendingAlloc*2 : 64;
+    CzExtent *aNew = sqlite3_realloc64(p->aPending, sizeof(CzExtent)*nNew);
+    if( aNew==0 ) return SQLITE_NOMEM;
+    p->aPending = aNew;
+    p->nPendingAlloc = nNew;
+  }
+  p->aPending[p->nPending].iOff = iOff;
+  p->aPending[p->nPending].nByte = nByte;
+  p->nPending++;
+  return SQLITE_OK;
+}
+
+/*
+** Return nByte bytes of file space at iOff, which is not used by the last
+** commit, to the free-list immediately.
+*/
+static int czFreeNow(CzFile *p, sqlite3_int64 iOff, sqlite3_int64 nByte){
+  int iLo = 0, iHi = p->nFree;
+  CzExtent *aFree = p->aFree;
+
+  /* Find the first extent that starts after iOff */
+  while( iLo<iHi ){
+    int iMid = (iLo+iHi)/2;
+    if( aFree[iMid].iOff<iOff ){
+      iLo = iMid+1;
+    }else{
+      iHi = iMid;
+    }
+  }
+  if( iLo>0 && aFree[iLo-1].iOff+aFree[iLo-1].nByte==iOff ){
+    aFree[iLo-1].nByte += nByte;
+    if( iLo<p->nFree && iOff+nByte==aFree[iLo].iOff ){
+      aFree[iLo-1].nByte += aFree[iLo].nByte;
+      p->nFree--;
+      memmove(&aFree[iLo], &aFree[iLo+1], (p->nFree-iLo)*sizeof(CzExtent));
+    }
+    return SQLITE_OK;
+  }
+  if( iLo<p->nFree && iOff+nByte==aFree[iLo].iOff ){
+    aFree[iLo].iOff = iOff;
+    aFree[iLo].nByte += nByte;
+    return SQLITE_OK;
+  }
+  if( p->nFree>=p->nFreeAlloc ){
+    int nNew = p->nFreeAlloc ? p->nFreeAlloc*2 : 64;
+    aFree = sqlite3_realloc64(p->aFree, sizeof(CzExtent)*nNew);
+    if( aFree==0 ) return SQLITE_NOMEM;
+    p->aFree = aFree;
+    p->nFreeAlloc = nNew;
+  }
+  memmove(&aFree[iLo+1], &aFree[iLo], (p->nFree-iLo)*sizeof(CzExtent));
+  aFree[iLo].iOff = iOff;
+  aFree[iLo].nByte = nByte;
+  p->nFree++;
+  return SQLITE_OK;
+}
+
+/*
+** Release the space used by the block with page map entry e.
+*/
+static int czRelease(CzFile *p, u64 e){
+  sqlite3_int64 iOff = CZ_ENTRY_OFFSET(e);
+  sqlite3_int64 nByte = CZ_ROUNDUP(CZ_ENTRY_SIZE(e));
+  if( e & CZ_ENTRY_NEW ) return czFreeNow(p, iOff, nByte);
+  return czFree(p, iOff, nByte);
+}
+
+static int czExtentCmp(const void *a, const void *b){
+  sqlite3_int64 i1 = ((const CzExtent*)a)->iOff;
+  sqlite3_int64 i2 = ((const CzExtent*)b)->iOff;
+  return (i1>i2) - (i1<i2);
+}
+
+/*
+** Merge the pending extents into the free-list, coalescing adjacent
+** extents.  Return the merged list in *paOut (allocated with
+** sqlite3_malloc()) and its size in *pnOut.
+*/
+static int czMergeFree(CzFile *p, CzExtent **paOut, int *pnOut){
+  int nMax = p->nFree + p->nPending;
+  CzExtent *aOut;
+  int i1 = 0, i2 = 0, n = 0;
+
+  aOut = (CzExtent*)sqlite3_malloc64(sizeof(CzExtent)*(nMax ? nMax : 1));
+  if( aOut==0 ) return SQLITE_NOMEM;
+  qsort(p->aPending, p->nPending, sizeof(CzExtent), czExtentCmp);
+  while( i1<p->nFree || i2<p->nPending ){
+    CzExtent *pNext;
+    if( i2>=p->nPending
+     || (i1<p->nFree && p->aFree[i1].iOff<p->aPending[i2].iOff)
+    ){
+      pNext = &p->aFree[i1++];
+    }else{
+      pNext = &p->aPending[i2++];
+    }
+    if( n>0 && aOut[n-1].iOff+aOut[n-1].nByte==pNext->iOff ){
+      aOut[n-1].nByte += pNext->nByte;
+    }else{
+      aOut[n++] = *pNext;
+    }
+  }
+  *paOut = aOut;
+  *pnOut = n;
+  return SQLITE_OK;
+}
+
+/*
+** Write nByte bytes from a[] to newly allocated space, freeing the space
+** at *piOff (of nOld bytes) if *piOff is not zero.  Set *piOff to the
+** offset of the new space.
+*/
+static int czWriteMeta(
+  CzFile *p,
+  const u8 *a,
+  int nByte,
+  sqlite3_int64 nOld,
+  sqlite3_int64 *piOff
+){
+  sqlite3_file *pSub = ORIGFILE(p);
+  sqlite3_int64 iOff;
+  int rc;
+  if( *piOff ){
+    rc = czFree(p, *piOff, nOld);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  *piOff = 0;
+  if( nByte==0 ) return SQLITE_OK;
+  rc = czAlloc(p, CZ_ROUNDUP(nByte), &iOff);
+  if( rc==SQLITE_OK ){
+    rc = czBlobWrite(pSub, a, nByte, iOff);
+  }
+  if( rc==SQLITE_OK ) *piOff = iOff;
+  return rc;
+}
+
+/*
+** Make all changes since the last commit durable: write modified map
+** blocks, the directory and the free-list to new space, then the header.
+** If bSync is true, the file is synced (with flags) before and after the
+** header is written.
+*/
+static int czCommit(CzFile *p, int bSync, int flags){
+  sqlite3_file *pSub = ORIGFILE(p);
+  CzHeader hdr = p->hdr;
+  CzExtent *aMerged = 0;
+  int nMerged = 0;
+  u8 *a;
+  sqlite3_int64 nA;
+  int rc = SQLITE_OK;
+  int i;
+
+  if( p->bDirty==0 ) return SQLITE_OK;
+  assert( p->szBlock>0 );
+
+  /* Buffer for the largest of a map block, the directory or the free-list.
+  ** The free-list may grow by one entry for each extent released below.  */
+  nA = CZ_MAP_SIZE;
+  if( (sqlite3_int64)p->nDir*8>nA ) nA = (sqlite3_int64)p->nDir*8;
+  if( (sqlite3_int64)(p->nFree + p->nPending + p->nDir + 3)*16>nA ){
+    nA = (sqlite3_int64)(p->nFree + p->nPending + p->nDir + 3)*16;
+  }
+  a = (u8*)sqlite3_malloc64(nA);
+  if( a==0 ) return SQLITE_NOMEM;
+
+  /* Modified map blocks */
+  for(i=0; rc==SQLITE_OK && i<p->nDir; i++){
+    if( p->aMapDirty[i] ){
+      int j;
+      for(j=0; j<CZ_MAP_ENTRY; j++){
+        p->apMap[i][j] &= ~CZ_ENTRY_NEW;
+        czPut64(&a[j*8], p->apMap[i][j]);
+      }
+      rc = czWriteMeta(p, a, CZ_MAP_SIZE, CZ_MAP_SIZE, &p->aDir[i]);
+    }
+  }
+
+  /* The directory */
+  for(i=0; rc==SQLITE_OK && i<p->nDir; i++){
+    czPut64(&a[i*8], (u64)p->aDir[i]);
+  }
+  if( rc==SQLITE_OK ){
+    rc = czWriteMeta(p, a, p->nDir*8, CZ_ROUNDUP(hdr.nDir*8), &hdr.iDir);
+    hdr.nDir = hdr.iDir ? p->nDir : 0;
+  }
+
+  /* The free-list.  The space for it is allocated before the list is
+  ** built, so that the list does not include it.  Space released by this
+  ** commit is included, as it is free once the header is written.  */
+  if( rc==SQLITE_OK && hdr.iFree ){
+    rc = czFree(p, hdr.iFree, CZ_ROUNDUP(hdr.nFree*16));
+    hdr.iFree = 0;
+  }
+  if( rc==SQLITE_OK ){
+    rc = czMergeFree(p, &aMerged, &hdr.nFree);
+    sqlite3_free(aMerged);
+    aMerged = 0;
+    hdr.nFree++;
+  }
+  if( rc==SQLITE_OK && hdr.nFree>0 ){
+    rc = czAlloc(p, CZ_ROUNDUP(hdr.nFree*16), &hdr.iFree);
+  }
+  if( rc==SQLITE_OK ){
+    rc = czMergeFree(p, &aMerged, &nMerged);
+  }
+  if( rc==SQLITE_OK && hdr.iFree ){
+    /* Allocating space for the list may split an extent, so space for
+    ** one more extent than before is allocated.  Unused entries are
+    ** written as empty.  */
+    assert( nMerged<=hdr.nFree );
+    memset(a, 0, hdr.nFree*16);
+    for(i=0; i<nMerged; i++){
+      czPut64(&a[i*16], (u64)aMerged[i].iOff);
+      czPut64(&a[i*16+8], (u64)aMerged[i].nByte);
+    }
+    rc = czBlobWrite(pSub, a, hdr.nFree*16, hdr.iFree);
+  }
+  sqlite3_free(a);
+
+  /* The header */
+  if( rc==SQLITE_OK && bSync ){
+    rc = pSub->pMethods->xSync(pSub, flags);
+  }
+  if( rc==SQLITE_OK ){
+    hdr.szBlock = p->szBlock;
+    hdr.eCodec = p->eCodec;
+    hdr.iSeq++;
+    hdr.iSize = p->iSize;
+    hdr.iEnd = p->iEnd;
+    rc = czWriteHeader(pSub, &hdr);
+  }
+  if( rc==SQLITE_OK && bSync ){
+    rc = pSub->pMethods->xSync(pSub, flags);
+  }
+
+  if( rc==SQLITE_OK ){
+    sqlite3_free(p->aFree);
+    p->aFree = aMerged;
+    p->nFree = p->nFreeAlloc = nMerged;
+    p->nPending = 0;
+    memset(p->aMapDirty, 0, p->nDir);
+    p->hdr = hdr;
+    p->bDirty = 0;
+  }else{
+    /* Nothing was committed.  The space used by the old directory and
+    ** free-list is already pending, so remember the new ones in order that
+    ** the next attempt releases them.  */
+    sqlite3_free(aMerged);
+    p->hdr.iDir = hdr.iDir;
+    p->hdr.nDir = hdr.nDir;
+    p->hdr.iFree = hdr.iFree;
+    p->hdr.nFree = hdr.nFree;
+  }
+  return rc;
+}
+
+/*
+** Compress block aIn[].  Set *paOut and *pnOut to the image to store.  If
+** compressing does not save at least one granule, this is aIn[] itself.
+*/
+static int czCompress(CzFile *p, const u8 *aIn, const u8 **paOut, int *pnOut){
+  int rc;
+  *paOut = aIn;
+  *pnOut = p->szBlock;
+  if( p->eCodec==CZ_CODEC_NONE ) return SQLITE_OK;
+
+  if( p->bDeflate==0 ){
+    memset(&p->zDeflate, 0, sizeof(z_stream));
+    rc = deflateInit2(&p->zDeflate, p->iLevel, Z_DEFLATED,
+        p->eCodec==CZ_CODEC_ZLIB ? 15 : -15, 8, Z_DEFAULT_STRATEGY
+    );
+    if( rc!=Z_OK ) return SQLITE_NOMEM;
+    p->bDeflate = 1;
+  }else if( deflateReset(&p->zDeflate)!=Z_OK ){
+    return SQLITE_ERROR;
+  }
+  p->zDeflate.next_in = (unsigned char*)aIn;
+  p->zDeflate.avail_in = p->szBlock;
+  p->zDeflate.next_out = p->aCmp;
+  p->zDeflate.avail_out = p->szBlock - CZ_GRANULE;
+  rc = deflate(&p->zDeflate, Z_FINISH);
+  if( rc==Z_STREAM_END ){
+    *paOut = p->aCmp;
+    *pnOut = (int)(p->szBlock - CZ_GRANULE - p->zDeflate.avail_out);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Decompress the nIn byte image aIn[] of a block into aOut[].
+*/
+static int czUncompress(CzFile *p, const u8 *aIn, int nIn, u8 *aOut){
+  z_stream s;
+  int rc;
+  memset(&s, 0, sizeof(s));
+  if( inflateInit2(&s, p->eCodec==CZ_CODEC_ZLIB ? 15 : -15)!=Z_OK ){
+    return SQLITE_NOMEM;
+  }
+  s.next_in = (unsigned char*)aIn;
+  s.avail_in = nIn;
+  s.next_out = aOut;
+  s.avail_out = p->szBlock;
+  rc = inflate(&s, Z_FINISH);
+  inflateEnd(&s);
+  return (rc==Z_STREAM_END && s.avail_out==0) ? SQLITE_OK : SQLITE_CORRUPT;
+}
+
+/*
+** Set *paData to point to the contents of block iBlk, which is loaded into
+** the cache if it is not already there.  The pointer is valid until the
+** next call that modifies the cache.
+*/
+static int czFetch(CzFile *p, sqlite3_int64 iBlk, u8 **paData){
+  sqlite3_file *pSub = ORIGFILE(p);
+  CzPage *pPg;
+  u64 *pEntry;
+  u8 *aData;
+  int rc;
+
+  pPg = czCacheFind(p, iBlk);
+  if( pPg ){
+    *paData = CZ_PAGE_DATA(pPg);
+    return SQLITE_OK;
+  }
+  rc = czMapEntry(p, iBlk, 0, &pEntry);
+  if( rc!=SQLITE_OK ) return rc;
+  pPg = czCacheAdd(p, iBlk);
+  if( pPg==0 ) return SQLITE_NOMEM;
+  aData = CZ_PAGE_DATA(pPg);
+
+  if( pEntry==0 || *pEntry==0 ){
+    memset(aData, 0, p->szBlock);
+  }else{
+    sqlite3_int64 iOff = CZ_ENTRY_OFFSET(*pEntry);
+    int nByte = CZ_ENTRY_SIZE(*pEntry);
+    if( nByte==p->szBlock ){
+      rc = pSub->pMethods->xRead(pSub, aData, nByte, iOff);
+    }else if( nByte>p->szBlock ){
+      rc = SQLITE_CORRUPT;
+    }else{
+      rc = pSub->pMethods->xRead(pSub, p->aCmp, nByte, iOff);
+      if( rc==SQLITE_OK ) rc = czUncompress(p, p->aCmp, nByte, aData);
+    }
+    if( rc!=SQLITE_OK ){
+      czCacheRemove(p, pPg);
+      if( rc==SQLITE_IOERR_SHORT_READ ) rc = SQLITE_CORRUPT;
+      return rc;
+    }
+  }
+  *paData = aData;
+  return SQLITE_OK;
+}
+
+/*
+** Write the szBlock bytes in aData[] as block iBlk.
+*/
+static int czStore(CzFile *p, sqlite3_int64 iBlk, const u8 *aData){
+  sqlite3_file *pSub = ORIGFILE(p);
+  const u8 *aOut;
+  int nOut;
+  sqlite3_int64 iOff;
+  u64 *pEntry;
+  CzPage *pPg;
+  int rc;
+
+  rc = czMapEntry(p, iBlk, 1, &pEntry);
+  if( rc==SQLITE_OK ) rc = czCompress(p, aData, &aOut, &nOut);
+  if( rc==SQLITE_OK ) rc = czAlloc(p, CZ_ROUNDUP(nOut), &iOff);
+  if( rc==SQLITE_OK ) rc = pSub->pMethods->xWrite(pSub, aOut, nOut, iOff);
+  if( rc==SQLITE_OK && *pEntry ){
+    rc = czRelease(p, *pEntry);
+  }
+  if( rc==SQLITE_OK ){
+    *pEntry = CZ_ENTRY(iOff, nOut) | CZ_ENTRY_NEW;
+    p->aMapDirty[iBlk / CZ_MAP_ENTRY] = 1;
+    p->bDirty = 1;
+    pPg = czCacheFind(p, iBlk);
+    if( pPg ) memcpy(CZ_PAGE_DATA(pPg), aData, p->szBlock);
+  }
+  return rc;
+}
+
+/*
+** Close a compressed file.
+*/
+static int czClose(sqlite3_file *pFile){
+  CzFile *p = (CzFile *)pFile;
+  int rc;
+  rc = czCommit(p, 0, 0);
+  czReset(p);
+  if( p->bDeflate ) deflateEnd(&p->zDeflate);
+  sqlite3_free(p->aDir);
+  sqlite3_free(p->apMap);
+  sqlite3_free(p->aMapDirty);
+  sqlite3_free(p->aFree);
+  sqlite3_free(p->aPending);
+  sqlite3_free(p->apHash);
+  sqlite3_free(p->aCmp);
+  sqlite3_free(p->aTmp);
+  pFile = ORIGFILE(pFile);
+  if( rc==SQLITE_OK ){
+    rc = pFile->pMethods->xClose(pFile);
+  }else{
+    pFile->pMethods->xClose(pFile);
+  }
+  return rc;
+}
+
+/*
+** Read data from a compressed file.
+*/
+static int czRead(
+  sqlite3_file *pFile,
+  void *zBuf,
+  int iAmt,
+  sqlite_int64 iOfst
+){
+  CzFile *p = (CzFile *)pFile;
+  u8 *zOut = (u8*)zBuf;
+  int nValid = 0;
+  int rc = SQLITE_OK;
+
+  if( iOfst<p->iSize ){
+    nValid = (p->iSize-iOfst)<iAmt ? (int)(p->iSize-iOfst) : iAmt;
+  }
+  while( rc==SQLITE_OK && nValid>0 ){
+    sqlite3_int64 iBlk = iOfst / p->szBlock;
+    int iIn = (int)(iOfst % p->szBlock);
+    int n = p->szBlock - iIn;
+    u8 *aData;
+    if( n>nValid ) n = nValid;
+    rc = czFetch(p, iBlk, &aData);
+    if( rc==SQLITE_OK ){
+      memcpy(zOut, &aData[iIn], n);
+      zOut += n;
+      iOfst += n;
+      iAmt -= n;
+      nValid -= n;
+    }
+  }
+  if( rc==SQLITE_OK && iAmt>0 ){
+    memset(zOut, 0, iAmt);
+    rc = SQLITE_IOERR_SHORT_READ;
+  }
+  return rc;
+}
+
+/*
+** Write data to a compressed file.
+*/
+static int czWrite(
+  sqlite3_file *pFile,
+  const void *zBuf,
+  int iAmt,
+  sqlite_int64 iOfst
+){
+  CzFile *p = (CzFile *)pFile;
+  const u8 *zIn = (const u8*)zBuf;
+  sqlite3_int64 iEnd = iOfst + iAmt;
+  int rc = SQLITE_OK;
+
+  if( p->szBlock==0 ){
+    int sz = CZ_DEFAULT_BLOCK;
+    if( iOfst==0 && iAmt>=512 && iAmt<=CZ_MAX_BLOCK && (iAmt&(iAmt-1))==0 ){
+      sz = iAmt;
+    }
+    rc = czSetBlockSize(p, sz);
+  }
+  while( rc==SQLITE_OK && iAmt>0 ){
+    sqlite3_int64 iBlk = iOfst / p->szBlock;
+    int iIn = (int)(iOfst % p->szBlock);
+    int n = p->szBlock - iIn;
+    if( n>iAmt ) n = iAmt;
+    if( n==p->szBlock ){
+      rc = czStore(p, iBlk, zIn);
+    }else{
+      u8 *aData;
+      rc = czFetch(p, iBlk, &aData);
+      if( rc==SQLITE_OK ){
+        memcpy(p->aTmp, aData, p->szBlock);
+        memcpy(&p->aTmp[iIn], zIn, n);
+        rc = czStore(p, iBlk, p->aTmp);
+      }
+    }
+    zIn += n;
+    iOfst += n;
+    iAmt -= n;
+  }
+  if( rc==SQLITE_OK && iEnd>p->iSize ){
+    p->iSize = iEnd;
+    p->bDirty = 1;
+  }
+  return rc;
+}
+
+/*
+** Truncate a compressed file.
+*/
+static int czTruncate(sqlite3_file *pFile, sqlite_int64 size){
+  CzFile *p = (CzFile *)pFile;
+  sqlite3_int64 iFirst;           /* First block to remove */
+  sqlite3_int64 iBlk;
+  int nDir;
+  int rc = SQLITE_OK;
+
+  if( size>=p->iSize || p->szBlock==0 ){
+    if( size!=p->iSize ){
+      p->iSize = size;
+      p->bDirty = 1;
+    }
+    return SQLITE_OK;
+  }
+
+  /* Zero the tail of a partial last block, so that it does not reappear
+  ** if the file is extended again.  */
+  iFirst = (size + p->szBlock - 1) / p->szBlock;
+  if( size % p->szBlock ){
+    u8 *aData;
+    int iIn = (int)(size % p->szBlock);
+    rc = czFetch(p, size / p->szBlock, &aData);
+    if( rc==SQLITE_OK ){
+      memcpy(p->aTmp, aData, iIn);
+      memset(&p->aTmp[iIn], 0, p->szBlock - iIn);
+      rc = czStore(p, size / p->szBlock, p->aTmp);
+    }
+  }
+
+  /* Release the blocks and map blocks past the new end of file */
+  czCacheDrop(p, iFirst);
+  nDir = (int)((iFirst + CZ_MAP_ENTRY - 1) / CZ_MAP_ENTRY);
+  for(iBlk=iFirst; rc==SQLITE_OK && iBlk<(sqlite3_int64)p->nDir*CZ_MAP_ENTRY;
+      iBlk++){
+    u64 *pEntry;
+    if( iBlk % CZ_MAP_ENTRY==0 && p->aDir[iBlk/CZ_MAP_ENTRY]==0
+     && p->apMap[iBlk/CZ_MAP_ENTRY]==0
+    ){
+      iBlk += CZ_MAP_ENTRY-1;
+      continue;
+    }
+    rc = czMapEntry(p, iBlk, 0, &pEntry);
+    if( rc==SQLITE_OK && *pEntry ){
+      rc = czRelease(p, *pEntry);
+      *pEntry = 0;
+      p->aMapDirty[iBlk / CZ_MAP_ENTRY] = 1;
+    }
+  }
+  while( rc==SQLITE_OK && p->nDir>nDir ){
+    p->nDir--;
+    if( p->aDir[p->nDir] ){
+      rc = czFree(p, p->aDir[p->nDir], CZ_MAP_SIZE);
+    }
+    sqlite3_free(p->apMap[p->nDir]);
+  }
+  if( rc==SQLITE_OK ){
+    p->iSize = size;
+    p->bDirty = 1;
+  }
+  return rc;
+}
+
+/*
+** Sync a compressed file.  This is when changes are committed.
+*/
+static int czSync(sqlite3_file *pFile, int flags){
+  return czCommit((CzFile*)pFile, 1, flags);
+}
+
+/*
+** Return the current (uncompressed) size of a compressed file.
+*/
+static int czFileSize(sqlite3_file *pFile, sqlite_int64 *pSize){
+  *pSize = ((CzFile*)pFile)->iSize;
+  return SQLITE_OK;
+}
+
+/*
+** Lock a compressed file.  When a SHARED lock is first obtained, check
+** whether another connection has committed changes, and reload the page
+** map if so.
+*/
+static int czLock(sqlite3_file *pFile, int eLock){
+  CzFile *p = (CzFile *)pFile;
+  sqlite3_file *pSub = ORIGFILE(pFile);
+  int rc;
+  rc = pSub->pMethods->xLock(pSub, eLock);
+  if( rc==SQLITE_OK && p->eLock==SQLITE_LOCK_NONE ){
+    CzHeader hdr;
+    rc = czReadHeader(pSub, &hdr);
+    if( rc==SQLITE_OK && hdr.iSeq!=p->hdr.iSeq ){
+      rc = czLoad(p);
+    }
+    if( rc!=SQLITE_OK ){
+      pSub->pMethods->xUnlock(pSub, SQLITE_LOCK_NONE);
+      return rc;
+    }
+  }
+  if( rc==SQLITE_OK ) p->eLock = eLock;
+  return rc;
+}
+
+/*
+** Unlock a compressed file.  Changes not yet committed by xSync (if the
+** database uses synchronous=OFF) are committed before the lock is
+** released.
+*/
+static int czUnlock(sqlite3_file *pFile, int eLock){
+  CzFile *p = (CzFile *)pFile;
+  sqlite3_file *pSub = ORIGFILE(pFile);
+  int rc = SQLITE_OK;
+  if( eLock<=SQLITE_LOCK_SHARED ){
+    rc = czCommit(p, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = pSub->pMethods->xUnlock(pSub, eLock);
+    if( rc==SQLITE_OK ) p->eLock = eLock;
+  }
+  return rc;
+}
+
+/*
+** Check if another file-handle holds a RESERVED lock on a compressed file.
+*/
+static int czCheckReservedLock(sqlite3_file *pFile, int *pResOut){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xCheckReservedLock(pFile, pResOut);
+}
+
+/*
+** File control method. For custom operations on a compressed file.
+*/
+static int czFileControl(sqlite3_file *pFile, int op, void *pArg){
+  static const char *azCodec[] = { "none", "zlib", "deflate" };
+  CzFile *p = (CzFile *)pFile;
+  int rc;
+  /* Size hints are in terms of the uncompressed file */
+  if( op==SQLITE_FCNTL_SIZE_HINT ) return SQLITE_OK;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xFileControl(pFile, op, pArg);
+  if( rc==SQLITE_OK && op==SQLITE_FCNTL_VFSNAME ){
+    *(char**)pArg = sqlite3_mprintf("compress(%s,%d)/%z",
+        azCodec[p->eCodec], p->iLevel, *(char**)pArg
+    );
+  }
+  return rc;
+}
+
+/*
+** Return the sector-size in bytes for a compressed file.
+*/
+static int czSectorSize(sqlite3_file *pFile){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xSectorSize(pFile);
+}
+
+/*
+** Return the device characteristic flags supported by a compressed file.
+** Blocks are written as several writes to the underlying file, so none
+** of the atomic write properties hold.
+*/
+static int czDeviceCharacteristics(sqlite3_file *pFile){
+  int iCap;
+  pFile = ORIGFILE(pFile);
+  iCap = pFile->pMethods->xDeviceCharacteristics(pFile);
+  return iCap & (SQLITE_IOCAP_POWERSAFE_OVERWRITE
+               | SQLITE_IOCAP_UNDELETABLE_WHEN_OPEN);
+}
+
+/*
+** Open a compressed file handle.
+*/
+static int czOpen(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_file *pFile,
+  int flags,
+  int *pOutFlags
+){
+  CzFile *p;
+  sqlite3_file *pSubFile;
+  sqlite3_vfs *pSubVfs;
+  const char *zCodec;
+  int rc;
+  sqlite3_int64 sz;
+  pSubVfs = ORIGVFS(pVfs);
+  if( (flags & SQLITE_OPEN_MAIN_DB)==0 ){
+    return pSubVfs->xOpen(pSubVfs, zName, pFile, flags, pOutFlags);
+  }
+  p = (CzFile*)pFile;
+  memset(p, 0, sizeof(*p));
+  pSubFile = ORIGFILE(pFile);
+  rc = pSubVfs->xOpen(pSubVfs, zName, pSubFile, flags, pOutFlags);
+  if( rc ) goto cz_open_done;
+  rc = pSubFile->pMethods->xFileSize(pSubFile, &sz);
+  if( rc ){
+    pSubFile->pMethods->xClose(pSubFile);
+    goto cz_open_done;
+  }
+  if( sz>0 && !czIsCompressedFile(pSubFile) ){
+    memmove(pFile, pSubFile, pSubVfs->szOsFile);
+    return SQLITE_OK;
+  }
+
+  p->base.pMethods = &cz_io_methods;
+  p->eCodec = CZ_CODEC_ZLIB;
+  zCodec = sqlite3_uri_parameter(zName, "codec");
+  if( zCodec ){
+    if( sqlite3_stricmp(zCodec, "none")==0 ){
+      p->eCodec = CZ_CODEC_NONE;
+    }else if( sqlite3_stricmp(zCodec, "deflate")==0 ){
+      p->eCodec = CZ_CODEC_DEFLATE;
+    }else if( sqlite3_stricmp(zCodec, "zlib")!=0 ){
+      rc = SQLITE_ERROR;
+    }
+  }
+  p->iLevel = (int)sqlite3_uri_int64(zName, "level", CZ_DEFAULT_LEVEL);
+  if( p->iLevel<0 || p->iLevel>9 ) rc = SQLITE_ERROR;
+  p->nCacheMax = (int)sqlite3_uri_int64(zName, "lru", CZ_DEFAULT_CACHE);
+  if( p->nCacheMax<1 ) p->nCacheMax = 1;
+  if( rc==SQLITE_OK ) rc = czLoad(p);
+  if( rc ){
+    czClose(pFile);
+  }
+cz_open_done:
+  if( rc ) pFile->pMethods = 0;
+  return rc;
+}
+
+/*
+** All other VFS methods are pass-thrus.
+*/
+static int czDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync){
+  return ORIGVFS(pVfs)->xDelete(ORIGVFS(pVfs), zPath, dirSync);
+}
+static int czAccess(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int flags,
+  int *pResOut
+){
+  return ORIGVFS(pVfs)->xAccess(ORIGVFS(pVfs), zPath, flags, pResOut);
+}
+static int czFullPathname(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int nOut,
+  char *zOut
+){
+  return ORIGVFS(pVfs)->xFullPathname(ORIGVFS(pVfs),zPath,nOut,zOut);
+}
+static void *czDlOpen(sqlite3_vfs *pVfs, const char *zPath){
+  return ORIGVFS(pVfs)->xDlOpen(ORIGVFS(pVfs), zPath);
+}
+static void czDlError(sqlite3_vfs *pVfs, int nByte, char *zErrMsg){
+  ORIGVFS(pVfs)->xDlError(ORIGVFS(pVfs), nByte, zErrMsg);
+}
+static void (*czDlSym(sqlite3_vfs *pVfs, void *p, const char *zSym))(void){
+  return ORIGVFS(pVfs)->xDlSym(ORIGVFS(pVfs), p, zSym);
+}
+static void czDlClose(sqlite3_vfs *pVfs, void *pHandle){
+  ORIGVFS(pVfs)->xDlClose(ORIGVFS(pVfs), pHandle);
+}
+static int czRandomness(sqlite3_vfs *pVfs, int nByte, char *zBufOut){
+  return ORIGVFS(pVfs)->xRandomness(ORIGVFS(pVfs), nByte, zBufOut);
+}
+static int czSleep(sqlite3_vfs *pVfs, int nMicro){
+  return ORIGVFS(pVfs)->xSleep(ORIGVFS(pVfs), nMicro);
+}
+static int czCurrentTime(sqlite3_vfs *pVfs, double *pTimeOut){
+  return ORIGVFS(pVfs)->xCurrentTime(ORIGVFS(pVfs), pTimeOut);
+}
+static int czGetLastError(sqlite3_vfs *pVfs, int a, char *b){
+  return ORIGVFS(pVfs)->xGetLastError(ORIGVFS(pVfs), a, b);
+}
+static int czCurrentTimeInt64(sqlite3_vfs *pVfs, sqlite3_int64 *p){
+  return ORIGVFS(pVfs)->xCurrentTimeInt64(ORIGVFS(pVfs), p);
+}
+static int czSetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_syscall_ptr pCall
+){
+  return ORIGVFS(pVfs)->xSetSystemCall(ORIGVFS(pVfs),zName,pCall);
+}
+static sqlite3_syscall_ptr czGetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName
+){
+  return ORIGVFS(pVfs)->xGetSystemCall(ORIGVFS(pVfs),zName);
+}
+static const char *czNextSystemCall(sqlite3_vfs *pVfs, const char *zName){
+  return ORIGVFS(pVfs)->xNextSystemCall(ORIGVFS(pVfs), zName);
+}
+
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+/*
+** This routine is called when the extension is loaded.
+** Register the new VFS.
+*/
+int sqlite3_compressvfs_init(
+  sqlite3 *db,
+  char **pzErrMsg,
+  const sqlite3_api_routines *pApi
+){
+  int rc = SQLITE_OK;
+  sqlite3_vfs *pOrig;
+  SQLITE_EXTENSION_INIT2(pApi);
+  (void)pzErrMsg;
+  (void)db;
+  pOrig = sqlite3_vfs_find(0);
+  cz_vfs.iVersion = pOrig->iVersion;
+  cz_vfs.pAppData = pOrig;
+  cz_vfs.szOsFile = pOrig->szOsFile + sizeof(CzFile);
+  rc = sqlite3_vfs_register(&cz_vfs, 0);
+  if( rc==SQLITE_OK ) rc = SQLITE_OK_LOAD_PERMANENTLY;
+  return rc;
+}
@@ -38,6 +38,28 @@
 **
 ** Some extra debugging features (used for testing virtual tables) are available
 ** if this module is compiled with -DSQLITE_TEST.
+**
+** If the mmap=YES parameter is supplied, the CSV file is memory-mapped
+** (or, for data=, used in place) instead of being read one character at
+** a time.  Delimiters and quotes are located with SSE2/AVX2 search kernels
+** where the CPU has them.  The first scan splits the file into chunks that
+** are scanned by threads=N worker threads (default: one per CPU) to build
+** an array holding the offset of every row.  Later scans reuse the array,
+** and constraints on rowid seek directly to the matching rows.  The
+** index=FILENAME parameter saves the row offsets to a sidecar file so that
+** later connections can skip the initial scan for as long as the size,
+** modification time (to the nanosecond where the OS records it) and a
+** sampled hash of the content of the CSV file are unchanged, and the
+** offsets fall on row boundaries.  Either of threads= or index= implies
+** mmap=YES.
+**
+**    CREATE VIRTUAL TABLE temp.big USING csv(
+**       filename = "export.csv", header = YES,
+**       mmap = YES, threads = 8, index = "export.csv.idx"
+**    );
+**
+** The mmap=YES scanner requires rfc4180 quoting: a '"' character may only
+** appear at the start of a field or doubled inside a quoted field.
 */
 #include <sqlite3ext.h>
 SQLITE_EXTENSION_INIT1
@@ -47,6 +69,30 @@ SQLITE_EXTENSION_INIT1
 #include <stdarg.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <pthread.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+# include <emmintrin.h>
+# define CSV_HAVE_SSE2 1
+#endif
+#if defined(CSV_HAVE_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define CSV_HAVE_AVX2 1
+#endif
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
 
 #ifndef SQLITE_OMIT_VIRTUALTABLE
 
@@ -285,6 +331,238 @@ static char *csv_read_one_field(CsvReader *p){
   return p->z;
 }
 
+/*
+** Search kernels used by the mmap=YES scanner.  Each returns the offset
+** of the first byte of z[0..n-1] that is equal to either c1 or c2, or n
+** if there is no such byte.  csv_find2 points at the fastest kernel that
+** the CPU supports and is set by sqlite3_csv_init().
+*/
+typedef size_t (*CsvFindFunc)(const unsigned char*, size_t, int, int);
+
+static size_t csv_find2_scalar(
+  const unsigned char *z, size_t n, int c1, int c2
+){
+  size_t i;
+  for(i=0; i<n; i++){
+    if( z[i]==c1 || z[i]==c2 ) break;
+  }
+  return i;
+}
+
+#ifdef CSV_HAVE_SSE2
+/* Return the index of the least significant set bit of x.  x!=0 */
+static int csv_ctz(unsigned int x){
+#if defined(__GNUC__)
+  return __builtin_ctz(x);
+#elif defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return (int)i;
+#else
+  int i = 0;
+  while( (x&1)==0 ){ x >>= 1; i++; }
+  return i;
+#endif
+}
+
+static size_t csv_find2_sse2(
+  const unsigned char *z, size_t n, int c1, int c2
+){
+  const __m128i v1 = _mm_set1_epi8((char)c1);
+  const __m128i v2 = _mm_set1_epi8((char)c2);
+  size_t i = 0;
+  while( i+16<=n ){
+    __m128i x = _mm_loadu_si128((const __m128i*)&z[i]);
+    unsigned int m = (unsigned int)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(x, v1), _mm_cmpeq_epi8(x, v2))
+    );
+    if( m ) return i + csv_ctz(m);
+    i += 16;
+  }
+  return i + csv_find2_scalar(&z[i], n-i, c1, c2);
+}
+#endif /* CSV_HAVE_SSE2 */
+
+#ifdef CSV_HAVE_AVX2
+__attribute__((target("avx2")))
+static size_t csv_find2_avx2(
+  const unsigned char *z, size_t n, int c1, int c2
+){
+  const __m256i v1 = _mm256_set1_epi8((char)c1);
+  const __m256i v2 = _mm256_set1_epi8((char)c2);
+  size_t i = 0;
+  while( i+32<=n ){
+    __m256i x = _mm256_loadu_si256((const __m256i*)&z[i]);
+    unsigned int m = (unsigned int)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, v1), _mm256_cmpeq_epi8(x, v2))
+    );
+    if( m ) return i + csv_ctz(m);
+    i += 32;
+  }
+  if( i+16<=n ){
+    /* Compiled as VEX instructions here, so there is no AVX-SSE
+    ** transition penalty as there would be from calling csv_find2_sse2() */
+    __m128i x = _mm_loadu_si128((const __m128i*)&z[i]);
+    unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(x, _mm256_castsi256_si128(v1)),
+        _mm_cmpeq_epi8(x, _mm256_castsi256_si128(v2))
+    ));
+    if( m ) return i + csv_ctz(m);
+    i += 16;
+  }
+  for(; i<n; i++){
+    if( z[i]==c1 || z[i]==c2 ) break;
+  }
+  return i;
+}
+#endif /* CSV_HAVE_AVX2 */
+
+static CsvFindFunc csv_find2 = csv_find2_scalar;
+
+/* Point csv_find2 at the best kernel for this CPU */
+static void csv_find2_init(void){
+#ifdef CSV_HAVE_AVX2
+  if( __builtin_cpu_supports("avx2") ){
+    csv_find2 = csv_find2_avx2;
+    return;
+  }
+#endif
+#ifdef CSV_HAVE_SSE2
+  csv_find2 = csv_find2_sse2;
+#endif
+}
+
+/* The content of a CSV file that is read by the mmap=YES scanner */
+typedef struct CsvMap CsvMap;
+struct CsvMap {
+  const unsigned char *a;  /* Content of the file */
+  sqlite3_int64 n;         /* Number of bytes in a[] */
+  int bMapped;             /* True if a[] must be unmapped by csv_map_close() */
+#if defined(_WIN32)
+  HANDLE hMap;             /* File mapping object */
+#endif
+};
+
+/* Unmap a file mapped by csv_map_open() */
+static void csv_map_close(CsvMap *p){
+  if( p->bMapped ){
+#if defined(_WIN32)
+    UnmapViewOfFile((LPCVOID)p->a);
+    CloseHandle(p->hMap);
+#else
+    munmap((void*)p->a, (size_t)p->n);
+#endif
+  }
+  memset(p, 0, sizeof(*p));
+}
+
+/* Memory-map the file zFilename.  Return the number of errors. */
+static int csv_map_open(CsvMap *p, CsvReader *pRdr, const char *zFilename){
+  memset(p, 0, sizeof(*p));
+#if defined(_WIN32)
+  {
+    LARGE_INTEGER sz;
+    HANDLE h = CreateFileA(zFilename, GENERIC_READ, FILE_SHARE_READ, 0,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if( h==INVALID_HANDLE_VALUE ){
+      csv_errmsg(pRdr, "cannot open '%s' for reading", zFilename);
+      return 1;
+    }
+    if( !GetFileSizeEx(h, &sz) || (sizeof(size_t)<8 && sz.HighPart!=0) ){
+      CloseHandle(h);
+      csv_errmsg(pRdr, "cannot map '%s'", zFilename);
+      return 1;
+    }
+    p->n = sz.QuadPart;
+    if( p->n>0 ){
+      p->hMap = CreateFileMappingA(h, 0, PAGE_READONLY, 0, 0, 0);
+      if( p->hMap ){
+        p->a = (const unsigned char*)MapViewOfFile(p->hMap,FILE_MAP_READ,0,0,0);
+        if( p->a==0 ) CloseHandle(p->hMap);
+      }
+    }
+    CloseHandle(h);
+  }
+#else
+  {
+    struct stat sStat;
+    int fd = open(zFilename, O_RDONLY);
+    if( fd<0 ){
+      csv_errmsg(pRdr, "cannot open '%s' for reading", zFilename);
+      return 1;
+    }
+    if( fstat(fd, &sStat)
+     || (sizeof(size_t)<8 && (sqlite3_int64)sStat.st_size>0x7fffffff)
+    ){
+      close(fd);
+      csv_errmsg(pRdr, "cannot map '%s'", zFilename);
+      return 1;
+    }
+    p->n = sStat.st_size;
+    if( p->n>0 ){
+      void *pMap = mmap(0, (size_t)p->n, PROT_READ, MAP_SHARED, fd, 0);
+      if( pMap!=MAP_FAILED ){
+        p->a = (const unsigned char*)pMap;
+#ifdef MADV_SEQUENTIAL
+        madvise(pMap, (size_t)p->n, MADV_SEQUENTIAL);
+#endif
+      }
+    }
+    close(fd);
+  }
+#endif
+  if( p->n>0 ){
+    if( p->a==0 ){
+      csv_errmsg(pRdr, "cannot map '%s'", zFilename);
+      return 1;
+    }
+    p->bMapped = 1;
+  }else{
+    p->a = (const unsigned char*)"";
+  }
+  return 0;
+}
+
+/* Find the size and modification time, in nanoseconds, of file
+** zFilename.  Return non-zero if the file cannot be examined. */
+static int csv_file_stat(
+  const char *zFilename,
+  sqlite3_int64 *pSize,
+  sqlite3_int64 *pMtime
+){
+#if defined(_WIN32)
+  struct _stat64 sStat;
+  if( _stat64(zFilename, &sStat) ) return 1;
+  *pMtime = (sqlite3_int64)sStat.st_mtime*1000000000;
+#else
+  struct stat sStat;
+  if( stat(zFilename, &sStat) ) return 1;
+# if defined(__APPLE__)
+  *pMtime = (sqlite3_int64)sStat.st_mtimespec.tv_sec*1000000000
+          + sStat.st_mtimespec.tv_nsec;
+# else
+  *pMtime = (sqlite3_int64)sStat.st_mtim.tv_sec*1000000000
+          + sStat.st_mtim.tv_nsec;
+# endif
+#endif
+  *pSize = (sqlite3_int64)sStat.st_size;
+  return 0;
+}
+
+/* Return the number of CPUs available to this process */
+static int csv_cpu_count(void){
+#if defined(_WIN32)
+  SYSTEM_INFO sInfo;
+  GetSystemInfo(&sInfo);
+  return (int)sInfo.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n>0 ? (int)n : 1;
+#else
+  return 1;
+#endif
+}
+
 
 /* Forward references to the various virtual table methods implemented
 ** in this file. */
@@ -311,11 +589,22 @@ typedef struct CsvTable {
   long iStart;                    /* Offset to start of data in zFilename */
   int nCol;                       /* Number of columns in the CSV file */
   unsigned int tstFlags;          /* Bit values used for testing */
+  int bMmap;                      /* True for the mmap=YES scanner */
+  int nThread;                    /* Threads used to build aOff[] */
+  char *zIndex;                   /* Sidecar file for aOff[], or NULL */
+  CsvMap map;                     /* File content for the mmap=YES scanner */
+  sqlite3_int64 nRow;             /* Rows in aOff[].  Negative if not built */
+  sqlite3_int64 *aOff;            /* Offset of each row, then of end-of-data */
 } CsvTable;
 
 /* Allowed values for tstFlags */
 #define CSVTEST_FIDX  0x0001      /* Pretend that constrained searchs cost less*/
 
+/* Bits of the idxNum used by the mmap=YES scanner */
+#define CSV_IDX_EQ    0x0001      /* rowid==argv[0] */
+#define CSV_IDX_GE    0x0002      /* rowid>=argv[N] */
+#define CSV_IDX_LE    0x0004      /* rowid<=argv[N] */
+
 /* A cursor for the CSV virtual table */
 typedef struct CsvCursor {
   sqlite3_vtab_cursor base;       /* Base class.  Must be first */
@@ -323,8 +612,410 @@ typedef struct CsvCursor {
   char **azVal;                   /* Value of the current row */
   int *aLen;                      /* Length of each entry */
   sqlite3_int64 iRowid;           /* The current rowid.  Negative for EOF */
+  const char **azRef;             /* mmap=YES: fields of the current row */
+  int *anRef;                     /* mmap=YES: bytes in each azRef[] field */
+  unsigned char *aEsc;            /* mmap=YES: true if field holds "" escapes */
+  int bSplit;                     /* mmap=YES: azRef[] is valid for the row */
+  sqlite3_int64 iLast;            /* mmap=YES: last rowid to visit */
 } CsvCursor;
 
+/* Minimum number of bytes handed to each thread that builds aOff[] */
+#define CSV_MIN_CHUNK (4*1024*1024)
+
+/* Maximum number of threads used to build aOff[] */
+#define CSV_MAX_THREAD 64
+
+/* A slice of the file scanned by one thread while aOff[] is built.
+**
+** The file is split at arbitrary byte offsets.  Pass 1 counts the '"'
+** characters in each chunk, from which the caller works out whether each
+** chunk begins inside a quoted field.  Pass 2 then records the start of
+** every row whose terminating newline is not inside quotes, which makes
+** the split points safe however the file is quoted.
+*/
+typedef struct CsvChunk CsvChunk;
+struct CsvChunk {
+  const unsigned char *a;         /* Content of the whole file */
+  sqlite3_int64 iFirst;           /* First byte of this chunk */
+  sqlite3_int64 iEnd;             /* One byte past the end of this chunk */
+  int ePass;                      /* 1 or 2 */
+  int bQuoted;                    /* Pass 2: chunk begins inside quotes */
+  int rc;                         /* SQLITE_OK or SQLITE_NOMEM */
+  sqlite3_int64 nQuote;           /* Pass 1: '"' characters in the chunk */
+  sqlite3_int64 nOff;             /* Pass 2: entries in aOff[] */
+  sqlite3_int64 nAlloc;           /* Pass 2: space allocated for aOff[] */
+  sqlite3_int64 *aOff;            /* Pass 2: offsets of rows that start here */
+};
+
+/* Pass 1: count the '"' characters in the chunk */
+static void csv_chunk_count_quotes(CsvChunk *p){
+  sqlite3_int64 i = p->iFirst;
+  while( i<p->iEnd ){
+    size_t n = (size_t)(p->iEnd - i);
+    size_t j = csv_find2(&p->a[i], n, '"', '"');
+    if( j>=n ) break;
+    p->nQuote++;
+    i += j+1;
+  }
+}
+
+/* Pass 2: record the offset of each row that starts within the chunk */
+static void csv_chunk_find_rows(CsvChunk *p){
+  sqlite3_int64 i = p->iFirst;
+  int bQuoted = p->bQuoted;
+  while( i<p->iEnd ){
+    size_t n = (size_t)(p->iEnd - i);
+    size_t j = csv_find2(&p->a[i], n, '"', '\n');
+    if( j>=n ) break;
+    i += j;
+    if( p->a[i]=='"' ){
+      bQuoted = !bQuoted;
+    }else if( !bQuoted ){
+      if( p->nOff>=p->nAlloc ){
+        sqlite3_int64 nNew = p->nAlloc*2 + 1024;
+        sqlite3_int64 *aNew;
+        aNew = sqlite3_realloc64(p->aOff, nNew*sizeof(sqlite3_int64));
+        if( aNew==0 ){
+          p->rc = SQLITE_NOMEM;
+          return;
+        }
+        p->aOff = aNew;
+        p->nAlloc = nNew;
+      }
+      p->aOff[p->nOff++] = i+1;
+    }
+    i++;
+  }
+}
+
+/* Run the current pass over a single chunk */
+static void csv_chunk_run(CsvChunk *p){
+  if( p->ePass==1 ){
+    csv_chunk_count_quotes(p);
+  }else{
+    csv_chunk_find_rows(p);
+  }
+}
+
+#if defined(_WIN32)
+typedef HANDLE CsvThread;
+static DWORD WINAPI csv_chunk_main(LPVOID pArg){
+  csv_chunk_run((CsvChunk*)pArg);
+  return 0;
+}
+static int csv_thread_start(CsvThread *pThread, CsvChunk *p){
+  *pThread = CreateThread(0, 0, csv_chunk_main, (LPVOID)p, 0, 0);
+  return *pThread==0;
+}
+static void csv_thread_join(CsvThread thread){
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+#else
+typedef pthread_t CsvThread;
+static void *csv_chunk_main(void *pArg){
+  csv_chunk_run((CsvChunk*)pArg);
+  return 0;
+}
+static int csv_thread_start(CsvThread *pThread, CsvChunk *p){
+  return pthread_create(pThread, 0, csv_chunk_main, (void*)p);
+}
+static void csv_thread_join(CsvThread thread){
+  pthread_join(thread, 0);
+}
+#endif
+
+/* Run pass ePass over every chunk.  aChunk[0] is handled by the calling
+** thread.  A chunk whose thread cannot be started is run inline.
+*/
+static void csv_chunks_run(CsvChunk *aChunk, int nChunk, int ePass){
+  CsvThread aThread[CSV_MAX_THREAD];
+  int aStarted[CSV_MAX_THREAD];
+  int i;
+  assert( nChunk>=1 && nChunk<=CSV_MAX_THREAD );
+  for(i=0; i<nChunk; i++) aChunk[i].ePass = ePass;
+  for(i=1; i<nChunk; i++){
+    aStarted[i] = csv_thread_start(&aThread[i], &aChunk[i])==0;
+  }
+  csv_chunk_run(&aChunk[0]);
+  for(i=1; i<nChunk; i++){
+    if( aStarted[i] ){
+      csv_thread_join(aThread[i]);
+    }else{
+      csv_chunk_run(&aChunk[i]);
+    }
+  }
+}
+
+/*
+** Split the row z[0..n-1] (not including the newline) into fields.
+** Store up to nCol of them in azRef[], anRef[] and aEsc[], any of which
+** may be NULL if only the count is wanted.  Return the number of fields
+** in the row, which may exceed nCol.
+*/
+static int csv_split_row(
+  const unsigned char *z, size_t n,
+  int nCol,
+  const char **azRef, int *anRef, unsigned char *aEsc
+){
+  const unsigned char *zEnd = &z[n];
+  int iField = 0;
+  while( 1 ){
+    const unsigned char *zField;
+    size_t nField;
+    int bEsc = 0;
+    if( z<zEnd && z[0]=='"' ){
+      zField = ++z;
+      while( z<zEnd ){
+        z += csv_find2(z, (size_t)(zEnd-z), '"', '"');
+        if( z+1<zEnd && z[1]=='"' ){
+          bEsc = 1;
+          z += 2;
+          continue;
+        }
+        break;
+      }
+      nField = (size_t)(z - zField);
+      if( z<zEnd ) z++;
+      z += csv_find2(z, (size_t)(zEnd-z), ',', ',');
+    }else{
+      zField = z;
+      nField = csv_find2(z, (size_t)(zEnd-z), ',', ',');
+      z += nField;
+    }
+    if( iField<nCol && azRef ){
+      azRef[iField] = (const char*)zField;
+      anRef[iField] = (int)nField;
+      aEsc[iField] = (unsigned char)bEsc;
+    }
+    iField++;
+    if( z>=zEnd ) break;
+    z++;
+  }
+  return iField;
+}
+
+/* Find the text of row iRow (1-based), not including the trailing
+** newline, in the mmap=YES scanner of pTab. */
+static const unsigned char *csv_row_text(
+  CsvTable *pTab,
+  sqlite3_int64 iRow,
+  size_t *pn
+){
+  const unsigned char *z = &pTab->map.a[pTab->aOff[iRow-1]];
+  size_t n = (size_t)(pTab->aOff[iRow] - pTab->aOff[iRow-1]);
+  if( n>0 && z[n-1]=='\n' ) n--;
+  if( n>0 && z[n-1]=='\r' ) n--;
+  *pn = n;
+  return z;
+}
+
+/* Hash the first and last 64KiB of the mapped file and 4KiB of every
+** MiB between them.  This catches most edits that leave the size and
+** modification time unchanged without reading the whole file. */
+static sqlite3_int64 csv_sample_hash(const unsigned char *a, size_t n){
+  sqlite3_uint64 h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  while( i<n ){
+    size_t iEnd = i + 4096;
+    if( iEnd>n ) iEnd = n;
+    for(; i<iEnd; i++){
+      h = (h ^ a[i]) * 0x100000001b3ULL;
+    }
+    if( i>=65536 && i+65536<n ){
+      i = (i + 1048576) & ~(size_t)1048575;
+      if( i+65536>n ) i = n - 65536;
+    }
+  }
+  return (sqlite3_int64)h;
+}
+
+/* Try to load aOff[] from the index= sidecar file.  Return non-zero
+** on success, or 0 if the sidecar is missing, stale, unreadable or does
+** not describe the rows of the mapped file, in which case the offsets
+** are rebuilt. */
+static int csv_index_load(CsvTable *pTab){
+  const unsigned char *a = pTab->map.a;
+  sqlite3_int64 aHdr[6];
+  sqlite3_int64 sz, mtime;
+  sqlite3_int64 *aOff = 0;
+  sqlite3_int64 i;
+  char zMagic[8];
+  FILE *in;
+  if( csv_file_stat(pTab->zFilename, &sz, &mtime) ) return 0;
+  in = fopen(pTab->zIndex, "rb");
+  if( in==0 ) return 0;
+  if( fread(zMagic, sizeof(zMagic), 1, in)!=1
+   || memcmp(zMagic, "csvidx02", 8)!=0
+   || fread(aHdr, sizeof(aHdr), 1, in)!=1
+   || aHdr[0]!=sz || aHdr[1]!=mtime || sz!=pTab->map.n
+   || aHdr[2]!=pTab->iStart || aHdr[3]!=pTab->nCol
+   || aHdr[4]<0 || aHdr[4]>sz
+   || aHdr[5]!=csv_sample_hash(a, (size_t)sz)
+  ){
+    fclose(in);
+    return 0;
+  }
+  aOff = sqlite3_malloc64( (aHdr[4]+1)*sizeof(sqlite3_int64) );
+  if( aOff==0
+   || fread(aOff, sizeof(sqlite3_int64), (size_t)(aHdr[4]+1), in)
+        !=(size_t)(aHdr[4]+1)
+  ){
+    sqlite3_free(aOff);
+    fclose(in);
+    return 0;
+  }
+  fclose(in);
+
+  /* Every row must be non-empty, lie within the file and, except for
+  ** a final unterminated row, start just after a newline. */
+  if( aOff[0]<pTab->iStart || aOff[aHdr[4]]>sz ){
+    sqlite3_free(aOff);
+    return 0;
+  }
+  for(i=1; i<=aHdr[4]; i++){
+    if( aOff[i]<=aOff[i-1] || (aOff[i]<sz && a[aOff[i]-1]!='\n') ){
+      sqlite3_free(aOff);
+      return 0;
+    }
+  }
+  pTab->aOff = aOff;
+  pTab->nRow = aHdr[4];
+  return 1;
+}
+
+/* Write aOff[] to the index= sidecar file.  The offsets are written to
+** a temporary file that is then renamed over the sidecar, so that a
+** crash or a concurrent reader never sees a partly written index.
+** Failure is not an error, as the offsets are simply rebuilt by the next
+** connection. */
+static void csv_index_save(CsvTable *pTab){
+  sqlite3_int64 aHdr[6];
+  char *zTmp;
+  FILE *out;
+  int bOk;
+  if( csv_file_stat(pTab->zFilename, &aHdr[0], &aHdr[1]) ) return;
+  if( aHdr[0]!=pTab->map.n ) return;
+  aHdr[2] = pTab->iStart;
+  aHdr[3] = pTab->nCol;
+  aHdr[4] = pTab->nRow;
+  aHdr[5] = csv_sample_hash(pTab->map.a, pTab->map.n);
+#if defined(_WIN32)
+  zTmp = sqlite3_mprintf("%s.%lu-%p.tmp", pTab->zIndex,
+                         (unsigned long)GetCurrentProcessId(), (void*)pTab);
+#else
+  zTmp = sqlite3_mprintf("%s.%lu-%p.tmp", pTab->zIndex,
+                         (unsigned long)getpid(), (void*)pTab);
+#endif
+  if( zTmp==0 ) return;
+  out = fopen(zTmp, "wb");
+  if( out==0 ){
+    sqlite3_free(zTmp);
+    return;
+  }
+  bOk = fwrite("csvidx02", 8, 1, out)==1
+     && fwrite(aHdr, sizeof(aHdr), 1, out)==1
+     && fwrite(pTab->aOff, sizeof(sqlite3_int64), (size_t)(pTab->nRow+1), out)
+          ==(size_t)(pTab->nRow+1);
+  if( fclose(out) ) bOk = 0;
+#if defined(_WIN32)
+  if( bOk ){
+    bOk = MoveFileExA(zTmp, pTab->zIndex, MOVEFILE_REPLACE_EXISTING)!=0;
+  }
+#else
+  if( bOk ) bOk = rename(zTmp, pTab->zIndex)==0;
+#endif
+  if( !bOk ) remove(zTmp);
+  sqlite3_free(zTmp);
+}
+
+/*
+** Build the aOff[] array of the mmap=YES scanner, either from the index=
+** sidecar file or by scanning the file with up to pTab->nThread threads.
+** Return SQLITE_OK or SQLITE_NOMEM.
+*/
+static int csv_index_build(CsvTable *pTab){
+  const unsigned char *a = pTab->map.a;
+  sqlite3_int64 iStart = pTab->iStart;
+  sqlite3_int64 nByte;
+  sqlite3_int64 nOff;
+  CsvChunk *aChunk;
+  int nChunk;
+  int bQuoted = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  if( pTab->nRow>=0 ) return SQLITE_OK;
+  if( pTab->zIndex && pTab->zFilename && csv_index_load(pTab) ){
+    return SQLITE_OK;
+  }
+
+  /* Skip the UTF-8 BOM, as csv_read_one_field() does */
+  if( iStart==0 && pTab->map.n>=3 && a[0]==0xef && a[1]==0xbb && a[2]==0xbf ){
+    iStart = 3;
+  }
+  nByte = pTab->map.n - iStart;
+  nChunk = pTab->nThread;
+  if( nByte/CSV_MIN_CHUNK < nChunk ) nChunk = (int)(nByte/CSV_MIN_CHUNK);
+  if( nChunk<1 ) nChunk = 1;
+  aChunk = sqlite3_malloc64( sizeof(CsvChunk)*nChunk );
+  if( aChunk==0 ) return SQLITE_NOMEM;
+  memset(aChunk, 0, sizeof(CsvChunk)*nChunk);
+  for(i=0; i<nChunk; i++){
+    aChunk[i].a = a;
+    aChunk[i].iFirst = iStart + nByte*i/nChunk;
+    aChunk[i].iEnd = iStart + nByte*(i+1)/nChunk;
+  }
+
+  csv_chunks_run(aChunk, nChunk, 1);
+  for(i=0; i<nChunk; i++){
+    aChunk[i].bQuoted = bQuoted;
+    if( aChunk[i].nQuote & 1 ) bQuoted = !bQuoted;
+  }
+  csv_chunks_run(aChunk, nChunk, 2);
+
+  nOff = 1;
+  for(i=0; i<nChunk; i++){
+    if( aChunk[i].rc ) rc = aChunk[i].rc;
+    nOff += aChunk[i].nOff;
+  }
+  if( rc==SQLITE_OK ){
+    pTab->aOff = sqlite3_malloc64( (nOff+1)*sizeof(sqlite3_int64) );
+    if( pTab->aOff==0 ) rc = SQLITE_NOMEM;
+  }
+  if( rc==SQLITE_OK ){
+    sqlite3_int64 *aOff = pTab->aOff;
+    sqlite3_int64 n = 1;
+    aOff[0] = iStart;
+    for(i=0; i<nChunk; i++){
+      if( aChunk[i].nOff==0 ) continue;
+      memcpy(&aOff[n], aChunk[i].aOff, aChunk[i].nOff*sizeof(sqlite3_int64));
+      n += aChunk[i].nOff;
+    }
+
+    /* The row that starts at end-of-file (after a final newline) is not a
+    ** row.  A final unterminated row that has too few fields is dropped,
+    ** the same as by csvtabNext(). */
+    if( aOff[nOff-1]==pTab->map.n ){
+      nOff--;
+    }else{
+      aOff[nOff] = pTab->map.n;
+    }
+    pTab->nRow = nOff;
+    if( nOff>0 && a[pTab->map.n-1]!='\n' ){
+      size_t nLast;
+      const unsigned char *zLast = csv_row_text(pTab, nOff, &nLast);
+      if( csv_split_row(zLast, nLast, 0, 0, 0, 0)<pTab->nCol ){
+        pTab->nRow--;
+      }
+    }
+    if( pTab->zIndex && pTab->zFilename ) csv_index_save(pTab);
+  }
+  for(i=0; i<nChunk; i++) sqlite3_free(aChunk[i].aOff);
+  sqlite3_free(aChunk);
+  return rc;
+}
+
 /* Transfer error message text from a reader into a CsvTable */
 static void csv_xfer_error(CsvTable *pTab, CsvReader *pRdr){
   sqlite3_free(pTab->base.zErrMsg);
@@ -336,8 +1027,11 @@ static void csv_xfer_error(CsvTable *pTab, CsvReader *pRdr){
 */
 static int csvtabDisconnect(sqlite3_vtab *pVtab){
   CsvTable *p = (CsvTable*)pVtab;
+  csv_map_close(&p->map);
+  sqlite3_free(p->aOff);
   sqlite3_free(p->zFilename);
   sqlite3_free(p->zData);
+  sqlite3_free(p->zIndex);
   sqlite3_free(p);
   return SQLITE_OK;
 }
@@ -445,6 +1139,13 @@ static int csv_boolean(const char *z){
 **    header=YES|NO              First row of CSV defines the names of
 **                               columns if "yes".  Default "no".
 **    columns=N                  Assume the CSV file contains N columns.
+**    mmap=YES|NO                Memory-map the file and scan it with the
+**                               vectorized, multi-threaded scanner.
+**                               Default "no".
+**    threads=N                  Threads used by the mmap=YES scanner.
+**                               Default: one per CPU.
+**    index=FILENAME             Sidecar file that caches the row offsets
+**                               found by the mmap=YES scanner.
 **
 ** Only available if compiled with SQLITE_TEST:
 **    
@@ -464,6 +1165,8 @@ static int csvtabConnect(
 ){
   CsvTable *pNew = 0;        /* The CsvTable object to construct */
   int bHeader = -1;          /* header= flags.  -1 means not seen yet */
+  int bMmap = -1;            /* mmap= flags.  -1 means not seen yet */
+  int nThread = 0;           /* Value of the threads= parameter */
   int rc = SQLITE_OK;        /* Result code from this routine */
   int i, j;                  /* Loop counters */
 #ifdef SQLITE_TEST
@@ -473,12 +1176,13 @@ static int csvtabConnect(
   CsvReader sRdr;            /* A CSV file reader used to store an error
                              ** message and/or to count the number of columns */
   static const char *azParam[] = {
-     "filename", "data", "schema", 
+     "filename", "data", "schema", "index",
   };
-  char *azPValue[3];         /* Parameter values */
+  char *azPValue[4];         /* Parameter values */
 # define CSV_FILENAME (azPValue[0])
 # define CSV_DATA     (azPValue[1])
 # define CSV_SCHEMA   (azPValue[2])
+# define CSV_INDEX    (azPValue[3])
 
 
   assert( sizeof(azPValue)==sizeof(azParam) );
@@ -509,6 +1213,28 @@ static int csvtabConnect(
         goto csvtab_connect_error;
       }
     }else
+    if( (zValue = csv_parameter("mmap",4,z))!=0 ){
+      if( bMmap>=0 ){
+        csv_errmsg(&sRdr, "more than one 'mmap' parameter");
+        goto csvtab_connect_error;
+      }
+      bMmap = csv_boolean(zValue);
+      if( bMmap<0 ){
+        csv_errmsg(&sRdr, "unrecognized argument to 'mmap': %s", zValue);
+        goto csvtab_connect_error;
+      }
+    }else
+    if( (zValue = csv_parameter("threads",7,z))!=0 ){
+      if( nThread>0 ){
+        csv_errmsg(&sRdr, "more than one 'threads' parameter");
+        goto csvtab_connect_error;
+      }
+      nThread = atoi(zValue);
+      if( nThread<=0 ){
+        csv_errmsg(&sRdr, "must have at least one thread");
+        goto csvtab_connect_error;
+      }
+    }else
 #ifdef SQLITE_TEST
     if( (zValue = csv_parameter("testflags",9,z))!=0 ){
       tstFlags = (unsigned int)atoi(zValue);
@@ -534,6 +1260,15 @@ static int csvtabConnect(
     csv_errmsg(&sRdr, "must either filename= or data= but not both");
     goto csvtab_connect_error;
   }
+  if( bMmap<0 ) bMmap = (nThread>0 || CSV_INDEX!=0);
+  if( bMmap==0 && (nThread>0 || CSV_INDEX!=0) ){
+    csv_errmsg(&sRdr, "threads= and index= require mmap=YES");
+    goto csvtab_connect_error;
+  }
+  if( CSV_INDEX!=0 && CSV_FILENAME==0 ){
+    csv_errmsg(&sRdr, "index= requires filename=");
+    goto csvtab_connect_error;
+  }
   if( nCol<=0 && csv_reader_open(&sRdr, CSV_FILENAME, CSV_DATA) ){
     goto csvtab_connect_error;
   }
@@ -554,8 +1289,29 @@ static int csvtabConnect(
 #ifdef SQLITE_TEST
   pNew->tstFlags = tstFlags;
 #endif
-  pNew->iStart = bHeader==1 ? ftell(sRdr.in) : 0;
+  if( bHeader!=1 || sRdr.zIn==0 ){
+    pNew->iStart = 0;
+  }else if( sRdr.in==0 ){
+    pNew->iStart = (long)sRdr.iIn;
+  }else{
+    pNew->iStart = (long)(ftell(sRdr.in) - sRdr.nIn + sRdr.iIn);
+  }
   csv_reader_reset(&sRdr);
+  pNew->nRow = -1;
+  if( bMmap ){
+    pNew->bMmap = 1;
+    pNew->nThread = nThread>0 ? nThread : csv_cpu_count();
+    if( pNew->nThread>CSV_MAX_THREAD ) pNew->nThread = CSV_MAX_THREAD;
+    pNew->zIndex = CSV_INDEX;  CSV_INDEX = 0;
+    if( pNew->zFilename ){
+      if( csv_map_open(&pNew->map, &sRdr, pNew->zFilename) ){
+        goto csvtab_connect_error;
+      }
+    }else{
+      pNew->map.a = (const unsigned char*)pNew->zData;
+      pNew->map.n = (sqlite3_int64)strlen(pNew->zData);
+    }
+  }
   if( CSV_SCHEMA==0 ){
     char *zSep = "";
     CSV_SCHEMA = sqlite3_mprintf("CREATE TABLE x(");
@@ -636,13 +1392,17 @@ static int csvtabOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
   CsvTable *pTab = (CsvTable*)p;
   CsvCursor *pCur;
   size_t nByte;
-  nByte = sizeof(*pCur) + (sizeof(char*)+sizeof(int))*pTab->nCol;
+  nByte = sizeof(*pCur) + (sizeof(char*)*2+sizeof(int)*2+1)*pTab->nCol;
   pCur = sqlite3_malloc64( nByte );
   if( pCur==0 ) return SQLITE_NOMEM;
   memset(pCur, 0, nByte);
   pCur->azVal = (char**)&pCur[1];
-  pCur->aLen = (int*)&pCur->azVal[pTab->nCol];
+  pCur->azRef = (const char**)&pCur->azVal[pTab->nCol];
+  pCur->aLen = (int*)&pCur->azRef[pTab->nCol];
+  pCur->anRef = &pCur->aLen[pTab->nCol];
+  pCur->aEsc = (unsigned char*)&pCur->anRef[pTab->nCol];
   *ppCursor = &pCur->base;
+  if( pTab->bMmap ) return SQLITE_OK;
   if( csv_reader_open(&pCur->rdr, pTab->zFilename, pTab->zData) ){
     csv_xfer_error(pTab, &pCur->rdr);
     return SQLITE_ERROR;
@@ -660,6 +1420,15 @@ static int csvtabNext(sqlite3_vtab_cursor *cur){
   CsvTable *pTab = (CsvTable*)cur->pVtab;
   int i = 0;
   char *z;
+  if( pTab->bMmap ){
+    pCur->bSplit = 0;
+    if( pCur->iRowid>=pCur->iLast ){
+      pCur->iRowid = -1;
+    }else{
+      pCur->iRowid++;
+    }
+    return SQLITE_OK;
+  }
   do{
     z = csv_read_one_field(&pCur->rdr);
     if( z==0 ){
@@ -694,6 +1463,46 @@ static int csvtabNext(sqlite3_vtab_cursor *cur){
   return SQLITE_OK;
 }
 
+/*
+** The xColumn method for the mmap=YES scanner.  The current row is split
+** into fields the first time one of its columns is requested.
+*/
+static int csvtabColumnMmap(
+  CsvCursor *pCur,            /* The cursor */
+  CsvTable *pTab,             /* The table pCur belongs to */
+  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
+  int i                       /* Which column to return */
+){
+  if( !pCur->bSplit ){
+    size_t n;
+    const unsigned char *z = csv_row_text(pTab, pCur->iRowid, &n);
+    int nField = csv_split_row(z, n, pTab->nCol,
+                               pCur->azRef, pCur->anRef, pCur->aEsc);
+    while( nField<pTab->nCol ) pCur->azRef[nField++] = 0;
+    pCur->bSplit = 1;
+  }
+  if( i<0 || i>=pTab->nCol || pCur->azRef[i]==0 ) return SQLITE_OK;
+  if( pCur->aEsc[i] ){
+    const char *zIn = pCur->azRef[i];
+    int nIn = pCur->anRef[i];
+    int j, k;
+    if( pCur->aLen[i]<nIn+1 ){
+      char *zNew = sqlite3_realloc64(pCur->azVal[i], nIn+1);
+      if( zNew==0 ) return SQLITE_NOMEM;
+      pCur->azVal[i] = zNew;
+      pCur->aLen[i] = nIn+1;
+    }
+    for(j=k=0; j<nIn; j++){
+      pCur->azVal[i][k++] = zIn[j];
+      if( zIn[j]=='"' && j+1<nIn && zIn[j+1]=='"' ) j++;
+    }
+    sqlite3_result_text(ctx, pCur->azVal[i], k, SQLITE_TRANSIENT);
+  }else{
+    sqlite3_result_text(ctx, pCur->azRef[i], pCur->anRef[i], SQLITE_TRANSIENT);
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Return values of columns for the row at which the CsvCursor
 ** is currently pointing.
@@ -705,6 +1514,9 @@ static int csvtabColumn(
 ){
   CsvCursor *pCur = (CsvCursor*)cur;
   CsvTable *pTab = (CsvTable*)cur->pVtab;
+  if( pTab->bMmap ){
+    return csvtabColumnMmap(pCur, pTab, ctx, i);
+  }
   if( i>=0 && i<pTab->nCol && pCur->azVal[i]!=0 ){
     sqlite3_result_text(ctx, pCur->azVal[i], -1, SQLITE_STATIC);
   }
@@ -729,6 +1541,55 @@ static int csvtabEof(sqlite3_vtab_cursor *cur){
   return pCur->iRowid<0;
 }
 
+/*
+** The xFilter method for the mmap=YES scanner.  Any rowid bounds chosen by
+** csvtabBestIndex() narrow the range of rows visited.  The bounds are only
+** used to seek; SQLite still checks the constraints against each row, so a
+** bound that is not numeric is ignored.
+*/
+static int csvtabFilterMmap(
+  CsvCursor *pCur,
+  CsvTable *pTab,
+  int idxNum,
+  int argc, sqlite3_value **argv
+){
+  sqlite3_int64 iFirst = 1;
+  int iArg = 0;
+  int rc = csv_index_build(pTab);
+  if( rc!=SQLITE_OK ) return rc;
+  pCur->iLast = pTab->nRow;
+  if( idxNum & CSV_IDX_EQ ){
+    sqlite3_value *pVal = argv[iArg++];
+    int eType = sqlite3_value_numeric_type(pVal);
+    if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+      sqlite3_int64 iRowid = sqlite3_value_int64(pVal);
+      if( iRowid>iFirst ) iFirst = iRowid;
+      if( iRowid<pCur->iLast ) pCur->iLast = iRowid;
+    }
+  }
+  if( idxNum & CSV_IDX_GE ){
+    sqlite3_value *pVal = argv[iArg++];
+    int eType = sqlite3_value_numeric_type(pVal);
+    if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+      sqlite3_int64 iRowid = sqlite3_value_int64(pVal);
+      if( iRowid>iFirst ) iFirst = iRowid;
+    }
+  }
+  if( idxNum & CSV_IDX_LE ){
+    sqlite3_value *pVal = argv[iArg++];
+    int eType = sqlite3_value_numeric_type(pVal);
+    if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+      sqlite3_int64 iRowid = sqlite3_value_int64(pVal);
+      if( iRowid<pCur->iLast ) pCur->iLast = iRowid;
+    }
+  }
+  assert( iArg==argc );
+  pCur->bSplit = 0;
+  pCur->iRowid = iFirst;
+  if( iFirst>pCur->iLast ) pCur->iRowid = -1;
+  return SQLITE_OK;
+}
+
 /*
 ** Only a full table scan is supported.  So xFilter simply rewinds to
 ** the beginning.
@@ -741,6 +1602,9 @@ static int csvtabFilter(
   CsvCursor *pCur = (CsvCursor*)pVtabCursor;
   CsvTable *pTab = (CsvTable*)pVtabCursor->pVtab;
   pCur->iRowid = 0;
+  if( pTab->bMmap ){
+    return csvtabFilterMmap(pCur, pTab, idxNum, argc, argv);
+  }
   if( pCur->rdr.in==0 ){
     assert( pCur->rdr.zIn==pTab->zData );
     assert( pTab->iStart>=0 );
@@ -765,6 +1629,51 @@ static int csvtabBestIndex(
   sqlite3_index_info *pIdxInfo
 ){
   pIdxInfo->estimatedCost = 1000000;
+  if( ((CsvTable*)tab)->bMmap ){
+    /* The mmap=YES scanner can seek to a rowid or a range of rowids.
+    ** Constraints are not omitted, so > and < are treated as >= and <=.
+    */
+    int aIdx[3] = { -1, -1, -1 };
+    int idxNum = 0;
+    int nArg = 0;
+    int i;
+    for(i=0; i<pIdxInfo->nConstraint; i++){
+      const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+      if( pCons->usable==0 || pCons->iColumn>=0 ) continue;
+      switch( pCons->op ){
+        case SQLITE_INDEX_CONSTRAINT_EQ: aIdx[0] = i; break;
+        case SQLITE_INDEX_CONSTRAINT_GT:
+        case SQLITE_INDEX_CONSTRAINT_GE: aIdx[1] = i; break;
+        case SQLITE_INDEX_CONSTRAINT_LT:
+        case SQLITE_INDEX_CONSTRAINT_LE: aIdx[2] = i; break;
+      }
+    }
+    if( aIdx[0]>=0 ){
+      idxNum = CSV_IDX_EQ;
+      pIdxInfo->aConstraintUsage[aIdx[0]].argvIndex = ++nArg;
+      pIdxInfo->estimatedCost = 1;
+      pIdxInfo->estimatedRows = 1;
+      pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    }else if( aIdx[1]>=0 || aIdx[2]>=0 ){
+      if( aIdx[1]>=0 ){
+        idxNum |= CSV_IDX_GE;
+        pIdxInfo->aConstraintUsage[aIdx[1]].argvIndex = ++nArg;
+      }
+      if( aIdx[2]>=0 ){
+        idxNum |= CSV_IDX_LE;
+        pIdxInfo->aConstraintUsage[aIdx[2]].argvIndex = ++nArg;
+      }
+      pIdxInfo->estimatedCost = nArg==2 ? 2500 : 250000;
+    }
+    if( pIdxInfo->nOrderBy==1
+     && pIdxInfo->aOrderBy[0].iColumn<0
+     && pIdxInfo->aOrderBy[0].desc==0
+    ){
+      pIdxInfo->orderByConsumed = 1;
+    }
+    pIdxInfo->idxNum = idxNum;
+    return SQLITE_OK;
+  }
 #ifdef SQLITE_TEST
   if( (((CsvTable*)tab)->tstFlags & CSVTEST_FIDX)!=0 ){
     /* The usual (and sensible) case is to always do a full table scan.
@@ -874,6 +1783,7 @@ int sqlite3_csv_init(
 #ifndef SQLITE_OMIT_VIRTUALTABLE	
   int rc;
   SQLITE_EXTENSION_INIT2(pApi);
+  csv_find2_init();
   rc = sqlite3_create_module(db, "csv", &CsvModule, 0);
 #ifdef SQLITE_TEST
   if( rc==SQLITE_OK ){
@@ -0,0 +1,1329 @@
+/*
+** 2018-12-03
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This file implements a VFS shim that keeps a single page cache for each
+** database file, shared by all connections in the process that open the
+** file through it.  It is intended for processes that hold many read-only
+** connections to the same large database.  Each page is read and held
+** once instead of once per connection, and a new connection starts with
+** a warm cache.
+**
+** USAGE:
+**
+**    .load ./sharedpagevfs
+**    .open 'file:big.db?vfs=sharedpagevfs&mode=ro&sharedcache=65536'
+**    PRAGMA cache_size=-256;
+**
+** The following URI parameters are recognized.  They are read by the
+** connection that creates the cache for a file (the first to open it) and
+** are ignored by the others:
+**
+**    sharedcache=N              Size of the shared cache in KiB.
+**                               Default 65536.
+**
+**    stripes=N                  Number of stripes the cache is divided
+**                               into.  Each stripe has its own mutex,
+**                               hash table, CLOCK ring and share of the
+**                               memory, and pages are assigned to stripes
+**                               by a hash of their offset, so readers in
+**                               different threads rarely wait for each
+**                               other.  Default 16.
+**
+** The shared cache sits below SQLite's own page cache, which every
+** connection still has.  Give each connection a small cache_size so that
+** most pages are held once, in the shared cache.
+**
+** A page found in the cache has its reference bit set.  To make room in a
+** stripe, its clock hand clears reference bits until it reaches a page
+** without one, and evicts that page.  New pages are added behind the hand
+** with the bit clear, so pages read only once by a scan are evicted first.
+**
+** Hit, miss and memory counters for each cache are available from the
+** eponymous virtual table "sharedpagevfs_stats":
+**
+**    SELECT * FROM sharedpagevfs_stats;
+**
+** INVALIDATION:
+**
+** Only reads of whole pages of the main database file, made while a
+** SHARED lock is held, are cached.  Pages written through this VFS are
+** removed from the cache, and truncating the file empties it.  Changes
+** made by other processes, or by connections using other VFSes, are
+** detected when a read transaction begins:
+**
+**   *  In WAL mode the database file changes only when a checkpoint copies
+**      frames from the WAL into it.  The cache records the WAL salt and the
+**      number of backfilled frames from the wal-index header.  If more
+**      frames have been backfilled, their page numbers are read from the
+**      wal-index and only those pages are removed.  If the salt has
+**      changed, the WAL was restarted and the cache is emptied.
+**
+**      A checkpoint may also run while a read transaction is open, and
+**      backfill frames that the reader's snapshot includes.  If that
+**      happens after the reader's WAL read lock is taken but before
+**      SQLite has noted how many frames are backfilled, the reader reads
+**      those pages from the database file.  So the backfill count is also
+**      checked on every read of a page that might be answered from the
+**      cache, and the cache brought up to date first if it has grown.
+**
+**   *  In rollback mode the file change counter, at byte offset 24, is
+**      compared with the value last seen and the cache is emptied if it
+**      differs.  So every commit empties the cache in rollback mode.
+**
+** Each time the cache is emptied a new generation begins.  A connection
+** only uses and adds pages of the generation current when its read
+** transaction began, so a reader that started before the cache was emptied
+** cannot refill it with stale pages.
+**
+** LIMITATIONS:
+**
+** Memory-mapped I/O is not used for files opened through this VFS
+** (mmap_size is ignored); mmap already shares pages between connections
+** through the operating system's page cache.  With locking_mode=EXCLUSIVE
+** and WAL there is no wal-index in shared memory to check, but then no
+** other connection can change the file.  The cache for a file is freed
+** when the last connection to it is closed.
+*/
+#include "sqlite3ext.h"
+SQLITE_EXTENSION_INIT1
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+/* Defaults and limits for the sharedcache= and stripes= URI parameters */
+#define SP_DEFAULT_CACHE  65536
+#define SP_DEFAULT_STRIPE 16
+#define SP_MAX_STRIPE     256
+
+/* Page sizes that are cached */
+#define SP_MIN_PAGE       512
+#define SP_MAX_PAGE       65536
+
+/* Hash buckets per byte of stripe budget (one per two 4KB pages) */
+#define SP_HASH_RATIO     2048
+
+/* Stripes are aligned to this, so that two never share a cache line */
+#define SP_CACHE_LINE     64
+
+/*
+** Layout of the wal-index, from wal.c.  The header is two copies of
+** WalIndexHdr (48 bytes each) followed by WalCkptInfo.  The page number of
+** each WAL frame follows the header in region 0, and starts each later
+** region.
+*/
+#define SP_WAL_SZPAGE     14        /* u16 WalIndexHdr.szPage */
+#define SP_WAL_SALT       32        /* u32 WalIndexHdr.aSalt[2] */
+#define SP_WAL_BACKFILL   96        /* u32 WalCkptInfo.nBackfill */
+#define SP_WAL_HDRSIZE    136       /* Size of the wal-index header */
+#define SP_WAL_NPAGE      4096      /* Frames in each region */
+#define SP_WAL_NPAGE_ONE  (SP_WAL_NPAGE - SP_WAL_HDRSIZE/4)
+#define SP_WAL_READ_LOCK0 3         /* xShmLock offset of WAL_READ_LOCK(0) */
+
+/*
+** Forward declaration of objects used by this utility
+*/
+typedef struct SpCache SpCache;
+typedef struct SpStripe SpStripe;
+typedef struct SpPage SpPage;
+typedef struct SpFile SpFile;
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef sqlite3_uint64 u64;
+
+/* Access to a lower-level VFS that (might) implement dynamic loading,
+** access to randomness, etc.
+*/
+#define ORIGVFS(p)  ((sqlite3_vfs*)((p)->pAppData))
+#define ORIGFILE(p) ((sqlite3_file*)(((SpFile*)(p))+1))
+
+/* A cached page.  The page data follows. */
+struct SpPage {
+  sqlite3_int64 iOff;             /* Offset of the page in the file */
+  int nByte;                      /* Size of the page */
+  u8 bRef;                        /* CLOCK reference bit */
+  SpPage *pHashNext;              /* Next entry with the same hash */
+  SpPage *pClockNext;             /* Next entry on the CLOCK ring */
+  SpPage *pClockPrev;             /* Previous entry on the CLOCK ring */
+};
+
+/* One stripe of a shared cache */
+struct SpStripe {
+  sqlite3_mutex *mutex;           /* Protects all fields of the stripe */
+  u32 iGen;                       /* Generation of the pages in the stripe */
+  int nHash;                      /* Size of apHash[] */
+  SpPage **apHash;                /* Hash table on page offset */
+  SpPage *pHand;                  /* CLOCK hand, or NULL if empty */
+  int nPage;                      /* Number of pages held */
+  sqlite3_int64 nByte;            /* Bytes of page data held */
+  sqlite3_int64 nMaxByte;         /* Budget for the stripe */
+  sqlite3_int64 nHit;             /* Reads answered from the stripe */
+  sqlite3_int64 nMiss;            /* Cacheable reads that went to the file */
+  sqlite3_int64 nEvict;           /* Pages evicted to make room */
+  sqlite3_int64 nInval;           /* Pages removed because they changed */
+};
+
+/* Size of each stripe, rounded up to a whole number of cache lines */
+#define SP_STRIPE_SIZE \
+  ((sizeof(SpStripe)+SP_CACHE_LINE-1) & ~(size_t)(SP_CACHE_LINE-1))
+
+/* The shared cache for one database file */
+struct SpCache {
+  char *zPath;                    /* Full pathname of the file */
+  int nRef;                       /* Number of SpFile objects using this */
+  SpCache *pNext;                 /* Next cache in spRegistry */
+  sqlite3_int64 nMaxByte;         /* Size of the cache in bytes */
+  int nStripe;                    /* Number of stripes */
+  u8 *aStripe;                    /* nStripe stripes, SP_STRIPE_SIZE apart */
+  void *pStripeAlloc;             /* Allocation holding aStripe[] */
+
+  /* The following are protected by mutex */
+  sqlite3_mutex *mutex;
+  u32 iGen;                       /* Current generation */
+  sqlite3_int64 nReset;           /* Number of times the cache was emptied */
+  int bChange;                    /* True if iChange is valid */
+  u32 iChange;                    /* File change counter last seen */
+  int bWal;                       /* True if aSalt[] and nBackfill are valid */
+  u32 aSalt[2];                   /* WAL salt last seen */
+  u32 nBackfill;                  /* Backfilled WAL frames last seen */
+};
+
+/* An open file */
+struct SpFile {
+  sqlite3_file base;              /* IO methods */
+  SpCache *pCache;                /* Shared cache for this file */
+  int eLock;                      /* Current lock held on the file */
+  u32 iGen;                       /* Generation of the read transaction */
+  u32 nBackfill;                  /* Backfill count the cache is known to
+                                  ** be up to date with */
+  int szRegion;                   /* Size of each wal-index region */
+  void volatile *pShm0;           /* Wal-index region 0, or NULL */
+};
+
+/*
+** All shared caches.  Protected by the SQLITE_MUTEX_STATIC_VFS2 mutex.
+*/
+static SpCache *spRegistry = 0;
+
+/*
+** Methods for SpFile
+*/
+static int spClose(sqlite3_file*);
+static int spRead(sqlite3_file*, void*, int iAmt, sqlite3_int64 iOfst);
+static int spWrite(sqlite3_file*,const void*,int iAmt, sqlite3_int64 iOfst);
+static int spTruncate(sqlite3_file*, sqlite3_int64 size);
+static int spSync(sqlite3_file*, int flags);
+static int spFileSize(sqlite3_file*, sqlite3_int64 *pSize);
+static int spLock(sqlite3_file*, int);
+static int spUnlock(sqlite3_file*, int);
+static int spCheckReservedLock(sqlite3_file*, int *pResOut);
+static int spFileControl(sqlite3_file*, int op, void *pArg);
+static int spSectorSize(sqlite3_file*);
+static int spDeviceCharacteristics(sqlite3_file*);
+static int spShmMap(sqlite3_file*, int iPg, int pgsz, int, void volatile**);
+static int spShmLock(sqlite3_file*, int offset, int n, int flags);
+static void spShmBarrier(sqlite3_file*);
+static int spShmUnmap(sqlite3_file*, int deleteFlag);
+
+/*
+** Methods for SpVfs
+*/
+static int spOpen(sqlite3_vfs*, const char *, sqlite3_file*, int , int *);
+static int spDelete(sqlite3_vfs*, const char *zName, int syncDir);
+static int spAccess(sqlite3_vfs*, const char *zName, int flags, int *);
+static int spFullPathname(sqlite3_vfs*, const char *zName, int, char *zOut);
+static void *spDlOpen(sqlite3_vfs*, const char *zFilename);
+static void spDlError(sqlite3_vfs*, int nByte, char *zErrMsg);
+static void (*spDlSym(sqlite3_vfs *pVfs, void *p, const char*zSym))(void);
+static void spDlClose(sqlite3_vfs*, void*);
+static int spRandomness(sqlite3_vfs*, int nByte, char *zOut);
+static int spSleep(sqlite3_vfs*, int microseconds);
+static int spCurrentTime(sqlite3_vfs*, double*);
+static int spGetLastError(sqlite3_vfs*, int, char *);
+static int spCurrentTimeInt64(sqlite3_vfs*, sqlite3_int64*);
+static int spSetSystemCall(sqlite3_vfs*, const char*,sqlite3_syscall_ptr);
+static sqlite3_syscall_ptr spGetSystemCall(sqlite3_vfs*, const char *z);
+static const char *spNextSystemCall(sqlite3_vfs*, const char *zName);
+
+static sqlite3_vfs sp_vfs = {
+  3,                            /* iVersion (set when registered) */
+  0,                            /* szOsFile (set when registered) */
+  1024,                         /* mxPathname */
+  0,                            /* pNext */
+  "sharedpagevfs",              /* zName */
+  0,                            /* pAppData (set when registered) */
+  spOpen,                       /* xOpen */
+  spDelete,                     /* xDelete */
+  spAccess,                     /* xAccess */
+  spFullPathname,               /* xFullPathname */
+  spDlOpen,                     /* xDlOpen */
+  spDlError,                    /* xDlError */
+  spDlSym,                      /* xDlSym */
+  spDlClose,                    /* xDlClose */
+  spRandomness,                 /* xRandomness */
+  spSleep,                      /* xSleep */
+  spCurrentTime,                /* xCurrentTime */
+  spGetLastError,               /* xGetLastError */
+  spCurrentTimeInt64,           /* xCurrentTimeInt64 */
+  spSetSystemCall,              /* xSetSystemCall */
+  spGetSystemCall,              /* xGetSystemCall */
+  spNextSystemCall              /* xNextSystemCall */
+};
+
+/*
+** Version 2 of the IO methods: there is no xFetch, so the pager does not
+** use memory-mapped I/O and every read of the file comes through spRead().
+*/
+static const sqlite3_io_methods sp_io_methods = {
+  2,                              /* iVersion */
+  spClose,                        /* xClose */
+  spRead,                         /* xRead */
+  spWrite,                        /* xWrite */
+  spTruncate,                     /* xTruncate */
+  spSync,                         /* xSync */
+  spFileSize,                     /* xFileSize */
+  spLock,                         /* xLock */
+  spUnlock,                       /* xUnlock */
+  spCheckReservedLock,            /* xCheckReservedLock */
+  spFileControl,                  /* xFileControl */
+  spSectorSize,                   /* xSectorSize */
+  spDeviceCharacteristics,        /* xDeviceCharacteristics */
+  spShmMap,                       /* xShmMap */
+  spShmLock,                      /* xShmLock */
+  spShmBarrier,                   /* xShmBarrier */
+  spShmUnmap,                     /* xShmUnmap */
+  0,                              /* xFetch */
+  0                               /* xUnfetch */
+};
+
+/*
+** Striped cache of pages.
+*/
+#define SP_PAGE_DATA(pPg) ((u8*)&(pPg)[1])
+
+/* Multiplier for Fibonacci hashing, 2^64 divided by the golden ratio */
+#define SP_HASH_MULT ((((u64)0x9E3779B9)<<32) | (u64)0x7F4A7C15)
+
+/*
+** Return true if a read or write of iAmt bytes at iOfst is of a whole
+** database page.
+*/
+static int spIsPage(int iAmt, sqlite3_int64 iOfst){
+  return iAmt>=SP_MIN_PAGE && iAmt<=SP_MAX_PAGE
+      && (iAmt & (iAmt-1))==0
+      && (iOfst & (iAmt-1))==0;
+}
+
+/*
+** Return the stripe that holds the page at offset iOff.  Set *piHash to
+** the bucket within the stripe's hash table.
+*/
+static SpStripe *spStripe(SpCache *pCache, sqlite3_int64 iOff, int *piHash){
+  u32 h = (u32)((((u64)iOff >> 9) * SP_HASH_MULT) >> 32);
+  SpStripe *pStripe;
+  pStripe = (SpStripe*)&pCache->aStripe[(h % pCache->nStripe)*SP_STRIPE_SIZE];
+  *piHash = (int)((h / pCache->nStripe) % (u32)pStripe->nHash);
+  return pStripe;
+}
+
+/*
+** Return the page at offset iOff in bucket iHash of stripe p, or NULL.
+*/
+static SpPage *spFind(SpStripe *p, int iHash, sqlite3_int64 iOff){
+  SpPage *pPg;
+  for(pPg=p->apHash[iHash]; pPg; pPg=pPg->pHashNext){
+    if( pPg->iOff==iOff ) return pPg;
+  }
+  return 0;
+}
+
+/*
+** Remove page pPg, which is in bucket iHash, from stripe p.  The page is
+** not freed.
+*/
+static void spUnlink(SpStripe *p, int iHash, SpPage *pPg){
+  SpPage **pp = &p->apHash[iHash];
+  while( *pp!=pPg ) pp = &(*pp)->pHashNext;
+  *pp = pPg->pHashNext;
+  if( pPg->pClockNext==pPg ){
+    p->pHand = 0;
+  }else{
+    if( p->pHand==pPg ) p->pHand = pPg->pClockNext;
+    pPg->pClockPrev->pClockNext = pPg->pClockNext;
+    pPg->pClockNext->pClockPrev = pPg->pClockPrev;
+  }
+  p->nPage--;
+  p->nByte -= pPg->nByte;
+}
+
+/*
+** Advance the clock hand of stripe p to the first page without its
+** reference bit set, clearing the bits it passes, and remove that page.
+** The stripe must not be empty.
+*/
+static SpPage *spEvict(SpCache *pCache, SpStripe *p){
+  SpPage *pPg = p->pHand;
+  int iHash;
+  assert( pPg!=0 );
+  while( pPg->bRef ){
+    pPg->bRef = 0;
+    pPg = pPg->pClockNext;
+  }
+  p->pHand = pPg;
+  spStripe(pCache, pPg->iOff, &iHash);
+  spUnlink(p, iHash, pPg);
+  p->nEvict++;
+  return pPg;
+}
+
+/*
+** Add a copy of the nByte byte page at offset iOff, which must not already
+** be in stripe p, evicting pages as needed to stay within the budget.
+** Nothing is added if there is not enough memory.
+*/
+static void spInsert(
+  SpCache *pCache,
+  SpStripe *p,
+  int iHash,
+  sqlite3_int64 iOff,
+  const void *aData,
+  int nByte
+){
+  SpPage *pNew = 0;
+  if( nByte>p->nMaxByte ) return;
+  while( p->nByte+nByte>p->nMaxByte ){
+    SpPage *pVictim = spEvict(pCache, p);
+    if( pNew==0 && pVictim->nByte==nByte ){
+      pNew = pVictim;
+    }else{
+      sqlite3_free(pVictim);
+    }
+  }
+  if( pNew==0 ){
+    pNew = (SpPage*)sqlite3_malloc64(sizeof(SpPage) + nByte);
+    if( pNew==0 ) return;
+  }
+  pNew->iOff = iOff;
+  pNew->nByte = nByte;
+  pNew->bRef = 0;
+  memcpy(SP_PAGE_DATA(pNew), aData, nByte);
+  pNew->pHashNext = p->apHash[iHash];
+  p->apHash[iHash] = pNew;
+  if( p->pHand==0 ){
+    pNew->pClockNext = pNew->pClockPrev = pNew;
+    p->pHand = pNew;
+  }else{
+    pNew->pClockNext = p->pHand;
+    pNew->pClockPrev = p->pHand->pClockPrev;
+    pNew->pClockPrev->pClockNext = pNew;
+    p->pHand->pClockPrev = pNew;
+  }
+  p->nPage++;
+  p->nByte += nByte;
+}
+
+/*
+** Free all pages in stripe p.  The caller must hold its mutex, if any.
+*/
+static void spStripeFree(SpStripe *p){
+  SpPage *pPg = p->pHand;
+  if( pPg ){
+    pPg->pClockPrev->pClockNext = 0;
+    while( pPg ){
+      SpPage *pNext = pPg->pClockNext;
+      sqlite3_free(pPg);
+      pPg = pNext;
+    }
+  }
+  if( p->apHash ) memset(p->apHash, 0, sizeof(SpPage*)*p->nHash);
+  p->pHand = 0;
+  p->nPage = 0;
+  p->nByte = 0;
+}
+
+/*
+** Remove the page at offset iOff, if it is cached.
+*/
+static void spInvalidate(SpCache *pCache, sqlite3_int64 iOff){
+  int iHash;
+  SpStripe *p = spStripe(pCache, iOff, &iHash);
+  SpPage *pPg;
+  sqlite3_mutex_enter(p->mutex);
+  pPg = spFind(p, iHash, iOff);
+  if( pPg ){
+    spUnlink(p, iHash, pPg);
+    sqlite3_free(pPg);
+    p->nInval++;
+  }
+  sqlite3_mutex_leave(p->mutex);
+}
+
+/*
+** Empty the cache and begin a new generation.  The caller must hold
+** pCache->mutex.
+*/
+static void spClear(SpCache *pCache){
+  int i;
+  pCache->iGen++;
+  for(i=0; i<pCache->nStripe; i++){
+    SpStripe *p = (SpStripe*)&pCache->aStripe[i*SP_STRIPE_SIZE];
+    sqlite3_mutex_enter(p->mutex);
+    p->nInval += p->nPage;
+    spStripeFree(p);
+    p->iGen = pCache->iGen;
+    sqlite3_mutex_leave(p->mutex);
+  }
+}
+
+/*
+** Empty the cache of a file after a change that cannot be tracked page by
+** page.
+*/
+static void spReset(SpCache *pCache){
+  sqlite3_mutex_enter(pCache->mutex);
+  spClear(pCache);
+  pCache->nReset++;
+  sqlite3_mutex_leave(pCache->mutex);
+}
+
+/*
+** Free a shared cache that is no longer used.
+*/
+static void spCacheFree(SpCache *pCache){
+  int i;
+  if( pCache->aStripe ){
+    for(i=0; i<pCache->nStripe; i++){
+      SpStripe *p = (SpStripe*)&pCache->aStripe[i*SP_STRIPE_SIZE];
+      spStripeFree(p);
+      sqlite3_free(p->apHash);
+      sqlite3_mutex_free(p->mutex);
+    }
+  }
+  sqlite3_free(pCache->pStripeAlloc);
+  sqlite3_mutex_free(pCache->mutex);
+  sqlite3_free(pCache);
+}
+
+/*
+** Allocate a new shared cache for file zPath, taking its size and number
+** of stripes from the URI parameters of zPath.
+*/
+static SpCache *spCacheNew(const char *zPath){
+  SpCache *pCache;
+  sqlite3_int64 nKiB;
+  int nStripe;
+  int nPath = (int)strlen(zPath);
+  int i;
+
+  nKiB = sqlite3_uri_int64(zPath, "sharedcache", SP_DEFAULT_CACHE);
+  if( nKiB<0 ) nKiB = 0;
+  nStripe = (int)sqlite3_uri_int64(zPath, "stripes", SP_DEFAULT_STRIPE);
+  if( nStripe<1 ) nStripe = 1;
+  if( nStripe>SP_MAX_STRIPE ) nStripe = SP_MAX_STRIPE;
+
+  pCache = (SpCache*)sqlite3_malloc64(sizeof(SpCache) + nPath + 1);
+  if( pCache==0 ) return 0;
+  memset(pCache, 0, sizeof(SpCache));
+  pCache->zPath = (char*)&pCache[1];
+  memcpy(pCache->zPath, zPath, nPath+1);
+  pCache->nMaxByte = nKiB*1024;
+  pCache->nStripe = nStripe;
+  pCache->iGen = 1;
+  pCache->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  pCache->pStripeAlloc = sqlite3_malloc64(SP_STRIPE_SIZE*nStripe
+                                          + SP_CACHE_LINE);
+  if( pCache->pStripeAlloc==0 ) goto new_failed;
+  pCache->aStripe = (u8*)pCache->pStripeAlloc
+     + ((SP_CACHE_LINE - ((size_t)pCache->pStripeAlloc & (SP_CACHE_LINE-1)))
+        & (SP_CACHE_LINE-1));
+  memset(pCache->aStripe, 0, SP_STRIPE_SIZE*nStripe);
+  for(i=0; i<nStripe; i++){
+    SpStripe *p = (SpStripe*)&pCache->aStripe[i*SP_STRIPE_SIZE];
+    p->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    p->iGen = pCache->iGen;
+    p->nMaxByte = pCache->nMaxByte / nStripe;
+    p->nHash = (int)(p->nMaxByte / SP_HASH_RATIO) + 1;
+    p->apHash = (SpPage**)sqlite3_malloc64(sizeof(SpPage*)*p->nHash);
+    if( p->apHash==0 ) goto new_failed;
+    memset(p->apHash, 0, sizeof(SpPage*)*p->nHash);
+  }
+  return pCache;
+
+new_failed:
+  spCacheFree(pCache);
+  return 0;
+}
+
+/*
+** Return the shared cache for file zPath, creating it if this is the
+** first connection to the file.
+*/
+static SpCache *spCacheAcquire(const char *zPath){
+  sqlite3_mutex *pMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_VFS2);
+  SpCache *pCache;
+  sqlite3_mutex_enter(pMutex);
+  for(pCache=spRegistry; pCache; pCache=pCache->pNext){
+    if( strcmp(pCache->zPath, zPath)==0 ) break;
+  }
+  if( pCache==0 ){
+    pCache = spCacheNew(zPath);
+    if( pCache ){
+      pCache->pNext = spRegistry;
+      spRegistry = pCache;
+    }
+  }
+  if( pCache ) pCache->nRef++;
+  sqlite3_mutex_leave(pMutex);
+  return pCache;
+}
+
+/*
+** Release a reference to a shared cache, freeing it if it was the last.
+*/
+static void spCacheRelease(SpCache *pCache){
+  sqlite3_mutex *pMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_VFS2);
+  sqlite3_mutex_enter(pMutex);
+  if( --pCache->nRef==0 ){
+    SpCache **pp = &spRegistry;
+    while( *pp!=pCache ) pp = &(*pp)->pNext;
+    *pp = pCache->pNext;
+    spCacheFree(pCache);
+  }
+  sqlite3_mutex_leave(pMutex);
+}
+
+/*
+** Invalidation.
+*/
+static u32 spShm32(void volatile *pShm, int iOff){
+  return ((volatile u32*)pShm)[iOff/4];
+}
+
+/*
+** Remove from the cache the pages written by WAL frames iFirst to iLast,
+** which have just been backfilled into the database file.  The caller
+** must hold pCache->mutex.
+*/
+static int spInvalidateFrames(SpFile *p, u32 iFirst, u32 iLast, int szPage){
+  sqlite3_file *pSub = ORIGFILE(p);
+  void volatile *pRegion = p->pShm0;
+  int iRegion = 0;
+  u32 iFrame;
+  for(iFrame=iFirst; iFrame<=iLast; iFrame++){
+    int iIdx;
+    int iNeed;
+    u32 pgno;
+    if( iFrame<=SP_WAL_NPAGE_ONE ){
+      iNeed = 0;
+      iIdx = SP_WAL_HDRSIZE/4 + iFrame - 1;
+    }else{
+      iNeed = (iFrame - SP_WAL_NPAGE_ONE - 1)/SP_WAL_NPAGE + 1;
+      iIdx = (iFrame - SP_WAL_NPAGE_ONE - 1)%SP_WAL_NPAGE;
+    }
+    if( iNeed!=iRegion ){
+      int rc = pSub->pMethods->xShmMap(pSub, iNeed, p->szRegion, 0, &pRegion);
+      if( (rc!=SQLITE_OK && rc!=SQLITE_READONLY) || pRegion==0 ){
+        return SQLITE_ERROR;
+      }
+      iRegion = iNeed;
+    }
+    pgno = spShm32(pRegion, iIdx*4);
+    if( pgno>0 ) spInvalidate(p->pCache, (sqlite3_int64)(pgno-1)*szPage);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Compare the WAL salt and backfill count in the wal-index with those last
+** seen, and remove the pages that have changed since.  The caller must hold
+** pCache->mutex.
+*/
+static void spCheckWal(SpFile *p){
+  SpCache *pCache = p->pCache;
+  sqlite3_file *pSub = ORIGFILE(p);
+  u32 aSalt[2];
+  u32 nBackfill;
+  int szPage;
+
+  pSub->pMethods->xShmBarrier(pSub);
+  aSalt[0] = spShm32(p->pShm0, SP_WAL_SALT);
+  aSalt[1] = spShm32(p->pShm0, SP_WAL_SALT+4);
+  nBackfill = spShm32(p->pShm0, SP_WAL_BACKFILL);
+  szPage = ((volatile u16*)p->pShm0)[SP_WAL_SZPAGE/2];
+  szPage = (szPage&0xfe00) + ((szPage&0x0001)<<16);
+
+  if( !pCache->bWal
+   || aSalt[0]!=pCache->aSalt[0] || aSalt[1]!=pCache->aSalt[1]
+   || nBackfill<pCache->nBackfill
+  ){
+    spClear(pCache);
+    if( pCache->bWal ) pCache->nReset++;
+  }else if( nBackfill>pCache->nBackfill ){
+    int rc = spInvalidateFrames(p, pCache->nBackfill+1, nBackfill, szPage);
+    /* If the WAL was restarted while the page numbers were being read,
+    ** some of them may belong to the new WAL. */
+    pSub->pMethods->xShmBarrier(pSub);
+    if( rc!=SQLITE_OK
+     || aSalt[0]!=spShm32(p->pShm0, SP_WAL_SALT)
+     || aSalt[1]!=spShm32(p->pShm0, SP_WAL_SALT+4)
+    ){
+      spClear(pCache);
+      pCache->nReset++;
+    }
+  }
+  pCache->bWal = 1;
+  pCache->aSalt[0] = aSalt[0];
+  pCache->aSalt[1] = aSalt[1];
+  pCache->nBackfill = nBackfill;
+}
+
+/*
+** Compare the file change counter with the value last seen, and empty the
+** cache if it differs.  The caller must hold pCache->mutex.
+*/
+static void spCheckChange(SpFile *p){
+  SpCache *pCache = p->pCache;
+  sqlite3_file *pSub = ORIGFILE(p);
+  u8 a[4];
+  u32 iChange;
+  int rc;
+  rc = pSub->pMethods->xRead(pSub, a, 4, 24);
+  if( rc!=SQLITE_OK && rc!=SQLITE_IOERR_SHORT_READ ){
+    spClear(pCache);
+    pCache->nReset++;
+    pCache->bChange = 0;
+    return;
+  }
+  iChange = ((u32)a[0]<<24) + ((u32)a[1]<<16) + ((u32)a[2]<<8) + (u32)a[3];
+  if( !pCache->bChange || iChange!=pCache->iChange ){
+    spClear(pCache);
+    if( pCache->bChange ) pCache->nReset++;
+  }
+  pCache->bChange = 1;
+  pCache->iChange = iChange;
+}
+
+/*
+** Called when a read transaction begins: when a SHARED lock is taken on
+** a database that is not in WAL mode, and when a WAL read lock is taken.
+** Bring the cache up to date and record the generation the transaction
+** reads.
+*/
+static void spBeginRead(SpFile *p){
+  SpCache *pCache = p->pCache;
+  sqlite3_mutex_enter(pCache->mutex);
+  if( p->pShm0 ){
+    spCheckWal(p);
+    p->nBackfill = pCache->nBackfill;
+  }else{
+    spCheckChange(p);
+  }
+  p->iGen = pCache->iGen;
+  sqlite3_mutex_leave(pCache->mutex);
+}
+
+/*
+** Called from spRead() in WAL mode if the backfill count in the wal-index
+** differs from the one the cache was last brought up to date with by this
+** connection.  Remove the pages that have been backfilled since.  The
+** generation of the read transaction is not changed, so if the cache is
+** emptied this connection neither uses nor adds pages until its next
+** transaction.
+*/
+static void spCatchUp(SpFile *p){
+  SpCache *pCache = p->pCache;
+  sqlite3_mutex_enter(pCache->mutex);
+  spCheckWal(p);
+  p->nBackfill = pCache->nBackfill;
+  sqlite3_mutex_leave(pCache->mutex);
+}
+
+/*
+** Close a file.
+*/
+static int spClose(sqlite3_file *pFile){
+  SpFile *p = (SpFile *)pFile;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xClose(pFile);
+  spCacheRelease(p->pCache);
+  return rc;
+}
+
+/*
+** Read data from a file.  Whole pages are answered from the shared cache
+** if possible, and added to it if not.
+*/
+static int spRead(
+  sqlite3_file *pFile,
+  void *zBuf,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  SpFile *p = (SpFile *)pFile;
+  SpStripe *pStripe;
+  SpPage *pPg;
+  int iHash;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  if( p->eLock<SQLITE_LOCK_SHARED || !spIsPage(iAmt, iOfst) ){
+    return pFile->pMethods->xRead(pFile, zBuf, iAmt, iOfst);
+  }
+  if( p->pShm0 && spShm32(p->pShm0, SP_WAL_BACKFILL)!=p->nBackfill ){
+    spCatchUp(p);
+  }
+  pStripe = spStripe(p->pCache, iOfst, &iHash);
+  sqlite3_mutex_enter(pStripe->mutex);
+  if( pStripe->iGen==p->iGen ){
+    pPg = spFind(pStripe, iHash, iOfst);
+    if( pPg && pPg->nByte==iAmt ){
+      memcpy(zBuf, SP_PAGE_DATA(pPg), iAmt);
+      pPg->bRef = 1;
+      pStripe->nHit++;
+      sqlite3_mutex_leave(pStripe->mutex);
+      return SQLITE_OK;
+    }
+  }
+  pStripe->nMiss++;
+  sqlite3_mutex_leave(pStripe->mutex);
+
+  rc = pFile->pMethods->xRead(pFile, zBuf, iAmt, iOfst);
+  if( rc==SQLITE_OK ){
+    sqlite3_mutex_enter(pStripe->mutex);
+    if( pStripe->iGen==p->iGen ){
+      pPg = spFind(pStripe, iHash, iOfst);
+      if( pPg && pPg->nByte!=iAmt ){
+        spUnlink(pStripe, iHash, pPg);
+        sqlite3_free(pPg);
+        pPg = 0;
+      }
+      if( pPg==0 ) spInsert(p->pCache, pStripe, iHash, iOfst, zBuf, iAmt);
+    }
+    sqlite3_mutex_leave(pStripe->mutex);
+  }
+  return rc;
+}
+
+/*
+** Write data to a file.  A page that is written is removed from the cache.
+** Writes of anything other than whole pages empty it.
+*/
+static int spWrite(
+  sqlite3_file *pFile,
+  const void *z,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  SpFile *p = (SpFile *)pFile;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xWrite(pFile, z, iAmt, iOfst);
+  if( rc==SQLITE_OK && spIsPage(iAmt, iOfst) ){
+    spInvalidate(p->pCache, iOfst);
+  }else{
+    spReset(p->pCache);
+  }
+  return rc;
+}
+
+/*
+** Truncate a file.  The cache is emptied.
+*/
+static int spTruncate(sqlite3_file *pFile, sqlite3_int64 size){
+  SpFile *p = (SpFile *)pFile;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xTruncate(pFile, size);
+  spReset(p->pCache);
+  return rc;
+}
+
+/*
+** Sync a file.
+*/
+static int spSync(sqlite3_file *pFile, int flags){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xSync(pFile, flags);
+}
+
+/*
+** Return the current file-size of a file.
+*/
+static int spFileSize(sqlite3_file *pFile, sqlite3_int64 *pSize){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xFileSize(pFile, pSize);
+}
+
+/*
+** Lock a file.  When a SHARED lock is first obtained on a database that
+** is not in WAL mode, check whether the file has been changed since the
+** cache was last brought up to date.  In WAL mode that is done when a
+** WAL read lock is obtained, in spShmLock().
+*/
+static int spLock(sqlite3_file *pFile, int eLock){
+  SpFile *p = (SpFile *)pFile;
+  sqlite3_file *pSub = ORIGFILE(pFile);
+  int rc;
+  rc = pSub->pMethods->xLock(pSub, eLock);
+  if( rc==SQLITE_OK ){
+    if( p->eLock==SQLITE_LOCK_NONE && p->pShm0==0 ) spBeginRead(p);
+    p->eLock = eLock;
+  }
+  return rc;
+}
+
+/*
+** Unlock a file.
+*/
+static int spUnlock(sqlite3_file *pFile, int eLock){
+  SpFile *p = (SpFile *)pFile;
+  sqlite3_file *pSub = ORIGFILE(pFile);
+  int rc;
+  rc = pSub->pMethods->xUnlock(pSub, eLock);
+  if( rc==SQLITE_OK ) p->eLock = eLock;
+  return rc;
+}
+
+/*
+** Check if another file-handle holds a RESERVED lock on a file.
+*/
+static int spCheckReservedLock(sqlite3_file *pFile, int *pResOut){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xCheckReservedLock(pFile, pResOut);
+}
+
+/*
+** File control method.
+*/
+static int spFileControl(sqlite3_file *pFile, int op, void *pArg){
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xFileControl(pFile, op, pArg);
+  if( rc==SQLITE_OK && op==SQLITE_FCNTL_VFSNAME ){
+    *(char**)pArg = sqlite3_mprintf("sharedpage/%z", *(char**)pArg);
+  }
+  return rc;
+}
+
+/*
+** Return the sector-size in bytes for a file.
+*/
+static int spSectorSize(sqlite3_file *pFile){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xSectorSize(pFile);
+}
+
+/*
+** Return the device characteristic flags supported by a file.
+*/
+static int spDeviceCharacteristics(sqlite3_file *pFile){
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xDeviceCharacteristics(pFile);
+}
+
+/*
+** Shared memory methods.  Region 0 of the wal-index, which holds its
+** header, is remembered so that spCheckWal() can read it.
+*/
+static int spShmMap(
+  sqlite3_file *pFile,
+  int iPg,
+  int pgsz,
+  int bExtend,
+  void volatile **pp
+){
+  SpFile *p = (SpFile *)pFile;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xShmMap(pFile, iPg, pgsz, bExtend, pp);
+  if( iPg==0 && (rc==SQLITE_OK || rc==SQLITE_READONLY) && *pp ){
+    p->pShm0 = *pp;
+    p->szRegion = pgsz;
+  }
+  return rc;
+}
+
+/*
+** Obtain or release a wal-index lock.  Taking a WAL read lock begins a
+** read transaction.
+*/
+static int spShmLock(sqlite3_file *pFile, int offset, int n, int flags){
+  SpFile *p = (SpFile *)pFile;
+  int rc;
+  pFile = ORIGFILE(pFile);
+  rc = pFile->pMethods->xShmLock(pFile, offset, n, flags);
+  if( rc==SQLITE_OK
+   && flags==(SQLITE_SHM_LOCK|SQLITE_SHM_SHARED)
+   && offset>=SP_WAL_READ_LOCK0
+   && p->pShm0
+  ){
+    spBeginRead(p);
+  }
+  return rc;
+}
+static void spShmBarrier(sqlite3_file *pFile){
+  pFile = ORIGFILE(pFile);
+  pFile->pMethods->xShmBarrier(pFile);
+}
+static int spShmUnmap(sqlite3_file *pFile, int deleteFlag){
+  SpFile *p = (SpFile *)pFile;
+  p->pShm0 = 0;
+  pFile = ORIGFILE(pFile);
+  return pFile->pMethods->xShmUnmap(pFile, deleteFlag);
+}
+
+/*
+** Open a file handle.  Main database files share the cache of the file;
+** all other files are opened directly by the underlying VFS.
+*/
+static int spOpen(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_file *pFile,
+  int flags,
+  int *pOutFlags
+){
+  SpFile *p;
+  sqlite3_file *pSubFile;
+  sqlite3_vfs *pSubVfs;
+  int rc;
+  pSubVfs = ORIGVFS(pVfs);
+  if( (flags & SQLITE_OPEN_MAIN_DB)==0 || zName==0 ){
+    return pSubVfs->xOpen(pSubVfs, zName, pFile, flags, pOutFlags);
+  }
+  p = (SpFile*)pFile;
+  memset(p, 0, sizeof(*p));
+  pSubFile = ORIGFILE(pFile);
+  rc = pSubVfs->xOpen(pSubVfs, zName, pSubFile, flags, pOutFlags);
+  if( rc==SQLITE_OK ){
+    p->pCache = spCacheAcquire(zName);
+    if( p->pCache==0 ){
+      pSubFile->pMethods->xClose(pSubFile);
+      rc = SQLITE_NOMEM;
+    }
+  }
+  if( rc==SQLITE_OK ){
+    p->base.pMethods = &sp_io_methods;
+  }else{
+    pFile->pMethods = 0;
+  }
+  return rc;
+}
+
+/*
+** All other VFS methods are pass-thrus.
+*/
+static int spDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync){
+  return ORIGVFS(pVfs)->xDelete(ORIGVFS(pVfs), zPath, dirSync);
+}
+static int spAccess(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int flags,
+  int *pResOut
+){
+  return ORIGVFS(pVfs)->xAccess(ORIGVFS(pVfs), zPath, flags, pResOut);
+}
+static int spFullPathname(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int nOut,
+  char *zOut
+){
+  return ORIGVFS(pVfs)->xFullPathname(ORIGVFS(pVfs),zPath,nOut,zOut);
+}
+static void *spDlOpen(sqlite3_vfs *pVfs, const char *zPath){
+  return ORIGVFS(pVfs)->xDlOpen(ORIGVFS(pVfs), zPath);
+}
+static void spDlError(sqlite3_vfs *pVfs, int nByte, char *zErrMsg){
+  ORIGVFS(pVfs)->xDlError(ORIGVFS(pVfs), nByte, zErrMsg);
+}
+static void (*spDlSym(sqlite3_vfs *pVfs, void *p, const char *zSym))(void){
+  return ORIGVFS(pVfs)->xDlSym(ORIGVFS(pVfs), p, zSym);
+}
+static void spDlClose(sqlite3_vfs *pVfs, void *pHandle){
+  ORIGVFS(pVfs)->xDlClose(ORIGVFS(pVfs), pHandle);
+}
+static int spRandomness(sqlite3_vfs *pVfs, int nByte, char *zBufOut){
+  return ORIGVFS(pVfs)->xRandomness(ORIGVFS(pVfs), nByte, zBufOut);
+}
+static int spSleep(sqlite3_vfs *pVfs, int nMicro){
+  return ORIGVFS(pVfs)->xSleep(ORIGVFS(pVfs), nMicro);
+}
+static int spCurrentTime(sqlite3_vfs *pVfs, double *pTimeOut){
+  return ORIGVFS(pVfs)->xCurrentTime(ORIGVFS(pVfs), pTimeOut);
+}
+static int spGetLastError(sqlite3_vfs *pVfs, int a, char *b){
+  return ORIGVFS(pVfs)->xGetLastError(ORIGVFS(pVfs), a, b);
+}
+static int spCurrentTimeInt64(sqlite3_vfs *pVfs, sqlite3_int64 *p){
+  return ORIGVFS(pVfs)->xCurrentTimeInt64(ORIGVFS(pVfs), p);
+}
+static int spSetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_syscall_ptr pCall
+){
+  return ORIGVFS(pVfs)->xSetSystemCall(ORIGVFS(pVfs),zName,pCall);
+}
+static sqlite3_syscall_ptr spGetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName
+){
+  return ORIGVFS(pVfs)->xGetSystemCall(ORIGVFS(pVfs),zName);
+}
+static const char *spNextSystemCall(sqlite3_vfs *pVfs, const char *zName){
+  return ORIGVFS(pVfs)->xNextSystemCall(ORIGVFS(pVfs), zName);
+}
+
+/*
+** The sharedpagevfs_stats virtual table.  It has one row for each shared
+** cache, with its counters summed over the stripes.
+*/
+#define SPSTAT_FILE          0
+#define SPSTAT_CONNECTIONS   1
+#define SPSTAT_STRIPES       2
+#define SPSTAT_MAX_BYTES     3
+#define SPSTAT_PAGES         4
+#define SPSTAT_BYTES         5
+#define SPSTAT_HITS          6
+#define SPSTAT_MISSES        7
+#define SPSTAT_EVICTIONS     8
+#define SPSTAT_INVALIDATIONS 9
+#define SPSTAT_RESETS        10
+#define SPSTAT_N             11
+
+/* One row of the table */
+typedef struct SpStatRow {
+  char *zPath;
+  sqlite3_int64 a[SPSTAT_N];      /* Values of columns other than "file" */
+} SpStatRow;
+
+/* A cursor.  The rows are copied when the scan starts. */
+typedef struct SpStatCursor {
+  sqlite3_vtab_cursor base;       /* Base class.  Must be first */
+  int nRow;                       /* Number of rows in aRow[] */
+  int iRow;                       /* Current row */
+  SpStatRow *aRow;                /* Copy of the rows */
+} SpStatCursor;
+
+static int spStatConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  sqlite3_vtab *pNew;
+  int rc;
+  rc = sqlite3_declare_vtab(db,
+      "CREATE TABLE x(file,connections,stripes,max_bytes,pages,bytes,"
+      "hits,misses,evictions,invalidations,resets)"
+  );
+  if( rc==SQLITE_OK ){
+    pNew = *ppVtab = sqlite3_malloc( sizeof(*pNew) );
+    if( pNew==0 ) return SQLITE_NOMEM;
+    memset(pNew, 0, sizeof(*pNew));
+  }
+  return rc;
+}
+
+static int spStatDisconnect(sqlite3_vtab *pVtab){
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+static int spStatOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
+  SpStatCursor *pCur;
+  pCur = sqlite3_malloc( sizeof(*pCur) );
+  if( pCur==0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void spStatClear(SpStatCursor *pCur){
+  int i;
+  for(i=0; i<pCur->nRow; i++) sqlite3_free(pCur->aRow[i].zPath);
+  sqlite3_free(pCur->aRow);
+  pCur->aRow = 0;
+  pCur->nRow = 0;
+  pCur->iRow = 0;
+}
+
+static int spStatClose(sqlite3_vtab_cursor *cur){
+  spStatClear((SpStatCursor*)cur);
+  sqlite3_free(cur);
+  return SQLITE_OK;
+}
+
+static int spStatNext(sqlite3_vtab_cursor *cur){
+  ((SpStatCursor*)cur)->iRow++;
+  return SQLITE_OK;
+}
+
+static int spStatColumn(
+  sqlite3_vtab_cursor *cur,
+  sqlite3_context *ctx,
+  int i
+){
+  SpStatCursor *pCur = (SpStatCursor*)cur;
+  SpStatRow *pRow = &pCur->aRow[pCur->iRow];
+  if( i==SPSTAT_FILE ){
+    sqlite3_result_text(ctx, pRow->zPath, -1, SQLITE_TRANSIENT);
+  }else{
+    sqlite3_result_int64(ctx, pRow->a[i]);
+  }
+  return SQLITE_OK;
+}
+
+static int spStatRowid(sqlite3_vtab_cursor *cur, sqlite3_int64 *pRowid){
+  *pRowid = ((SpStatCursor*)cur)->iRow;
+  return SQLITE_OK;
+}
+
+static int spStatEof(sqlite3_vtab_cursor *cur){
+  SpStatCursor *pCur = (SpStatCursor*)cur;
+  return pCur->iRow>=pCur->nRow;
+}
+
+/*
+** Copy the counters of every shared cache.
+*/
+static int spStatFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  SpStatCursor *pCur = (SpStatCursor*)pVtabCursor;
+  sqlite3_mutex *pMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_VFS2);
+  SpCache *pCache;
+  int nRow = 0;
+  int rc = SQLITE_OK;
+
+  spStatClear(pCur);
+  sqlite3_mutex_enter(pMutex);
+  for(pCache=spRegistry; pCache; pCache=pCache->pNext) nRow++;
+  if( nRow>0 ){
+    pCur->aRow = (SpStatRow*)sqlite3_malloc64(sizeof(SpStatRow)*nRow);
+    if( pCur->aRow==0 ) rc = SQLITE_NOMEM;
+  }
+  for(pCache=spRegistry; rc==SQLITE_OK && pCache; pCache=pCache->pNext){
+    SpStatRow *pRow = &pCur->aRow[pCur->nRow];
+    int i;
+    memset(pRow, 0, sizeof(*pRow));
+    pRow->zPath = sqlite3_mprintf("%s", pCache->zPath);
+    if( pRow->zPath==0 ){
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    pCur->nRow++;
+    pRow->a[SPSTAT_CONNECTIONS] = pCache->nRef;
+    pRow->a[SPSTAT_STRIPES] = pCache->nStripe;
+    pRow->a[SPSTAT_MAX_BYTES] = pCache->nMaxByte;
+    sqlite3_mutex_enter(pCache->mutex);
+    pRow->a[SPSTAT_RESETS] = pCache->nReset;
+    sqlite3_mutex_leave(pCache->mutex);
+    for(i=0; i<pCache->nStripe; i++){
+      SpStripe *p = (SpStripe*)&pCache->aStripe[i*SP_STRIPE_SIZE];
+      sqlite3_mutex_enter(p->mutex);
+      pRow->a[SPSTAT_PAGES] += p->nPage;
+      pRow->a[SPSTAT_BYTES] += p->nByte;
+      pRow->a[SPSTAT_HITS] += p->nHit;
+      pRow->a[SPSTAT_MISSES] += p->nMiss;
+      pRow->a[SPSTAT_EVICTIONS] += p->nEvict;
+      pRow->a[SPSTAT_INVALIDATIONS] += p->nInval;
+      sqlite3_mutex_leave(p->mutex);
+    }
+  }
+  sqlite3_mutex_leave(pMutex);
+  return rc;
+}
+
+/*
+** Only a full table scan is supported.
+*/
+static int spStatBestIndex(
+  sqlite3_vtab *tab,
+  sqlite3_index_info *pIdxInfo
+){
+  pIdxInfo->estimatedCost = 10.0;
+  pIdxInfo->estimatedRows = 10;
+  return SQLITE_OK;
+}
+
+static sqlite3_module spStatModule = {
+  0,                         /* iVersion */
+  0,                         /* xCreate */
+  spStatConnect,             /* xConnect */
+  spStatBestIndex,           /* xBestIndex */
+  spStatDisconnect,          /* xDisconnect */
+  0,                         /* xDestroy */
+  spStatOpen,                /* xOpen - open a cursor */
+  spStatClose,               /* xClose - close a cursor */
+  spStatFilter,              /* xFilter - configure scan constraints */
+  spStatNext,                /* xNext - advance a cursor */
+  spStatEof,                 /* xEof - check for end of scan */
+  spStatColumn,              /* xColumn - read data */
+  spStatRowid,               /* xRowid - read data */
+  0,                         /* xUpdate */
+  0,                         /* xBegin */
+  0,                         /* xSync */
+  0,                         /* xCommit */
+  0,                         /* xRollback */
+  0,                         /* xFindMethod */
+  0,                         /* xRename */
+};
+
+/*
+** This routine is an sqlite3_auto_extension() callback, invoked to register
+** the sharedpagevfs_stats virtual table for all new database connections.
+*/
+static int spStatRegister(
+  sqlite3 *db,
+  const char **pzErrMsg,
+  const struct sqlite3_api_routines *pThunk
+){
+  return sqlite3_create_module(db, "sharedpagevfs_stats", &spStatModule, 0);
+}
+
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+/*
+** This routine is called when the extension is loaded.
+** Register the new VFS, and the virtual table for this and each new
+** database connection.
+*/
+int sqlite3_sharedpagevfs_init(
+  sqlite3 *db,
+  char **pzErrMsg,
+  const sqlite3_api_routines *pApi
+){
+  int rc = SQLITE_OK;
+  sqlite3_vfs *pOrig;
+  SQLITE_EXTENSION_INIT2(pApi);
+  (void)pzErrMsg;
+  if( sqlite3_vfs_find(sp_vfs.zName)!=0 ) return SQLITE_OK_LOAD_PERMANENTLY;
+  pOrig = sqlite3_vfs_find(0);
+  sp_vfs.iVersion = pOrig->iVersion;
+  sp_vfs.pAppData = pOrig;
+  sp_vfs.szOsFile = pOrig->szOsFile + sizeof(SpFile);
+  rc = sqlite3_vfs_register(&sp_vfs, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_auto_extension((void(*)(void))spStatRegister);
+  }
+  if( rc==SQLITE_OK ) rc = spStatRegister(db, 0, 0);
+  if( rc==SQLITE_OK ) rc = SQLITE_OK_LOAD_PERMANENTLY;
+  return rc;
+}
@@ -54,6 +54,10 @@
 **     4. The largest rowid in the range of rowids that may be stored in the
 **        database table (an integer).
 **
+**   The SQL statement may be followed by options of the form
+**   <name>=<value>. The only option supported by unionvtab is "parallel"
+**   (see PARALLEL SCANS below).
+**
 ** SWARMVTAB
 **
 **  LEGACY SYNTAX:
@@ -83,6 +87,7 @@
 **      missing=<udf-function-name>
 **      openclose=<udf-function-name>
 **      maxopen=<integer>
+**      parallel=<integer>
 **      <sql-parameter>=<text-value>
 **
 **   The <sql-statement> must return the same 4 columns as for a swarmvtab
@@ -122,6 +127,8 @@
 **   The "maxopen" option is used to configure the maximum number of
 **   database files swarmvtab will hold open simultaneously (default 9).
 **
+**   The "parallel" option is described under PARALLEL SCANS below.
+**
 **   If an option name begins with a ":" character, then it is assumed
 **   to be an SQL parameter. In this case, the specified text value is
 **   bound to the same variable of the <sql-statement> before it is 
@@ -133,6 +140,45 @@
 **       :path='/home/user/databases/'
 **       missing='missing_func'
 **     );
+**
+** PARALLEL SCANS
+**
+**   If the "parallel" option is set to a value N greater than 1, a scan
+**   that must visit more than one source table after the sources have been
+**   pruned using any constraints on the rowid is run by up to N worker
+**   threads. Each worker opens its own read-only connection to the
+**   database file of one source at a time, and rows are passed back to the
+**   calling connection through a bounded queue. Rows are not returned in
+**   rowid order.
+**
+**   Worker connections read the most recently committed contents of each
+**   file, so scans are only run in parallel when the calling connection is
+**   in autocommit mode. For unionvtab, sources in the temp database, in
+**   in-memory databases, found by searching all databases (a NULL
+**   database name) or in a database using locking_mode=EXCLUSIVE cannot
+**   be opened by the workers, and scans that use them are run on the
+**   calling connection as usual. Workers open a unionvtab source with the
+**   URI parameters and VFS of the calling connection's database. If a
+**   worker finds a source locked before the first row has been returned,
+**   the scan is restarted on the calling connection. For swarmvtab, each
+**   source is opened by the calling connection (invoking the "openclose"
+**   and "missing" UDFs) shortly before a worker reads it, and stays open
+**   until the worker is finished with it, so that at most one source per
+**   worker is held open by a scan in addition to the "maxopen" limit.
+**
+**   The following SQL function computes an aggregate of a column of a
+**   unionvtab or swarmvtab table by running it against each source and
+**   combining the per-source results, in parallel if the table has the
+**   "parallel" option set:
+**
+**     SELECT unionvtab_aggregate(<table>, <function>, <column>
+**                                [, <min-rowid> [, <max-rowid>]]);
+**
+**   where <function> is one of "count", "sum", "min" or "max" and
+**   <column> is a column name, or "*" for count. Only sources whose
+**   rowid range intersects <min-rowid>..<max-rowid> are visited, and only
+**   rows within that range are included. "min" and "max" compare text
+**   values using the BINARY collation.
 */
 
 #include "sqlite3ext.h"
@@ -178,7 +224,32 @@ SQLITE_EXTENSION_INIT1
 */
 #define SWARMVTAB_MAX_OPEN 9
 
+/*
+** Upper limit on the value of the "parallel" option.
+*/
+#define UNIONVTAB_MAX_PARALLEL 64
+
+/*
+** Worker threads are only used if this file is compiled for a threadsafe
+** library. SQLITE_THREADSAFE is not usually defined when building a
+** loadable extension, in which case whether or not the library loading it
+** is threadsafe is checked at runtime using sqlite3_threadsafe().
+*/
+#if !defined(SQLITE_THREADSAFE) || SQLITE_THREADSAFE>0
+# define UNIONVTAB_PARALLEL 1
+# if defined(_WIN32)
+#  include <windows.h>
+# else
+#  include <pthread.h>
+# endif
+#else
+# define UNIONVTAB_PARALLEL 0
+#endif
+
+typedef struct UnionAux UnionAux;
 typedef struct UnionCsr UnionCsr;
+typedef struct UnionGlobal UnionGlobal;
+typedef struct UnionScan UnionScan;
 typedef struct UnionTab UnionTab;
 typedef struct UnionSrc UnionSrc;
 
@@ -209,8 +280,13 @@ struct UnionTab {
   sqlite3 *db;                    /* Database handle */
   int bSwarm;                     /* 1 for "swarmvtab", 0 for "unionvtab" */
   int iPK;                        /* INTEGER PRIMARY KEY column, or -1 */
+  int nCol;                       /* Number of columns in the virtual table */
   int nSrc;                       /* Number of elements in the aSrc[] array */
   UnionSrc *aSrc;                 /* Array of source tables, sorted by rowid */
+  int nParallel;                  /* Value of "parallel" option, or 0 */
+  char *zName;                    /* Name of the virtual table */
+  UnionGlobal *pGlobal;           /* Registry of tables this one is in */
+  UnionTab *pNextTab;             /* Next table in pGlobal->pTabList */
 
   /* Used by swarmvtab only */
   int bHasContext;                /* Has context strings */
@@ -229,12 +305,29 @@ struct UnionTab {
 struct UnionCsr {
   sqlite3_vtab_cursor base;       /* Base class - must be first */
   sqlite3_stmt *pStmt;            /* SQL statement to run */
+  UnionScan *pScan;               /* Parallel scan, if any */
 
   /* Used by swarmvtab only */
   sqlite3_int64 iMaxRowid;        /* Last rowid to visit */
   int iTab;                       /* Index of table read by pStmt */
 };
 
+/*
+** The modules and the unionvtab_aggregate() function registered with a
+** database handle share a single UnionGlobal object, which keeps a list
+** of the tables created so that the function can find them by name. The
+** two modules are distinguished by the UnionAux object passed to each.
+*/
+struct UnionAux {
+  UnionGlobal *pGlobal;           /* Registry shared by all */
+  int bSwarm;                     /* 1 for "swarmvtab", 0 for "unionvtab" */
+};
+struct UnionGlobal {
+  UnionAux aAux[2];               /* For unionvtab and swarmvtab */
+  UnionTab *pTabList;             /* List of connected tables */
+  int nRef;                       /* Number of registrations using this */
+};
+
 /*
 ** Given UnionTab table pTab and UnionSrc object pSrc, return the database
 ** handle that should be used to access the table identified by pSrc. This
@@ -494,8 +587,14 @@ static int unionDisconnect(sqlite3_vtab *pVtab){
       sqlite3_free(pSrc->zFile);
       sqlite3_free(pSrc->zContext);
     }
+    if( pTab->pGlobal ){
+      UnionTab **pp;
+      for(pp=&pTab->pGlobal->pTabList; *pp!=pTab; pp=&(*pp)->pNextTab);
+      *pp = pTab->pNextTab;
+    }
     sqlite3_finalize(pTab->pNotFound);
     sqlite3_finalize(pTab->pOpenClose);
+    sqlite3_free(pTab->zName);
     sqlite3_free(pTab->zSourceStr);
     sqlite3_free(pTab->aSrc);
     sqlite3_free(pTab);
@@ -715,6 +814,23 @@ static void unionIncrRefcount(UnionTab *pTab, int iTab){
   }
 }
 
+/*
+** This function is a no-op for unionvtab tables. For swarmvtab, decrement
+** the reference count for source table iTab. If this means the source
+** table's refcount is now zero, add it to the closable list.
+*/
+static void unionDecrRefcount(UnionTab *pTab, int iTab){
+  if( pTab->bSwarm ){
+    UnionSrc *pSrc = &pTab->aSrc[iTab];
+    pSrc->nUser--;
+    assert( pSrc->nUser>=0 );
+    if( pSrc->nUser==0 ){
+      pSrc->pNextClosable = pTab->pClosable;
+      pTab->pClosable = pSrc;
+    }
+  }
+}
+
 /*
 ** Finalize the SQL statement pCsr->pStmt and return the result.
 **
@@ -727,22 +843,880 @@ static int unionFinalizeCsrStmt(UnionCsr *pCsr){
   int rc = SQLITE_OK;
   if( pCsr->pStmt ){
     UnionTab *pTab = (UnionTab*)pCsr->base.pVtab;
-    UnionSrc *pSrc = &pTab->aSrc[pCsr->iTab];
     rc = sqlite3_finalize(pCsr->pStmt);
     pCsr->pStmt = 0;
     if( pTab->bSwarm ){
-      pSrc->nUser--;
-      assert( pSrc->nUser>=0 );
-      if( pSrc->nUser==0 ){
-        pSrc->pNextClosable = pTab->pClosable;
-        pTab->pClosable = pSrc;
-      }
+      unionDecrRefcount(pTab, pCsr->iTab);
       unionCloseSources(pTab, pTab->nMaxOpen);
     }
   }
   return rc;
 }
 
+/*
+** Return the SQL used to read the rows of source pSrc that lie within
+** the range iMin..iMax. zSelect is the list of expressions to select.
+** If bWorker is true, the table name is not qualified with the name of
+** its database, as a worker thread opens the database file as "main".
+**
+** If an OOM error occurs, NULL is returned and *pRc set to SQLITE_NOMEM.
+** Otherwise, the returned buffer must be freed using sqlite3_free().
+*/
+static char *unionSourceSql(
+  int *pRc,                       /* IN/OUT: Error code */
+  UnionSrc *pSrc,                 /* Source to read */
+  const char *zSelect,            /* Expressions to select */
+  sqlite3_int64 iMin,             /* Smallest rowid required */
+  sqlite3_int64 iMax,             /* Largest rowid required */
+  int bWorker                     /* True to omit database name */
+){
+  const char *zDb = (bWorker ? 0 : pSrc->zDb);
+  const char *zWhere = "WHERE";
+  char *zSql = 0;
+  if( *pRc==SQLITE_OK ){
+    zSql = sqlite3_mprintf("SELECT %s FROM %s%q%s%Q", zSelect,
+        (zDb ? "'" : ""), (zDb ? zDb : ""), (zDb ? "'." : ""), pSrc->zTab
+    );
+    if( zSql && iMin>pSrc->iMin ){
+      zSql = sqlite3_mprintf("%z WHERE rowid>=%lld", zSql, iMin);
+      zWhere = "AND";
+    }
+    if( zSql && iMax<pSrc->iMax ){
+      zSql = sqlite3_mprintf("%z %s rowid<=%lld", zSql, zWhere, iMax);
+    }
+    if( zSql==0 ) *pRc = SQLITE_NOMEM;
+  }
+  return zSql;
+}
+
+#if UNIONVTAB_PARALLEL
+
+/*
+** Workers pass rows back to the calling thread in batches of roughly
+** UNION_BATCH_SIZE bytes. At most UNION_BATCH_QUEUE batches per worker
+** may be waiting to be read before the workers block.
+*/
+#define UNION_BATCH_SIZE  (64*1024)
+#define UNION_BATCH_QUEUE 4
+
+#if defined(_WIN32)
+typedef HANDLE UnionThread;
+typedef CRITICAL_SECTION UnionMutex;
+typedef CONDITION_VARIABLE UnionCond;
+#else
+typedef pthread_t UnionThread;
+typedef pthread_mutex_t UnionMutex;
+typedef pthread_cond_t UnionCond;
+#endif
+
+typedef struct UnionBatch UnionBatch;
+typedef struct UnionTask UnionTask;
+typedef struct UnionWorker UnionWorker;
+
+/*
+** A batch of rows read by a worker. Each value is stored as a single
+** byte containing its type (SQLITE_INTEGER etc.), followed by:
+**
+**   SQLITE_INTEGER, SQLITE_FLOAT: 8 bytes, in native byte order.
+**   SQLITE_TEXT, SQLITE_BLOB:     a 4 byte size (native), then the data.
+**   SQLITE_NULL:                  nothing.
+*/
+struct UnionBatch {
+  UnionBatch *pNext;              /* Next batch in queue */
+  int n;                          /* Bytes of a[] used */
+  int nAlloc;                     /* Bytes allocated at a[] */
+  unsigned char *a;               /* Encoded rows */
+};
+
+/*
+** One source to be read by a worker.
+*/
+struct UnionTask {
+  int iSrc;                       /* Index of source in UnionTab.aSrc[] */
+  int bPinned;                    /* True if swarmvtab source is pinned open */
+  int bDone;                      /* Set by worker (with mutex) when done */
+  char *zFile;                    /* File or URI to open */
+  char *zVfs;                     /* VFS to open it with, or NULL */
+  char *zSql;                     /* SQL to run against it */
+};
+
+struct UnionWorker {
+  UnionScan *pScan;               /* Scan this worker belongs to */
+  UnionThread thread;             /* Thread handle */
+  int bStarted;                   /* True if thread was started */
+  sqlite3 *db;                    /* Connection in use (guarded by mutex) */
+};
+
+/*
+** A parallel scan. Except where noted, fields following "mutex" may only
+** be accessed while holding it.
+*/
+struct UnionScan {
+  UnionTab *pTab;                 /* Table being scanned */
+  int nVal;                       /* Values in each row */
+  int nTask;                      /* Size of aTask[] */
+  UnionTask *aTask;               /* Sources to read */
+  int nWorker;                    /* Size of aWorker[] */
+  UnionWorker *aWorker;           /* Worker threads */
+
+  UnionMutex mutex;
+  UnionCond condRow;              /* Batch queued, task or worker finished */
+  UnionCond condSpace;            /* Batch dequeued or scan aborted */
+  UnionCond condTask;             /* Task made ready or scan aborted */
+  int iNextTask;                  /* Next entry of aTask[] to hand out */
+  int iReady;                     /* Entries of aTask[] ready to hand out */
+  int nDone;                      /* Pinned tasks finished by workers */
+  int nDoneSeen;                  /* Value of nDone when last unpinned */
+  UnionBatch *pFirst;             /* First batch in queue */
+  UnionBatch *pLast;              /* Last batch in queue */
+  int nBatch;                     /* Batches in queue */
+  int nMaxBatch;                  /* Max batches in queue */
+  int nRunning;                   /* Workers still running */
+  int bAbort;                     /* Set to stop the workers */
+  int rc;                         /* First error code reported by a worker */
+  char *zErr;                     /* Error message to go with rc */
+
+  /* Accessed by the calling thread only */
+  int nMaxPinned;                 /* Max. tasks pinned at once */
+  int nPinned;                    /* Tasks with UnionTask.bPinned set */
+  int iUnpin;                     /* First task that may still be pinned */
+  UnionBatch *pBatch;             /* Batch containing current row */
+  int iOff;                       /* Offset of next row in pBatch->a[] */
+  const unsigned char **apVal;    /* Values of current row */
+};
+
+static void unionMutexEnter(UnionScan *p){
+#if defined(_WIN32)
+  EnterCriticalSection(&p->mutex);
+#else
+  pthread_mutex_lock(&p->mutex);
+#endif
+}
+static void unionMutexLeave(UnionScan *p){
+#if defined(_WIN32)
+  LeaveCriticalSection(&p->mutex);
+#else
+  pthread_mutex_unlock(&p->mutex);
+#endif
+}
+static void unionCondWait(UnionScan *p, UnionCond *pCond){
+#if defined(_WIN32)
+  SleepConditionVariableCS(pCond, &p->mutex, INFINITE);
+#else
+  pthread_cond_wait(pCond, &p->mutex);
+#endif
+}
+static void unionCondBroadcast(UnionCond *pCond){
+#if defined(_WIN32)
+  WakeAllConditionVariable(pCond);
+#else
+  pthread_cond_broadcast(pCond);
+#endif
+}
+
+/*
+** Append the current row of statement pStmt to batch *ppBatch, allocating
+** a new batch first if *ppBatch is NULL. Return SQLITE_OK if successful,
+** or SQLITE_NOMEM if an allocation fails.
+*/
+static int unionBatchAppend(UnionBatch **ppBatch, sqlite3_stmt *pStmt){
+  UnionBatch *p = *ppBatch;
+  int nCol = sqlite3_column_count(pStmt);
+  int nByte = 0;
+  int i;
+
+  if( p==0 ){
+    p = (UnionBatch*)sqlite3_malloc(sizeof(UnionBatch));
+    if( p==0 ) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(UnionBatch));
+    *ppBatch = p;
+  }
+
+  for(i=0; i<nCol; i++){
+    switch( sqlite3_column_type(pStmt, i) ){
+      case SQLITE_INTEGER:
+      case SQLITE_FLOAT:
+        nByte += 9;
+        break;
+      case SQLITE_TEXT:
+        nByte += 5 + sqlite3_column_bytes(pStmt, i);
+        break;
+      case SQLITE_BLOB:
+        nByte += 5 + sqlite3_column_bytes(pStmt, i);
+        break;
+      default:
+        nByte += 1;
+        break;
+    }
+  }
+
+  if( p->n+nByte>p->nAlloc ){
+    int nNew = p->nAlloc ? p->nAlloc*2 : UNION_BATCH_SIZE;
+    unsigned char *aNew;
+    while( nNew<p->n+nByte ) nNew = nNew*2;
+    aNew = (unsigned char*)sqlite3_realloc(p->a, nNew);
+    if( aNew==0 ) return SQLITE_NOMEM;
+    p->a = aNew;
+    p->nAlloc = nNew;
+  }
+
+  for(i=0; i<nCol; i++){
+    unsigned char *a = &p->a[p->n];
+    int eType = sqlite3_column_type(pStmt, i);
+    a[0] = (unsigned char)eType;
+    switch( eType ){
+      case SQLITE_INTEGER: {
+        sqlite3_int64 iVal = sqlite3_column_int64(pStmt, i);
+        memcpy(&a[1], &iVal, 8);
+        p->n += 9;
+        break;
+      }
+      case SQLITE_FLOAT: {
+        double rVal = sqlite3_column_double(pStmt, i);
+        memcpy(&a[1], &rVal, 8);
+        p->n += 9;
+        break;
+      }
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        const void *z = (eType==SQLITE_TEXT ?
+            (const void*)sqlite3_column_text(pStmt, i) :
+            sqlite3_column_blob(pStmt, i)
+        );
+        int n = sqlite3_column_bytes(pStmt, i);
+        memcpy(&a[1], &n, 4);
+        if( n>0 ) memcpy(&a[5], z, n);
+        p->n += 5 + n;
+        break;
+      }
+      default:
+        p->n += 1;
+        break;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Return the number of bytes used by the encoded value at a[].
+*/
+static int unionValueSize(const unsigned char *a){
+  int n;
+  switch( a[0] ){
+    case SQLITE_INTEGER:
+    case SQLITE_FLOAT:
+      return 9;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+      memcpy(&n, &a[1], 4);
+      return 5 + n;
+    default:
+      return 1;
+  }
+}
+
+/*
+** Set the result of ctx to the encoded value at a[].
+*/
+static void unionValueResult(sqlite3_context *ctx, const unsigned char *a){
+  switch( a[0] ){
+    case SQLITE_INTEGER: {
+      sqlite3_int64 iVal;
+      memcpy(&iVal, &a[1], 8);
+      sqlite3_result_int64(ctx, iVal);
+      break;
+    }
+    case SQLITE_FLOAT: {
+      double rVal;
+      memcpy(&rVal, &a[1], 8);
+      sqlite3_result_double(ctx, rVal);
+      break;
+    }
+    case SQLITE_TEXT:
+    case SQLITE_BLOB: {
+      int n;
+      memcpy(&n, &a[1], 4);
+      if( a[0]==SQLITE_TEXT ){
+        sqlite3_result_text(ctx, (const char*)&a[5], n, SQLITE_TRANSIENT);
+      }else{
+        sqlite3_result_blob(ctx, &a[5], n, SQLITE_TRANSIENT);
+      }
+      break;
+    }
+    default:
+      sqlite3_result_null(ctx);
+      break;
+  }
+}
+
+/*
+** Record error rc, with message zErr (which is always freed), against
+** scan pScan and tell the other workers to stop. The caller must hold
+** the mutex.
+*/
+static void unionScanError(UnionScan *pScan, int rc, char *zErr){
+  if( pScan->rc==SQLITE_OK ){
+    pScan->rc = rc;
+    pScan->zErr = zErr;
+  }else{
+    sqlite3_free(zErr);
+  }
+  pScan->bAbort = 1;
+  unionCondBroadcast(&pScan->condSpace);
+  unionCondBroadcast(&pScan->condTask);
+}
+
+/*
+** Add batch p to the queue, blocking while the queue is full. Return 0
+** if successful, or non-zero if the scan has been aborted (in which case
+** p is freed).
+*/
+static int unionScanPush(UnionScan *pScan, UnionBatch *p){
+  int bAbort;
+  unionMutexEnter(pScan);
+  while( pScan->bAbort==0 && pScan->nBatch>=pScan->nMaxBatch ){
+    unionCondWait(pScan, &pScan->condSpace);
+  }
+  bAbort = pScan->bAbort;
+  if( bAbort==0 ){
+    if( pScan->pLast ){
+      pScan->pLast->pNext = p;
+    }else{
+      pScan->pFirst = p;
+    }
+    pScan->pLast = p;
+    pScan->nBatch++;
+    unionCondBroadcast(&pScan->condRow);
+  }
+  unionMutexLeave(pScan);
+  if( bAbort ){
+    sqlite3_free(p->a);
+    sqlite3_free(p);
+  }
+  return bAbort;
+}
+
+/*
+** Read source pTask on behalf of worker pWorker. Return SQLITE_OK if
+** successful or if the scan is aborted. Otherwise, return an error code
+** and set *pzErr to an error message.
+*/
+static int unionWorkerTask(
+  UnionWorker *pWorker,
+  UnionTask *pTask,
+  char **pzErr
+){
+  UnionScan *pScan = pWorker->pScan;
+  sqlite3 *db = 0;
+  sqlite3_stmt *pStmt = 0;
+  UnionBatch *pBatch = 0;
+  int rc;
+
+  rc = sqlite3_open_v2(pTask->zFile, &db,
+      SQLITE_OPEN_READONLY|SQLITE_OPEN_URI|SQLITE_OPEN_NOMUTEX, pTask->zVfs
+  );
+  unionMutexEnter(pScan);
+  pWorker->db = db;
+  if( pScan->bAbort ) sqlite3_interrupt(db);
+  unionMutexLeave(pScan);
+
+  pStmt = unionPrepare(&rc, db, pTask->zSql, pzErr);
+  if( rc==SQLITE_OK && sqlite3_column_count(pStmt)!=pScan->nVal ){
+    *pzErr = sqlite3_mprintf("source table schema mismatch");
+    rc = SQLITE_ERROR;
+  }
+  while( rc==SQLITE_OK && SQLITE_ROW==sqlite3_step(pStmt) ){
+    rc = unionBatchAppend(&pBatch, pStmt);
+    if( rc==SQLITE_OK && pBatch->n>=UNION_BATCH_SIZE ){
+      int bAbort = unionScanPush(pScan, pBatch);
+      pBatch = 0;
+      if( bAbort ) break;
+    }
+  }
+  unionFinalize(&rc, pStmt, pzErr);
+  if( rc==SQLITE_OK && pBatch ){
+    unionScanPush(pScan, pBatch);
+    pBatch = 0;
+  }
+
+  unionMutexEnter(pScan);
+  pWorker->db = 0;
+  if( pScan->bAbort && rc==SQLITE_INTERRUPT ){
+    sqlite3_free(*pzErr);
+    *pzErr = 0;
+    rc = SQLITE_OK;
+  }
+  unionMutexLeave(pScan);
+  if( rc!=SQLITE_OK && *pzErr==0 && db ){
+    *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  }
+  sqlite3_close(db);
+  if( pBatch ){
+    sqlite3_free(pBatch->a);
+    sqlite3_free(pBatch);
+  }
+  return rc;
+}
+
+/*
+** Main routine of each worker thread. Read sources until there are none
+** left, an error occurs or the scan is aborted.
+*/
+static void unionWorkerMain(UnionWorker *pWorker){
+  UnionScan *pScan = pWorker->pScan;
+  unionMutexEnter(pScan);
+  while( pScan->bAbort==0 && pScan->iNextTask<pScan->nTask ){
+    UnionTask *pTask;
+    char *zErr = 0;
+    int rc;
+    if( pScan->iNextTask>=pScan->iReady ){
+      unionCondWait(pScan, &pScan->condTask);
+      continue;
+    }
+    pTask = &pScan->aTask[pScan->iNextTask++];
+    unionMutexLeave(pScan);
+    rc = unionWorkerTask(pWorker, pTask, &zErr);
+    unionMutexEnter(pScan);
+    if( rc!=SQLITE_OK ) unionScanError(pScan, rc, zErr);
+    if( pTask->bPinned ){
+      /* Tell the calling thread that the source may be released */
+      pTask->bDone = 1;
+      pScan->nDone++;
+      unionCondBroadcast(&pScan->condRow);
+    }
+  }
+  pScan->nRunning--;
+  unionCondBroadcast(&pScan->condRow);
+  unionMutexLeave(pScan);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI unionWorkerThread(LPVOID pArg){
+  unionWorkerMain((UnionWorker*)pArg);
+  return 0;
+}
+#else
+static void *unionWorkerThread(void *pArg){
+  unionWorkerMain((UnionWorker*)pArg);
+  return 0;
+}
+#endif
+
+/*
+** Start the thread for worker pWorker. Return non-zero if successful.
+*/
+static int unionWorkerStart(UnionWorker *pWorker){
+#if defined(_WIN32)
+  pWorker->thread = CreateThread(0, 0, unionWorkerThread, pWorker, 0, 0);
+  pWorker->bStarted = (pWorker->thread!=0);
+#else
+  pWorker->bStarted = (0==pthread_create(
+      &pWorker->thread, 0, unionWorkerThread, pWorker
+  ));
+#endif
+  return pWorker->bStarted;
+}
+
+static void unionWorkerJoin(UnionWorker *pWorker){
+  if( pWorker->bStarted ){
+#if defined(_WIN32)
+    WaitForSingleObject(pWorker->thread, INFINITE);
+    CloseHandle(pWorker->thread);
+#else
+    pthread_join(pWorker->thread, 0);
+#endif
+    pWorker->bStarted = 0;
+  }
+}
+
+/*
+** Stop the workers of scan pScan, if they are still running, and free
+** it. This is a no-op if pScan is NULL.
+*/
+static void unionScanFree(UnionScan *pScan){
+  if( pScan ){
+    UnionTab *pTab = pScan->pTab;
+    UnionBatch *p;
+    UnionBatch *pNext;
+    int i;
+
+    unionMutexEnter(pScan);
+    pScan->bAbort = 1;
+    for(i=0; i<pScan->nWorker; i++){
+      if( pScan->aWorker[i].db ) sqlite3_interrupt(pScan->aWorker[i].db);
+    }
+    unionCondBroadcast(&pScan->condSpace);
+    unionCondBroadcast(&pScan->condTask);
+    unionMutexLeave(pScan);
+    for(i=0; i<pScan->nWorker; i++){
+      unionWorkerJoin(&pScan->aWorker[i]);
+    }
+
+#if defined(_WIN32)
+    DeleteCriticalSection(&pScan->mutex);
+#else
+    pthread_mutex_destroy(&pScan->mutex);
+    pthread_cond_destroy(&pScan->condRow);
+    pthread_cond_destroy(&pScan->condSpace);
+    pthread_cond_destroy(&pScan->condTask);
+#endif
+
+    for(p=pScan->pBatch; p; p=pNext){
+      pNext = p->pNext;
+      sqlite3_free(p->a);
+      sqlite3_free(p);
+    }
+    for(p=pScan->pFirst; p; p=pNext){
+      pNext = p->pNext;
+      sqlite3_free(p->a);
+      sqlite3_free(p);
+    }
+    for(i=0; i<pScan->nTask; i++){
+      UnionTask *pTask = &pScan->aTask[i];
+      if( pTask->bPinned ) unionDecrRefcount(pTab, pTask->iSrc);
+      sqlite3_free(pTask->zFile);
+      sqlite3_free(pTask->zVfs);
+      sqlite3_free(pTask->zSql);
+    }
+    unionCloseSources(pTab, pTab->nMaxOpen);
+    sqlite3_free(pScan->zErr);
+    sqlite3_free(pScan);
+  }
+}
+
+/*
+** This function is only used for swarmvtab scans, by the calling thread.
+** Release the sources that the workers have finished reading, then open
+** and pin the sources of the following tasks, so that no more than one
+** source per worker is pinned at a time, and hand them to the workers.
+** Return SQLITE_OK if successful, or an error code and set *pzErr to an
+** error message otherwise.
+*/
+static int unionScanPin(UnionScan *pScan, char **pzErr){
+  UnionTab *pTab = pScan->pTab;
+  int rc = SQLITE_OK;
+  int iReady;
+  int i;
+
+  unionMutexEnter(pScan);
+  iReady = pScan->iReady;
+  for(i=pScan->iUnpin; i<iReady; i++){
+    UnionTask *pTask = &pScan->aTask[i];
+    if( pTask->bPinned && pTask->bDone ){
+      unionDecrRefcount(pTab, pTask->iSrc);
+      pTask->bPinned = 0;
+      pScan->nPinned--;
+    }
+  }
+  pScan->nDoneSeen = pScan->nDone;
+  unionMutexLeave(pScan);
+  while( pScan->iUnpin<iReady && pScan->aTask[pScan->iUnpin].bPinned==0 ){
+    pScan->iUnpin++;
+  }
+
+  while( rc==SQLITE_OK
+      && iReady<pScan->nTask && pScan->nPinned<pScan->nMaxPinned
+  ){
+    UnionTask *pTask = &pScan->aTask[iReady];
+    rc = unionOpenDatabase(pTab, pTask->iSrc, pzErr);
+    if( rc==SQLITE_OK ){
+      unionIncrRefcount(pTab, pTask->iSrc);
+      pTask->bPinned = 1;
+      pScan->nPinned++;
+      iReady++;
+    }
+  }
+
+  unionMutexEnter(pScan);
+  pScan->iReady = iReady;
+  unionCondBroadcast(&pScan->condTask);
+  unionMutexLeave(pScan);
+  unionCloseSources(pTab, pTab->nMaxOpen);
+  return rc;
+}
+
+/*
+** Advance scan pScan to its next row. If there is one, set the entries of
+** pScan->apVal[] to point to its values and return SQLITE_ROW. Return
+** SQLITE_DONE if there are no more rows, or an error code if a worker
+** failed. In the latter case, *pzErr is set to an error message.
+*/
+static int unionScanNext(UnionScan *pScan, char **pzErr){
+  int rc = SQLITE_ROW;
+  int i;
+
+  if( pScan->pBatch && pScan->iOff>=pScan->pBatch->n ){
+    sqlite3_free(pScan->pBatch->a);
+    sqlite3_free(pScan->pBatch);
+    pScan->pBatch = 0;
+  }
+  while( pScan->pBatch==0 && rc==SQLITE_ROW ){
+    if( pScan->pTab->bSwarm ){
+      char *zErr = 0;
+      int rc2 = unionScanPin(pScan, &zErr);
+      if( rc2!=SQLITE_OK ){
+        unionMutexEnter(pScan);
+        unionScanError(pScan, rc2, zErr);
+        unionMutexLeave(pScan);
+      }
+    }
+    unionMutexEnter(pScan);
+    while( pScan->rc==SQLITE_OK && pScan->pFirst==0 && pScan->nRunning>0
+        && pScan->nDone==pScan->nDoneSeen
+    ){
+      unionCondWait(pScan, &pScan->condRow);
+    }
+    if( pScan->rc!=SQLITE_OK ){
+      rc = pScan->rc;
+      *pzErr = pScan->zErr;
+      pScan->zErr = 0;
+    }else if( pScan->pFirst==0 ){
+      /* Either the workers have all finished, or one of them has finished
+      ** with a swarmvtab source and the next can be pinned. */
+      if( pScan->nRunning==0 ) rc = SQLITE_DONE;
+    }else{
+      pScan->pBatch = pScan->pFirst;
+      pScan->pFirst = pScan->pBatch->pNext;
+      if( pScan->pFirst==0 ) pScan->pLast = 0;
+      pScan->pBatch->pNext = 0;
+      pScan->nBatch--;
+      pScan->iOff = 0;
+      unionCondBroadcast(&pScan->condSpace);
+    }
+    unionMutexLeave(pScan);
+  }
+
+  if( rc==SQLITE_ROW ){
+    for(i=0; i<pScan->nVal; i++){
+      const unsigned char *a = &pScan->pBatch->a[pScan->iOff];
+      pScan->apVal[i] = a;
+      pScan->iOff += unionValueSize(a);
+    }
+  }
+  return rc;
+}
+
+/*
+** Return true if database zDb of the connection that owns table pTab is
+** in exclusive locking mode (or if this cannot be determined), in which
+** case a worker connection might not be able to read it.
+*/
+static int unionIsExclusive(UnionTab *pTab, const char *zDb){
+  int rc = SQLITE_OK;
+  char *zErr = 0;
+  int bExcl = 1;
+  sqlite3_stmt *pStmt = unionPreparePrintf(&rc, &zErr, pTab->db,
+      "PRAGMA %Q.locking_mode", zDb
+  );
+  if( rc==SQLITE_OK && SQLITE_ROW==sqlite3_step(pStmt) ){
+    const char *zMode = (const char*)sqlite3_column_text(pStmt, 0);
+    bExcl = (zMode==0 || sqlite3_stricmp(zMode, "exclusive")==0);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zErr);
+  return bExcl;
+}
+
+/*
+** Append zIn to the buffer at zOut, percent-encoding all characters other
+** than unreserved URI characters and '/', and return a pointer to the
+** byte following the encoded text. The buffer must have room for three
+** bytes for each byte of zIn.
+*/
+static char *unionUriEncode(char *zOut, const char *zIn){
+  static const char aHex[] = "0123456789ABCDEF";
+  const unsigned char *p;
+  for(p=(const unsigned char*)zIn; *p; p++){
+    if( (*p>='a' && *p<='z') || (*p>='A' && *p<='Z') || (*p>='0' && *p<='9')
+     || *p=='/' || *p=='-' || *p=='.' || *p=='_' || *p=='~'
+    ){
+      *zOut++ = (char)*p;
+    }else{
+      *zOut++ = '%';
+      *zOut++ = aHex[*p>>4];
+      *zOut++ = aHex[*p&0x0f];
+    }
+  }
+  return zOut;
+}
+
+/*
+** Argument zName is a database file name as returned by
+** sqlite3_db_filename(), which is followed by the URI parameters that the
+** database was opened with, as name/value pairs of nul-terminated strings
+** ending with an empty string. Return a URI that opens the same file with
+** the same parameters, except for "vfs", "mode" and "cache", which are
+** set by the worker.
+**
+** If an OOM error occurs, NULL is returned and *pRc set to SQLITE_NOMEM.
+** Otherwise, the returned buffer must be freed using sqlite3_free().
+*/
+static char *unionFilenameToUri(int *pRc, const char *zName){
+  const char *z;
+  char *zRet;
+  char *zOut;
+  char cSep = '?';
+  sqlite3_int64 nByte = 6 + 3*(sqlite3_int64)strlen(zName);
+
+  for(z=&zName[strlen(zName)+1]; z[0]; ){
+    const char *zVal = &z[strlen(z)+1];
+    nByte += 3*(sqlite3_int64)(strlen(z) + strlen(zVal)) + 2;
+    z = &zVal[strlen(zVal)+1];
+  }
+  zRet = (char*)unionMalloc(pRc, (int)nByte);
+  if( zRet==0 ) return 0;
+
+  memcpy(zRet, "file:", 5);
+  zOut = unionUriEncode(&zRet[5], zName);
+  for(z=&zName[strlen(zName)+1]; z[0]; ){
+    const char *zVal = &z[strlen(z)+1];
+    if( strcmp(z, "vfs") && strcmp(z, "mode") && strcmp(z, "cache") ){
+      *zOut++ = cSep;
+      zOut = unionUriEncode(zOut, z);
+      *zOut++ = '=';
+      zOut = unionUriEncode(zOut, zVal);
+      cSep = '&';
+    }
+    z = &zVal[strlen(zVal)+1];
+  }
+  *zOut = '\0';
+  return zRet;
+}
+
+/*
+** Attempt to start a parallel scan of the sources of table pTab that
+** intersect the range iMin..iMax. Each row of the scan consists of the
+** nVal values selected by zSelect.
+**
+** If the scan is started, *ppScan is set to point to it and SQLITE_OK
+** returned. Or, if the scan should not be run in parallel, *ppScan is set
+** to NULL and SQLITE_OK returned. If an error occurs, an SQLite error code
+** is returned and *pzErr may be set to an error message.
+*/
+static int unionScanStart(
+  UnionTab *pTab,                 /* Table to scan */
+  const char *zSelect,            /* Expressions to select */
+  int nVal,                       /* Number of expressions in zSelect */
+  sqlite3_int64 iMin,             /* Smallest rowid required */
+  sqlite3_int64 iMax,             /* Largest rowid required */
+  UnionScan **ppScan,             /* OUT: New scan */
+  char **pzErr                    /* OUT: Error message */
+){
+  int rc = SQLITE_OK;
+  UnionScan *pScan = 0;
+  int nTask = 0;
+  int nWorker;
+  int i;
+
+  *ppScan = 0;
+  if( pTab->nParallel<2 || sqlite3_threadsafe()==0 ) return SQLITE_OK;
+
+  /* Worker connections would not see the changes made by an open
+  ** transaction, so scans within one are not run in parallel. */
+  if( sqlite3_get_autocommit(pTab->db)==0 ) return SQLITE_OK;
+
+  for(i=0; i<pTab->nSrc; i++){
+    UnionSrc *pSrc = &pTab->aSrc[i];
+    if( iMin>pSrc->iMax || iMax<pSrc->iMin ) continue;
+    if( pTab->bSwarm==0 ){
+      const char *zFile;
+      if( pSrc->zDb==0 || sqlite3_stricmp(pSrc->zDb, "temp")==0 ){
+        return SQLITE_OK;
+      }
+      zFile = sqlite3_db_filename(pTab->db, pSrc->zDb);
+      if( zFile==0 || zFile[0]=='\0' ) return SQLITE_OK;
+      if( unionIsExclusive(pTab, pSrc->zDb) ) return SQLITE_OK;
+    }
+    nTask++;
+  }
+  if( nTask<2 ) return SQLITE_OK;
+  nWorker = (nTask<pTab->nParallel ? nTask : pTab->nParallel);
+
+  pScan = (UnionScan*)unionMalloc(&rc, sizeof(UnionScan)
+      + nTask*sizeof(UnionTask)
+      + nWorker*sizeof(UnionWorker)
+      + nVal*sizeof(const unsigned char*)
+  );
+  if( pScan==0 ) return rc;
+  pScan->pTab = pTab;
+  pScan->nVal = nVal;
+  pScan->aTask = (UnionTask*)&pScan[1];
+  pScan->aWorker = (UnionWorker*)&pScan->aTask[nTask];
+  pScan->apVal = (const unsigned char**)&pScan->aWorker[nWorker];
+  pScan->nMaxBatch = nWorker * UNION_BATCH_QUEUE;
+  pScan->nMaxPinned = nWorker;
+#if defined(_WIN32)
+  InitializeCriticalSection(&pScan->mutex);
+  InitializeConditionVariable(&pScan->condRow);
+  InitializeConditionVariable(&pScan->condSpace);
+  InitializeConditionVariable(&pScan->condTask);
+#else
+  pthread_mutex_init(&pScan->mutex, 0);
+  pthread_cond_init(&pScan->condRow, 0);
+  pthread_cond_init(&pScan->condSpace, 0);
+  pthread_cond_init(&pScan->condTask, 0);
+#endif
+
+  for(i=0; rc==SQLITE_OK && i<pTab->nSrc; i++){
+    UnionSrc *pSrc = &pTab->aSrc[i];
+    UnionTask *pTask;
+    if( iMin>pSrc->iMax || iMax<pSrc->iMin ) continue;
+    pTask = &pScan->aTask[pScan->nTask++];
+    pTask->iSrc = i;
+    pTask->zSql = unionSourceSql(&rc, pSrc, zSelect, iMin, iMax, 1);
+    if( pTab->bSwarm ){
+      /* The source is opened and pinned by unionScanPin() before it is
+      ** handed to a worker. */
+      pTask->zFile = unionStrdup(&rc, pSrc->zFile);
+    }else{
+      sqlite3_vfs *pVfs = 0;
+      pTask->zFile = unionFilenameToUri(&rc,
+          sqlite3_db_filename(pTab->db, pSrc->zDb)
+      );
+      sqlite3_file_control(pTab->db, pSrc->zDb, SQLITE_FCNTL_VFS_POINTER,
+          (void*)&pVfs
+      );
+      if( pVfs ) pTask->zVfs = unionStrdup(&rc, pVfs->zName);
+    }
+  }
+
+  /* Open the swarmvtab sources on the calling connection, so that the
+  ** "missing" and "openclose" callbacks are invoked and the schema is
+  ** checked, one per worker to begin with. */
+  if( rc==SQLITE_OK ){
+    if( pTab->bSwarm ){
+      rc = unionScanPin(pScan, pzErr);
+    }else{
+      pScan->iReady = pScan->nTask;
+    }
+  }
+
+  if( rc==SQLITE_OK ){
+    unionMutexEnter(pScan);
+    for(i=0; i<nWorker; i++){
+      UnionWorker *pWorker = &pScan->aWorker[i];
+      pWorker->pScan = pScan;
+      pScan->nWorker++;
+      if( unionWorkerStart(pWorker)==0 ) break;
+      pScan->nRunning++;
+    }
+    if( pScan->nRunning==0 ){
+      *pzErr = sqlite3_mprintf("unable to start worker thread");
+      rc = SQLITE_ERROR;
+    }
+    unionMutexLeave(pScan);
+  }
+
+  if( rc!=SQLITE_OK ){
+    unionScanFree(pScan);
+    pScan = 0;
+  }
+  *ppScan = pScan;
+  return rc;
+}
+
+#endif /* UNIONVTAB_PARALLEL */
+
 /* 
 ** Return true if the argument is a space, tab, CR or LF character.
 */
@@ -760,10 +1734,10 @@ static int union_isidchar(char c){
 
 /*
 ** This function is called to handle all arguments following the first 
-** (the SQL statement) passed to a swarmvtab (not unionvtab) CREATE 
-** VIRTUAL TABLE statement. It may bind parameters to the SQL statement 
-** or configure members of the UnionTab object passed as the second
-** argument.
+** (the SQL statement) passed to a swarmvtab or unionvtab CREATE VIRTUAL
+** TABLE statement. It may bind parameters to the SQL statement or
+** configure members of the UnionTab object passed as the second argument.
+** Only the "parallel" option is accepted for unionvtab.
 **
 ** Refer to header comments at the top of this file for a description
 ** of the arguments parsed.
@@ -784,7 +1758,8 @@ static void unionConfigureVtab(
 ){
   int rc = *pRc;
   int i;
-  if( rc==SQLITE_OK ){
+  const char *zVtab = (pTab && pTab->bSwarm ? "swarmvtab" : "unionvtab");
+  if( rc==SQLITE_OK && pTab->bSwarm ){
     pTab->bHasContext = (sqlite3_column_count(pStmt)>4);
   }
   for(i=0; rc==SQLITE_OK && i<nArg; i++){
@@ -810,7 +1785,18 @@ static void unionConfigureVtab(
         zVal = unionStrdup(&rc, zVal);
         if( zVal ){
           unionDequote(zVal);
-          if( zOpt[0]==':' ){
+          if( nOpt==8 && 0==sqlite3_strnicmp(zOpt, "parallel", 8) ){
+            pTab->nParallel = atoi(zVal);
+            if( pTab->nParallel<0 ){
+              *pzErr = sqlite3_mprintf("%s: illegal parallel value", zVtab);
+              rc = SQLITE_ERROR;
+            }else if( pTab->nParallel>UNIONVTAB_MAX_PARALLEL ){
+              pTab->nParallel = UNIONVTAB_MAX_PARALLEL;
+            }
+          }else if( pTab->bSwarm==0 ){
+            *pzErr = sqlite3_mprintf("unionvtab: unrecognized option: %s",zOpt);
+            rc = SQLITE_ERROR;
+          }else if( zOpt[0]==':' ){
             /* A value to bind to the SQL statement */
             int iParam = sqlite3_bind_parameter_index(pStmt, zOpt);
             if( iParam==0 ){
@@ -854,12 +1840,12 @@ static void unionConfigureVtab(
           sqlite3_free(zVal);
         }
       }else{
-        if( i==0 && nArg==1 ){
+        if( i==0 && nArg==1 && pTab->bSwarm ){
           pTab->pNotFound = unionPreparePrintf(&rc, pzErr, pTab->db,
               "SELECT \"%w\"(?)", zArg
           );
         }else{
-          *pzErr = sqlite3_mprintf( "swarmvtab: parse error: %s", azArg[i]);
+          *pzErr = sqlite3_mprintf("%s: parse error: %s", zVtab, azArg[i]);
           rc = SQLITE_ERROR;
         }
       }
@@ -878,7 +1864,9 @@ static void unionConfigureVtab(
 **   argv[1]   -> database name
 **   argv[2]   -> table name
 **   argv[3]   -> SQL statement
-**   argv[4]   -> not-found callback UDF name
+**   argv[4]   -> not-found callback UDF name, or first option
+**
+** pAux points to the UnionAux object registered with the module.
 */
 static int unionConnect(
   sqlite3 *db,
@@ -887,16 +1875,17 @@ static int unionConnect(
   sqlite3_vtab **ppVtab,
   char **pzErr
 ){
+  UnionAux *pUnionAux = (UnionAux*)pAux;
   UnionTab *pTab = 0;
   int rc = SQLITE_OK;
-  int bSwarm = (pAux==0 ? 0 : 1);
+  int bSwarm = pUnionAux->bSwarm;
   const char *zVtab = (bSwarm ? "swarmvtab" : "unionvtab");
 
   if( sqlite3_stricmp("temp", argv[1]) ){
     /* unionvtab tables may only be created in the temp schema */
     *pzErr = sqlite3_mprintf("%s tables must be created in TEMP schema", zVtab);
     rc = SQLITE_ERROR;
-  }else if( argc<4 || (argc>4 && bSwarm==0) ){
+  }else if( argc<4 ){
     *pzErr = sqlite3_mprintf("wrong number of arguments for %s", zVtab);
     rc = SQLITE_ERROR;
   }else{
@@ -923,9 +1912,7 @@ static int unionConnect(
     }
 
     /* Parse other CVT arguments, if any */
-    if( bSwarm ){
-      unionConfigureVtab(&rc, pTab, pStmt, argc-4, &argv[4], pzErr);
-    }
+    unionConfigureVtab(&rc, pTab, pStmt, argc-4, &argv[4], pzErr);
 
     /* Iterate through the rows returned by the SQL statement specified
     ** as an argument to the CREATE VIRTUAL TABLE statement. */
@@ -1004,7 +1991,8 @@ static int unionConnect(
           "'CREATE TABLE xyz('"
           "    || group_concat(quote(name) || ' ' || type, ', ')"
           "    || ')',"
-          "max((cid+1) * (type='INTEGER' COLLATE nocase AND pk=1))-1 "
+          "max((cid+1) * (type='INTEGER' COLLATE nocase AND pk=1))-1, "
+          "count(*) "
           "FROM pragma_table_info(%Q, ?)", 
           pSrc->zTab, pSrc->zDb
       );
@@ -1013,11 +2001,22 @@ static int unionConnect(
       const char *zDecl = (const char*)sqlite3_column_text(pStmt, 0);
       rc = sqlite3_declare_vtab(db, zDecl);
       pTab->iPK = sqlite3_column_int(pStmt, 1);
+      pTab->nCol = sqlite3_column_int(pStmt, 2);
     }
 
     unionFinalize(&rc, pStmt, pzErr);
   }
 
+  /* Add the new table to the list used by unionvtab_aggregate() */
+  if( rc==SQLITE_OK ){
+    pTab->zName = unionStrdup(&rc, argv[2]);
+    if( rc==SQLITE_OK ){
+      pTab->pGlobal = pUnionAux->pGlobal;
+      pTab->pNextTab = pTab->pGlobal->pTabList;
+      pTab->pGlobal->pTabList = pTab;
+    }
+  }
+
   if( rc!=SQLITE_OK ){
     unionDisconnect((sqlite3_vtab*)pTab);
     pTab = 0;
@@ -1045,6 +2044,9 @@ static int unionOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor){
 static int unionClose(sqlite3_vtab_cursor *cur){
   UnionCsr *pCsr = (UnionCsr*)cur;
   unionFinalizeCsrStmt(pCsr);
+#if UNIONVTAB_PARALLEL
+  unionScanFree(pCsr->pScan);
+#endif
   sqlite3_free(pCsr);
   return SQLITE_OK;
 }
@@ -1091,6 +2093,18 @@ static int doUnionNext(UnionCsr *pCsr){
 */
 static int unionNext(sqlite3_vtab_cursor *cur){
   int rc;
+#if UNIONVTAB_PARALLEL
+  UnionCsr *pCsr = (UnionCsr*)cur;
+  if( pCsr->pScan ){
+    rc = unionScanNext(pCsr->pScan, &cur->pVtab->zErrMsg);
+    if( rc!=SQLITE_ROW ){
+      unionScanFree(pCsr->pScan);
+      pCsr->pScan = 0;
+      return (rc==SQLITE_DONE ? SQLITE_OK : rc);
+    }
+    return SQLITE_OK;
+  }
+#endif
   do {
     rc = doUnionNext((UnionCsr*)cur);
   }while( rc==SQLITE_ROW );
@@ -1106,6 +2120,12 @@ static int unionColumn(
   int i
 ){
   UnionCsr *pCsr = (UnionCsr*)cur;
+#if UNIONVTAB_PARALLEL
+  if( pCsr->pScan ){
+    unionValueResult(ctx, pCsr->pScan->apVal[i+1]);
+    return SQLITE_OK;
+  }
+#endif
   sqlite3_result_value(ctx, sqlite3_column_value(pCsr->pStmt, i+1));
   return SQLITE_OK;
 }
@@ -1115,6 +2135,14 @@ static int unionColumn(
 */
 static int unionRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid){
   UnionCsr *pCsr = (UnionCsr*)cur;
+#if UNIONVTAB_PARALLEL
+  if( pCsr->pScan ){
+    const unsigned char *a = pCsr->pScan->apVal[0];
+    assert( a[0]==SQLITE_INTEGER );
+    memcpy(pRowid, &a[1], 8);
+    return SQLITE_OK;
+  }
+#endif
   *pRowid = sqlite3_column_int64(pCsr->pStmt, 0);
   return SQLITE_OK;
 }
@@ -1124,6 +2152,9 @@ static int unionRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid){
 */
 static int unionEof(sqlite3_vtab_cursor *cur){
   UnionCsr *pCsr = (UnionCsr*)cur;
+#if UNIONVTAB_PARALLEL
+  if( pCsr->pScan ) return 0;
+#endif
   return pCsr->pStmt==0;
 }
 
@@ -1187,10 +2218,30 @@ static int unionFilter(
   }
 
   unionFinalizeCsrStmt(pCsr);
+#if UNIONVTAB_PARALLEL
+  unionScanFree(pCsr->pScan);
+  pCsr->pScan = 0;
+#endif
   if( bZero ){
     return SQLITE_OK;
   }
 
+#if UNIONVTAB_PARALLEL
+  rc = unionScanStart(pTab, "rowid, *", pTab->nCol+1, iMin, iMax,
+      &pCsr->pScan, &pTab->base.zErrMsg
+  );
+  if( rc==SQLITE_OK && pCsr->pScan ){
+    rc = unionNext(pVtabCursor);
+    if( (rc & 0xff)!=SQLITE_BUSY ) return rc;
+    /* A worker found a source locked before any row was returned. Run
+    ** the scan on the calling connection instead. */
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = 0;
+    rc = SQLITE_OK;
+  }
+  if( rc!=SQLITE_OK ) return rc;
+#endif
+
   for(i=0; i<pTab->nSrc; i++){
     UnionSrc *pSrc = &pTab->aSrc[i];
     if( iMin>pSrc->iMax || iMax<pSrc->iMin ){
@@ -1324,7 +2375,296 @@ static int unionBestIndex(
 }
 
 /*
-** Register the unionvtab virtual table module with database handle db.
+** Aggregates supported by unionvtab_aggregate().
+*/
+#define UNION_AGG_COUNT 1
+#define UNION_AGG_SUM   2
+#define UNION_AGG_MIN   3
+#define UNION_AGG_MAX   4
+
+/*
+** The result of a unionvtab_aggregate() call, accumulated one source
+** at a time.
+*/
+typedef struct UnionAgg UnionAgg;
+struct UnionAgg {
+  int eFunc;                      /* UNION_AGG_* value */
+  int eType;                      /* Type of result so far, or 0 */
+  sqlite3_int64 iVal;             /* Value if eType is SQLITE_INTEGER */
+  double rVal;                    /* Value if eType is SQLITE_FLOAT */
+  char *aVal;                     /* Value if eType is TEXT or BLOB */
+  int nVal;                       /* Size of aVal[] in bytes */
+};
+
+/*
+** Compare two values, each of which is INTEGER, FLOAT, TEXT or BLOB,
+** in the order used by SQLite for min() and max() (BINARY collation).
+** Return negative, zero or positive if the first is smaller than, equal
+** to or larger than the second.
+*/
+static int unionAggCompare(
+  int eType1, sqlite3_int64 i1, double r1, const char *a1, int n1,
+  int eType2, sqlite3_int64 i2, double r2, const char *a2, int n2
+){
+  int c1 = (eType1==SQLITE_FLOAT ? SQLITE_INTEGER : eType1);
+  int c2 = (eType2==SQLITE_FLOAT ? SQLITE_INTEGER : eType2);
+  int res;
+  if( c1!=c2 ) return c1 - c2;
+  if( c1==SQLITE_INTEGER ){
+    if( eType1==SQLITE_INTEGER && eType2==SQLITE_INTEGER ){
+      return (i1<i2 ? -1 : i1>i2);
+    }
+    if( eType1==SQLITE_INTEGER ) r1 = (double)i1;
+    if( eType2==SQLITE_INTEGER ) r2 = (double)i2;
+    return (r1<r2 ? -1 : r1>r2);
+  }
+  res = (n1<n2 ? n1 : n2) ? memcmp(a1, a2, (n1<n2 ? n1 : n2)) : 0;
+  return (res ? res : n1 - n2);
+}
+
+/*
+** Combine the result of the aggregate for a single source with the
+** result accumulated so far. Return SQLITE_OK if successful, or an error
+** code otherwise. If the error is other than SQLITE_NOMEM, also set
+** *pzErr to point to an error message.
+*/
+static int unionAggStep(
+  UnionAgg *p,
+  int eType, sqlite3_int64 iVal, double rVal, const char *aVal, int nVal,
+  char **pzErr
+){
+  if( eType==SQLITE_NULL ) return SQLITE_OK;
+  switch( p->eFunc ){
+    case UNION_AGG_COUNT:
+    case UNION_AGG_SUM:
+      if( p->eType==0 ){
+        p->eType = eType;
+        p->iVal = iVal;
+        p->rVal = rVal;
+      }else if( p->eType==SQLITE_INTEGER && eType==SQLITE_INTEGER ){
+        if( (iVal>0 && p->iVal>LARGEST_INT64-iVal)
+         || (iVal<0 && p->iVal<SMALLEST_INT64-iVal)
+        ){
+          *pzErr = sqlite3_mprintf("integer overflow");
+          return SQLITE_ERROR;
+        }
+        p->iVal += iVal;
+      }else{
+        if( p->eType==SQLITE_INTEGER ) p->rVal = (double)p->iVal;
+        p->rVal += (eType==SQLITE_INTEGER ? (double)iVal : rVal);
+        p->eType = SQLITE_FLOAT;
+      }
+      break;
+
+    default: {
+      int c = 0;
+      if( p->eType ){
+        c = unionAggCompare(eType, iVal, rVal, aVal, nVal,
+            p->eType, p->iVal, p->rVal, p->aVal, p->nVal
+        );
+      }
+      if( p->eType==0 || (p->eFunc==UNION_AGG_MIN ? c<0 : c>0) ){
+        p->eType = eType;
+        p->iVal = iVal;
+        p->rVal = rVal;
+        p->nVal = 0;
+        if( eType==SQLITE_TEXT || eType==SQLITE_BLOB ){
+          char *aNew = (char*)sqlite3_realloc(p->aVal, nVal>0 ? nVal : 1);
+          if( aNew==0 ) return SQLITE_NOMEM;
+          p->aVal = aNew;
+          p->nVal = nVal;
+          if( nVal>0 ) memcpy(p->aVal, aVal, nVal);
+        }
+      }
+      break;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Implementation of SQL function:
+**
+**   unionvtab_aggregate(TABLE, FUNCTION, COLUMN [, MIN-ROWID [, MAX-ROWID]])
+**
+** See the header comment at the top of this file for details.
+*/
+static void unionAggregateFunc(
+  sqlite3_context *ctx,
+  int argc,
+  sqlite3_value **argv
+){
+  UnionGlobal *pGlobal = (UnionGlobal*)sqlite3_user_data(ctx);
+  const char *zName = (const char*)sqlite3_value_text(argv[0]);
+  const char *zFunc = (const char*)sqlite3_value_text(argv[1]);
+  const char *zCol = (const char*)sqlite3_value_text(argv[2]);
+  sqlite3_int64 iMin = SMALLEST_INT64;
+  sqlite3_int64 iMax = LARGEST_INT64;
+  UnionTab *pTab;
+  UnionAgg agg;
+  char *zSelect = 0;
+  char *zErr = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  memset(&agg, 0, sizeof(agg));
+  for(pTab=pGlobal->pTabList; pTab; pTab=pTab->pNextTab){
+    if( zName && sqlite3_stricmp(pTab->zName, zName)==0 ) break;
+  }
+  if( pTab==0 ){
+    zErr = sqlite3_mprintf("no such unionvtab table: %s", zName);
+    rc = SQLITE_ERROR;
+  }else if( zFunc && sqlite3_stricmp(zFunc, "count")==0 ){
+    agg.eFunc = UNION_AGG_COUNT;
+  }else if( zFunc && sqlite3_stricmp(zFunc, "sum")==0 ){
+    agg.eFunc = UNION_AGG_SUM;
+  }else if( zFunc && sqlite3_stricmp(zFunc, "min")==0 ){
+    agg.eFunc = UNION_AGG_MIN;
+  }else if( zFunc && sqlite3_stricmp(zFunc, "max")==0 ){
+    agg.eFunc = UNION_AGG_MAX;
+  }else{
+    zErr = sqlite3_mprintf("unsupported aggregate: %s", zFunc);
+    rc = SQLITE_ERROR;
+  }
+
+  if( rc==SQLITE_OK ){
+    if( zCol==0 ){
+      zErr = sqlite3_mprintf("column name may not be NULL");
+      rc = SQLITE_ERROR;
+    }else if( zCol[0]=='*' && zCol[1]=='\0' ){
+      if( agg.eFunc!=UNION_AGG_COUNT ){
+        zErr = sqlite3_mprintf("%s(*) is not supported", zFunc);
+        rc = SQLITE_ERROR;
+      }
+      zSelect = sqlite3_mprintf("count(*)");
+    }else{
+      /* Double-quoted names that are not columns are taken as strings by
+      ** SQLite, so check that zCol is a column of the virtual table. */
+      if( sqlite3_table_column_metadata(
+            pTab->db, "temp", pTab->zName, zCol, 0, 0, 0, 0, 0)
+      ){
+        zErr = sqlite3_mprintf("no such column: %s", zCol);
+        rc = SQLITE_ERROR;
+      }
+      zSelect = sqlite3_mprintf("%s(\"%w\")", zFunc, zCol);
+    }
+    if( rc==SQLITE_OK && zSelect==0 ) rc = SQLITE_NOMEM;
+  }
+  if( argc>3 && sqlite3_value_type(argv[3])!=SQLITE_NULL ){
+    iMin = sqlite3_value_int64(argv[3]);
+  }
+  if( argc>4 && sqlite3_value_type(argv[4])!=SQLITE_NULL ){
+    iMax = sqlite3_value_int64(argv[4]);
+  }
+
+#if UNIONVTAB_PARALLEL
+  if( rc==SQLITE_OK ){
+    UnionScan *pScan = 0;
+    rc = unionScanStart(pTab, zSelect, 1, iMin, iMax, &pScan, &zErr);
+    if( pScan ){
+      int nRow = 0;
+      while( rc==SQLITE_OK ){
+        const unsigned char *a;
+        sqlite3_int64 iVal = 0;
+        double rVal = 0.0;
+        int nVal = 0;
+        rc = unionScanNext(pScan, &zErr);
+        if( rc!=SQLITE_ROW ) break;
+        nRow++;
+        a = pScan->apVal[0];
+        if( a[0]==SQLITE_INTEGER ) memcpy(&iVal, &a[1], 8);
+        if( a[0]==SQLITE_FLOAT ) memcpy(&rVal, &a[1], 8);
+        if( a[0]==SQLITE_TEXT || a[0]==SQLITE_BLOB ) memcpy(&nVal, &a[1], 4);
+        rc = unionAggStep(&agg, a[0], iVal, rVal, (const char*)&a[5], nVal,
+            &zErr
+        );
+      }
+      if( rc==SQLITE_DONE ) rc = SQLITE_OK;
+      unionScanFree(pScan);
+      if( (rc & 0xff)!=SQLITE_BUSY || nRow>0 ) goto aggregate_done;
+      /* A source was locked before any result was seen. Run the serial
+      ** version below instead. */
+      sqlite3_free(zErr);
+      zErr = 0;
+      rc = SQLITE_OK;
+    }
+  }
+#endif
+
+  for(i=0; rc==SQLITE_OK && i<pTab->nSrc; i++){
+    UnionSrc *pSrc = &pTab->aSrc[i];
+    sqlite3_stmt *pStmt = 0;
+    char *zSql;
+    if( iMin>pSrc->iMax || iMax<pSrc->iMin ) continue;
+    if( pTab->bSwarm ) rc = unionOpenDatabase(pTab, i, &zErr);
+    zSql = unionSourceSql(&rc, pSrc, zSelect, iMin, iMax, 0);
+    if( rc==SQLITE_OK ){
+      pStmt = unionPrepare(&rc, unionGetDb(pTab, pSrc), zSql, &zErr);
+    }
+    if( rc==SQLITE_OK && SQLITE_ROW==sqlite3_step(pStmt) ){
+      rc = unionAggStep(&agg, sqlite3_column_type(pStmt, 0),
+          sqlite3_column_int64(pStmt, 0),
+          sqlite3_column_double(pStmt, 0),
+          (const char*)sqlite3_column_blob(pStmt, 0),
+          sqlite3_column_bytes(pStmt, 0), &zErr
+      );
+    }
+    unionFinalize(&rc, pStmt, &zErr);
+    sqlite3_free(zSql);
+  }
+  if( pTab ) unionCloseSources(pTab, pTab->nMaxOpen);
+
+#if UNIONVTAB_PARALLEL
+ aggregate_done:
+#endif
+  if( rc==SQLITE_NOMEM ){
+    sqlite3_result_error_nomem(ctx);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3_result_error(ctx, zErr ? zErr : sqlite3_errstr(rc), -1);
+    sqlite3_result_error_code(ctx, rc);
+  }else{
+    switch( agg.eType ){
+      case SQLITE_INTEGER:
+        sqlite3_result_int64(ctx, agg.iVal);
+        break;
+      case SQLITE_FLOAT:
+        sqlite3_result_double(ctx, agg.rVal);
+        break;
+      case SQLITE_TEXT:
+        sqlite3_result_text(ctx, agg.aVal, agg.nVal, SQLITE_TRANSIENT);
+        break;
+      case SQLITE_BLOB:
+        sqlite3_result_blob(ctx, agg.aVal, agg.nVal, SQLITE_TRANSIENT);
+        break;
+      default:
+        if( agg.eFunc==UNION_AGG_COUNT ) sqlite3_result_int(ctx, 0);
+        break;
+    }
+  }
+  sqlite3_free(agg.aVal);
+  sqlite3_free(zSelect);
+  sqlite3_free(zErr);
+}
+
+/*
+** Release a reference to the UnionGlobal object registered with the
+** modules and the unionvtab_aggregate() function.
+*/
+static void unionGlobalFree(void *p){
+  UnionGlobal *pGlobal = (UnionGlobal*)p;
+  pGlobal->nRef--;
+  if( pGlobal->nRef==0 ){
+    assert( pGlobal->pTabList==0 );
+    sqlite3_free(pGlobal);
+  }
+}
+static void unionAuxFree(void *p){
+  unionGlobalFree((void*)((UnionAux*)p)->pGlobal);
+}
+
+/*
+** Register the unionvtab and swarmvtab virtual table modules,
+** and the unionvtab_aggregate() function, with database handle db.
 */
 static int createUnionVtab(sqlite3 *db){
   static sqlite3_module unionModule = {
@@ -1352,12 +2692,39 @@ static int createUnionVtab(sqlite3 *db){
     0,                            /* xRelease */
     0                             /* xRollbackTo */
   };
+  UnionGlobal *pGlobal;
   int rc;
+  int i;
 
-  rc = sqlite3_create_module(db, "unionvtab", &unionModule, 0);
+  pGlobal = (UnionGlobal*)sqlite3_malloc(sizeof(UnionGlobal));
+  if( pGlobal==0 ) return SQLITE_NOMEM;
+  memset(pGlobal, 0, sizeof(UnionGlobal));
+  pGlobal->aAux[0].pGlobal = pGlobal;
+  pGlobal->aAux[1].pGlobal = pGlobal;
+  pGlobal->aAux[1].bSwarm = 1;
+
+  /* Each successful registration holds a reference to pGlobal, which is
+  ** released by its destructor (via the UnionAux object for modules). The
+  ** destructor is also invoked if the registration fails. One more
+  ** reference is held until this function returns.  */
+  pGlobal->nRef = 2;
+  rc = sqlite3_create_module_v2(db, "unionvtab", &unionModule,
+      (void*)&pGlobal->aAux[0], unionAuxFree
+  );
   if( rc==SQLITE_OK ){
-    rc = sqlite3_create_module(db, "swarmvtab", &unionModule, (void*)db);
+    pGlobal->nRef++;
+    rc = sqlite3_create_module_v2(db, "swarmvtab", &unionModule,
+        (void*)&pGlobal->aAux[1], unionAuxFree
+    );
+  }
+  for(i=3; i<=5 && rc==SQLITE_OK; i++){
+    pGlobal->nRef++;
+    rc = sqlite3_create_function_v2(db, "unionvtab_aggregate", i,
+        SQLITE_UTF8, (void*)pGlobal, unionAggregateFunc, 0, 0,
+        unionGlobalFree
+    );
   }
+  unionGlobalFree(pGlobal);
   return rc;
 }
 
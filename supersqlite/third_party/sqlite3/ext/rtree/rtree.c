@@ -67,6 +67,12 @@
 #include <assert.h>
 #include <stdio.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+# include <emmintrin.h>
+# define RTREE_HAVE_SSE2 1
+#endif
+
 #ifndef SQLITE_AMALGAMATION
 #include "sqlite3rtree.h"
 typedef sqlite3_int64 i64;
@@ -234,6 +240,12 @@ struct RtreeSearchPoint {
 */
 #define RTREE_CACHE_SZ  5
 
+/*
+** Number of cells that rtreeScanNode() loads and tests against the
+** comparison constraints of a query in one pass.  Less than 32.
+*/
+#define RTREE_SCAN_BLOCK 8
+
 /* 
 ** An rtree cursor object.
 */
@@ -253,6 +265,9 @@ struct RtreeCursor {
   RtreeSearchPoint sPoint;          /* Cached next search point */
   RtreeNode *aNode[RTREE_CACHE_SZ]; /* Rtree node cache */
   u32 anQueue[RTREE_MAX_DEPTH+1];   /* Number of queued entries by iLevel */
+  i64 iScanNode;                    /* Node that mScan applies to, or 0 */
+  int iScanCell;                    /* First cell of the block in mScan */
+  u32 mScan;                        /* Cells of the block that may match */
 };
 
 /* Return the Rtree of a RtreeCursor */
@@ -426,6 +441,18 @@ struct RtreeMatchArg {
 #endif
 #endif
 
+/*
+** Hint to the CPU that the memory at X will be read soon.  Prefetching
+** an address that is not mapped is harmless.
+*/
+#if GCC_VERSION>=4000000
+# define RTREE_PREFETCH(X) __builtin_prefetch((const void*)(X))
+#elif MSVC_VERSION>=1300 && defined(RTREE_HAVE_SSE2)
+# define RTREE_PREFETCH(X) _mm_prefetch((const char*)(X), _MM_HINT_T0)
+#else
+# define RTREE_PREFETCH(X)
+#endif
+
 /*
 ** Functions to deserialize a 16 bit integer, 32 bit real number and
 ** 64 bit integer. The deserialized value is returned.
@@ -1256,6 +1283,159 @@ static void rtreeLeafConstraint(
   *peWithin = NOT_WITHIN;
 }
 
+/*
+** Decode coordinate iOff bytes into each of the nCell cells starting
+** at pCellData into aVal[].  If nCell is odd, aVal[nCell] is set too so
+** that the vector loops in rtreeScanMask() only read initialized values.
+*/
+static void rtreeScanLoad(
+  u8 *pCellData,             /* First cell, as it appears on disk */
+  int nBytesPerCell,         /* Distance between cells */
+  int iOff,                  /* Offset of the coordinate within a cell */
+  int nCell,                 /* Number of cells to decode */
+  int eInt,                  /* True if RTree holds integer coordinates */
+  RtreeDValue *aVal          /* OUT: Decoded coordinates */
+){
+  int ii;
+  pCellData += iOff;
+  for(ii=0; ii<nCell; ii++){
+    RtreeCoord c;
+    readCoord(pCellData, &c);
+#ifdef SQLITE_RTREE_INT_ONLY
+    UNUSED_PARAMETER(eInt);
+    aVal[ii] = c.i;
+#else
+    aVal[ii] = eInt ? (RtreeDValue)c.i : (RtreeDValue)c.f;
+#endif
+    pCellData += nBytesPerCell;
+  }
+  if( nCell&1 ) aVal[nCell] = aVal[nCell-1];
+}
+
+/*
+** Return a bitmask with bit i set for each of the first nVal entries of
+** aVal[] for which "aVal[i] op rValue" is true.
+*/
+static u32 rtreeScanMask(
+  RtreeDValue *aVal,         /* Decoded coordinates */
+  int nVal,                  /* Number of entries in aVal[] */
+  int op,                    /* One of RTREE_LE, LT, GE, GT or EQ */
+  RtreeDValue rValue         /* Right-hand side of the comparison */
+){
+  u32 m = 0;
+  int ii;
+#if defined(RTREE_HAVE_SSE2) && !defined(SQLITE_RTREE_INT_ONLY)
+  __m128d r = _mm_set1_pd(rValue);
+#define RTREE_SCAN_LOOP(CMP)                                  \
+  for(ii=0; ii<nVal; ii+=2){                                  \
+    __m128d v = _mm_loadu_pd(&aVal[ii]);                      \
+    m |= (u32)_mm_movemask_pd(CMP(v, r)) << ii;               \
+  }
+  switch( op ){
+    case RTREE_LE: RTREE_SCAN_LOOP(_mm_cmple_pd); break;
+    case RTREE_LT: RTREE_SCAN_LOOP(_mm_cmplt_pd); break;
+    case RTREE_GE: RTREE_SCAN_LOOP(_mm_cmpge_pd); break;
+    case RTREE_GT: RTREE_SCAN_LOOP(_mm_cmpgt_pd); break;
+    default:       RTREE_SCAN_LOOP(_mm_cmpeq_pd); break;
+  }
+#undef RTREE_SCAN_LOOP
+#else
+#define RTREE_SCAN_LOOP(OP)                                   \
+  for(ii=0; ii<nVal; ii++){                                   \
+    m |= (u32)(aVal[ii] OP rValue) << ii;                     \
+  }
+  switch( op ){
+    case RTREE_LE: RTREE_SCAN_LOOP(<=); break;
+    case RTREE_LT: RTREE_SCAN_LOOP(<);  break;
+    case RTREE_GE: RTREE_SCAN_LOOP(>=); break;
+    case RTREE_GT: RTREE_SCAN_LOOP(>);  break;
+    default:       RTREE_SCAN_LOOP(==); break;
+  }
+#undef RTREE_SCAN_LOOP
+#endif
+  return m & (((u32)1<<nVal)-1);
+}
+
+/*
+** Return the index of the first cell of pNode at or after iCell that
+** might satisfy all of the comparison constraints (those other than
+** MATCH) on cursor pCur, or nCell if there is no such cell.  The cell
+** returned must still be checked against the complete set of
+** constraints by the caller.
+**
+** Rather than testing one cell against every constraint, this routine
+** decodes the constrained coordinate of RTREE_SCAN_BLOCK cells at a time
+** and compares them all in a vector loop, so that cells which fail are
+** skipped without the per-cell overhead of rtreeLeafConstraint() and
+** rtreeNonleafConstraint().  The result for the most recent block is
+** kept in pCur->mScan, as rtreeStepToLeaf() returns to the same node
+** once for each cell that matches.
+*/
+static int rtreeScanNode(
+  RtreeCursor *pCur,         /* The cursor */
+  RtreeNode *pNode,          /* Node to scan */
+  int iLevel,                /* 1 for a leaf, 2+ for an internal node */
+  int iCell,                 /* First cell to consider */
+  int nCell                  /* Number of cells in pNode */
+){
+  Rtree *pRtree = RTREE_OF_CURSOR(pCur);
+  int eInt = pRtree->eCoordType==RTREE_COORD_INT32;
+  int nByte = pRtree->nBytesPerCell;
+  RtreeDValue aVal[RTREE_SCAN_BLOCK+1];
+  u32 m;
+
+  assert( RTREE_SCAN_BLOCK<32 );
+  if( pCur->iScanNode==pNode->iNode
+   && iCell>=pCur->iScanCell && iCell<pCur->iScanCell+RTREE_SCAN_BLOCK
+  ){
+    m = pCur->mScan >> (iCell - pCur->iScanCell);
+    if( m ) goto scan_found;
+    iCell = pCur->iScanCell + RTREE_SCAN_BLOCK;
+  }
+
+  while( iCell<nCell ){
+    u8 *pCellData = &pNode->zData[4 + nByte*iCell];
+    int n = MIN(nCell - iCell, RTREE_SCAN_BLOCK);
+    int ii;
+    RTREE_PREFETCH(&pCellData[nByte*RTREE_SCAN_BLOCK]);
+    m = ((u32)1<<n) - 1;
+    for(ii=0; m && ii<pCur->nConstraint; ii++){
+      RtreeConstraint *p = &pCur->aConstraint[ii];
+      if( p->op>=RTREE_MATCH ) continue;
+      if( iLevel==1 ){
+        rtreeScanLoad(pCellData, nByte, 8+4*p->iCoord, n, eInt, aVal);
+        m &= rtreeScanMask(aVal, n, p->op, p->u.rValue);
+      }else{
+        /* As in rtreeNonleafConstraint(), a child may hold a match if
+        ** its lower bound is not above the value (for <, <= and ==) and
+        ** its upper bound is not below it (for >, >= and ==). */
+        int iOff = 8 + 4*(p->iCoord&0xfe);
+        if( p->op!=RTREE_GE && p->op!=RTREE_GT ){
+          rtreeScanLoad(pCellData, nByte, iOff, n, eInt, aVal);
+          m &= rtreeScanMask(aVal, n, RTREE_LE, p->u.rValue);
+        }
+        if( m && p->op!=RTREE_LE && p->op!=RTREE_LT ){
+          rtreeScanLoad(pCellData, nByte, iOff+4, n, eInt, aVal);
+          m &= rtreeScanMask(aVal, n, RTREE_GE, p->u.rValue);
+        }
+      }
+    }
+    pCur->iScanNode = pNode->iNode;
+    pCur->iScanCell = iCell;
+    pCur->mScan = m;
+    if( m ) goto scan_found;
+    iCell += n;
+  }
+  return nCell;
+
+scan_found:
+  while( (m&1)==0 ){
+    m >>= 1;
+    iCell++;
+  }
+  return iCell;
+}
+
 /*
 ** One of the cells in node pNode is guaranteed to have a 64-bit 
 ** integer value equal to iRowid. Return the index of this cell.
@@ -1519,9 +1699,13 @@ static int rtreeStepToLeaf(RtreeCursor *pCur){
   int nConstraint = pCur->nConstraint;
   int ii;
   int eInt;
+  int bScan = 0;             /* True to use rtreeScanNode() */
   RtreeSearchPoint x;
 
   eInt = pRtree->eCoordType==RTREE_COORD_INT32;
+  for(ii=0; ii<nConstraint; ii++){
+    if( pCur->aConstraint[ii].op<RTREE_MATCH ) bScan = 1;
+  }
   while( (p = rtreeSearchPointFirst(pCur))!=0 && p->iLevel>0 ){
     pNode = rtreeNodeOfFirstSearchPoint(pCur, &rc);
     if( rc ) return rc;
@@ -1529,7 +1713,12 @@ static int rtreeStepToLeaf(RtreeCursor *pCur){
     assert( nCell<200 );
     while( p->iCell<nCell ){
       sqlite3_rtree_dbl rScore = (sqlite3_rtree_dbl)-1;
-      u8 *pCellData = pNode->zData + (4+pRtree->nBytesPerCell*p->iCell);
+      u8 *pCellData;
+      if( bScan ){
+        p->iCell = (u8)rtreeScanNode(pCur, pNode, p->iLevel, p->iCell, nCell);
+        if( p->iCell>=nCell ) break;
+      }
+      pCellData = pNode->zData + (4+pRtree->nBytesPerCell*p->iCell);
       eWithin = FULLY_WITHIN;
       for(ii=0; ii<nConstraint; ii++){
         RtreeConstraint *pConstraint = pCur->aConstraint + ii;
@@ -4227,6 +4416,726 @@ static void rtreecheck(
   }
 }
 
+/*
+** Context object passed between the various routines that make up the
+** implementation of the bulk-load function rtreebulkload().
+*/
+typedef struct RtreeBulk RtreeBulk;
+struct RtreeBulk {
+  sqlite3 *db;                    /* Database handle */
+  const char *zDb;                /* Database containing rtree table */
+  const char *zTab;               /* Name of rtree table */
+  Rtree tree;                     /* Node geometry of the rtree table */
+  int nAux;                       /* Number of auxiliary columns */
+  int nMaxCell;                   /* Number of cells in a full node */
+  int nMinCell;                   /* Fewest cells allowed in a node */
+  i64 iNextNode;                  /* Number of the next non-root node */
+  sqlite3_stmt *pWriteNode;       /* Statement to write to %_node */
+  sqlite3_stmt *pWriteRowid;      /* Statement to write to %_rowid */
+  sqlite3_stmt *pWriteParent;     /* Statement to write to %_parent */
+  RtreeCell *aCell;               /* Bounding boxes of nodes just written */
+  int nCell;                      /* Number of entries in aCell[] */
+  int nCellAlloc;                 /* Allocated size of aCell[] */
+  int rc;                         /* Return code */
+  char *zErr;                     /* Error message, if any */
+};
+
+/*
+** If no error has been recorded yet, record error code rc, together
+** with either the printf() style message zFmt or, if zFmt is NULL, the
+** current error message of the database handle.
+*/
+static void rtreeBulkError(RtreeBulk *pBulk, int rc, const char *zFmt, ...){
+  if( pBulk->rc==SQLITE_OK ){
+    pBulk->rc = rc;
+    if( zFmt ){
+      va_list ap;
+      va_start(ap, zFmt);
+      pBulk->zErr = sqlite3_vmprintf(zFmt, ap);
+      va_end(ap);
+    }else if( rc!=SQLITE_NOMEM ){
+      pBulk->zErr = sqlite3_mprintf("%s", sqlite3_errmsg(pBulk->db));
+    }
+  }
+}
+
+/*
+** Format an SQL statement using the printf() style arguments and
+** prepare it.  Return NULL and leave an error in pBulk if that fails.
+*/
+static sqlite3_stmt *rtreeBulkPrepare(RtreeBulk *pBulk, const char *zFmt, ...){
+  va_list ap;
+  char *z;
+  sqlite3_stmt *pRet = 0;
+
+  va_start(ap, zFmt);
+  z = sqlite3_vmprintf(zFmt, ap);
+  va_end(ap);
+  if( pBulk->rc==SQLITE_OK ){
+    if( z==0 ){
+      rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+    }else if( sqlite3_prepare_v2(pBulk->db, z, -1, &pRet, 0)!=SQLITE_OK ){
+      rtreeBulkError(pBulk, sqlite3_errcode(pBulk->db), 0);
+    }
+  }
+  sqlite3_free(z);
+  return pRet;
+}
+
+/*
+** Step statement pStmt, which should not return any rows, and reset it.
+*/
+static void rtreeBulkStep(RtreeBulk *pBulk, sqlite3_stmt *pStmt){
+  sqlite3_step(pStmt);
+  if( sqlite3_reset(pStmt)!=SQLITE_OK ){
+    rtreeBulkError(pBulk, sqlite3_errcode(pBulk->db), 0);
+  }
+}
+
+/*
+** Run the printf() style SQL script zFmt, which should not return any
+** rows.
+*/
+static void rtreeBulkExec(RtreeBulk *pBulk, const char *zFmt, ...){
+  va_list ap;
+  char *z;
+  va_start(ap, zFmt);
+  z = sqlite3_vmprintf(zFmt, ap);
+  va_end(ap);
+  if( pBulk->rc==SQLITE_OK ){
+    if( z==0 ){
+      rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+    }else if( sqlite3_exec(pBulk->db, z, 0, 0, 0)!=SQLITE_OK ){
+      rtreeBulkError(pBulk, sqlite3_errcode(pBulk->db), 0);
+    }
+  }
+  sqlite3_free(z);
+}
+
+/*
+** Record a constraint error for the row with id iRowid, the (c1<=c2)
+** constraint on columns iCol and iCol+1 of the rtree table having
+** failed.  The message matches that of rtreeConstraintError().
+*/
+static void rtreeBulkConstraintError(RtreeBulk *pBulk, int iCol, i64 iRowid){
+  sqlite3_stmt *pStmt;
+  pStmt = rtreeBulkPrepare(pBulk, "SELECT * FROM %Q.%Q", 
+                           pBulk->zDb, pBulk->zTab);
+  if( pStmt ){
+    rtreeBulkError(pBulk, SQLITE_CONSTRAINT,
+        "rtree constraint failed: %s.(%s<=%s) for id %lld", pBulk->zTab,
+        sqlite3_column_name(pStmt, iCol), sqlite3_column_name(pStmt, iCol+1),
+        iRowid
+    );
+    sqlite3_finalize(pStmt);
+  }
+}
+
+/*
+** Return 0 if zSql is the CREATE VIRTUAL TABLE statement of an "rtree"
+** table, 1 if it is an "rtree_i32" table, or -1 if it is something else.
+*/
+static int rtreeBulkModule(const char *zSql){
+  static const char *azModule[] = { "rtree", "rtree_i32" };
+  int i;
+  for(i=1; zSql[i]; i++){
+    if( (zSql[i-1]==' ' || zSql[i-1]=='\t' || zSql[i-1]=='\n')
+     && sqlite3_strnicmp(&zSql[i], "using", 5)==0
+     && (zSql[i+5]==' ' || zSql[i+5]=='\t' || zSql[i+5]=='\n')
+    ){
+      const char *z = &zSql[i+5];
+      int iType;
+      while( *z==' ' || *z=='\t' || *z=='\n' ) z++;
+      if( *z=='"' || *z=='\'' || *z=='`' || *z=='[' ) z++;
+      for(iType=1; iType>=0; iType--){
+        int n = (int)strlen(azModule[iType]);
+        if( sqlite3_strnicmp(z, azModule[iType], n)==0
+         && (z[n]=='(' || z[n]==' ' || z[n]=='"' || z[n]=='\''
+          || z[n]=='`' || z[n]==']' || z[n]=='\0')
+        ){
+          return iType;
+        }
+      }
+      return -1;
+    }
+  }
+  return -1;
+}
+
+/*
+** Return the number of slabs to cut each of nDim dimensions into so that
+** nEntry entries fill about nPer entries per node: the smallest S such
+** that S^nDim nodes are enough.
+*/
+static i64 rtreeBulkSlabs(i64 nEntry, int nPer, int nDim){
+  i64 nNode = (nEntry + nPer - 1) / nPer;
+  i64 nSlab = 1;
+  for(;;){
+    i64 nCover = 1;
+    int ii;
+    for(ii=0; ii<nDim && nCover<nNode; ii++) nCover *= nSlab;
+    if( nCover>=nNode ) return nSlab;
+    nSlab++;
+  }
+}
+
+/*
+** Return the number of cells to put in the next node of a level that
+** has nRemain cells left to pack.  Nodes are filled completely, except
+** that if the last node would be left with fewer than the minimum number
+** of cells the last two nodes share the remainder evenly.
+*/
+static int rtreeBulkTake(RtreeBulk *pBulk, i64 nRemain){
+  if( nRemain<=pBulk->nMaxCell ) return (int)nRemain;
+  if( nRemain-pBulk->nMaxCell<pBulk->nMinCell ) return (int)(nRemain/2);
+  return pBulk->nMaxCell;
+}
+
+/*
+** Clear node pNode, which is the root if iDepth>=0, and give it a node
+** number.
+*/
+static void rtreeBulkNodeStart(RtreeBulk *pBulk, RtreeNode *pNode, int iDepth){
+  memset(pNode->zData, 0, pBulk->tree.iNodeSize);
+  pNode->iNode = iDepth>=0 ? 1 : pBulk->iNextNode++;
+  if( iDepth>=0 ) writeInt16(pNode->zData, iDepth);
+}
+
+/*
+** Add cell pCell to node pNode, growing the bounding box pBox to cover it.
+** If pNode is an internal node, also record it as the parent of pCell.
+*/
+static void rtreeBulkNodeAdd(
+  RtreeBulk *pBulk,
+  RtreeNode *pNode,
+  RtreeCell *pCell,
+  RtreeCell *pBox,
+  int bLeaf
+){
+  if( NCELL(pNode)==0 ){
+    *pBox = *pCell;
+  }else{
+    cellUnion(&pBulk->tree, pBox, pCell);
+  }
+  nodeInsertCell(&pBulk->tree, pNode, pCell);
+  if( !bLeaf ){
+    sqlite3_bind_int64(pBulk->pWriteParent, 1, pCell->iRowid);
+    sqlite3_bind_int64(pBulk->pWriteParent, 2, pNode->iNode);
+    rtreeBulkStep(pBulk, pBulk->pWriteParent);
+  }
+}
+
+/*
+** Write node pNode to the %_node table.  Unless it is the root, append
+** its bounding box pBox to pBulk->aCell[] for the level above.
+*/
+static void rtreeBulkNodeFinish(
+  RtreeBulk *pBulk,
+  RtreeNode *pNode,
+  RtreeCell *pBox
+){
+  sqlite3_bind_int64(pBulk->pWriteNode, 1, pNode->iNode);
+  sqlite3_bind_blob(pBulk->pWriteNode, 2, pNode->zData,
+                    pBulk->tree.iNodeSize, SQLITE_STATIC);
+  rtreeBulkStep(pBulk, pBulk->pWriteNode);
+  if( pNode->iNode!=1 && pBulk->rc==SQLITE_OK ){
+    if( pBulk->nCell>=pBulk->nCellAlloc ){
+      int nNew = pBulk->nCellAlloc ? pBulk->nCellAlloc*2 : 256;
+      RtreeCell *aNew;
+      if( nNew<0 ){
+        rtreeBulkError(pBulk, SQLITE_FULL, "rtreebulkload: too many nodes");
+        return;
+      }
+      aNew = sqlite3_realloc64(pBulk->aCell, nNew*sizeof(RtreeCell));
+      if( aNew==0 ){
+        rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+        return;
+      }
+      pBulk->aCell = aNew;
+      pBulk->nCellAlloc = nNew;
+    }
+    pBox->iRowid = pNode->iNode;
+    pBulk->aCell[pBulk->nCell++] = *pBox;
+  }
+}
+
+/*
+** Sort the nIdx cells of aCell[] indexed by aIdx[] into Sort-Tile-Recursive
+** order, starting with dimension iDim: sort by that dimension, cut the
+** result into slabs of nSlab cells and sort each slab by the remaining
+** dimensions in the same way.
+*/
+static void rtreeBulkSortLevel(
+  Rtree *pRtree,
+  RtreeCell *aCell,
+  int *aIdx,
+  int *aSpare,
+  int nIdx,
+  int iDim,
+  i64 nSlab,
+  i64 nSlabPerDim
+){
+  SortByDimension(pRtree, aIdx, nIdx, iDim, aCell, aSpare);
+  if( iDim<pRtree->nDim-1 ){
+    int ii;
+    for(ii=0; ii<nIdx; ii+=(int)nSlab){
+      rtreeBulkSortLevel(pRtree, aCell, &aIdx[ii], aSpare,
+          (int)MIN(nSlab, nIdx-ii), iDim+1, nSlab/nSlabPerDim, nSlabPerDim
+      );
+    }
+  }
+}
+
+/*
+** Build the leaf level of the tree from the rows of SELECT statement
+** zSelect, which are first sorted into Sort-Tile-Recursive order by an
+** SQL query.  That query uses window functions to number each row
+** within its slab, so the sorting is done by the external merge sorter
+** of the core and works on inputs much larger than memory.
+**
+** If all the rows fit on the root node, it is written with a depth of 0.
+** Otherwise the leaves are written and their bounding boxes left in
+** pBulk->aCell[].  Return the number of rows loaded.
+*/
+static i64 rtreeBulkLeaves(RtreeBulk *pBulk, const char *zSelect){
+  Rtree *pRtree = &pBulk->tree;
+  sqlite3_stmt *pStmt;
+  sqlite3_str *pSql;
+  char *zSql;
+  i64 nRow = 0;
+  i64 nSlabPerDim;
+  i64 nSlab;
+  i64 iRow = 0;
+  int nTake = 0;
+  int nCol = 1 + pRtree->nDim2 + pBulk->nAux;
+  int bRoot;
+  int ii, jj;
+  RtreeNode *pNode;
+  RtreeCell box;
+
+  /* Check that the input has one column for each column of the table.
+  ** Otherwise the error would come from preparing the CTE below, and
+  ** refer to it rather than to the SELECT. */
+  pStmt = rtreeBulkPrepare(pBulk, "%s", zSelect);
+  if( pStmt ){
+    int nSelect = sqlite3_column_count(pStmt);
+    sqlite3_finalize(pStmt);
+    if( nSelect!=nCol ){
+      rtreeBulkError(pBulk, SQLITE_ERROR,
+          "rtreebulkload: SELECT returns %d columns - expected %d",
+          nSelect, nCol
+      );
+      return 0;
+    }
+  }
+
+  /* Count the input rows */
+  pStmt = rtreeBulkPrepare(pBulk, "SELECT count(*) FROM (%s)", zSelect);
+  if( pStmt ){
+    if( sqlite3_step(pStmt)==SQLITE_ROW ) nRow = sqlite3_column_int64(pStmt,0);
+    if( sqlite3_finalize(pStmt)!=SQLITE_OK ){
+      rtreeBulkError(pBulk, sqlite3_errcode(pBulk->db), 0);
+    }
+  }
+  if( pBulk->rc || nRow==0 ) return 0;
+  bRoot = nRow<=pBulk->nMaxCell;
+
+  /* Sort the input.  Slab keys k0, k1, ... are computed for all but the
+  ** last dimension; rows within the innermost slab are ordered by the
+  ** centre of the last dimension. */
+  nSlabPerDim = rtreeBulkSlabs(nRow, pBulk->nMaxCell, pRtree->nDim);
+  nSlab = pBulk->nMaxCell;
+  for(ii=1; ii<pRtree->nDim; ii++) nSlab *= nSlabPerDim;
+  pSql = sqlite3_str_new(pBulk->db);
+  sqlite3_str_appendf(pSql, "WITH rtreebulk_src(id");
+  for(ii=0; ii<pRtree->nDim2; ii++) sqlite3_str_appendf(pSql, ",c%d", ii);
+  for(ii=0; ii<pBulk->nAux; ii++) sqlite3_str_appendf(pSql, ",a%d", ii);
+  sqlite3_str_appendf(pSql, ") AS (%s)", zSelect);
+  for(ii=0; ii<pRtree->nDim-1; ii++){
+    sqlite3_str_appendf(pSql,
+        ", rtreebulk_s%d AS (SELECT *, (row_number() OVER (", ii
+    );
+    for(jj=0; jj<ii; jj++){
+      sqlite3_str_appendf(pSql, "%sk%d", jj ? "," : "PARTITION BY ", jj);
+    }
+    sqlite3_str_appendf(pSql, " ORDER BY c%d+c%d)-1)/%lld AS k%d FROM ",
+        ii*2, ii*2+1, nSlab, ii
+    );
+    if( ii==0 ){
+      sqlite3_str_appendf(pSql, "rtreebulk_src)");
+    }else{
+      sqlite3_str_appendf(pSql, "rtreebulk_s%d)", ii-1);
+    }
+    nSlab /= nSlabPerDim;
+  }
+  sqlite3_str_appendf(pSql, " SELECT *");
+  if( pRtree->nDim>1 ){
+    sqlite3_str_appendf(pSql, " FROM rtreebulk_s%d ORDER BY ",
+                        pRtree->nDim-2);
+    for(ii=0; ii<pRtree->nDim-1; ii++) sqlite3_str_appendf(pSql, "k%d,", ii);
+  }else{
+    sqlite3_str_appendf(pSql, " FROM rtreebulk_src ORDER BY ");
+  }
+  sqlite3_str_appendf(pSql, "c%d+c%d", pRtree->nDim2-2, pRtree->nDim2-1);
+  zSql = sqlite3_str_finish(pSql);
+  if( zSql==0 ){
+    rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+    return 0;
+  }
+  pStmt = rtreeBulkPrepare(pBulk, "%s", zSql);
+  sqlite3_free(zSql);
+  if( pStmt==0 ) return 0;
+
+  pNode = nodeNew(pRtree, 0);
+  if( pNode==0 ){
+    rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+  }
+  while( pBulk->rc==SQLITE_OK && sqlite3_step(pStmt)==SQLITE_ROW ){
+    RtreeCell cell;
+    if( iRow>=nRow ){
+      rtreeBulkError(pBulk, SQLITE_ERROR,
+          "rtreebulkload: SELECT returned more rows than it counted"
+      );
+      break;
+    }
+    if( sqlite3_column_type(pStmt, 0)!=SQLITE_INTEGER ){
+      rtreeBulkError(pBulk, SQLITE_MISMATCH,
+          "rtreebulkload: id of row %lld is not an integer", iRow+1
+      );
+      break;
+    }
+    cell.iRowid = sqlite3_column_int64(pStmt, 0);
+    for(ii=0; ii<pRtree->nDim2; ii+=2){
+      sqlite3_value *pLo = sqlite3_column_value(pStmt, ii+1);
+      sqlite3_value *pHi = sqlite3_column_value(pStmt, ii+2);
+#ifndef SQLITE_RTREE_INT_ONLY
+      if( pRtree->eCoordType==RTREE_COORD_REAL32 ){
+        cell.aCoord[ii].f = rtreeValueDown(pLo);
+        cell.aCoord[ii+1].f = rtreeValueUp(pHi);
+        if( cell.aCoord[ii].f<=cell.aCoord[ii+1].f ) continue;
+      }else
+#endif
+      {
+        cell.aCoord[ii].i = sqlite3_value_int(pLo);
+        cell.aCoord[ii+1].i = sqlite3_value_int(pHi);
+        if( cell.aCoord[ii].i<=cell.aCoord[ii+1].i ) continue;
+      }
+      rtreeBulkConstraintError(pBulk, ii+1, cell.iRowid);
+      break;
+    }
+    if( pBulk->rc ) break;
+
+    if( nTake==0 ){
+      rtreeBulkNodeStart(pBulk, pNode, bRoot ? 0 : -1);
+      nTake = bRoot ? (int)nRow : rtreeBulkTake(pBulk, nRow-iRow);
+    }
+    rtreeBulkNodeAdd(pBulk, pNode, &cell, &box, 1);
+    sqlite3_bind_int64(pBulk->pWriteRowid, 1, cell.iRowid);
+    sqlite3_bind_int64(pBulk->pWriteRowid, 2, pNode->iNode);
+    for(ii=0; ii<pBulk->nAux; ii++){
+      sqlite3_bind_value(pBulk->pWriteRowid, ii+3,
+          sqlite3_column_value(pStmt, nCol-pBulk->nAux+ii)
+      );
+    }
+    rtreeBulkStep(pBulk, pBulk->pWriteRowid);
+    iRow++;
+    if( --nTake==0 ) rtreeBulkNodeFinish(pBulk, pNode, &box);
+  }
+  if( sqlite3_finalize(pStmt)!=SQLITE_OK ){
+    rtreeBulkError(pBulk, sqlite3_errcode(pBulk->db), 0);
+  }
+  if( pBulk->rc==SQLITE_OK && iRow!=nRow ){
+    rtreeBulkError(pBulk, SQLITE_ERROR,
+        "rtreebulkload: SELECT returned fewer rows than it counted"
+    );
+  }
+  sqlite3_free(pNode);
+  if( pNode ) pRtree->nNodeRef--;
+  return iRow;
+}
+
+/*
+** Build the internal levels of the tree bottom-up from the bounding
+** boxes of the level below, left in pBulk->aCell[], until they fit on
+** the root node.  These levels are a fraction of the size of the input,
+** so they are sorted in memory.
+*/
+static void rtreeBulkInternal(RtreeBulk *pBulk){
+  Rtree *pRtree = &pBulk->tree;
+  RtreeCell *aIn = 0;
+  int *aIdx = 0;
+  int iDepth = 1;
+  RtreeNode *pNode = nodeNew(pRtree, 0);
+  if( pNode==0 ) rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+
+  while( pBulk->rc==SQLITE_OK ){
+    int nIn = pBulk->nCell;
+    int bRoot = nIn<=pBulk->nMaxCell;
+    i64 nSlabPerDim = rtreeBulkSlabs(nIn, pBulk->nMaxCell, pRtree->nDim);
+    i64 nSlab = pBulk->nMaxCell;
+    int nTake = 0;
+    int ii;
+    RtreeCell box;
+
+    /* Take the boxes of the level below and sort them */
+    sqlite3_free(aIn);
+    aIn = pBulk->aCell;
+    pBulk->aCell = 0;
+    pBulk->nCell = pBulk->nCellAlloc = 0;
+    sqlite3_free(aIdx);
+    aIdx = sqlite3_malloc64(sizeof(int)*2*(i64)nIn);
+    if( aIdx==0 ){
+      rtreeBulkError(pBulk, SQLITE_NOMEM, 0);
+      break;
+    }
+    /* SortByDimension() may read one entry past the end of a run, so
+    ** the spare half of aIdx[] must hold valid indexes too */
+    for(ii=0; ii<nIn; ii++) aIdx[ii] = ii;
+    memset(&aIdx[nIn], 0, sizeof(int)*nIn);
+    for(ii=1; ii<pRtree->nDim; ii++) nSlab *= nSlabPerDim;
+    if( !bRoot ){
+      rtreeBulkSortLevel(pRtree, aIn, aIdx, &aIdx[nIn], nIn,
+                         0, nSlab, nSlabPerDim);
+    }
+
+    for(ii=0; ii<nIn && pBulk->rc==SQLITE_OK; ii++){
+      if( nTake==0 ){
+        rtreeBulkNodeStart(pBulk, pNode, bRoot ? iDepth : -1);
+        nTake = bRoot ? nIn : rtreeBulkTake(pBulk, nIn-ii);
+      }
+      rtreeBulkNodeAdd(pBulk, pNode, &aIn[aIdx[ii]], &box, 0);
+      if( --nTake==0 ) rtreeBulkNodeFinish(pBulk, pNode, &box);
+    }
+    if( bRoot ) break;
+    if( ++iDepth>RTREE_MAX_DEPTH ){
+      rtreeBulkError(pBulk, SQLITE_FULL, "rtreebulkload: tree too deep");
+    }
+  }
+
+  sqlite3_free(aIn);
+  sqlite3_free(aIdx);
+  sqlite3_free(pNode);
+  if( pNode ) pRtree->nNodeRef--;
+}
+
+/*
+** This function does the bulk of the work for rtreebulkload(). It loads
+** the rows of SELECT statement zSelect into the empty rtree table zTab,
+** writing *pnRow, and returns an SQLite error code.
+*/
+static int rtreeBulkLoad(
+  sqlite3 *db,                    /* Database handle */
+  const char *zDb,                /* Name of db ("main", "temp" etc.) */
+  const char *zTab,               /* Name of rtree table to load */
+  const char *zSelect,            /* SELECT statement returning the rows */
+  i64 *pnRow,                     /* OUT: Number of rows loaded */
+  char **pzErr                    /* OUT: sqlite3_malloc'd error message */
+){
+  RtreeBulk bulk;
+  sqlite3_stmt *pStmt;
+  int eType = -1;
+  int nCol = 0;
+  int bAutocommit;
+  int ii;
+
+  memset(&bulk, 0, sizeof(bulk));
+  bulk.db = db;
+  bulk.zDb = zDb;
+  bulk.zTab = zTab;
+  *pnRow = 0;
+
+  /* Work out the type and shape of the rtree table */
+  pStmt = rtreeBulkPrepare(&bulk,
+      "SELECT sql FROM %Q.sqlite_master WHERE type='table' AND name=%Q",
+      zDb, zTab
+  );
+  if( pStmt && sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *zSql = (const char*)sqlite3_column_text(pStmt, 0);
+    if( zSql ) eType = rtreeBulkModule(zSql);
+  }
+  sqlite3_finalize(pStmt);
+  if( bulk.rc==SQLITE_OK && eType<0 ){
+    rtreeBulkError(&bulk, SQLITE_ERROR,
+        "rtreebulkload: %s is not an rtree table", zTab
+    );
+  }
+  pStmt = rtreeBulkPrepare(&bulk, "SELECT * FROM %Q.'%q_rowid'", zDb, zTab);
+  if( pStmt ){
+    bulk.nAux = sqlite3_column_count(pStmt) - 2;
+    sqlite3_finalize(pStmt);
+  }
+  pStmt = rtreeBulkPrepare(&bulk, "SELECT * FROM %Q.%Q", zDb, zTab);
+  if( pStmt ){
+    nCol = sqlite3_column_count(pStmt);
+    sqlite3_finalize(pStmt);
+  }
+  pStmt = rtreeBulkPrepare(&bulk,
+      "SELECT length(data), (SELECT count(*) FROM %Q.'%q_rowid') "
+      "FROM %Q.'%q_node' WHERE nodeno=1", zDb, zTab, zDb, zTab
+  );
+  if( pStmt ){
+    if( sqlite3_step(pStmt)==SQLITE_ROW ){
+      bulk.tree.iNodeSize = sqlite3_column_int(pStmt, 0);
+      if( sqlite3_column_int64(pStmt, 1)>0 ){
+        rtreeBulkError(&bulk, SQLITE_ERROR,
+            "rtreebulkload: table %s is not empty", zTab
+        );
+      }
+    }
+    sqlite3_finalize(pStmt);
+  }
+  if( bulk.rc==SQLITE_OK ){
+    bulk.tree.nDim = (u8)((nCol - 1 - bulk.nAux) / 2);
+    bulk.tree.nDim2 = bulk.tree.nDim*2;
+    bulk.tree.nBytesPerCell = 8 + bulk.tree.nDim2*4;
+#ifdef SQLITE_RTREE_INT_ONLY
+    bulk.tree.eCoordType = RTREE_COORD_INT32;
+#else
+    bulk.tree.eCoordType = eType ? RTREE_COORD_INT32 : RTREE_COORD_REAL32;
+#endif
+    if( bulk.tree.nDim<1 || bulk.tree.nDim>RTREE_MAX_DIMENSIONS
+     || bulk.nAux<0 || bulk.tree.iNodeSize<(512-64)
+    ){
+      rtreeBulkError(&bulk, SQLITE_CORRUPT_VTAB,
+          "rtreebulkload: schema of %s is corrupt", zTab
+      );
+    }else{
+      bulk.nMaxCell = (bulk.tree.iNodeSize-4)/bulk.tree.nBytesPerCell;
+      bulk.nMinCell = RTREE_MINCELLS(&bulk.tree);
+    }
+  }
+
+  /* Load the rows.  The whole operation is done within a savepoint so
+  ** that the table is left unchanged if it fails. */
+  bAutocommit = sqlite3_get_autocommit(db);
+  rtreeBulkExec(&bulk, "SAVEPOINT rtreebulkload");
+  if( bulk.rc==SQLITE_OK ){
+    sqlite3_str *pSql;
+    char *zSql;
+    rtreeBulkExec(&bulk,
+        "DELETE FROM %Q.'%q_parent'; DELETE FROM %Q.'%q_node' WHERE nodeno>1",
+        zDb, zTab, zDb, zTab
+    );
+    bulk.iNextNode = 2;
+    bulk.pWriteNode = rtreeBulkPrepare(&bulk,
+        "INSERT OR REPLACE INTO %Q.'%q_node' VALUES(?1, ?2)", zDb, zTab
+    );
+    bulk.pWriteParent = rtreeBulkPrepare(&bulk,
+        "INSERT INTO %Q.'%q_parent' VALUES(?1, ?2)", zDb, zTab
+    );
+    pSql = sqlite3_str_new(db);
+    sqlite3_str_appendf(pSql, "INSERT INTO %Q.'%q_rowid' VALUES(?1, ?2",
+                        zDb, zTab);
+    for(ii=0; ii<bulk.nAux; ii++) sqlite3_str_appendf(pSql, ", ?%d", ii+3);
+    sqlite3_str_appendf(pSql, ")");
+    zSql = sqlite3_str_finish(pSql);
+    if( zSql==0 ) rtreeBulkError(&bulk, SQLITE_NOMEM, 0);
+    bulk.pWriteRowid = rtreeBulkPrepare(&bulk, "%s", zSql);
+    sqlite3_free(zSql);
+
+    if( bulk.rc==SQLITE_OK ){
+      *pnRow = rtreeBulkLeaves(&bulk, zSelect);
+    }
+    if( bulk.rc==SQLITE_OK && bulk.nCell>0 ){
+      rtreeBulkInternal(&bulk);
+    }
+    sqlite3_finalize(bulk.pWriteNode);
+    sqlite3_finalize(bulk.pWriteParent);
+    sqlite3_finalize(bulk.pWriteRowid);
+    sqlite3_free(bulk.aCell);
+    if( bulk.rc!=SQLITE_OK ){
+      *pnRow = 0;
+      if( sqlite3_exec(db, "ROLLBACK TO rtreebulkload", 0, 0, 0) ){
+        /* The table may now be partly loaded, which matters more to the
+        ** caller than the error that caused the rollback. */
+        sqlite3_free(bulk.zErr);
+        bulk.zErr = 0;
+        bulk.rc = SQLITE_OK;
+        rtreeBulkError(&bulk, sqlite3_errcode(db), 0);
+      }
+    }
+    if( sqlite3_exec(db, "RELEASE rtreebulkload", 0, 0, 0) ){
+      /* If the savepoint opened the transaction, RELEASE commits it, which
+      ** can fail (e.g. with SQLITE_BUSY).  Roll the transaction back so
+      ** that it is not left open. */
+      *pnRow = 0;
+      rtreeBulkError(&bulk, sqlite3_errcode(db), 0);
+      if( bAutocommit ){
+        sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+      }else{
+        sqlite3_exec(db, "ROLLBACK TO rtreebulkload", 0, 0, 0);
+        sqlite3_exec(db, "RELEASE rtreebulkload", 0, 0, 0);
+      }
+    }
+  }
+
+  *pzErr = bulk.zErr;
+  return bulk.rc;
+}
+
+/*
+** Usage:
+**
+**   rtreebulkload(<rtree-table>, <select>);
+**   rtreebulkload(<database>, <rtree-table>, <select>);
+**
+** Load the rows returned by SELECT statement <select> into the empty
+** rtree or rtree_i32 table <rtree-table> and return the number of rows
+** loaded.  The SELECT must return the same columns as the rtree table:
+** an integer id, a minimum and maximum for each dimension and then any
+** auxiliary columns.  For example:
+**
+**   CREATE VIRTUAL TABLE rt USING rtree(id, x0, x1, y0, y1);
+**   SELECT rtreebulkload('rt', 'SELECT id, x0, x1, y0, y1 FROM src');
+**
+** Rather than inserting the rows one at a time, which splits nodes as
+** they fill up, a packed tree is built bottom-up using the
+** Sort-Tile-Recursive algorithm (Leutenegger et al, 1997): the rows are
+** sorted into slabs by the centre of their first dimension, then within
+** each slab by the second dimension, and so on, and consecutive runs of
+** rows become full leaf nodes.  The leaves are packed into the levels
+** above in the same way.  This is many times faster than INSERT and
+** produces nodes with little overlap, which makes queries faster.  The
+** nodes are packed full, so the first inserts afterwards split them.
+**
+** The <select> is run twice, once to count the rows and once to load
+** them, so it should return the same rows each time.
+*/
+static void rtreebulkload(
+  sqlite3_context *ctx,
+  int nArg,
+  sqlite3_value **apArg
+){
+  if( nArg!=2 && nArg!=3 ){
+    sqlite3_result_error(ctx, 
+        "wrong number of arguments to function rtreebulkload()", -1
+    );
+  }else{
+    int rc;
+    i64 nRow = 0;
+    char *zErr = 0;
+    const char *zDb = "main";
+    const char *zTab;
+    const char *zSelect;
+    if( nArg==3 ) zDb = (const char*)sqlite3_value_text(*apArg++);
+    zTab = (const char*)sqlite3_value_text(apArg[0]);
+    zSelect = (const char*)sqlite3_value_text(apArg[1]);
+    if( zDb==0 || zTab==0 || zSelect==0 ){
+      sqlite3_result_error(ctx, "rtreebulkload: NULL argument", -1);
+      return;
+    }
+    rc = rtreeBulkLoad(sqlite3_context_db_handle(ctx), zDb, zTab, zSelect,
+                       &nRow, &zErr);
+    if( rc==SQLITE_OK ){
+      sqlite3_result_int64(ctx, nRow);
+    }else{
+      if( zErr ) sqlite3_result_error(ctx, zErr, -1);
+      sqlite3_result_error_code(ctx, rc);
+    }
+    sqlite3_free(zErr);
+  }
+}
+
 /* Conditionally include the geopoly code */
 #ifdef SQLITE_ENABLE_GEOPOLY
 # include "geopoly.c"
@@ -4248,6 +5157,10 @@ int sqlite3RtreeInit(sqlite3 *db){
   if( rc==SQLITE_OK ){
     rc = sqlite3_create_function(db, "rtreecheck", -1, utf8, 0,rtreecheck, 0,0);
   }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_function(db, "rtreebulkload", -1, utf8, 0,
+                                 rtreebulkload, 0, 0);
+  }
   if( rc==SQLITE_OK ){
 #ifdef SQLITE_RTREE_INT_ONLY
     void *c = (void *)RTREE_COORD_INT32;
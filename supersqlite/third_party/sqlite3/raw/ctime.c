@@ -274,6 +274,9 @@ static const char * const sqlite3azCompileOpt[] = {
 #if SQLITE_ENABLE_PREUPDATE_HOOK
   "ENABLE_PREUPDATE_HOOK",
 #endif
+#if SQLITE_ENABLE_PROFILE_VTAB
+  "ENABLE_PROFILE_VTAB",
+#endif
 #if SQLITE_ENABLE_QPSG
   "ENABLE_QPSG",
 #endif
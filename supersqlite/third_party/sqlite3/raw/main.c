@@ -1237,6 +1237,9 @@ void sqlite3LeaveMutexAndCloseZombie(sqlite3 *db){
   }
   sqlite3HashClear(&db->aModule);
 #endif
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  sqlite3ProfileFree(db);
+#endif
 
   sqlite3Error(db, SQLITE_OK); /* Deallocates any cached error strings. */
   sqlite3ValueFree(db->pErr);
@@ -3221,6 +3224,12 @@ static int openDatabase(
   }
 #endif
 
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  if( !db->mallocFailed && rc==SQLITE_OK){
+    rc = sqlite3ProfileRegister(db);
+  }
+#endif
+
 #ifdef SQLITE_ENABLE_JSON1
   if( !db->mallocFailed && rc==SQLITE_OK){
     rc = sqlite3Json1Init(db);
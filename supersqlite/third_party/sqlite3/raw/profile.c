@@ -0,0 +1,703 @@
+/*
+** 2018-12-03
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This file contains an implementation of the "sqlite_profile" virtual
+** table, which reports where a connection spends its time on a
+** per-statement basis.
+**
+** Profiling is off until it is enabled for a connection.  While it is on,
+** every call to sqlite3_step() measures the wall-clock time spent inside
+** the VDBE, the number of VM steps, page cache hits and misses and the
+** number of rows returned.  Each sorter subtask also counts the bytes it
+** writes to temporary files.  When the statement is reset or finalized,
+** the counters for that run are added to an entry for its SQL text.
+** Statements that are prepared again with identical SQL text share an
+** entry.
+**
+** Usage example:
+**
+**    INSERT INTO sqlite_profile(sqlite_profile) VALUES('enable');
+**    ... run the workload ...
+**    SELECT sql, runs, elapsed_ns FROM sqlite_profile
+**     ORDER BY elapsed_ns DESC LIMIT 10;
+**
+** The commands 'enable', 'disable' and 'reset' may be inserted into the
+** hidden "sqlite_profile" column.  Disabling the profile stops collection
+** but keeps the figures collected so far.  DELETE removes entries.
+**
+** All counters belong to the connection, and the database connection
+** mutex already serializes calls to sqlite3_step().  Sorter worker threads
+** use counters in their own SortSubtask objects, which the main thread
+** reads after the workers have been joined.  No global state is updated,
+** so collection costs nothing when SQLITE_DEFAULT_MEMSTATUS is 0.
+**
+** The elapsed time, cache and sorter figures for a statement include any
+** work done by statements that it runs itself, such as those of
+** application-defined functions or virtual tables.  The vm_steps figure
+** does not.  The nested_runs column counts the runs of a statement that
+** were made from within another statement, so that totals may be taken
+** over statements with nested_runs=0 without counting anything twice.
+**
+** Once SQLITE_PROFILE_MAX_ENTRY distinct statements have been seen, runs
+** of any further statements are added to a single entry with a NULL sql
+** column.
+*/
+
+#include "sqliteInt.h"   /* Requires access to internal data structures */
+#include "vdbeInt.h"
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#ifndef SQLITE_PROFILE_MAX_ENTRY
+# define SQLITE_PROFILE_MAX_ENTRY 2000
+#endif
+
+/*
+** The per-connection profile.  Entries are kept both in a hash table keyed
+** by SQL text and in a list in the order they were created.
+**
+** iGen is incremented whenever entries are removed.  A Vdbe caches the
+** entry it last recorded a run in along with the value of iGen at the
+** time, so that it can tell when the cached pointer has gone stale.
+*/
+struct StmtProfile {
+  int nEntry;                     /* Number of entries, excluding pOverflow */
+  int nSlot;                      /* Size of the aSlot[] hash table */
+  StmtProfileEntry **aSlot;       /* Hash table of entries */
+  StmtProfileEntry *pFirst;       /* First entry in creation order */
+  StmtProfileEntry *pLast;        /* Last entry in creation order */
+  StmtProfileEntry *pOverflow;    /* Entry for statements beyond the limit */
+  i64 iNextId;                    /* Rowid to assign to the next entry */
+  u32 iGen;                       /* Incremented when entries are removed */
+};
+
+struct StmtProfileEntry {
+  StmtProfileEntry *pNext;        /* Next entry in creation order */
+  StmtProfileEntry *pHashNext;    /* Next entry in the same hash slot */
+  unsigned int h;                 /* Hash of zSql */
+  int nSql;                       /* Length of zSql in bytes */
+  char *zSql;                     /* SQL text, or NULL for pOverflow */
+  i64 iId;                        /* Rowid of this entry */
+  i64 nRun;                       /* Number of runs recorded */
+  i64 nNested;                    /* Runs nested within another statement */
+  i64 nMaxElapsed;                /* Longest single run, in nanoseconds */
+  i64 aCounter[PROFILE_N];        /* Sums of Vdbe.aProfile[] */
+};
+
+/*
+** Return the value of a monotonic clock in nanoseconds.
+*/
+static i64 profileClock(void){
+#if defined(_WIN32)
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (i64)((double)now.QuadPart * 1.0e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (i64)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+** Add the page cache hit and miss counts of all pagers used by db to
+** *pnHit and *pnMiss.
+*/
+static void profileCacheStat(sqlite3 *db, int *pnHit, int *pnMiss){
+  int i;
+  for(i=0; i<db->nDb; i++){
+    Btree *pBt = db->aDb[i].pBt;
+    if( pBt ){
+      Pager *pPager = sqlite3BtreePager(pBt);
+      sqlite3PagerCacheStat(pPager, SQLITE_DBSTATUS_CACHE_HIT, 0, pnHit);
+      sqlite3PagerCacheStat(pPager, SQLITE_DBSTATUS_CACHE_MISS, 0, pnMiss);
+    }
+  }
+}
+
+/*
+** Run sqlite3VdbeExec() on p and add the resources it used to the
+** counters for the current run of p.  This is called instead of
+** sqlite3VdbeExec() by sqlite3Step() while profiling is enabled.
+*/
+int sqlite3ProfileExec(Vdbe *p){
+  sqlite3 *db = p->db;
+  u32 nStep = p->aCounter[SQLITE_STMTSTATUS_VM_STEP];
+  i64 nSpill = db->nSorterSpill;
+  int nHit = 0, nMiss = 0;
+  int nHit2 = 0, nMiss2 = 0;
+  i64 iStart;
+  int rc;
+
+  profileCacheStat(db, &nHit, &nMiss);
+  iStart = profileClock();
+  rc = sqlite3VdbeExec(p);
+  p->aProfile[PROFILE_ELAPSED] += profileClock() - iStart;
+  profileCacheStat(db, &nHit2, &nMiss2);
+
+  /* The pager counters may be reset through sqlite3_db_status(), or may
+  ** belong to a database that was detached by the statement, so ignore
+  ** deltas that went backwards. */
+  if( nHit2>nHit ) p->aProfile[PROFILE_CACHE_HIT] += nHit2 - nHit;
+  if( nMiss2>nMiss ) p->aProfile[PROFILE_CACHE_MISS] += nMiss2 - nMiss;
+  p->aProfile[PROFILE_VM_STEP] +=
+      (u32)(p->aCounter[SQLITE_STMTSTATUS_VM_STEP] - nStep);
+  p->aProfile[PROFILE_SPILL] += db->nSorterSpill - nSpill;
+  if( rc==SQLITE_ROW ) p->aProfile[PROFILE_ROWS]++;
+  p->bProfileRun = 1;
+  if( db->nVdbeExec>1 ) p->bProfileNested = 1;
+  return rc;
+}
+
+/*
+** Hash the n bytes of SQL text at z.
+*/
+static unsigned int profileHash(const char *z, int n){
+  unsigned int h = 0;
+  int i;
+  for(i=0; i<n; i++){
+    h = (h<<3) ^ h ^ (unsigned char)z[i];
+  }
+  return h;
+}
+
+/*
+** Double the size of the hash table of pProfile.  If the allocation
+** fails, leave the hash table as it is.
+*/
+static void profileRehash(StmtProfile *pProfile){
+  int nNew = pProfile->nSlot ? pProfile->nSlot*2 : 64;
+  StmtProfileEntry **aNew;
+  StmtProfileEntry *pEntry;
+
+  aNew = (StmtProfileEntry**)sqlite3MallocZero(nNew*sizeof(aNew[0]));
+  if( aNew==0 ) return;
+  for(pEntry=pProfile->pFirst; pEntry; pEntry=pEntry->pNext){
+    StmtProfileEntry **pp = &aNew[pEntry->h & (nNew-1)];
+    pEntry->pHashNext = *pp;
+    *pp = pEntry;
+  }
+  sqlite3_free(pProfile->aSlot);
+  pProfile->aSlot = aNew;
+  pProfile->nSlot = nNew;
+}
+
+/*
+** Allocate a new entry for SQL text zSql, which is nSql bytes in size
+** and may be NULL.  Return NULL if the allocation fails.
+*/
+static StmtProfileEntry *profileNewEntry(
+  StmtProfile *pProfile,
+  const char *zSql,
+  int nSql
+){
+  StmtProfileEntry *pEntry;
+  pEntry = (StmtProfileEntry*)sqlite3MallocZero(sizeof(*pEntry) + nSql + 1);
+  if( pEntry ){
+    pEntry->iId = ++pProfile->iNextId;
+    if( zSql ){
+      pEntry->zSql = (char*)&pEntry[1];
+      pEntry->nSql = nSql;
+      memcpy(pEntry->zSql, zSql, nSql);
+    }
+  }
+  return pEntry;
+}
+
+/*
+** Return the entry for SQL text zSql, creating it if necessary.  Return
+** NULL if a new entry is required but cannot be allocated.
+*/
+static StmtProfileEntry *profileFindEntry(
+  StmtProfile *pProfile,
+  const char *zSql
+){
+  int nSql = sqlite3Strlen30(zSql);
+  unsigned int h = profileHash(zSql, nSql);
+  StmtProfileEntry *pEntry;
+
+  if( pProfile->nSlot ){
+    for(pEntry=pProfile->aSlot[h & (pProfile->nSlot-1)];
+        pEntry;
+        pEntry=pEntry->pHashNext
+    ){
+      if( pEntry->h==h && pEntry->nSql==nSql
+       && memcmp(pEntry->zSql, zSql, nSql)==0
+      ){
+        return pEntry;
+      }
+    }
+  }
+
+  if( pProfile->nEntry>=SQLITE_PROFILE_MAX_ENTRY ){
+    if( pProfile->pOverflow==0 ){
+      pProfile->pOverflow = profileNewEntry(pProfile, 0, 0);
+    }
+    return pProfile->pOverflow;
+  }
+
+  if( pProfile->nEntry>=pProfile->nSlot ){
+    profileRehash(pProfile);
+    if( pProfile->nSlot==0 ) return 0;
+  }
+  pEntry = profileNewEntry(pProfile, zSql, nSql);
+  if( pEntry ){
+    StmtProfileEntry **pp = &pProfile->aSlot[h & (pProfile->nSlot-1)];
+    pEntry->h = h;
+    pEntry->pHashNext = *pp;
+    *pp = pEntry;
+    if( pProfile->pLast ){
+      pProfile->pLast->pNext = pEntry;
+    }else{
+      pProfile->pFirst = pEntry;
+    }
+    pProfile->pLast = pEntry;
+    pProfile->nEntry++;
+  }
+  return pEntry;
+}
+
+/*
+** Add the counters for the run of p that has just finished to the entry
+** for its SQL text, then clear them.  This is called by sqlite3VdbeReset().
+*/
+void sqlite3ProfileRecord(Vdbe *p){
+  StmtProfile *pProfile = p->db->pStmtProfile;
+  StmtProfileEntry *pEntry = p->pProfileEntry;
+
+  assert( p->bProfileRun && p->zSql );
+  assert( pProfile );
+  if( pEntry==0 || p->iProfileGen!=pProfile->iGen ){
+    /* Memory allocation failures here lose a run of a statement but are
+    ** otherwise harmless. */
+    sqlite3BeginBenignMalloc();
+    pEntry = profileFindEntry(pProfile, p->zSql);
+    sqlite3EndBenignMalloc();
+    p->pProfileEntry = pEntry;
+    p->iProfileGen = pProfile->iGen;
+  }
+  if( pEntry ){
+    int i;
+    pEntry->nRun++;
+    pEntry->nNested += p->bProfileNested;
+    for(i=0; i<PROFILE_N; i++){
+      pEntry->aCounter[i] += p->aProfile[i];
+    }
+    if( p->aProfile[PROFILE_ELAPSED]>pEntry->nMaxElapsed ){
+      pEntry->nMaxElapsed = p->aProfile[PROFILE_ELAPSED];
+    }
+  }
+  memset(p->aProfile, 0, sizeof(p->aProfile));
+  p->bProfileRun = 0;
+  p->bProfileNested = 0;
+}
+
+/*
+** Remove the entry with rowid iId from the profile, or all entries if
+** iId is negative.
+*/
+static void profileRemove(StmtProfile *pProfile, i64 iId){
+  StmtProfileEntry **pp = &pProfile->pFirst;
+  StmtProfileEntry *pPrev = 0;
+
+  while( *pp ){
+    StmtProfileEntry *pEntry = *pp;
+    if( iId<0 || pEntry->iId==iId ){
+      StmtProfileEntry **ppHash;
+      ppHash = &pProfile->aSlot[pEntry->h & (pProfile->nSlot-1)];
+      while( *ppHash!=pEntry ) ppHash = &(*ppHash)->pHashNext;
+      *ppHash = pEntry->pHashNext;
+      *pp = pEntry->pNext;
+      pProfile->nEntry--;
+      sqlite3_free(pEntry);
+      if( iId>=0 ) break;
+    }else{
+      pPrev = pEntry;
+      pp = &pEntry->pNext;
+    }
+  }
+  if( *pp==0 ) pProfile->pLast = pPrev;
+  if( pProfile->pOverflow && (iId<0 || pProfile->pOverflow->iId==iId) ){
+    sqlite3_free(pProfile->pOverflow);
+    pProfile->pOverflow = 0;
+  }
+  pProfile->iGen++;
+}
+
+/*
+** Free the profile of connection db, if any.  This is called when the
+** connection is closed.
+*/
+void sqlite3ProfileFree(sqlite3 *db){
+  StmtProfile *pProfile = db->pStmtProfile;
+  if( pProfile ){
+    profileRemove(pProfile, -1);
+    sqlite3_free(pProfile->aSlot);
+    sqlite3_free(pProfile);
+    db->pStmtProfile = 0;
+  }
+  db->bStmtProfile = 0;
+}
+
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+typedef struct ProfileTable ProfileTable;
+typedef struct ProfileCursor ProfileCursor;
+typedef struct ProfileRow ProfileRow;
+
+/*
+** A copy of one entry, taken when a scan starts.  The copies allow the
+** profile to be modified, for example by a DELETE on this table, while
+** a cursor is open.
+*/
+struct ProfileRow {
+  i64 iId;                        /* Rowid */
+  i64 nRun;                       /* Number of runs recorded */
+  i64 nNested;                    /* Runs nested within another statement */
+  i64 nMaxElapsed;                /* Longest single run */
+  i64 aCounter[PROFILE_N];        /* Counters */
+  const char *zSql;               /* SQL text (points into the same buffer) */
+};
+
+struct ProfileCursor {
+  sqlite3_vtab_cursor base;       /* Base class.  Must be first */
+  ProfileRow *aRow;               /* Snapshot of the profile */
+  int nRow;                       /* Number of entries in aRow[] */
+  int iRow;                       /* Current entry */
+};
+
+struct ProfileTable {
+  sqlite3_vtab base;              /* Base class.  Must be first */
+  sqlite3 *db;                    /* The database */
+};
+
+/* Columns */
+#define PROFILE_COLUMN_SQL        0
+#define PROFILE_COLUMN_RUNS       1
+#define PROFILE_COLUMN_NESTED     2
+#define PROFILE_COLUMN_ROWS       3
+#define PROFILE_COLUMN_ELAPSED    4
+#define PROFILE_COLUMN_MAXELAPSED 5
+#define PROFILE_COLUMN_VMSTEP     6
+#define PROFILE_COLUMN_CACHEHIT   7
+#define PROFILE_COLUMN_CACHEMISS  8
+#define PROFILE_COLUMN_SPILL      9
+#define PROFILE_COLUMN_CMD        10
+
+/*
+** Connect to the sqlite_profile virtual table.
+*/
+static int profileConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  ProfileTable *pTab = 0;
+  int rc = SQLITE_OK;
+
+  rc = sqlite3_declare_vtab(db,
+      "CREATE TABLE x(sql TEXT, runs INTEGER, nested_runs INTEGER, "
+      "rows INTEGER, elapsed_ns INTEGER, max_elapsed_ns INTEGER, "
+      "vm_steps INTEGER, cache_hits INTEGER, cache_misses INTEGER, "
+      "sorter_spill_bytes INTEGER, sqlite_profile HIDDEN)"
+  );
+  if( rc==SQLITE_OK ){
+    pTab = (ProfileTable *)sqlite3_malloc64(sizeof(ProfileTable));
+    if( pTab==0 ) rc = SQLITE_NOMEM_BKPT;
+  }
+
+  assert( rc==SQLITE_OK || pTab==0 );
+  if( rc==SQLITE_OK ){
+    memset(pTab, 0, sizeof(ProfileTable));
+    pTab->db = db;
+  }
+
+  *ppVtab = (sqlite3_vtab*)pTab;
+  return rc;
+}
+
+/*
+** Disconnect from the sqlite_profile virtual table.
+*/
+static int profileDisconnect(sqlite3_vtab *pVtab){
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/*
+** Only full table scans are supported.
+*/
+static int profileBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo){
+  pIdxInfo->estimatedCost = (double)SQLITE_PROFILE_MAX_ENTRY;
+  pIdxInfo->estimatedRows = SQLITE_PROFILE_MAX_ENTRY;
+  return SQLITE_OK;
+}
+
+/*
+** Open a new sqlite_profile cursor.
+*/
+static int profileOpen(sqlite3_vtab *pVTab, sqlite3_vtab_cursor **ppCursor){
+  ProfileCursor *pCsr;
+
+  pCsr = (ProfileCursor *)sqlite3_malloc64(sizeof(ProfileCursor));
+  if( pCsr==0 ){
+    return SQLITE_NOMEM_BKPT;
+  }else{
+    memset(pCsr, 0, sizeof(ProfileCursor));
+    pCsr->base.pVtab = pVTab;
+  }
+
+  *ppCursor = (sqlite3_vtab_cursor *)pCsr;
+  return SQLITE_OK;
+}
+
+/*
+** Close a sqlite_profile cursor.
+*/
+static int profileClose(sqlite3_vtab_cursor *pCursor){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  sqlite3_free(pCsr->aRow);
+  sqlite3_free(pCsr);
+  return SQLITE_OK;
+}
+
+/*
+** Copy entry pEntry into pRow, and its SQL text to the buffer at *pz.
+*/
+static void profileCopyEntry(
+  ProfileRow *pRow,
+  StmtProfileEntry *pEntry,
+  char **pz
+){
+  pRow->iId = pEntry->iId;
+  pRow->nRun = pEntry->nRun;
+  pRow->nNested = pEntry->nNested;
+  pRow->nMaxElapsed = pEntry->nMaxElapsed;
+  memcpy(pRow->aCounter, pEntry->aCounter, sizeof(pRow->aCounter));
+  if( pEntry->zSql ){
+    pRow->zSql = *pz;
+    memcpy(*pz, pEntry->zSql, pEntry->nSql+1);
+    *pz += pEntry->nSql+1;
+  }else{
+    pRow->zSql = 0;
+  }
+}
+
+/*
+** Take a snapshot of the profile for the new scan.
+*/
+static int profileFilter(
+  sqlite3_vtab_cursor *pCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  StmtProfile *pProfile = ((ProfileTable *)pCursor->pVtab)->db->pStmtProfile;
+  StmtProfileEntry *pEntry;
+  sqlite3_int64 nByte = 0;
+  char *z;
+  int nRow = 0;
+
+  sqlite3_free(pCsr->aRow);
+  pCsr->aRow = 0;
+  pCsr->nRow = 0;
+  pCsr->iRow = 0;
+  if( pProfile==0 ) return SQLITE_OK;
+
+  for(pEntry=pProfile->pFirst; pEntry; pEntry=pEntry->pNext){
+    nByte += sizeof(ProfileRow) + pEntry->nSql + 1;
+  }
+  if( pProfile->pOverflow ) nByte += sizeof(ProfileRow);
+  if( nByte==0 ) return SQLITE_OK;
+
+  pCsr->aRow = (ProfileRow*)sqlite3_malloc64(nByte);
+  if( pCsr->aRow==0 ) return SQLITE_NOMEM_BKPT;
+  z = (char*)&pCsr->aRow[pProfile->nEntry + (pProfile->pOverflow!=0)];
+  for(pEntry=pProfile->pFirst; pEntry; pEntry=pEntry->pNext){
+    profileCopyEntry(&pCsr->aRow[nRow++], pEntry, &z);
+  }
+  if( pProfile->pOverflow ){
+    profileCopyEntry(&pCsr->aRow[nRow++], pProfile->pOverflow, &z);
+  }
+  pCsr->nRow = nRow;
+  return SQLITE_OK;
+}
+
+/*
+** Move a sqlite_profile cursor to the next entry.
+*/
+static int profileNext(sqlite3_vtab_cursor *pCursor){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  pCsr->iRow++;
+  return SQLITE_OK;
+}
+
+static int profileEof(sqlite3_vtab_cursor *pCursor){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  return pCsr->iRow>=pCsr->nRow;
+}
+
+static int profileColumn(
+  sqlite3_vtab_cursor *pCursor,
+  sqlite3_context *ctx,
+  int i
+){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  ProfileRow *pRow = &pCsr->aRow[pCsr->iRow];
+  switch( i ){
+    case PROFILE_COLUMN_SQL:
+      if( pRow->zSql ){
+        sqlite3_result_text(ctx, pRow->zSql, -1, SQLITE_TRANSIENT);
+      }
+      break;
+    case PROFILE_COLUMN_RUNS:
+      sqlite3_result_int64(ctx, pRow->nRun);
+      break;
+    case PROFILE_COLUMN_NESTED:
+      sqlite3_result_int64(ctx, pRow->nNested);
+      break;
+    case PROFILE_COLUMN_ROWS:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_ROWS]);
+      break;
+    case PROFILE_COLUMN_ELAPSED:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_ELAPSED]);
+      break;
+    case PROFILE_COLUMN_MAXELAPSED:
+      sqlite3_result_int64(ctx, pRow->nMaxElapsed);
+      break;
+    case PROFILE_COLUMN_VMSTEP:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_VM_STEP]);
+      break;
+    case PROFILE_COLUMN_CACHEHIT:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_CACHE_HIT]);
+      break;
+    case PROFILE_COLUMN_CACHEMISS:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_CACHE_MISS]);
+      break;
+    case PROFILE_COLUMN_SPILL:
+      sqlite3_result_int64(ctx, pRow->aCounter[PROFILE_SPILL]);
+      break;
+    default:
+      /* The hidden command column is always NULL */
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int profileRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid){
+  ProfileCursor *pCsr = (ProfileCursor *)pCursor;
+  *pRowid = pCsr->aRow[pCsr->iRow].iId;
+  return SQLITE_OK;
+}
+
+/*
+** Rows may be deleted, which discards the figures for those statements.
+** Inserting a row runs the command stored in its sqlite_profile column,
+** which must be one of:
+**
+**    'enable'      Start collecting statistics.
+**    'disable'     Stop collecting statistics, keeping those collected.
+**    'reset'       Discard all statistics collected so far.
+**
+** Rows may not be updated.
+*/
+static int profileUpdate(
+  sqlite3_vtab *pVtab,
+  int argc,
+  sqlite3_value **argv,
+  sqlite_int64 *pRowid
+){
+  sqlite3 *db = ((ProfileTable *)pVtab)->db;
+  const char *zCmd;
+  const char *zErr;
+
+  if( argc==1 ){
+    if( db->pStmtProfile ){
+      profileRemove(db->pStmtProfile, sqlite3_value_int64(argv[0]));
+    }
+    return SQLITE_OK;
+  }
+  if( sqlite3_value_type(argv[0])!=SQLITE_NULL ){
+    zErr = "cannot update sqlite_profile";
+    goto update_fail;
+  }
+
+  zCmd = (const char*)sqlite3_value_text(argv[2+PROFILE_COLUMN_CMD]);
+  if( zCmd==0 ){
+    zErr = "a command must be inserted into the sqlite_profile column";
+    goto update_fail;
+  }
+  if( sqlite3_stricmp(zCmd, "enable")==0 ){
+    if( db->pStmtProfile==0 ){
+      db->pStmtProfile = (StmtProfile*)sqlite3MallocZero(sizeof(StmtProfile));
+      if( db->pStmtProfile==0 ) return SQLITE_NOMEM_BKPT;
+    }
+    db->bStmtProfile = 1;
+  }else if( sqlite3_stricmp(zCmd, "disable")==0 ){
+    db->bStmtProfile = 0;
+  }else if( sqlite3_stricmp(zCmd, "reset")==0 ){
+    if( db->pStmtProfile ) profileRemove(db->pStmtProfile, -1);
+  }else{
+    zErr = "unknown sqlite_profile command";
+    goto update_fail;
+  }
+  return SQLITE_OK;
+
+update_fail:
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = sqlite3_mprintf("%s", zErr);
+  return SQLITE_ERROR;
+}
+
+/*
+** Invoke this routine to register the "sqlite_profile" virtual table module
+*/
+int sqlite3ProfileRegister(sqlite3 *db){
+  static sqlite3_module profile_module = {
+    0,                            /* iVersion */
+    0,                            /* xCreate - eponymous only */
+    profileConnect,               /* xConnect */
+    profileBestIndex,             /* xBestIndex */
+    profileDisconnect,            /* xDisconnect */
+    profileDisconnect,            /* xDestroy */
+    profileOpen,                  /* xOpen - open a cursor */
+    profileClose,                 /* xClose - close a cursor */
+    profileFilter,                /* xFilter - configure scan constraints */
+    profileNext,                  /* xNext - advance a cursor */
+    profileEof,                   /* xEof - check for end of scan */
+    profileColumn,                /* xColumn - read data */
+    profileRowid,                 /* xRowid - read data */
+    profileUpdate,                /* xUpdate */
+    0,                            /* xBegin */
+    0,                            /* xSync */
+    0,                            /* xCommit */
+    0,                            /* xRollback */
+    0,                            /* xFindMethod */
+    0,                            /* xRename */
+    0,                            /* xSavepoint */
+    0,                            /* xRelease */
+    0,                            /* xRollbackTo */
+  };
+  return sqlite3_create_module(db, "sqlite_profile", &profile_module, 0);
+}
+#else
+int sqlite3ProfileRegister(sqlite3 *db){ return SQLITE_OK; }
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+#endif /* SQLITE_ENABLE_PROFILE_VTAB */
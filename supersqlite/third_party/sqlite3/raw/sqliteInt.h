@@ -1095,6 +1095,7 @@ typedef struct Select Select;
 typedef struct SQLiteThread SQLiteThread;
 typedef struct SelectDest SelectDest;
 typedef struct SrcList SrcList;
+typedef struct StmtProfile StmtProfile;
 typedef struct sqlite3_str StrAccum; /* Internal alias for sqlite3_str */
 typedef struct Table Table;
 typedef struct TableLock TableLock;
@@ -1491,6 +1492,11 @@ struct sqlite3 {
 #ifdef SQLITE_USER_AUTHENTICATION
   sqlite3_userauth auth;        /* User authentication information */
 #endif
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  u8 bStmtProfile;              /* True to collect statement profiles */
+  i64 nSorterSpill;             /* Bytes written to sorter temp files */
+  StmtProfile *pStmtProfile;    /* Profiles reported by sqlite_profile */
+#endif
 };
 
 /*
@@ -4588,6 +4594,10 @@ int sqlite3DbpageRegister(sqlite3*);
 #if defined(SQLITE_ENABLE_DBSTAT_VTAB) || defined(SQLITE_TEST)
 int sqlite3DbstatRegister(sqlite3*);
 #endif
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+int sqlite3ProfileRegister(sqlite3*);
+void sqlite3ProfileFree(sqlite3*);
+#endif
 
 int sqlite3ExprVectorSize(Expr *pExpr);
 int sqlite3ExprIsVector(Expr *pExpr);
@@ -165,8 +165,15 @@ static int SQLITE_TCLAPI testAsyncControl(
   Tcl_Obj *CONST objv[]
 ){
   int rc = SQLITE_OK;
-  int aeOpt[] = { SQLITEASYNC_HALT, SQLITEASYNC_DELAY, SQLITEASYNC_LOCKFILES };
-  const char *azOpt[] = { "halt", "delay", "lockfiles", 0 };
+  int aeOpt[] = { 
+    SQLITEASYNC_HALT, SQLITEASYNC_DELAY, SQLITEASYNC_LOCKFILES,
+    SQLITEASYNC_GROUPCOMMIT, SQLITEASYNC_BATCHWINDOW, SQLITEASYNC_BATCHSIZE,
+    SQLITEASYNC_BATCHBYTES, SQLITEASYNC_QUEUEBYTES
+  };
+  const char *azOpt[] = { 
+    "halt", "delay", "lockfiles", "groupcommit", "batchwindow", "batchsize",
+    "batchbytes", "queuebytes", 0 
+  };
   const char *az[] = { "never", "now", "idle", 0 };
   int iVal;
   int eOpt;
@@ -192,12 +199,17 @@ static int SQLITE_TCLAPI testAsyncControl(
         break;
       }
       case SQLITEASYNC_DELAY:
+      case SQLITEASYNC_BATCHWINDOW:
+      case SQLITEASYNC_BATCHSIZE:
+      case SQLITEASYNC_BATCHBYTES:
+      case SQLITEASYNC_QUEUEBYTES:
         if( Tcl_GetIntFromObj(interp, objv[2], &iVal) ){
           return TCL_ERROR;
         }
         break;
 
       case SQLITEASYNC_LOCKFILES:
+      case SQLITEASYNC_GROUPCOMMIT:
         if( Tcl_GetBooleanFromObj(interp, objv[2], &iVal) ){
           return TCL_ERROR;
         }
@@ -208,10 +220,8 @@ static int SQLITE_TCLAPI testAsyncControl(
   }
 
   if( rc==SQLITE_OK ){
-    rc = sqlite3async_control(
-        eOpt==SQLITEASYNC_HALT ? SQLITEASYNC_GET_HALT :
-        eOpt==SQLITEASYNC_DELAY ? SQLITEASYNC_GET_DELAY :
-        SQLITEASYNC_GET_LOCKFILES, &iVal);
+    /* Each SQLITEASYNC_GET_XXX symbol is one greater than SQLITEASYNC_XXX */
+    rc = sqlite3async_control(eOpt+1, &iVal);
   }
 
   if( rc!=SQLITE_OK ){
@@ -228,6 +238,34 @@ static int SQLITE_TCLAPI testAsyncControl(
   return TCL_OK;
 }
 
+/*
+** sqlite3async_stats DB
+**
+** Register the sqlite3async_stats virtual table with database handle DB.
+*/
+static int SQLITE_TCLAPI testAsyncStats(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  extern int getDbPointer(Tcl_Interp*, const char*, sqlite3**);
+  sqlite3 *db;
+  int rc;
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  rc = sqlite3async_stats_register(db);
+  if( rc!=SQLITE_OK ){
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(sqlite3ErrName(rc), -1));
+    return TCL_ERROR;
+  }
+  return TCL_OK;
+}
+
 #endif  /* SQLITE_ENABLE_ASYNCIO */
 
 /*
@@ -243,6 +281,7 @@ int Sqlitetestasync_Init(Tcl_Interp *interp){
   Tcl_CreateObjCommand(interp,"sqlite3async_control",testAsyncControl,0,0);
   Tcl_CreateObjCommand(interp,"sqlite3async_initialize",testAsyncInit,0,0);
   Tcl_CreateObjCommand(interp,"sqlite3async_shutdown",testAsyncShutdown,0,0);
+  Tcl_CreateObjCommand(interp,"sqlite3async_stats",testAsyncStats,0,0);
 #endif  /* SQLITE_ENABLE_ASYNCIO */
   return TCL_OK;
 }
@@ -400,6 +400,7 @@ foreach file {
    sqlite3rbu.c
    dbstat.c
    dbpage.c
+   profile.c
    sqlite3session.c
    fts5.c
    stmt.c
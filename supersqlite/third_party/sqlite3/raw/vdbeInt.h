@@ -55,6 +55,9 @@ typedef struct VdbeSorter VdbeSorter;
 /* Elements of the linked list at Vdbe.pAuxData */
 typedef struct AuxData AuxData;
 
+/* Per-statement entry in the profile of a connection (see profile.c) */
+typedef struct StmtProfileEntry StmtProfileEntry;
+
 /* Types of VDBE cursors */
 #define CURTYPE_BTREE       0
 #define CURTYPE_SORTER      1
@@ -345,6 +348,17 @@ struct ScanStatus {
   char *zName;                    /* Name of table or index */
 };
 
+/*
+** Indexes for use with Vdbe.aProfile[]
+*/
+#define PROFILE_ROWS        0   /* Rows returned */
+#define PROFILE_ELAPSED     1   /* Nanoseconds spent in sqlite3VdbeExec() */
+#define PROFILE_VM_STEP     2   /* VM steps */
+#define PROFILE_CACHE_HIT   3   /* Page cache hits */
+#define PROFILE_CACHE_MISS  4   /* Page cache misses */
+#define PROFILE_SPILL       5   /* Bytes written to sorter temp files */
+#define PROFILE_N           6
+
 /*
 ** An instance of the virtual machine.  This structure contains the complete
 ** state of the virtual machine.
@@ -418,6 +432,13 @@ struct Vdbe {
   int nScan;              /* Entries in aScan[] */
   ScanStatus *aScan;      /* Scan definitions for sqlite3_stmt_scanstatus() */
 #endif
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  u8 bProfileRun;         /* True if aProfile[] holds data for this run */
+  u8 bProfileNested;      /* True if this run is nested in another stmt */
+  u32 iProfileGen;        /* StmtProfile.iGen when pProfileEntry was set */
+  StmtProfileEntry *pProfileEntry;  /* Entry that runs are recorded in */
+  i64 aProfile[PROFILE_N];          /* Counters for the current run */
+#endif
 };
 
 /*
@@ -531,6 +552,11 @@ int sqlite3VdbeSorterRewind(const VdbeCursor *, int *);
 int sqlite3VdbeSorterWrite(const VdbeCursor *, Mem *);
 int sqlite3VdbeSorterCompare(const VdbeCursor *, Mem *, int, int *);
 
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+int sqlite3ProfileExec(Vdbe*);
+void sqlite3ProfileRecord(Vdbe*);
+#endif
+
 #ifdef SQLITE_DEBUG
   void sqlite3VdbeIncrWriteCounter(Vdbe*, VdbeCursor*);
   void sqlite3VdbeAssertAbortable(Vdbe*);
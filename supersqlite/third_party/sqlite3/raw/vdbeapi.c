@@ -625,6 +625,11 @@ static int sqlite3Step(Vdbe *p){
 #endif /* SQLITE_OMIT_EXPLAIN */
   {
     db->nVdbeExec++;
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+    if( db->bStmtProfile && p->zSql && !db->init.busy ){
+      rc = sqlite3ProfileExec(p);
+    }else
+#endif
     rc = sqlite3VdbeExec(p);
     db->nVdbeExec--;
   }
@@ -3000,7 +3000,13 @@ int sqlite3VdbeReset(Vdbe *p){
 #endif
 
   sqlite3 *db;
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  i64 nSpill;
+#endif
   db = p->db;
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  nSpill = db->nSorterSpill;
+#endif
 
   /* If the VM did not run to completion or if it encountered an
   ** error, then it might not have been halted properly.  So halt
@@ -3076,6 +3082,14 @@ int sqlite3VdbeReset(Vdbe *p){
       fclose(out);
     }
   }
+#endif
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  /* Sorters closed by sqlite3VdbeHalt() above may only now have added
+  ** the bytes they spilled to db->nSorterSpill. */
+  if( p->bProfileRun ){
+    p->aProfile[PROFILE_SPILL] += db->nSorterSpill - nSpill;
+    sqlite3ProfileRecord(p);
+  }
 #endif
   p->magic = VDBE_MAGIC_RESET;
   return p->rc & db->errMask;
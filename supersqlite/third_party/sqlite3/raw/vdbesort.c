@@ -134,6 +134,35 @@
 ** one background thread for each temporary file on disk, and one background
 ** thread to merge the output of each of the others to a single PMA for
 ** the main thread to read from.
+**
+** Range merge:
+**
+** The incremental merge described above spreads the work of building
+** level-1 PMAs across threads, but the final merge that feeds the VDBE is
+** always performed by a single thread. For large sorts (e.g. CREATE INDEX)
+** that final merge dominates. So, if running in multi-threaded mode, the
+** sorter samples one key from roughly every SORTER_SAMPLE_SZ bytes of each
+** level-0 PMA as it is written. At Rewind() time, provided there are no
+** more than SORTER_MAX_RANGE_PMA PMAs and each temporary file can be memory
+** mapped, the samples are sorted and used to split the key space into
+** nTask disjoint ranges of roughly equal size. A background thread for
+** each range but the first merges the keys in its range from all level-0
+** PMAs into its own output file. The main thread merges the keys in the
+** first range itself and returns them directly, so that it may begin
+** returning keys while the other ranges are still being merged, and then
+** reads the output files one after another, in range order.
+**
+** The range merge is silently not used, and the sorter falls back to the
+** tree of IncrMerger objects described above, in which the final merge is
+** performed by a single thread, if either:
+**
+**   * there are more than SORTER_MAX_RANGE_PMA (1024) level-0 PMAs, as the
+**     MergeEngine of each range reads from all of them at once, or
+**
+**   * any temporary file is larger than sqlite3.nMaxSorterMmap (2GiB by
+**     default, see SQLITE_TESTCTRL_SORTER_MMAP) or cannot be memory mapped
+**     by the VFS, as the range merge threads read the level-0 PMAs through
+**     memory mappings.
 */
 #include "sqliteInt.h"
 #include "vdbeInt.h"
@@ -165,6 +194,8 @@ typedef struct SortSubtask SortSubtask;     /* A sub-task in the sort process */
 typedef struct SorterFile SorterFile;       /* Temporary file object wrapper */
 typedef struct SorterList SorterList;       /* In-memory list of records */
 typedef struct IncrMerger IncrMerger;       /* Read & merge multiple PMAs */
+typedef struct SorterSample SorterSample;   /* Key sampled from a PMA */
+typedef struct SorterRange SorterRange;     /* Key range merged by one task */
 
 /*
 ** A container for a temp file handle and the current amount of data 
@@ -302,8 +333,26 @@ struct SortSubtask {
   SorterCompare xCompare;         /* Compare function to use */
   SorterFile file;                /* Temp file for level-0 PMAs */
   SorterFile file2;               /* Space for other PMAs */
+  int nSample;                    /* Number of entries in aSample[] */
+  int nSampleAlloc;               /* Allocated size of aSample[] */
+  SorterSample *aSample;          /* Keys sampled from level-0 PMAs */
+  u8 *aFileMap;                   /* Mapping of file used by range merge */
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  i64 nSpill;                     /* Bytes written to temp files by this task */
+#endif
 };
 
+/*
+** Add nByte bytes written to a temp file to the total for task pTask.
+** Each task is only used by one thread at a time, so no locking is
+** required.
+*/
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+# define vdbeSorterCountSpill(pTask, nByte) ((pTask)->nSpill += (nByte))
+#else
+# define vdbeSorterCountSpill(pTask, nByte)
+#endif
+
 
 /*
 ** Main sorter structure. A single instance of this is allocated for each 
@@ -320,7 +369,9 @@ struct VdbeSorter {
   int mxKeysize;                  /* Largest serialized key seen so far */
   int pgsz;                       /* Main database page size */
   PmaReader *pReader;             /* Readr data from here after Rewind() */
-  MergeEngine *pMerger;           /* Or here, if bUseThreads==0 */
+  MergeEngine *pMerger;           /* Or here, if bUseThreads==0 or if the
+                                  ** first range of a range merge is being
+                                  ** read */
   sqlite3 *db;                    /* Database connection */
   KeyInfo *pKeyInfo;              /* How to compare records */
   UnpackedRecord *pUnpacked;      /* Used by VdbeSorterCompare() */
@@ -332,6 +383,9 @@ struct VdbeSorter {
   u8 iPrev;                       /* Previous thread used to flush PMA */
   u8 nTask;                       /* Size of aTask[] array */
   u8 typeMask;
+  int nRange;                     /* Size of aRange[], or 0 if not in use */
+  int iRange;                     /* Index of range pReader is reading */
+  SorterRange *aRange;            /* Key ranges for a range merge */
   SortSubtask aTask[1];           /* One or more subtasks */
 };
 
@@ -359,6 +413,7 @@ struct PmaReader {
   int nBuffer;                /* Size of read buffer in bytes */
   u8 *aMap;                   /* Pointer to mapping of entire file */
   IncrMerger *pIncr;          /* Incremental merger */
+  int bMapRef;                /* True if aMap is owned by a SortSubtask */
 };
 
 /*
@@ -456,9 +511,39 @@ struct SorterRecord {
 #define SRVAL(p) ((void*)((SorterRecord*)(p) + 1))
 
 
+/*
+** A key sampled from a level-0 PMA by vdbeSorterListToPMA(). The samples
+** belonging to a SortSubtask are stored in order of offset, so that the
+** samples for each PMA are contiguous and sorted by key.
+*/
+struct SorterSample {
+  i64 iOff;                       /* Offset of sampled record in file */
+  SorterRecord *pRec;             /* Copy of the sampled key */
+};
+
+/*
+** One of the key ranges merged in parallel by a range merge. The range
+** contains all keys K such that (pLo<=K && K<pHi). A NULL pLo or pHi
+** means the range is unbounded in that direction. The merged keys are
+** written to pTask->file2, in the same format as the output of an
+** IncrMerger.
+*/
+struct SorterRange {
+  SortSubtask *pTask;             /* Task that merges this range */
+  SorterRecord *pLo;              /* Smallest key in range, or NULL */
+  SorterRecord *pHi;              /* First key after range, or NULL */
+};
+
 /* Maximum number of PMAs that a single MergeEngine can merge */
 #define SORTER_MAX_MERGE_COUNT 16
 
+/* Maximum number of level-0 PMAs for which a range merge is attempted.
+** The MergeEngine used by each range reads from all of them at once. */
+#define SORTER_MAX_RANGE_PMA 1024
+
+/* Approximate number of bytes of PMA data between sampled keys */
+#define SORTER_SAMPLE_SZ (64*1024)
+
 static int vdbeIncrSwap(IncrMerger*);
 static void vdbeIncrFree(IncrMerger *);
 
@@ -469,7 +554,9 @@ static void vdbeIncrFree(IncrMerger *);
 static void vdbePmaReaderClear(PmaReader *pReadr){
   sqlite3_free(pReadr->aAlloc);
   sqlite3_free(pReadr->aBuffer);
-  if( pReadr->aMap ) sqlite3OsUnfetch(pReadr->pFd, 0, pReadr->aMap);
+  if( pReadr->aMap && pReadr->bMapRef==0 ){
+    sqlite3OsUnfetch(pReadr->pFd, 0, pReadr->aMap);
+  }
   vdbeIncrFree(pReadr->pIncr);
   memset(pReadr, 0, sizeof(PmaReader));
 }
@@ -1038,6 +1125,7 @@ static void vdbeSorterRecordFree(sqlite3 *db, SorterRecord *pRecord){
 ** fields of *pTask are zeroed before returning.
 */
 static void vdbeSortSubtaskCleanup(sqlite3 *db, SortSubtask *pTask){
+  int i;
   sqlite3DbFree(db, pTask->pUnpacked);
 #if SQLITE_MAX_WORKER_THREADS>0
   /* pTask->list.aMemory can only be non-zero if it was handed memory
@@ -1050,12 +1138,22 @@ static void vdbeSortSubtaskCleanup(sqlite3 *db, SortSubtask *pTask){
     assert( pTask->list.aMemory==0 );
     vdbeSorterRecordFree(0, pTask->list.pList);
   }
+  for(i=0; i<pTask->nSample; i++){
+    sqlite3_free(pTask->aSample[i].pRec);
+  }
+  sqlite3_free(pTask->aSample);
+  if( pTask->aFileMap ){
+    sqlite3OsUnfetch(pTask->file.pFd, 0, pTask->aFileMap);
+  }
   if( pTask->file.pFd ){
     sqlite3OsCloseFree(pTask->file.pFd);
   }
   if( pTask->file2.pFd ){
     sqlite3OsCloseFree(pTask->file2.pFd);
   }
+#ifdef SQLITE_ENABLE_PROFILE_VTAB
+  db->nSorterSpill += pTask->nSpill;
+#endif
   memset(pTask, 0, sizeof(SortSubtask));
 }
 
@@ -1164,14 +1262,16 @@ static int vdbeSorterJoinAll(VdbeSorter *pSorter, int rcin){
 ** nReader PmaReader inputs.
 **
 ** nReader is automatically rounded up to the next power of two.
-** nReader may not exceed SORTER_MAX_MERGE_COUNT even after rounding up.
+** nReader may not exceed SORTER_MAX_MERGE_COUNT even after rounding up,
+** except for the MergeEngine objects used by a range merge, which may
+** read from up to SORTER_MAX_RANGE_PMA PMAs.
 */
 static MergeEngine *vdbeMergeEngineNew(int nReader){
   int N = 2;                      /* Smallest power of two >= nReader */
   int nByte;                      /* Total bytes of space to allocate */
   MergeEngine *pNew;              /* Pointer to allocated object to return */
 
-  assert( nReader<=SORTER_MAX_MERGE_COUNT );
+  assert( nReader<=MAX(SORTER_MAX_MERGE_COUNT, SORTER_MAX_RANGE_PMA) );
 
   while( N<nReader ) N += N;
   nByte = sizeof(MergeEngine) + N * (sizeof(int) + sizeof(PmaReader));
@@ -1233,6 +1333,10 @@ void sqlite3VdbeSorterReset(sqlite3 *db, VdbeSorter *pSorter){
 #endif
   vdbeMergeEngineFree(pSorter->pMerger);
   pSorter->pMerger = 0;
+  sqlite3DbFree(db, pSorter->aRange);
+  pSorter->aRange = 0;
+  pSorter->nRange = 0;
+  pSorter->iRange = 0;
   for(i=0; i<pSorter->nTask; i++){
     SortSubtask *pTask = &pSorter->aTask[i];
     vdbeSortSubtaskCleanup(db, pTask);
@@ -1528,6 +1632,33 @@ static void vdbePmaWriteVarint(PmaWriter *p, u64 iVal){
   vdbePmaWriteBlob(p, aByte, nByte);
 }
 
+/*
+** Append a copy of record p, which is about to be written to pTask->file
+** at offset iOff, to the pTask->aSample[] array. Return SQLITE_OK if
+** successful, or SQLITE_NOMEM if an OOM error is encountered.
+*/
+static int vdbeSorterAddSample(SortSubtask *pTask, i64 iOff, SorterRecord *p){
+  SorterRecord *pCopy;
+  if( pTask->nSample>=pTask->nSampleAlloc ){
+    int nNew = pTask->nSampleAlloc ? pTask->nSampleAlloc*2 : 64;
+    SorterSample *aNew = (SorterSample*)sqlite3_realloc64(
+        pTask->aSample, nNew*sizeof(SorterSample)
+    );
+    if( aNew==0 ) return SQLITE_NOMEM_BKPT;
+    pTask->aSample = aNew;
+    pTask->nSampleAlloc = nNew;
+  }
+  pCopy = (SorterRecord*)sqlite3_malloc64(sizeof(SorterRecord) + p->nVal);
+  if( pCopy==0 ) return SQLITE_NOMEM_BKPT;
+  pCopy->nVal = p->nVal;
+  pCopy->u.pNext = 0;
+  memcpy(SRVAL(pCopy), SRVAL(p), p->nVal);
+  pTask->aSample[pTask->nSample].iOff = iOff;
+  pTask->aSample[pTask->nSample].pRec = pCopy;
+  pTask->nSample++;
+  return SQLITE_OK;
+}
+
 /*
 ** Write the current contents of in-memory linked-list pList to a level-0
 ** PMA in the temp file belonging to sub-task pTask. Return SQLITE_OK if 
@@ -1578,19 +1709,35 @@ static int vdbeSorterListToPMA(SortSubtask *pTask, SorterList *pList){
   if( rc==SQLITE_OK ){
     SorterRecord *p;
     SorterRecord *pNext = 0;
+    int rcSample = SQLITE_OK;     /* Result of sampling keys */
+    i64 iSample;                  /* Sample the first key at or after this */
 
     vdbePmaWriterInit(pTask->file.pFd, &writer, pTask->pSorter->pgsz,
                       pTask->file.iEof);
     pTask->nPMA++;
     vdbePmaWriteVarint(&writer, pList->szPMA);
+
+    /* In multi-threaded mode, sample keys for a possible range merge. The
+    ** first key of each PMA is not sampled, as a range merge can always
+    ** start reading from the start of a PMA.  */
+    iSample = pTask->pSorter->bUseThreads ?
+        pTask->file.iEof + SORTER_SAMPLE_SZ : LARGEST_INT64;
     for(p=pList->pList; p; p=pNext){
       pNext = p->u.pNext;
+      if( writer.iWriteOff+writer.iBufEnd>=iSample && rcSample==SQLITE_OK ){
+        i64 iOff = writer.iWriteOff + writer.iBufEnd;
+        rcSample = vdbeSorterAddSample(pTask, iOff, p);
+        iSample = iOff + SORTER_SAMPLE_SZ;
+      }
       vdbePmaWriteVarint(&writer, p->nVal);
       vdbePmaWriteBlob(&writer, SRVAL(p), p->nVal);
       if( pList->aMemory==0 ) sqlite3_free(p);
     }
     pList->pList = p;
     rc = vdbePmaWriterFinish(&writer, &pTask->file.iEof);
+    vdbeSorterCountSpill(pTask,
+        pList->szPMA + sqlite3VarintLen(pList->szPMA));
+    if( rc==SQLITE_OK ) rc = rcSample;
   }
 
   vdbeSorterWorkDebug(pTask, "exit");
@@ -1898,6 +2045,7 @@ static int vdbeIncrPopulate(IncrMerger *pIncr){
   }
 
   rc2 = vdbePmaWriterFinish(&writer, &pOut->iEof);
+  vdbeSorterCountSpill(pTask, pOut->iEof - iStart);
   if( rc==SQLITE_OK ) rc = rc2;
   vdbeSorterPopulateDebug(pTask, "exit");
   return rc;
@@ -2477,6 +2625,331 @@ static int vdbeSorterMergeTreeBuild(
   return rc;
 }
 
+#if SQLITE_MAX_WORKER_THREADS>0
+/*
+** Set *piOff to the offset of the first record between offsets iStart and
+** iEof-1 of a PMA in pSrc->file with a key greater than or equal to pKey,
+** or to iEof if there is no such record. iStart must be the offset of
+** a record (or of the end of the PMA). The nSample entries of array
+** aSample[] are the keys sampled from the PMA. They are used to skip most
+** of the records that precede the one being sought.
+**
+** Comparisons are made using the UnpackedRecord belonging to pTask, which
+** may or may not be the same object as pSrc.
+*/
+static int vdbeSorterRangeSeek(
+  SortSubtask *pTask,             /* Task context (for comparisons) */
+  SortSubtask *pSrc,              /* Task whose file contains the PMA */
+  i64 iStart,                     /* Offset to begin searching at */
+  i64 iEof,                       /* Offset immediately following PMA */
+  SorterSample *aSample,          /* Keys sampled from the PMA */
+  int nSample,                    /* Size of aSample[] */
+  SorterRecord *pKey,             /* Key to seek to */
+  i64 *piOff                      /* OUT: Offset of first record >= pKey */
+){
+  const u8 *aMap = pSrc->aFileMap;
+  int bCached = 0;
+  int iLo = 0;
+  int iHi = nSample;
+  i64 iOff;
+
+  /* Find the last sampled key that is smaller than pKey. Reading starts
+  ** there, as all records before it are also smaller than pKey. It is not
+  ** safe to start from a sample equal to pKey, as the records immediately
+  ** preceding it may be equal to pKey as well.  */
+  while( iLo<iHi ){
+    int iMid = (iLo + iHi) / 2;
+    SorterRecord *p = aSample[iMid].pRec;
+    int res = pTask->xCompare(
+        pTask, &bCached, SRVAL(p), p->nVal, SRVAL(pKey), pKey->nVal
+    );
+    if( res<0 ){
+      iLo = iMid+1;
+    }else{
+      iHi = iMid;
+    }
+  }
+  iOff = iStart;
+  if( iLo>0 && aSample[iLo-1].iOff>iStart ) iOff = aSample[iLo-1].iOff;
+
+  while( iOff<iEof ){
+    u64 nKey;
+    int nVarint = sqlite3GetVarint(&aMap[iOff], &nKey);
+    int res = pTask->xCompare(pTask, &bCached,
+        &aMap[iOff+nVarint], (int)nKey, SRVAL(pKey), pKey->nVal
+    );
+    if( res>=0 ) break;
+    iOff += nVarint + nKey;
+  }
+
+  *piOff = iOff;
+  return pTask->pUnpacked->errCode;
+}
+
+/*
+** Allocate and initialize a MergeEngine that merges the keys that fall
+** within range pRange from all level-0 PMAs, and set *ppOut to point to
+** it. This function may be called either by the main thread or by a
+** background thread. Either way, it only reads the level-0 PMAs via the
+** mappings established by vdbeSorterSetupRange().
+*/
+static int vdbeSorterRangeMergerNew(SorterRange *pRange, MergeEngine **ppOut){
+  SortSubtask *pTask = pRange->pTask;
+  VdbeSorter *pSorter = pTask->pSorter;
+  MergeEngine *pMerger = 0;
+  int nPMA = 0;
+  int iReadr = 0;
+  int i;
+  int rc;
+
+  for(i=0; i<pSorter->nTask; i++){
+    nPMA += pSorter->aTask[i].nPMA;
+  }
+  rc = vdbeSortAllocUnpacked(pTask);
+  if( rc==SQLITE_OK ){
+    pMerger = vdbeMergeEngineNew(nPMA);
+    if( pMerger==0 ) rc = SQLITE_NOMEM_BKPT;
+  }
+
+  /* Point one PmaReader at the part of each level-0 PMA that falls
+  ** within the range.  */
+  for(i=0; rc==SQLITE_OK && i<pSorter->nTask; i++){
+    SortSubtask *pSrc = &pSorter->aTask[i];
+    int iSample = 0;
+    int iPMA;
+    i64 iOff = 0;
+    for(iPMA=0; rc==SQLITE_OK && iPMA<pSrc->nPMA; iPMA++){
+      PmaReader *pReadr = &pMerger->aReadr[iReadr++];
+      SorterSample *aSample = &pSrc->aSample[iSample];
+      int nSample = 0;
+      u64 nByte;
+      i64 iStart;
+      i64 iEof;
+      i64 iLo;
+      i64 iHi;
+
+      iStart = iOff + sqlite3GetVarint(&pSrc->aFileMap[iOff], &nByte);
+      iEof = iStart + nByte;
+      while( iSample+nSample<pSrc->nSample && aSample[nSample].iOff<iEof ){
+        nSample++;
+      }
+      iSample += nSample;
+      iOff = iEof;
+
+      iLo = iStart;
+      iHi = iEof;
+      if( pRange->pLo ){
+        rc = vdbeSorterRangeSeek(pTask, pSrc, iStart, iEof,
+            aSample, nSample, pRange->pLo, &iLo
+        );
+      }
+      if( rc==SQLITE_OK && pRange->pHi ){
+        rc = vdbeSorterRangeSeek(pTask, pSrc, iLo, iEof,
+            aSample, nSample, pRange->pHi, &iHi
+        );
+      }
+      if( rc==SQLITE_OK ){
+        pReadr->pFd = pSrc->file.pFd;
+        pReadr->aMap = pSrc->aFileMap;
+        pReadr->bMapRef = 1;
+        pReadr->iReadOff = iLo;
+        pReadr->iEof = iHi;
+        rc = vdbePmaReaderNext(pReadr);
+      }
+    }
+  }
+  if( rc==SQLITE_OK ){
+    rc = vdbeMergeEngineInit(pTask, pMerger, INCRINIT_NORMAL);
+  }
+  if( rc!=SQLITE_OK ){
+    vdbeMergeEngineFree(pMerger);
+    pMerger = 0;
+  }
+  *ppOut = pMerger;
+  return rc;
+}
+
+/*
+** Merge the keys that fall within range pRange from all level-0 PMAs and
+** write them to pRange->pTask->file2.
+*/
+static int vdbeSorterRangeMerge(SorterRange *pRange){
+  SortSubtask *pTask = pRange->pTask;
+  VdbeSorter *pSorter = pTask->pSorter;
+  MergeEngine *pMerger = 0;
+  int rc;
+
+  rc = vdbeSorterRangeMergerNew(pRange, &pMerger);
+  if( rc==SQLITE_OK && pTask->file2.pFd==0 ){
+    rc = vdbeSorterOpenTempFile(pSorter->db, 0, &pTask->file2.pFd);
+  }
+
+  /* Write the merged keys to pTask->file2 */
+  if( rc==SQLITE_OK ){
+    PmaWriter writer;
+    int rc2;
+    vdbePmaWriterInit(pTask->file2.pFd, &writer, pSorter->pgsz, 0);
+    while( rc==SQLITE_OK ){
+      int bEof;
+      PmaReader *pReadr = &pMerger->aReadr[ pMerger->aTree[1] ];
+      if( pReadr->pFd==0 ) break;
+      vdbePmaWriteVarint(&writer, pReadr->nKey);
+      vdbePmaWriteBlob(&writer, pReadr->aKey, pReadr->nKey);
+      rc = vdbeMergeEngineStep(pMerger, &bEof);
+    }
+    rc2 = vdbePmaWriterFinish(&writer, &pTask->file2.iEof);
+    vdbeSorterCountSpill(pTask, pTask->file2.iEof);
+    if( rc==SQLITE_OK ) rc = rc2;
+  }
+
+  vdbeMergeEngineFree(pMerger);
+  return rc;
+}
+
+/*
+** The main routine for background threads that merge a key range.
+*/
+static void *vdbeSorterRangeThread(void *pCtx){
+  SorterRange *pRange = (SorterRange*)pCtx;
+  int rc;                         /* Return code */
+  assert( pRange->pTask->bDone==0 );
+  rc = vdbeSorterRangeMerge(pRange);
+  pRange->pTask->bDone = 1;
+  return SQLITE_INT_TO_PTR(rc);
+}
+
+/*
+** If the range merge is in use and both the MergeEngine for the first
+** range (pSorter->pMerger) and PmaReader pSorter->pReader are at EOF,
+** free the MergeEngine and advance pSorter->pReader to the first key of
+** the next non-empty range, blocking until that range has been merged if
+** necessary. If there are no further keys, pSorter->pReader is left at
+** EOF. SQLITE_OK is returned if successful, or an SQLite error code
+** otherwise.
+*/
+static int vdbeSorterRangeNext(VdbeSorter *pSorter){
+  PmaReader *pReadr = pSorter->pReader;
+  int rc = SQLITE_OK;
+  if( pSorter->pMerger ){
+    MergeEngine *pMerger = pSorter->pMerger;
+    if( pMerger->aReadr[pMerger->aTree[1]].pFd ) return SQLITE_OK;
+    vdbeMergeEngineFree(pMerger);
+    pSorter->pMerger = 0;
+  }
+  while( rc==SQLITE_OK && pReadr->pFd==0 ){
+    SortSubtask *pTask;
+    if( pSorter->iRange>=pSorter->nRange-1 ) break;
+    pTask = pSorter->aRange[++pSorter->iRange].pTask;
+    rc = vdbeSorterJoinThread(pTask);
+    if( rc==SQLITE_OK && pTask->file2.iEof>0 ){
+      rc = vdbePmaReaderSeek(pTask, pReadr, &pTask->file2, 0);
+      if( rc==SQLITE_OK ) rc = vdbePmaReaderNext(pReadr);
+    }
+  }
+  return rc;
+}
+
+/*
+** This function is called by vdbeSorterSetupMerge() for multi-threaded
+** sorters. If the level-0 PMAs are suitable for a range merge (see the
+** comment at the head of this file), then it divides the key space into
+** ranges, starts a background thread to merge each range except the
+** first, and sets up pSorter->pMerger to merge the first range using the
+** calling thread. VdbeSorter.nRange is set to the number of ranges in this
+** case. pSorter->pReader is used once the first range has been read.
+**
+** Otherwise, nRange is left set to zero and the caller should set up
+** the usual tree of IncrMerger objects instead.
+**
+** SQLITE_OK is returned if successful, or an SQLite error code otherwise.
+*/
+static int vdbeSorterSetupRange(VdbeSorter *pSorter){
+  sqlite3 *db = pSorter->db;
+  SortSubtask *pLast = &pSorter->aTask[pSorter->nTask-1];
+  int nRange = pSorter->nTask;
+  int nPMA = 0;
+  int nSample = 0;
+  int rc = SQLITE_OK;
+  int i;
+  SorterList list;
+
+  assert( pSorter->bUseThreads && pSorter->nRange==0 );
+  for(i=0; i<pSorter->nTask; i++){
+    nPMA += pSorter->aTask[i].nPMA;
+    nSample += pSorter->aTask[i].nSample;
+  }
+  if( nPMA<2 || nPMA>SORTER_MAX_RANGE_PMA || nSample<nRange ){
+    return SQLITE_OK;
+  }
+
+  /* The range merge threads read the level-0 PMAs of all tasks, so each
+  ** file must be mapped into memory. If any cannot be, for example because
+  ** it is larger than sqlite3.nMaxSorterMmap, do not use the range merge.
+  ** The caller then merges the PMAs using the usual tree of IncrMergers,
+  ** the root of which is merged by a single thread.  */
+  for(i=0; i<pSorter->nTask; i++){
+    SortSubtask *pTask = &pSorter->aTask[i];
+    if( pTask->nPMA>0 && pTask->aFileMap==0 ){
+      rc = vdbeSorterMapFile(pTask, &pTask->file, &pTask->aFileMap);
+      if( rc!=SQLITE_OK ) return rc;
+      if( pTask->aFileMap==0 ) return SQLITE_OK;
+    }
+  }
+
+  /* Sort all samples. Then use every (nSample/nRange)'th sample as the
+  ** boundary between a pair of adjacent ranges.  */
+  memset(&list, 0, sizeof(SorterList));
+  for(i=0; i<pSorter->nTask; i++){
+    SortSubtask *pTask = &pSorter->aTask[i];
+    int j;
+    for(j=0; j<pTask->nSample; j++){
+      pTask->aSample[j].pRec->u.pNext = list.pList;
+      list.pList = pTask->aSample[j].pRec;
+    }
+  }
+  rc = vdbeSorterSort(pLast, &list);
+  if( rc==SQLITE_OK ){
+    pSorter->aRange = (SorterRange*)sqlite3DbMallocZero(db,
+        nRange * sizeof(SorterRange)
+    );
+    pSorter->pReader = (PmaReader*)sqlite3DbMallocZero(db, sizeof(PmaReader));
+    if( pSorter->aRange==0 || pSorter->pReader==0 ) rc = SQLITE_NOMEM_BKPT;
+  }
+  if( rc==SQLITE_OK ){
+    SorterRange *aRange = pSorter->aRange;
+    SorterRecord *p = list.pList;
+    int iRange = 1;
+    for(i=0; p && iRange<nRange; i++, p=p->u.pNext){
+      if( i==(int)(((i64)iRange * nSample) / nRange) ){
+        aRange[iRange-1].pHi = p;
+        aRange[iRange].pLo = p;
+        iRange++;
+      }
+    }
+
+    /* The first range is merged by the main thread, using the final
+    ** task object. The others each use one of the remaining tasks.  */
+    for(i=0; i<nRange; i++){
+      aRange[i].pTask = &pSorter->aTask[(i + nRange - 1) % nRange];
+    }
+    pSorter->nRange = nRange;
+    pSorter->iRange = 0;
+    for(i=nRange-1; rc==SQLITE_OK && i>0; i--){
+      void *pCtx = (void*)&aRange[i];
+      rc = vdbeSorterCreateThread(aRange[i].pTask, vdbeSorterRangeThread,pCtx);
+    }
+    if( rc==SQLITE_OK ){
+      assert( aRange[0].pTask==pLast );
+      rc = vdbeSorterRangeMergerNew(&aRange[0], &pSorter->pMerger);
+    }
+    if( rc==SQLITE_OK ){
+      rc = vdbeSorterRangeNext(pSorter);
+    }
+  }
+  return rc;
+}
+#endif /* SQLITE_MAX_WORKER_THREADS>0 */
+
 /*
 ** This function is called as part of an sqlite3VdbeSorterRewind() operation
 ** on a sorter that has written two or more PMAs to temporary files. It sets
@@ -2497,6 +2970,10 @@ static int vdbeSorterSetupMerge(VdbeSorter *pSorter){
   for(i=0; i<pSorter->nTask; i++){
     pSorter->aTask[i].xCompare = xCompare;
   }
+  if( pSorter->bUseThreads ){
+    rc = vdbeSorterSetupRange(pSorter);
+    if( rc!=SQLITE_OK || pSorter->nRange>0 ) return rc;
+  }
 #endif
 
   rc = vdbeSorterMergeTreeBuild(pSorter, &pMain);
@@ -2628,13 +3105,23 @@ int sqlite3VdbeSorterNext(sqlite3 *db, const VdbeCursor *pCsr){
   pSorter = pCsr->uc.pSorter;
   assert( pSorter->bUsePMA || (pSorter->pReader==0 && pSorter->pMerger==0) );
   if( pSorter->bUsePMA ){
-    assert( pSorter->pReader==0 || pSorter->pMerger==0 );
+    assert( pSorter->pReader==0 || pSorter->pMerger==0 || pSorter->nRange>0 );
     assert( pSorter->bUseThreads==0 || pSorter->pReader );
     assert( pSorter->bUseThreads==1 || pSorter->pMerger );
 #if SQLITE_MAX_WORKER_THREADS>0
     if( pSorter->bUseThreads ){
-      rc = vdbePmaReaderNext(pSorter->pReader);
-      if( rc==SQLITE_OK && pSorter->pReader->pFd==0 ) rc = SQLITE_DONE;
+      if( pSorter->pMerger ){
+        int res = 0;
+        rc = vdbeMergeEngineStep(pSorter->pMerger, &res);
+      }else{
+        rc = vdbePmaReaderNext(pSorter->pReader);
+      }
+      if( rc==SQLITE_OK && pSorter->nRange>0 ){
+        rc = vdbeSorterRangeNext(pSorter);
+      }
+      if( rc==SQLITE_OK && pSorter->pMerger==0 && pSorter->pReader->pFd==0 ){
+        rc = SQLITE_DONE;
+      }
     }else
 #endif
     /*if( !pSorter->bUseThreads )*/ {
@@ -2666,7 +3153,7 @@ static void *vdbeSorterRowkey(
   if( pSorter->bUsePMA ){
     PmaReader *pReader;
 #if SQLITE_MAX_WORKER_THREADS>0
-    if( pSorter->bUseThreads ){
+    if( pSorter->bUseThreads && pSorter->pMerger==0 ){
       pReader = pSorter->pReader;
     }else
 #endif
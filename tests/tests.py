@@ -3,12 +3,20 @@ from __future__ import division
 from __future__ import print_function
 
 import argparse
+import ctypes
 import gc
+import glob
 import os
+import random
+import shutil
+import struct
+import subprocess
 import sys
 import tempfile
+import threading
 import unittest
 
+import supersqlite.third_party.sqlite3
 from supersqlite import pysqlite, apsw, SQLITE_LIB, APSW_LIB, SuperSQLite
 
 
@@ -21,6 +29,14 @@ def _clear_mmap():
             '*.supersqlmmap*'))
 
 
+def _load_extension(db, name):
+    path = glob.glob(os.path.join(
+        os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+        name + '*'))[0]
+    db.enableloadextension(True)
+    db.loadextension(path, 'sqlite3_%s_init' % (name,))
+
+
 class MagnitudeTest(unittest.TestCase):
 
     def setUp(self):
@@ -47,6 +63,930 @@ class MagnitudeTest(unittest.TestCase):
         self.assertTrue(issubclass(SuperSQLite.connect, apsw.Connection))
 
 
+class CsvIndexTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.csv = os.path.join(self.tmpdir, 'rows.csv')
+        self.index = os.path.join(self.tmpdir, 'rows.csv.idx')
+        self._write(['%d,row%d' % (i, i) for i in range(1, 101)])
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _write(self, lines):
+        with open(self.csv, 'w') as f:
+            f.write('id,name\n' + '\n'.join(lines) + '\n')
+
+    def _rows(self):
+        db = SuperSQLite.connect(':memory:')
+        _load_extension(db, 'csv')
+        cursor = db.cursor()
+        cursor.execute(
+            "CREATE VIRTUAL TABLE temp.t USING csv(filename=%s, header=YES, "
+            "index=%s)" % ("'%s'" % self.csv, "'%s'" % self.index))
+        rows = cursor.execute("SELECT c0, c1 FROM t").fetchall()
+        rows.append(cursor.execute(
+            "SELECT c1 FROM t WHERE rowid=50").fetchone())
+        db.close()
+        return rows
+
+    def test_reuse(self):
+        rows = self._rows()
+        self.assertEqual(len(rows), 101)
+        self.assertEqual(rows[-1], ('row50',))
+        self.assertTrue(os.path.exists(self.index))
+        self.assertEqual(sorted(os.listdir(self.tmpdir)),
+                         ['rows.csv', 'rows.csv.idx'])
+        self.assertEqual(self._rows(), rows)
+
+    def test_corrupt_offsets(self):
+        rows = self._rows()
+        # The header is left intact, so only the offsets are wrong.
+        with open(self.index, 'r+b') as f:
+            f.seek(8 + 6 * 8 + 8)
+            f.write(struct.pack('=q', 1 << 40))
+        self.assertEqual(self._rows(), rows)
+        with open(self.index, 'r+b') as f:
+            f.seek(8 + 6 * 8 + 8 * 3)
+            f.write(struct.pack('=q', 5))
+        self.assertEqual(self._rows(), rows)
+
+    def test_same_size_and_mtime(self):
+        self._rows()
+        st = os.stat(self.csv)
+        if not hasattr(st, 'st_mtime_ns'):
+            self.skipTest("os.utime() cannot set the mtime exactly")
+        # Same size, but the first two rows end in different places.
+        self._write(['1,row1x', '2,row'] +
+                    ['%d,row%d' % (i, i) for i in range(3, 101)])
+        os.utime(self.csv, ns=(st.st_atime_ns, st.st_mtime_ns))
+        rows = self._rows()
+        self.assertEqual(rows[:2], [('1', 'row1x'), ('2', 'row')])
+        self.assertEqual(rows[-1], ('row50',))
+
+    def test_chunks(self):
+        # Large enough to be split into several 4MiB chunks, with quoted
+        # fields holding delimiters, doubled quotes and newlines, so that
+        # chunk boundaries fall inside quoted fields, and CRLF endings.
+        rand = random.Random(7)
+        with open(self.csv, 'wb') as f:
+            f.write(b'id,name,note\r\n')
+            for i in range(1, 120001):
+                note = ' '.join('w%d' % (rand.randint(0, 999),)
+                                for j in range(rand.randint(0, 40)))
+                kind = i % 5
+                if kind == 1:
+                    note = '"%s"' % (note.replace(' ', '\n', 3),)
+                elif kind == 2:
+                    note = '"%s ""q"", %s"' % (note, i)
+                elif kind == 3:
+                    note = '"%s\r\n"' % (note,)
+                f.write(('%d,n%d,%s%s' % (
+                    i, i, note, '\r\n' if i % 2 else '\n')).encode('ascii'))
+        self.assertGreater(os.path.getsize(self.csv), 3 * 4 * 1024 * 1024)
+        db = SuperSQLite.connect(':memory:')
+        _load_extension(db, 'csv')
+        cursor = db.cursor()
+        args = {
+            'classic': '',
+            'mmap': ', mmap=YES',
+            'threads': ', threads=4',
+            'index': ", threads=4, index='%s'" % (self.index,),
+            'reuse': ", index='%s'" % (self.index,),
+        }
+        rows = {}
+        for name in sorted(args, key=lambda k: k != 'classic'):
+            cursor.execute(
+                "CREATE VIRTUAL TABLE temp.t_%s USING csv(filename='%s', "
+                "header=YES%s)" % (name, self.csv, args[name]))
+            rows[name] = cursor.execute(
+                "SELECT rowid, * FROM t_%s" % (name,)).fetchall()
+            rows[name].append(cursor.execute(
+                "SELECT * FROM t_%s WHERE rowid BETWEEN 59998 AND 60002" %
+                (name,)).fetchall())
+        db.close()
+        self.assertEqual(len(rows['classic']), 120001)
+        notes = [r[3] for r in rows['classic'][:100]]
+        self.assertTrue([n for n in notes if '\n' in n and '\r' not in n])
+        self.assertTrue([n for n in notes if n.endswith('\r\n')])
+        self.assertTrue([n for n in notes if '"q", ' in n])
+        for name in args:
+            self.assertEqual(rows[name], rows['classic'], name)
+
+
+class UnionVtabTest(unittest.TestCase):
+
+    SOURCES = 4
+    ROWS = 1000
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        # The unusual name checks that workers open the same file.
+        self.files = [os.path.join(self.tmpdir, 's %d?#.db' % (i,))
+                      for i in range(self.SOURCES)]
+        for i, path in enumerate(self.files):
+            db = SuperSQLite.connect(path)
+            cursor = db.cursor()
+            cursor.execute("CREATE TABLE t(a INTEGER PRIMARY KEY, b, c)")
+            cursor.execute("BEGIN")
+            # Column c holds a different type in each source.
+            cursor.executemany(
+                "INSERT INTO t VALUES(?, ?, ?)",
+                ((self.ROWS * i + j, j,
+                  [j, 'text%d' % (j,), b'blob%d' % (j,), j + 0.5][i % 4])
+                 for j in range(1, self.ROWS + 1)))
+            cursor.execute("COMMIT")
+            db.close()
+        self.db = SuperSQLite.connect(':memory:')
+        _load_extension(self.db, 'unionvtab')
+        self.cursor = self.db.cursor()
+        self.opened = []
+        self.open_now = 0
+        self.open_max = 0
+        self.db.createscalarfunction('openclose', self._openclose, 2)
+        for i, path in enumerate(self.files):
+            self.cursor.execute("ATTACH ? AS s%d" % (i,), (path,))
+        union_sql = ' UNION ALL '.join(
+            "SELECT 's%d', 't', %d, %d" % (
+                i, self.ROWS * i + 1, self.ROWS * (i + 1))
+            for i in range(self.SOURCES))
+        swarm_sql = ' UNION ALL '.join(
+            "SELECT %s, 't', %d, %d" % (
+                "'%s'" % (path.replace("'", "''"),),
+                self.ROWS * i + 1, self.ROWS * (i + 1))
+            for i, path in enumerate(self.files))
+        self.cursor.execute(
+            "CREATE VIRTUAL TABLE temp.u USING unionvtab(\"%s\")" %
+            (union_sql,))
+        self.cursor.execute(
+            "CREATE VIRTUAL TABLE temp.up USING unionvtab(\"%s\", "
+            "parallel=4)" % (union_sql,))
+        self.cursor.execute(
+            "CREATE VIRTUAL TABLE temp.sp USING swarmvtab(\"%s\", "
+            "openclose=openclose, maxopen=1, parallel=2)" % (swarm_sql,))
+
+    def tearDown(self):
+        self.db.close()
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _openclose(self, path, closed):
+        if closed:
+            self.open_now -= 1
+        else:
+            self.opened.append(path)
+            self.open_now += 1
+            self.open_max = max(self.open_max, self.open_now)
+
+    def _query(self, sql, *args):
+        return self.cursor.execute(sql, args).fetchall()
+
+    def test_parallel(self):
+        expected = self._query("SELECT count(*), sum(b), sum(a) FROM u")
+        self.assertEqual(expected, [(4000, 4 * 500500, 8002000)])
+        self.assertEqual(
+            self._query("SELECT count(*), sum(b), sum(a) FROM up"), expected)
+        self.assertEqual(
+            self._query("SELECT count(*), sum(b), sum(a) FROM sp"), expected)
+        self.assertEqual(sorted(self._query("SELECT a, c FROM up")),
+                         sorted(self._query("SELECT a, c FROM u")))
+        # Only as many sources as there are workers are held open at a
+        # time, in addition to maxopen.
+        self.assertEqual(len(self.opened), 4)
+        self.assertLessEqual(self.open_max, 1 + 2)
+
+    def test_pruning(self):
+        sql = "SELECT count(*), min(a), max(a) FROM %s " \
+              "WHERE rowid BETWEEN 1500 AND 2500"
+        del self.opened[:]
+        self.assertEqual(self._query(sql % 'up'), [(1001, 1500, 2500)])
+        self.assertEqual(self._query(sql % 'sp'), [(1001, 1500, 2500)])
+        self.assertEqual(sorted(set(self.opened)), sorted(self.files[1:3]))
+        self.assertEqual(self._query("SELECT b FROM up WHERE rowid=3001"),
+                         [(1,)])
+
+    def test_limit(self):
+        for name in ('up', 'sp'):
+            self.assertEqual(
+                len(self._query("SELECT * FROM %s LIMIT 5" % (name,))), 5)
+            rows = self.db.cursor().execute("SELECT a FROM %s" % (name,))
+            next(rows)
+            rows.close()
+        self.assertEqual(self._query("SELECT count(*) FROM sp"), [(4000,)])
+        self.assertLessEqual(self.open_now, 1)
+
+    def test_transaction(self):
+        # The scan must see the changes made by the open transaction, so
+        # it is not run by worker connections.
+        self.cursor.execute("BEGIN")
+        self.cursor.execute("DELETE FROM s1.t WHERE a>1500")
+        self.assertEqual(self._query("SELECT count(*) FROM up"), [(3500,)])
+        self.assertEqual(
+            self._query("SELECT unionvtab_aggregate('up', 'count', '*')"),
+            [(3500,)])
+        self.cursor.execute("ROLLBACK")
+        self.assertEqual(self._query("SELECT count(*) FROM up"), [(4000,)])
+
+    def test_exclusive(self):
+        self.cursor.execute("PRAGMA s2.locking_mode=EXCLUSIVE")
+        self.cursor.execute("UPDATE s2.t SET b=b+1 WHERE a=2001")
+        self.assertEqual(self._query("SELECT count(*), sum(b) FROM up"),
+                         [(4000, 4 * 500500 + 1)])
+        self.assertEqual(
+            self._query("SELECT unionvtab_aggregate('up', 'sum', 'b')"),
+            [(4 * 500500 + 1,)])
+
+    def test_aggregate(self):
+        for name in ('u', 'up', 'sp'):
+            for func in ('count', 'sum', 'min', 'max'):
+                for col in ('b', 'c'):
+                    expected = self._query(
+                        "SELECT %s(%s) FROM u WHERE rowid>=? AND rowid<=?" %
+                        (func, col), 501, 3600)
+                    self.assertEqual(self._query(
+                        "SELECT unionvtab_aggregate(?, ?, ?, 501, 3600)",
+                        name, func, col), expected)
+        # Integers sort before reals and text, text before blobs.
+        self.assertEqual(
+            self._query("SELECT unionvtab_aggregate('up', 'min', 'c'), "
+                        "unionvtab_aggregate('up', 'max', 'c')"),
+            [(1, b'blob999')])
+        self.assertEqual(
+            self._query("SELECT typeof(unionvtab_aggregate('up', 'sum', "
+                        "'c', 1, 1000)), typeof(unionvtab_aggregate("
+                        "'up', 'sum', 'c', 1, 4000))"),
+            [('integer', 'real')])
+        self.assertEqual(
+            self._query("SELECT unionvtab_aggregate('up', 'count', '*', "
+                        "10, 5)"), [(0,)])
+
+    def test_aggregate_overflow(self):
+        self.cursor.execute("UPDATE s0.t SET b=9223372036854775807 WHERE a=1")
+        self.cursor.execute("UPDATE s1.t SET b=1000 WHERE a=1001")
+        for name in ('u', 'up'):
+            self.assertRaises(
+                apsw.SQLError, self._query,
+                "SELECT unionvtab_aggregate(?, 'sum', 'b', 1, 1001)", name)
+        self.assertEqual(
+            self._query("SELECT unionvtab_aggregate('up', 'sum', 'b', 1, 1)"),
+            [(9223372036854775807,)])
+
+    def test_errors(self):
+        for sql in (
+                "SELECT unionvtab_aggregate('nosuch', 'count', '*')",
+                "SELECT unionvtab_aggregate('up', 'avg', 'b')",
+                "SELECT unionvtab_aggregate('up', 'sum', '*')",
+                "SELECT unionvtab_aggregate('up', 'sum', 'nosuch')",
+                "SELECT unionvtab_aggregate('up', 'sum', NULL)",
+                "CREATE VIRTUAL TABLE temp.x USING unionvtab("
+                "\"SELECT 's0', 't', 1, 1000\", parallel=-1)",
+                "CREATE VIRTUAL TABLE temp.x USING unionvtab("
+                "\"SELECT 's0', 't', 1, 1000\", maxopen=2)"):
+            self.assertRaises(apsw.SQLError, self._query, sql)
+        # A swarmvtab source whose schema differs from the others.
+        db = SuperSQLite.connect(self.files[3])
+        db.cursor().execute("DROP TABLE t")
+        db.cursor().execute("CREATE TABLE t(a INTEGER PRIMARY KEY, b)")
+        db.close()
+        self.assertRaises(apsw.SQLError, self._query,
+                          "SELECT count(*) FROM sp")
+        self.assertRaises(apsw.SQLError, self._query,
+                          "SELECT unionvtab_aggregate('sp', 'count', '*')")
+        self.assertEqual(self._query("SELECT count(*) FROM sp "
+                                     "WHERE rowid<=3000"), [(3000,)])
+        self.assertLessEqual(self.open_now, 1)
+
+
+class CompressVfsTest(unittest.TestCase):
+
+    SLOT_SIZE = 512
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'compressed.db')
+        self.vfs_db = SuperSQLite.connect(':memory:')
+        _load_extension(self.vfs_db, 'compressvfs')
+
+    def tearDown(self):
+        self.vfs_db.close()
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _connect(self):
+        return SuperSQLite.connect(
+            'file:%s?vfs=compressvfs&lru=4' % (self.path,),
+            flags=(apsw.SQLITE_OPEN_READWRITE | apsw.SQLITE_OPEN_CREATE |
+                   apsw.SQLITE_OPEN_URI))
+
+    def _rows(self, db):
+        return [r[0] for r in db.cursor().execute("SELECT v FROM t ORDER BY k")]
+
+    def _slots(self):
+        # Returns [(sequence number, slot bytes)] for the two header slots.
+        with open(self.path, 'rb') as f:
+            data = f.read(2 * self.SLOT_SIZE)
+        return [(struct.unpack('>Q', data[i + 24:i + 32])[0],
+                 bytearray(data[i:i + self.SLOT_SIZE]))
+                for i in (0, self.SLOT_SIZE)]
+
+    def _write_slot(self, i, slot, fix_checksum=True):
+        if fix_checksum:
+            s1, s2 = 1, 0
+            for b in slot[:72]:
+                s1 = (s1 + b) & 0xffffffff
+                s2 = (s2 + s1) & 0xffffffff
+            slot[72:76] = struct.pack('>I', ((s2 << 16) ^ s1) & 0xffffffff)
+        with open(self.path, 'r+b') as f:
+            f.seek(i * self.SLOT_SIZE)
+            f.write(slot)
+
+    def _read_fails(self, *errors):
+        try:
+            db = self._connect()
+        except errors:
+            return
+        try:
+            self.assertRaises(errors, self._rows, db)
+        finally:
+            db.close()
+
+    def _populate(self, db, rows):
+        cursor = db.cursor()
+        cursor.execute("CREATE TABLE IF NOT EXISTS t(k INTEGER PRIMARY KEY, v)")
+        cursor.execute("BEGIN")
+        cursor.executemany("INSERT INTO t(v) VALUES(?)",
+                           (('value %d ' % (i,) * 20,) for i in rows))
+        cursor.execute("COMMIT")
+
+    def test_header_recovery(self):
+        db = self._connect()
+        self._populate(db, range(100))
+        self._populate(db, range(100, 200))
+        db.close()
+        # Damage the newest slot.  The other describes the database as of
+        # the previous commit, whose blocks have not been reused.
+        slots = self._slots()
+        newest = 0 if slots[0][0] > slots[1][0] else 1
+        slot = slots[newest][1]
+        slot[40] ^= 0xff
+        self._write_slot(newest, slot, fix_checksum=False)
+        db = self._connect()
+        self.assertEqual(len(self._rows(db)), 100)
+        self.assertEqual(
+            db.cursor().execute("PRAGMA integrity_check").fetchall(),
+            [('ok',)])
+        self._populate(db, range(100, 150))
+        self.assertEqual(len(self._rows(db)), 150)
+        db.close()
+        slots = self._slots()
+        for i in (0, 1):
+            slot = slots[i][1]
+            slot[0] ^= 0xff
+            self._write_slot(i, slot, fix_checksum=False)
+        # Without a valid slot the file is not recognized as compressed.
+        self._read_fails(apsw.CorruptError, apsw.NotADBError)
+
+    def test_header_bounds(self):
+        db = self._connect()
+        self._populate(db, range(100))
+        db.close()
+        # Directory and free-list sizes that pass the checksum but do not
+        # fit in the file are rejected before anything is allocated.
+        for offset, value in ((56, 0x7fffffff), (68, 0x7fffffff),
+                              (48, 1 << 60)):
+            slots = self._slots()
+            newest = 0 if slots[0][0] > slots[1][0] else 1
+            slot = bytearray(slots[newest][1])
+            saved = bytes(slot)
+            if offset == 48:
+                slot[48:56] = struct.pack('>Q', value)
+            else:
+                slot[offset:offset + 4] = struct.pack('>I', value)
+            self._write_slot(newest, slot)
+            self._read_fails(apsw.CorruptError)
+            self._write_slot(newest, bytearray(saved), fix_checksum=False)
+        db = self._connect()
+        self.assertEqual(len(self._rows(db)), 100)
+        db.close()
+
+    def test_commit(self):
+        # Changes are committed at xSync, or at xUnlock when SQLite does
+        # not sync, and are not visible before then.
+        for synchronous in ('FULL', 'OFF'):
+            if os.path.exists(self.path):
+                os.remove(self.path)
+            writer = self._connect()
+            writer.cursor().execute("PRAGMA synchronous=%s" % (synchronous,))
+            self._populate(writer, range(10))
+            reader = self._connect()
+            self.assertEqual(len(self._rows(reader)), 10)
+            cursor = writer.cursor()
+            cursor.execute("BEGIN")
+            cursor.execute("DELETE FROM t WHERE k<=5")
+            self.assertEqual(len(self._rows(reader)), 10)
+            cursor.execute("ROLLBACK")
+            self.assertEqual(len(self._rows(writer)), 10)
+            cursor.execute("DELETE FROM t WHERE k<=5")
+            self.assertEqual(len(self._rows(reader)), 5)
+            reader.close()
+            writer.close()
+            db = self._connect()
+            self.assertEqual(len(self._rows(db)), 5)
+            db.close()
+
+    def test_reload(self):
+        # Each connection caches decompressed blocks, which must be
+        # reloaded when the other connection commits.
+        a = self._connect()
+        b = self._connect()
+        self._populate(a, range(200))
+        for i in range(20):
+            writer, reader = (a, b) if i % 2 else (b, a)
+            writer.cursor().execute(
+                "UPDATE t SET v=? WHERE k%10=?", ('update %d' % (i,), i % 10))
+            rows = self._rows(reader)
+            self.assertEqual(rows, self._rows(writer))
+            self.assertEqual(rows.count('update %d' % (i,)), 20)
+        a.close()
+        b.close()
+
+    def test_vacuum(self):
+        db = self._connect()
+        self._populate(db, range(2000))
+        size = os.path.getsize(self.path)
+        cursor = db.cursor()
+        cursor.execute("DELETE FROM t WHERE k%10!=0")
+        cursor.execute("VACUUM")
+        self.assertEqual(
+            cursor.execute("PRAGMA integrity_check").fetchall(), [('ok',)])
+        self.assertEqual(len(self._rows(db)), 200)
+        db.close()
+        db = self._connect()
+        self.assertEqual(len(self._rows(db)), 200)
+        # The space freed by VACUUM is reused.
+        self._populate(db, range(1800))
+        self.assertEqual(len(self._rows(db)), 2000)
+        self.assertLess(os.path.getsize(self.path), size * 1.5)
+        db.close()
+
+
+class SharedPageVfsTest(unittest.TestCase):
+
+    ACCOUNTS = 1000
+    TOTAL = ACCOUNTS * 10000
+
+    # Moves money between accounts, so that the sum of the balances never
+    # changes, with frequent passive checkpoints and a restart checkpoint
+    # every fifty transfers.
+    WRITER = """
+import random, sys
+from supersqlite import SuperSQLite
+db = SuperSQLite.connect(sys.argv[1])
+db.setbusytimeout(5000)
+cursor = db.cursor()
+cursor.execute("PRAGMA wal_autocheckpoint=4")
+rand = random.Random(1)
+for i in range(int(sys.argv[2])):
+    a, b = rand.randint(1, %d), rand.randint(1, %d)
+    cursor.execute("BEGIN IMMEDIATE")
+    cursor.execute("UPDATE acct SET bal=bal-1 WHERE id=?", (a,))
+    cursor.execute("UPDATE acct SET bal=bal+1 WHERE id=?", (b,))
+    cursor.execute("COMMIT")
+    if i %% 50 == 49:
+        cursor.execute("PRAGMA wal_checkpoint(RESTART)")
+""" % (ACCOUNTS, ACCOUNTS)
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'shared.db')
+        self.stats_db = SuperSQLite.connect(':memory:')
+        _load_extension(self.stats_db, 'sharedpagevfs')
+
+    def tearDown(self):
+        self.stats_db.close()
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _populate(self, journal_mode):
+        db = SuperSQLite.connect(self.path)
+        cursor = db.cursor()
+        cursor.execute("PRAGMA journal_mode=%s" % (journal_mode,))
+        cursor.execute("CREATE TABLE acct(id INTEGER PRIMARY KEY, bal, pad)")
+        cursor.execute("BEGIN")
+        cursor.executemany("INSERT INTO acct VALUES(?, 10000, zeroblob(200))",
+                           ((i,) for i in range(1, self.ACCOUNTS + 1)))
+        cursor.execute("COMMIT")
+        return db
+
+    def _reader(self):
+        db = SuperSQLite.connect(
+            'file:%s?vfs=sharedpagevfs' % (self.path,),
+            flags=apsw.SQLITE_OPEN_READONLY | apsw.SQLITE_OPEN_URI)
+        db.setbusytimeout(5000)
+        db.cursor().execute("PRAGMA cache_size=10")
+        return db
+
+    def _stats(self):
+        return self.stats_db.cursor().execute(
+            "SELECT pages, misses, invalidations, resets "
+            "FROM sharedpagevfs_stats WHERE file=?",
+            (os.path.realpath(self.path),)).fetchone()
+
+    def _sum(self, db):
+        return db.cursor().execute("SELECT sum(bal) FROM acct").fetchone()[0]
+
+    def test_wal_multiprocess(self):
+        self._populate('WAL').close()
+        # Keeps the cache, and so its statistics, after the readers close.
+        keep = self._reader()
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+        writer = subprocess.Popen(
+            [sys.executable, '-c', self.WRITER, self.path, '500'], env=env)
+        sums = []
+        errors = []
+
+        def read():
+            db = self._reader()
+            try:
+                while writer.poll() is None:
+                    sums.append(self._sum(db))
+            except Exception as e:
+                errors.append(e)
+            finally:
+                db.close()
+
+        threads = [threading.Thread(target=read) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(writer.wait(), 0)
+        self.assertEqual(errors, [])
+        self.assertTrue(sums)
+        self.assertEqual(set(sums), set([self.TOTAL]))
+        pages, misses, invalidations, resets = self._stats()
+        self.assertGreater(invalidations, 0)
+        self.assertGreater(resets, 0)
+        keep.close()
+
+    def test_rollback(self):
+        writer = self._populate('DELETE')
+        reader = self._reader()
+        self.assertEqual(self._sum(reader), self.TOTAL)
+        self.assertEqual(self._sum(reader), self.TOTAL)
+        pages, misses, invalidations, resets = self._stats()
+        self.assertGreater(pages, 0)
+        for i in range(3):
+            writer.cursor().execute("UPDATE acct SET bal=bal+1 WHERE id=1")
+            self.assertEqual(self._sum(reader), self.TOTAL + i + 1)
+        self.assertEqual(self._stats()[3], resets + 3)
+        reader.close()
+        writer.close()
+
+    def test_generation(self):
+        # A reader whose snapshot is the database file alone (the WAL was
+        # fully checkpointed when it began) stays open while a writer
+        # restarts the WAL.  The cache is emptied, and this reader must
+        # not fill it again with pages from before the restart.
+        writer = self._populate('WAL')
+        cursor = writer.cursor()
+        cursor.execute("PRAGMA wal_autocheckpoint=0")
+        cursor.execute("UPDATE acct SET bal=bal+0")
+        cursor.execute("PRAGMA wal_checkpoint(PASSIVE)")
+        reader = self._reader()
+        rcursor = reader.cursor()
+        rcursor.execute("BEGIN")
+        self.assertEqual(self._sum(reader), self.TOTAL)
+        self.assertGreater(self._stats()[0], 0)
+        cursor.execute("UPDATE acct SET bal=bal+1 WHERE id=1")
+        self.assertEqual(self._sum(reader), self.TOTAL)
+        pages, misses, invalidations, resets = self._stats()
+        self.assertEqual(pages, 0)
+        self.assertGreater(resets, 0)
+        self.assertEqual(self._sum(reader), self.TOTAL)
+        self.assertEqual(self._stats()[0], 0)
+        self.assertGreater(self._stats()[1], misses)
+        rcursor.execute("COMMIT")
+        self.assertEqual(self._sum(reader), self.TOTAL + 1)
+        self.assertGreater(self._stats()[0], 0)
+        reader.close()
+        writer.close()
+
+
+class AsyncStatsTest(unittest.TestCase):
+    """Drives the asynchronous IO VFS built into the sqlite3 extension
+    through ctypes, as it is not reachable from apsw or pysqlite."""
+
+    SQLITE_OPEN_RW_CREATE = 0x06
+    SQLITEASYNC_HALT = 1
+    SQLITEASYNC_HALT_IDLE = 2
+    SQLITEASYNC_GROUPCOMMIT = 7
+    THREADS = 4
+    COMMITS = 40
+
+    CALLBACK = ctypes.CFUNCTYPE(
+        ctypes.c_int, ctypes.c_void_p, ctypes.c_int,
+        ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(ctypes.c_char_p))
+
+    def setUp(self):
+        libs = [path for path in glob.glob(os.path.join(
+            os.path.dirname(supersqlite.third_party.sqlite3.__file__),
+            'sqlite3.*')) if path.endswith(('.so', '.pyd'))]
+        if not libs:
+            self.skipTest("sqlite3 extension library not found")
+        self.lib = ctypes.CDLL(libs[0])
+        if not hasattr(self.lib, 'sqlite3async_initialize'):
+            self.skipTest("built without SQLITE_ENABLE_ASYNCIO")
+        self.lib.sqlite3_open_v2.argtypes = [
+            ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p),
+            ctypes.c_int, ctypes.c_char_p]
+        self.lib.sqlite3_exec.argtypes = [
+            ctypes.c_void_p, ctypes.c_char_p, self.CALLBACK,
+            ctypes.c_void_p, ctypes.c_void_p]
+        for name in ('sqlite3_close', 'sqlite3async_stats_register'):
+            getattr(self.lib, name).argtypes = [ctypes.c_void_p]
+        self.lib.sqlite3_busy_timeout.argtypes = [
+            ctypes.c_void_p, ctypes.c_int]
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'async.db').encode('utf-8')
+        self.assertEqual(self.lib.sqlite3async_initialize(None, 0), 0)
+        self.lib.sqlite3async_control(self.SQLITEASYNC_GROUPCOMMIT, 1)
+        self.writer = threading.Thread(target=self.lib.sqlite3async_run)
+        self.writer.start()
+
+    def tearDown(self):
+        self.lib.sqlite3async_control(
+            self.SQLITEASYNC_HALT, self.SQLITEASYNC_HALT_IDLE)
+        self.writer.join()
+        self.lib.sqlite3async_shutdown()
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _open(self):
+        db = ctypes.c_void_p()
+        self.assertEqual(self.lib.sqlite3_open_v2(
+            self.path, ctypes.byref(db), self.SQLITE_OPEN_RW_CREATE,
+            b'sqlite3async'), 0)
+        self.lib.sqlite3_busy_timeout(db, 10000)
+        return db
+
+    def _exec(self, db, sql):
+        rows = []
+
+        def callback(arg, ncols, values, names):
+            rows.append(tuple(values[i] for i in range(ncols)))
+            return 0
+        self.assertEqual(
+            self.lib.sqlite3_exec(db, sql, self.CALLBACK(callback), None,
+                                  None), 0)
+        return rows
+
+    def _stats(self, db):
+        return dict((name.decode('utf-8'), int(value)) for name, value in
+                    self._exec(db, b"SELECT * FROM sqlite3async_stats"))
+
+    def test_stats_while_writing(self):
+        db = self._open()
+        self.lib.sqlite3async_stats_register(db)
+        self._exec(db, b"PRAGMA journal_mode=WAL; PRAGMA synchronous=FULL;"
+                       b"CREATE TABLE t(a, b)")
+
+        def insert():
+            conn = self._open()
+            for i in range(self.COMMITS):
+                self._exec(conn, b"INSERT INTO t VALUES(1, randomblob(300))")
+            self.lib.sqlite3_close(conn)
+        threads = [threading.Thread(target=insert)
+                   for i in range(self.THREADS)]
+        for thread in threads:
+            thread.start()
+
+        # Each snapshot is taken under the queue mutex, so the histograms
+        # always add up to their totals and no counter goes backwards.
+        counters = ('writes', 'bytes_written', 'write_calls', 'fsyncs',
+                    'fsync_us_total', 'batches', 'commits')
+        last = self._stats(db)
+        while any(thread.is_alive() for thread in threads) or \
+                last['queue_depth']:
+            stats = self._stats(db)
+            self.assertEqual(sum(v for k, v in stats.items()
+                                 if k.startswith('fsync_us<')
+                                 or k.startswith('fsync_us>')),
+                             stats['fsyncs'])
+            self.assertEqual(sum(v for k, v in stats.items()
+                                 if k.startswith('batch_size')),
+                             stats['batches'])
+            self.assertGreaterEqual(stats['fsync_us_total'],
+                                    stats['fsync_us_max'])
+            for name in counters:
+                self.assertGreaterEqual(stats[name], last[name])
+            last = stats
+        for thread in threads:
+            thread.join()
+
+        stats = self._stats(db)
+        self.assertEqual(stats['queue_depth'], 0)
+        self.assertEqual(stats['queue_bytes'], 0)
+        self.assertGreaterEqual(stats['commits'], self.THREADS * self.COMMITS)
+        self.assertGreater(stats['fsyncs'], 0)
+        self.assertGreaterEqual(stats['writes'], self.THREADS * self.COMMITS)
+        self.assertGreater(stats['bytes_written'],
+                           self.THREADS * self.COMMITS * 300)
+        self.assertGreater(stats['write_calls'], 0)
+        self.assertEqual(self._exec(db, b"SELECT count(*) FROM t"),
+                         [(str(self.THREADS * self.COMMITS).encode(),)])
+        self.lib.sqlite3_close(db)
+
+
+class SorterThreadsTest(unittest.TestCase):
+
+    ROWS = 100000
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+        gc.collect()
+
+    def _populate(self, page_size):
+        db = SuperSQLite.connect(os.path.join(
+            self.tmpdir, 'sort%d.db' % (page_size,)))
+        rand = random.Random(5)
+        cursor = db.cursor()
+        cursor.execute("PRAGMA page_size=%d" % (page_size,))
+        cursor.execute("CREATE TABLE t(a, b, c)")
+        cursor.execute("BEGIN")
+        cursor.executemany("INSERT INTO t VALUES(?, ?, ?)", ((
+            rand.randint(0, 1000), '%x' % (rand.getrandbits(128),),
+            'x' * rand.randint(0, 40)) for i in range(self.ROWS)))
+        cursor.execute("COMMIT")
+        # A tiny cache makes the sorter write PMAs of the minimum size.
+        cursor.execute("PRAGMA cache_size=10")
+        return db
+
+    def _sort(self, db, threads):
+        cursor = db.cursor()
+        cursor.execute("PRAGMA threads=%d" % (threads,))
+        rows = list(cursor.execute("SELECT * FROM t ORDER BY b, a"))
+        rows += list(cursor.execute("SELECT a, count(*), max(c) FROM t "
+                                    "GROUP BY a ORDER BY a DESC"))
+        cursor.execute("DROP INDEX IF EXISTS i")
+        cursor.execute("CREATE INDEX i ON t(c, b DESC)")
+        self.assertEqual(
+            list(cursor.execute("PRAGMA integrity_check")), [('ok',)])
+        rows += list(cursor.execute(
+            "SELECT c, b FROM t INDEXED BY i ORDER BY c, b DESC"))
+        return rows
+
+    def _check(self, page_size):
+        db = self._populate(page_size)
+        serial = self._sort(db, 0)
+        self.assertEqual(len(serial), 2 * self.ROWS + 1001)
+        self.assertEqual(serial[:self.ROWS], sorted(
+            serial[:self.ROWS], key=lambda row: (row[1], row[0])))
+        self.assertEqual(self._sort(db, 4), serial)
+        self.assertEqual(self._sort(db, 1), serial)
+        db.close()
+
+    def test_few_pmas(self):
+        self._check(4096)
+
+    def test_many_pmas(self):
+        # PMAs are at least 250 pages, so 512 byte pages give several
+        # times as many PMAs to split into ranges as the default.
+        self._check(512)
+
+
+class RtreeBulkLoadTest(unittest.TestCase):
+
+    ROWS = 20000
+
+    def setUp(self):
+        self.db = SuperSQLite.connect(':memory:')
+        rand = random.Random(11)
+        cursor = self.db.cursor()
+        cursor.execute("CREATE TABLE src(id INTEGER PRIMARY KEY, "
+                       "x1, x2, y1, y2, tag)")
+        rows = []
+        for i in range(1, self.ROWS + 1):
+            x, y = rand.uniform(-180, 180), rand.uniform(-90, 90)
+            rows.append((i * 3, x, x + rand.uniform(0, 2),
+                         y, y + rand.uniform(0, 2), 'tag%d' % (i,)))
+        cursor.execute("BEGIN")
+        cursor.executemany("INSERT INTO src VALUES(?, ?, ?, ?, ?, ?)", rows)
+        cursor.execute("COMMIT")
+
+    def tearDown(self):
+        self.db.close()
+        gc.collect()
+
+    def _create(self, name, module):
+        self.db.cursor().execute(
+            "CREATE VIRTUAL TABLE %s USING %s(id, x1, x2, y1, y2, +tag)" % (
+                name, module))
+
+    def _windows(self, name):
+        cursor = self.db.cursor()
+        results = []
+        rand = random.Random(13)
+        for i in range(200):
+            x, y = rand.uniform(-190, 190), rand.uniform(-100, 100)
+            w, h = rand.uniform(0, 40), rand.uniform(0, 20)
+            results.append(list(cursor.execute(
+                "SELECT id, tag FROM %s WHERE x2>=? AND x1<=? AND y2>=? "
+                "AND y1<=? ORDER BY id" % (name,), (x, x + w, y, y + h))))
+            results.append(list(cursor.execute(
+                "SELECT id FROM %s WHERE x1>=? AND x2<=? AND y1>=? AND y2<=? "
+                "ORDER BY id" % (name,), (x, x + w, y, y + h))))
+        results.append(list(cursor.execute(
+            "SELECT count(*), min(id), max(id) FROM %s" % (name,))))
+        results.append(list(cursor.execute(
+            "SELECT * FROM %s WHERE id=?" % (name,), (3 * 777,))))
+        return results
+
+    def _check(self, module):
+        cursor = self.db.cursor()
+        self._create('rows', module)
+        cursor.execute("BEGIN")
+        cursor.execute("INSERT INTO rows SELECT * FROM src")
+        cursor.execute("COMMIT")
+        self._create('bulk', module)
+        self.assertEqual(list(cursor.execute(
+            "SELECT rtreebulkload('bulk', 'SELECT * FROM src')")),
+            [(self.ROWS,)])
+        self.assertEqual(list(cursor.execute(
+            "SELECT rtreecheck('rows'), rtreecheck('bulk')")),
+            [('ok', 'ok')])
+        expected = self._windows('rows')
+        self.assertGreater(sum(len(rows) for rows in expected), self.ROWS)
+        self.assertEqual(self._windows('bulk'), expected)
+        # The bulk loaded tree can be modified as usual.
+        cursor.execute("DELETE FROM bulk WHERE id%2=0")
+        cursor.execute("DELETE FROM rows WHERE id%2=0")
+        cursor.execute("INSERT INTO bulk VALUES(1, 0, 1, 0, 1, 'new')")
+        cursor.execute("INSERT INTO rows VALUES(1, 0, 1, 0, 1, 'new')")
+        self.assertEqual(list(cursor.execute("SELECT rtreecheck('bulk')")),
+                         [('ok',)])
+        self.assertEqual(self._windows('bulk'), self._windows('rows'))
+
+    def test_rtree(self):
+        self._check('rtree')
+
+    def test_rtree_i32(self):
+        self._check('rtree_i32')
+
+
+class Fts5RebuildTest(unittest.TestCase):
+
+    # Enough text for several rounds of FTS5_BULK_BATCH bytes per worker.
+    DOCS = 60000
+
+    def setUp(self):
+        self.db = SuperSQLite.connect(':memory:')
+        rand = random.Random(3)
+        words = ['w%d' % (i,) for i in range(5000)]
+        cursor = self.db.cursor()
+        cursor.execute("CREATE TABLE docs(a, b)")
+        cursor.execute("BEGIN")
+        cursor.executemany("INSERT INTO docs VALUES(?, ?)", ((
+            ' '.join(rand.choice(words) for j in range(30)),
+            ' '.join(rand.choice(words) for j in range(10)))
+            for i in range(self.DOCS)))
+        cursor.execute("COMMIT")
+        cursor.execute("CREATE VIRTUAL TABLE ft USING fts5(a, b)")
+        cursor.execute("INSERT INTO ft(rowid, a, b) SELECT rowid, a, b "
+                       "FROM docs")
+
+    def tearDown(self):
+        self.db.close()
+        gc.collect()
+
+    def _rebuild(self, threads):
+        cursor = self.db.cursor()
+        cursor.execute("INSERT INTO ft(ft, rank) VALUES('rebuild', ?)",
+                       (threads,))
+        cursor.execute("INSERT INTO ft(ft) VALUES('integrity-check')")
+        results = [list(cursor.execute(
+            "SELECT rowid, bm25(ft) FROM ft WHERE ft MATCH ? ORDER BY rowid",
+            (query,))) for query in (
+                'w1', 'w17 AND w9', 'b:w3', 'w12*', 'w4 OR w5 NOT w6',
+                'NEAR(w7 w8, 10)')]
+        results.append(list(cursor.execute(
+            "SELECT * FROM ft_docsize ORDER BY id")))
+        return results
+
+    def test_threads_match_serial(self):
+        serial = self._rebuild(0)
+        self.assertGreater(len(serial[0]), 0)
+        self.assertEqual(len(serial[-1]), self.DOCS)
+        self.assertEqual(self._rebuild(4), serial)
+        self.assertEqual(self._rebuild(3), serial)
+        self.assertEqual(self._rebuild(1), serial)
+
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
     parser.add_argument('unittest_args', nargs='*')